@@ -0,0 +1,205 @@
+#include "assetLoader.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+
+AssetLoader::AssetLoader(u32 threadCount)
+{
+	threadCount = MAX(threadCount, 1u);
+	for(u32 threadNum = 0; threadNum < threadCount; ++threadNum)
+	{
+		m_threads.emplace_back(&AssetLoader::ThreadLoop, this);
+	}
+}
+
+AssetLoader::~AssetLoader()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		m_quit = true;
+		m_jobs.clear();
+	}
+	m_jobSignal.notify_all();
+
+	for(std::thread &thread : m_threads)
+	{
+		thread.join();
+	}
+}
+
+void AssetLoader::PushJob(std::function<void()> &&job)
+{
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		m_jobs.push_back(std::move(job));
+	}
+	m_jobSignal.notify_one();
+}
+
+void AssetLoader::ThreadLoop()
+{
+	OPTICK_THREAD("AssetLoader");
+
+	for(;;)
+	{
+		std::function<void()> job;
+		{
+			std::unique_lock<std::mutex> lock(m_jobMutex);
+			m_jobSignal.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+			if(m_quit)
+			{
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		job();
+	}
+}
+
+// Obj indices are 1 based, negative ones count back from the latest entry. Returns -1 when missing or out of range
+static int ResolveObjIndex(const char *text, u32 count)
+{
+	if(!text || !*text)
+	{
+		return -1;
+	}
+
+	int index = atoi(text);
+	int resolved = (index < 0) ? (int)count + index : index - 1;
+	return (resolved >= 0 && resolved < (int)count) ? resolved : -1;
+}
+
+// Reads a whole line however long it is, so a long face or comment is never split into two. False at the end of the file
+static bool ReadObjLine(FILE *file, std::string &line)
+{
+	line.clear();
+	char chunk[512];
+	while(fgets(chunk, sizeof(chunk), file))
+	{
+		line += chunk;
+		if(line.back() == '\n')
+		{
+			break;
+		}
+	}
+	return !line.empty();
+}
+
+bool LoadObjMesh(const char *fileName, MeshData &mesh)
+{
+	OPTICK_EVENT();
+
+	FILE *file = fopen(fileName, "r");
+	if(!file)
+	{
+		return false;
+	}
+
+	std::vector<r32> texcoords;
+	std::vector<btVector3> normals;
+
+	struct Corner
+	{
+		int position;
+		int texcoord;
+		int normal;
+	};
+	std::vector<Corner> face;
+
+	std::string lineBuffer;
+	while(ReadObjLine(file, lineBuffer))
+	{
+		char *line = lineBuffer.data();
+		r32 x, y, z;
+		if(line[0] == 'v' && line[1] == ' ' && sscanf(line + 2, "%f %f %f", &x, &y, &z) == 3)
+		{
+			mesh.positions.push_back(btVector3(x, y, z));
+		}
+		else if(line[0] == 'v' && line[1] == 't' && sscanf(line + 3, "%f %f", &x, &y) == 2)
+		{
+			texcoords.push_back(x);
+			texcoords.push_back(1.0f - y);
+		}
+		else if(line[0] == 'v' && line[1] == 'n' && sscanf(line + 3, "%f %f %f", &x, &y, &z) == 3)
+		{
+			normals.push_back(btVector3(x, y, z));
+		}
+		else if(line[0] == 'f' && line[1] == ' ')
+		{
+			face.clear();
+
+			char *cursor = line + 2;
+			for(;;)
+			{
+				while(*cursor == ' ' || *cursor == '\t')
+				{
+					++cursor;
+				}
+				if(!*cursor || *cursor == '\r' || *cursor == '\n')
+				{
+					break;
+				}
+
+				char *token = cursor;
+				while(*cursor && *cursor != ' ' && *cursor != '\t' && *cursor != '\r' && *cursor != '\n')
+				{
+					++cursor;
+				}
+				bool lastToken = (*cursor != ' ' && *cursor != '\t');
+				*cursor++ = 0;
+
+				// v, v/vt, v//vn or v/vt/vn
+				char *texcoordText = strchr(token, '/');
+				char *normalText = texcoordText ? strchr(texcoordText + 1, '/') : nullptr;
+				if(texcoordText) { *texcoordText++ = 0; }
+				if(normalText) { *normalText++ = 0; }
+
+				Corner corner;
+				corner.position = ResolveObjIndex(token, (u32)mesh.positions.size());
+				corner.texcoord = ResolveObjIndex(texcoordText, (u32)texcoords.size() / 2);
+				corner.normal = ResolveObjIndex(normalText, (u32)normals.size());
+				if(corner.position >= 0)
+				{
+					face.push_back(corner);
+				}
+
+				if(lastToken)
+				{
+					break;
+				}
+			}
+
+			for(u32 cornerNum = 2; cornerNum < face.size(); ++cornerNum)
+			{
+				const Corner triangle[3] = {face[0], face[cornerNum - 1], face[cornerNum]};
+				for(const Corner &corner : triangle)
+				{
+					const btVector3 &position = mesh.positions[corner.position];
+					mesh.vertices.insert(mesh.vertices.end(), {position.x(), position.y(), position.z()});
+
+					if(corner.texcoord >= 0)
+					{
+						mesh.texcoords.insert(mesh.texcoords.end(), {texcoords[corner.texcoord * 2], texcoords[corner.texcoord * 2 + 1]});
+					}
+					else
+					{
+						mesh.texcoords.insert(mesh.texcoords.end(), {0.0f, 0.0f});
+					}
+
+					if(!normals.empty())
+					{
+						btVector3 normal = (corner.normal >= 0) ? normals[corner.normal] : Vec3Up;
+						mesh.normals.insert(mesh.normals.end(), {normal.x(), normal.y(), normal.z()});
+					}
+				}
+				mesh.vertexCount += 3;
+			}
+		}
+	}
+	fclose(file);
+
+	return mesh.vertexCount > 0;
+}
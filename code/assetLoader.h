@@ -0,0 +1,67 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+// Runs asset jobs (file reads, decoding, cooking) on its own threads and hands back a std::future per job.
+// Kept apart from the SystemScheduler workers so a long decode never stalls a frame that is helping with its jobs.
+// Poll the futures from the main thread and do any GPU upload there.
+class AssetLoader
+{
+public:
+	AssetLoader(u32 threadCount);
+	~AssetLoader(); // Jobs that haven't started are dropped, their futures report broken_promise
+
+	template<typename Func>
+	std::future<std::invoke_result_t<Func>> Submit(Func &&func)
+	{
+		using Result = std::invoke_result_t<Func>;
+		auto task = std::make_shared<std::packaged_task<Result()>>(std::forward<Func>(func));
+		std::future<Result> future = task->get_future();
+		PushJob([task]() { (*task)(); });
+		return future;
+	}
+
+	u32 GetThreadCount() const { return (u32)m_threads.size(); }
+
+private:
+	void PushJob(std::function<void()> &&job);
+	void ThreadLoop();
+
+	std::vector<std::thread> m_threads;
+	std::mutex m_jobMutex;
+	std::condition_variable m_jobSignal;
+	std::deque<std::function<void()>> m_jobs;
+	bool m_quit = false;
+};
+
+template<typename T>
+bool IsFutureReady(const std::future<T> &future)
+{
+	return future.valid() && future.wait_for(std::chrono::seconds(0)) == std::future_status::ready;
+}
+
+// Triangulated, unindexed obj mesh. Same layout raylib's Mesh arrays use
+struct MeshData
+{
+	std::vector<r32> vertices; // xyz per vertex
+	std::vector<r32> texcoords; // uv per vertex, v flipped to match raylib's loader
+	std::vector<r32> normals; // xyz per vertex, empty if the obj has none
+	u32 vertexCount = 0;
+
+	std::vector<btVector3> positions; // The obj's 'v' entries, each corner once, for building collision hulls
+};
+
+// Reads positions, texture coordinates, normals and faces. Polygons are fanned into triangles, materials are ignored
+bool LoadObjMesh(const char *fileName, MeshData &mesh);
@@ -0,0 +1,462 @@
+#include "assetPack.h"
+
+#include "assetLoader.h"
+#include "hullCooker.h"
+
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#if defined(_WIN32)
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+constexpr u32 assetPackMagic = 0x4B415057; // "WPAK"
+constexpr u32 assetPackVersion = 2;
+constexpr u64 assetPackAlignment = 16;
+
+static u64 AlignPackOffset(u64 offset)
+{
+	return (offset + assetPackAlignment - 1) & ~(assetPackAlignment - 1);
+}
+
+// Appends an array to payload at the next aligned offset and returns that offset
+static u64 AppendArray(std::vector<u8> &payload, const void *data, u64 size)
+{
+	if(!size)
+	{
+		return 0;
+	}
+
+	u64 offset = AlignPackOffset(payload.size());
+	payload.resize(offset + size);
+	memcpy(payload.data() + offset, data, size);
+	return offset;
+}
+
+bool HashAssetSource(const char *fileName, u64 &hash)
+{
+	FILE *file = fopen(fileName, "rb");
+	if(!file)
+	{
+		return false;
+	}
+
+	hash = 14695981039346656037ULL;
+	u8 buffer[16 * 1024];
+	size_t readSize;
+	while((readSize = fread(buffer, 1, sizeof(buffer), file)) > 0)
+	{
+		for(size_t byteNum = 0; byteNum < readSize; ++byteNum)
+		{
+			hash = (hash ^ buffer[byteNum]) * 1099511628211ULL;
+		}
+	}
+
+	bool read = !ferror(file);
+	fclose(file);
+	return read;
+}
+
+void AssetPackWriter::AddMesh(const char *name, u64 sourceHash, const MeshData &mesh)
+{
+	bool hasTexcoords = !mesh.texcoords.empty();
+	bool hasNormals = !mesh.normals.empty();
+
+	// Weld vertices whose position, uv and normal all match
+	struct Vertex
+	{
+		r32 values[8] = {};
+		bool operator==(const Vertex &other) const { return memcmp(values, other.values, sizeof(values)) == 0; }
+	};
+	struct VertexHash
+	{
+		size_t operator()(const Vertex &vertex) const
+		{
+			u64 hash = 14695981039346656037ULL;
+			const u8 *bytes = (const u8 *)vertex.values;
+			for(size_t byteNum = 0; byteNum < sizeof(vertex.values); ++byteNum)
+			{
+				hash = (hash ^ bytes[byteNum]) * 1099511628211ULL;
+			}
+			return (size_t)hash;
+		}
+	};
+
+	std::unordered_map<Vertex, u32, VertexHash> vertexIndices;
+	std::vector<Vertex> uniqueVertices;
+	std::vector<u32> indices;
+	indices.reserve(mesh.vertexCount);
+	for(u32 vertexNum = 0; vertexNum < mesh.vertexCount; ++vertexNum)
+	{
+		Vertex vertex;
+		memcpy(&vertex.values[0], &mesh.vertices[vertexNum * 3], 3 * sizeof(r32));
+		if(hasTexcoords) { memcpy(&vertex.values[3], &mesh.texcoords[vertexNum * 2], 2 * sizeof(r32)); }
+		if(hasNormals) { memcpy(&vertex.values[5], &mesh.normals[vertexNum * 3], 3 * sizeof(r32)); }
+
+		auto inserted = vertexIndices.emplace(vertex, (u32)uniqueVertices.size());
+		if(inserted.second)
+		{
+			uniqueVertices.push_back(vertex);
+		}
+		indices.push_back(inserted.first->second);
+	}
+
+	// raylib meshes only take u16 indices
+	bool indexed = uniqueVertices.size() <= U16_MAX;
+
+	std::vector<r32> vertices;
+	std::vector<r32> texcoords;
+	std::vector<r32> normals;
+	std::vector<u16> packedIndices;
+	if(indexed)
+	{
+		for(const Vertex &vertex : uniqueVertices)
+		{
+			vertices.insert(vertices.end(), &vertex.values[0], &vertex.values[3]);
+			if(hasTexcoords) { texcoords.insert(texcoords.end(), &vertex.values[3], &vertex.values[5]); }
+			if(hasNormals) { normals.insert(normals.end(), &vertex.values[5], &vertex.values[8]); }
+		}
+		packedIndices.assign(indices.begin(), indices.end());
+	}
+	else
+	{
+		vertices = mesh.vertices;
+		texcoords = mesh.texcoords;
+		normals = mesh.normals;
+	}
+
+	PendingEntry entry;
+	entry.name = name;
+	entry.type = AssetPackEntryType::MESH;
+	entry.sourceHash = sourceHash;
+	entry.payload.resize(sizeof(PackedMesh));
+
+	PackedMesh packed = {};
+	packed.vertexCount = (u32)(vertices.size() / 3);
+	packed.indexCount = (u32)packedIndices.size();
+	packed.verticesOffset = AppendArray(entry.payload, vertices.data(), vertices.size() * sizeof(r32));
+	packed.texcoordsOffset = AppendArray(entry.payload, texcoords.data(), texcoords.size() * sizeof(r32));
+	packed.normalsOffset = AppendArray(entry.payload, normals.data(), normals.size() * sizeof(r32));
+	packed.indicesOffset = AppendArray(entry.payload, packedIndices.data(), packedIndices.size() * sizeof(u16));
+	memcpy(entry.payload.data(), &packed, sizeof(packed));
+
+	m_entries.push_back(std::move(entry));
+}
+
+void AssetPackWriter::AddHull(const char *name, u64 sourceHash, const CookedHull &hull)
+{
+	std::vector<r32> points;
+	points.reserve(hull.points.size() * 3);
+	for(const btVector3 &point : hull.points)
+	{
+		points.insert(points.end(), {point.x(), point.y(), point.z()});
+	}
+
+	PendingEntry entry;
+	entry.name = name;
+	entry.type = AssetPackEntryType::HULL;
+	entry.sourceHash = sourceHash;
+	entry.payload.resize(sizeof(PackedHull));
+
+	PackedHull packed = {};
+	packed.pointCount = (u32)hull.points.size();
+	packed.pointsOffset = AppendArray(entry.payload, points.data(), points.size() * sizeof(r32));
+	memcpy(entry.payload.data(), &packed, sizeof(packed));
+
+	m_entries.push_back(std::move(entry));
+}
+
+void AssetPackWriter::AddTexture(const char *name, u64 sourceHash, u32 width, u32 height, u32 format, const void *pixels, u64 size)
+{
+	PendingEntry entry;
+	entry.name = name;
+	entry.type = AssetPackEntryType::TEXTURE;
+	entry.sourceHash = sourceHash;
+	entry.payload.resize(sizeof(PackedTexture));
+
+	PackedTexture packed = {};
+	packed.width = width;
+	packed.height = height;
+	packed.format = format;
+	packed.mipmaps = 1;
+	packed.dataOffset = AppendArray(entry.payload, pixels, size);
+	packed.dataSize = size;
+	memcpy(entry.payload.data(), &packed, sizeof(packed));
+
+	m_entries.push_back(std::move(entry));
+}
+
+bool AssetPackWriter::Write(const char *fileName) const
+{
+	OPTICK_EVENT();
+
+	AssetPackHeader header = {};
+	header.magic = assetPackMagic;
+	header.version = assetPackVersion;
+	header.entryCount = (u32)m_entries.size();
+
+	std::vector<AssetPackEntry> entries(m_entries.size());
+	u64 offset = AlignPackOffset(sizeof(AssetPackHeader) + entries.size() * sizeof(AssetPackEntry));
+	for(u32 entryNum = 0; entryNum < m_entries.size(); ++entryNum)
+	{
+		const PendingEntry &pending = m_entries[entryNum];
+		AssetPackEntry &entry = entries[entryNum];
+		if(pending.name.size() >= sizeof(entry.name))
+		{
+			printf("Asset pack entry name too long: %s\n", pending.name.c_str());
+			return false;
+		}
+
+		memset(&entry, 0, sizeof(entry));
+		memcpy(entry.name, pending.name.c_str(), pending.name.size());
+		entry.type = pending.type;
+		entry.offset = offset;
+		entry.size = pending.payload.size();
+		entry.sourceHash = pending.sourceHash;
+		offset = AlignPackOffset(offset + entry.size);
+	}
+
+	// Written under a temporary name first so a running game never maps a half written pack
+	std::string tempFileName = std::string(fileName) + ".tmp";
+	FILE *file = fopen(tempFileName.c_str(), "wb");
+	if(!file)
+	{
+		return false;
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1;
+	written = written && (entries.empty() || fwrite(entries.data(), sizeof(AssetPackEntry), entries.size(), file) == entries.size());
+
+	static const u8 padding[assetPackAlignment] = {};
+	for(u32 entryNum = 0; entryNum < m_entries.size() && written; ++entryNum)
+	{
+		long position = ftell(file);
+		u64 paddingSize = entries[entryNum].offset - (u64)position;
+		written = fwrite(padding, 1, paddingSize, file) == paddingSize;
+
+		const std::vector<u8> &payload = m_entries[entryNum].payload;
+		written = written && fwrite(payload.data(), 1, payload.size(), file) == payload.size();
+	}
+	fclose(file);
+
+	if(!written)
+	{
+		remove(tempFileName.c_str());
+		return false;
+	}
+
+	remove(fileName);
+	return rename(tempFileName.c_str(), fileName) == 0;
+}
+
+bool AssetPack::Open(const char *fileName)
+{
+	OPTICK_EVENT();
+
+	Close();
+
+#if defined(_WIN32)
+	HANDLE file = CreateFileA(fileName, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_RANDOM_ACCESS, nullptr);
+	if(file == INVALID_HANDLE_VALUE)
+	{
+		return false;
+	}
+
+	LARGE_INTEGER fileSize;
+	HANDLE mapping = GetFileSizeEx(file, &fileSize) ? CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr) : nullptr;
+	const void *data = mapping ? MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0) : nullptr;
+	if(!data)
+	{
+		if(mapping) { CloseHandle(mapping); }
+		CloseHandle(file);
+		return false;
+	}
+
+	m_fileHandle = file;
+	m_mappingHandle = mapping;
+	m_size = (u64)fileSize.QuadPart;
+#else
+	int file = open(fileName, O_RDONLY);
+	if(file < 0)
+	{
+		return false;
+	}
+
+	struct stat fileStat;
+	void *data = (fstat(file, &fileStat) == 0 && fileStat.st_size > 0) ? mmap(nullptr, (size_t)fileStat.st_size, PROT_READ, MAP_PRIVATE, file, 0) : MAP_FAILED;
+	close(file); // The mapping keeps the file alive
+	if(data == MAP_FAILED)
+	{
+		return false;
+	}
+
+	m_size = (u64)fileStat.st_size;
+#endif
+
+	m_data = (const u8 *)data;
+
+	const AssetPackHeader *header = (const AssetPackHeader *)m_data;
+	bool valid = m_size >= sizeof(AssetPackHeader) && header->magic == assetPackMagic && header->version == assetPackVersion
+		&& m_size >= sizeof(AssetPackHeader) + (u64)header->entryCount * sizeof(AssetPackEntry);
+
+	const AssetPackEntry *entries = (const AssetPackEntry *)(m_data + sizeof(AssetPackHeader));
+	for(u32 entryNum = 0; valid && entryNum < header->entryCount; ++entryNum)
+	{
+		// Written so a corrupt offset or size can't wrap around
+		const AssetPackEntry &entry = entries[entryNum];
+		valid = entry.offset <= m_size && entry.size <= m_size - entry.offset && entry.offset % assetPackAlignment == 0
+			&& entry.name[sizeof(entry.name) - 1] == 0;
+	}
+
+	if(!valid)
+	{
+		printf("%s is not a valid asset pack\n", fileName);
+		Close();
+		return false;
+	}
+	return true;
+}
+
+void AssetPack::Close()
+{
+	if(!m_data)
+	{
+		return;
+	}
+
+#if defined(_WIN32)
+	UnmapViewOfFile(m_data);
+	CloseHandle((HANDLE)m_mappingHandle);
+	CloseHandle((HANDLE)m_fileHandle);
+	m_mappingHandle = nullptr;
+	m_fileHandle = nullptr;
+#else
+	munmap((void *)m_data, (size_t)m_size);
+#endif
+
+	m_data = nullptr;
+	m_size = 0;
+}
+
+// True when the array of count elements at offset lies inside a payload of payloadSize bytes, aligned for its type.
+// An offset of 0 is only allowed for an absent array
+static bool ArrayFits(u64 payloadSize, u64 offset, u64 count, u64 elementSize, bool required = false)
+{
+	if(!offset)
+	{
+		return !required || !count;
+	}
+	return offset % elementSize == 0 && offset <= payloadSize && count * elementSize <= payloadSize - offset;
+}
+
+// Checks every array an entry points at lies inside it, so nothing read through GetArray leaves the mapping
+static bool IsPayloadValid(AssetPackEntryType type, const u8 *payload, u64 size)
+{
+	switch(type)
+	{
+	case AssetPackEntryType::MESH:
+	{
+		if(size < sizeof(PackedMesh))
+		{
+			return false;
+		}
+		const PackedMesh *mesh = (const PackedMesh *)payload;
+		u64 vertexCount = mesh->vertexCount;
+		if(!vertexCount || !ArrayFits(size, mesh->verticesOffset, vertexCount * 3, sizeof(r32), true) || !ArrayFits(size, mesh->texcoordsOffset, vertexCount * 2, sizeof(r32))
+			|| !ArrayFits(size, mesh->normalsOffset, vertexCount * 3, sizeof(r32)) || !ArrayFits(size, mesh->indicesOffset, mesh->indexCount, sizeof(u16), true))
+		{
+			return false;
+		}
+
+		// Indices are read by the GPU, which does no checking of its own
+		const u16 *indices = AssetPack::GetArray<u16>(mesh, mesh->indicesOffset);
+		for(u32 indexNum = 0; indexNum < mesh->indexCount; ++indexNum)
+		{
+			if(indices[indexNum] >= vertexCount)
+			{
+				return false;
+			}
+		}
+		return true;
+	}
+	case AssetPackEntryType::HULL:
+	{
+		const PackedHull *hull = (const PackedHull *)payload;
+		return size >= sizeof(PackedHull) && hull->pointCount && ArrayFits(size, hull->pointsOffset, (u64)hull->pointCount * 3, sizeof(r32), true);
+	}
+	case AssetPackEntryType::TEXTURE:
+	{
+		// Whoever decodes the pixels checks dataSize covers the format
+		const PackedTexture *texture = (const PackedTexture *)payload;
+		return size >= sizeof(PackedTexture) && ArrayFits(size, texture->dataOffset, texture->dataSize, 1, true);
+	}
+	}
+	return false;
+}
+
+bool AssetPack::LoadHull(const char *name, u64 sourceHash, CookedHull &hull) const
+{
+	const PackedHull *packed = FindHull(name, sourceHash);
+	if(!packed)
+	{
+		return false;
+	}
+
+	const r32 *coords = GetArray<r32>(packed, packed->pointsOffset);
+	hull.points.resize(packed->pointCount);
+	for(u32 pointNum = 0; pointNum < packed->pointCount; ++pointNum)
+	{
+		hull.points[pointNum] = btVector3(coords[pointNum * 3], coords[pointNum * 3 + 1], coords[pointNum * 3 + 2]);
+	}
+	return true;
+}
+
+const AssetPackEntry *AssetPack::FindEntry(const char *name, AssetPackEntryType type) const
+{
+	if(!m_data)
+	{
+		return nullptr;
+	}
+
+	const AssetPackHeader *header = (const AssetPackHeader *)m_data;
+	const AssetPackEntry *entries = (const AssetPackEntry *)(m_data + sizeof(AssetPackHeader));
+	for(u32 entryNum = 0; entryNum < header->entryCount; ++entryNum)
+	{
+		const AssetPackEntry &entry = entries[entryNum];
+		if(entry.type == type && strcmp(entry.name, name) == 0)
+		{
+			return &entry;
+		}
+	}
+	return nullptr;
+}
+
+const void *AssetPack::Find(const char *name, AssetPackEntryType type, u64 sourceHash) const
+{
+	const AssetPackEntry *entry = FindEntry(name, type);
+	if(!entry)
+	{
+		return nullptr;
+	}
+
+	if(entry->sourceHash != sourceHash)
+	{
+		printf("%s changed since the asset pack was baked, loading it from source\n", name);
+		return nullptr;
+	}
+
+	if(!IsPayloadValid(type, m_data + entry->offset, entry->size))
+	{
+		printf("%s in the asset pack is corrupt, loading it from source\n", name);
+		return nullptr;
+	}
+	return m_data + entry->offset;
+}
@@ -0,0 +1,134 @@
+#pragma once
+
+#include "defines.h"
+
+#include <string>
+#include <vector>
+
+struct MeshData;
+struct CookedHull;
+
+// Binary pack of baked assets, mapped straight into memory at runtime. Everything is stored in the layout it is
+// consumed in, so loading is pointer arithmetic:
+//     AssetPackHeader | AssetPackEntry[entryCount] | payloads, each 16 byte aligned
+// Entries are looked up by source file name and type, so the same name can have a mesh and a hull. Each entry keeps
+// the hash of the file it was baked from, an entry whose source has been edited since is treated as missing.
+
+enum class AssetPackEntryType : u32
+{
+	MESH,
+	HULL,
+	TEXTURE,
+};
+
+struct AssetPackHeader
+{
+	u32 magic;
+	u32 version;
+	u32 entryCount;
+	u32 pad;
+};
+
+struct AssetPackEntry
+{
+	char name[112];
+	AssetPackEntryType type;
+	u32 pad;
+	u64 offset; // From the start of the pack to the payload
+	u64 size;
+	u64 sourceHash; // HashAssetSource of the file it was baked from
+};
+
+// Offsets are from the start of this struct. An offset of 0 means the array isn't present
+struct PackedMesh
+{
+	u32 vertexCount;
+	u32 indexCount; // u16 indices, 0 when the mesh has too many vertices to index and is stored as a triangle list
+	u64 verticesOffset; // r32 xyz per vertex
+	u64 texcoordsOffset; // r32 uv per vertex
+	u64 normalsOffset; // r32 xyz per vertex
+	u64 indicesOffset;
+};
+
+struct PackedHull
+{
+	u32 pointCount;
+	u32 pad;
+	u64 pointsOffset; // r32 xyz per point
+};
+
+// Decoded pixels, ready for upload. Format matches raylib's PixelFormat
+struct PackedTexture
+{
+	u32 width;
+	u32 height;
+	u32 format;
+	u32 mipmaps;
+	u64 dataOffset;
+	u64 dataSize;
+};
+
+// FNV-1a over the bytes of a source file. False if it can't be read
+bool HashAssetSource(const char *fileName, u64 &hash);
+
+class AssetPackWriter
+{
+public:
+	// Welds identical vertices and adds an index buffer when the result fits in u16 indices
+	void AddMesh(const char *name, u64 sourceHash, const MeshData &mesh);
+	void AddHull(const char *name, u64 sourceHash, const CookedHull &hull);
+	void AddTexture(const char *name, u64 sourceHash, u32 width, u32 height, u32 format, const void *pixels, u64 size);
+
+	bool Write(const char *fileName) const;
+
+private:
+	struct PendingEntry
+	{
+		std::string name;
+		AssetPackEntryType type;
+		u64 sourceHash;
+		std::vector<u8> payload;
+	};
+	std::vector<PendingEntry> m_entries;
+};
+
+// Read only view of a pack file mapped into memory. Pointers it hands out are valid until it is closed
+class AssetPack
+{
+public:
+	AssetPack() = default;
+	~AssetPack() { Close(); }
+
+	AssetPack(const AssetPack &) = delete;
+	AssetPack &operator=(const AssetPack &) = delete;
+
+	bool Open(const char *fileName);
+	void Close();
+	bool IsOpen() const { return m_data != nullptr; }
+
+	// Null when the pack has no entry of that name and type, it was baked from a source whose hash isn't sourceHash,
+	// or its arrays don't fit inside it. Every offset and count of an entry handed out is safe to read through GetArray
+	const PackedMesh *FindMesh(const char *name, u64 sourceHash) const { return (const PackedMesh *)Find(name, AssetPackEntryType::MESH, sourceHash); }
+	const PackedHull *FindHull(const char *name, u64 sourceHash) const { return (const PackedHull *)Find(name, AssetPackEntryType::HULL, sourceHash); }
+	const PackedTexture *FindTexture(const char *name, u64 sourceHash) const { return (const PackedTexture *)Find(name, AssetPackEntryType::TEXTURE, sourceHash); }
+
+	// Whether the pack has an entry of that name and type at all, valid or not
+	bool HasEntry(const char *name, AssetPackEntryType type) const { return FindEntry(name, type) != nullptr; }
+
+	// Copies a hull found by FindHull out of the pack. False if FindHull would return null
+	bool LoadHull(const char *name, u64 sourceHash, CookedHull &hull) const;
+
+	template<typename T, typename Packed>
+	static const T *GetArray(const Packed *packed, u64 offset) { return offset ? (const T *)((const u8 *)packed + offset) : nullptr; }
+
+private:
+	const AssetPackEntry *FindEntry(const char *name, AssetPackEntryType type) const;
+	const void *Find(const char *name, AssetPackEntryType type, u64 sourceHash) const;
+
+	const u8 *m_data = nullptr;
+	u64 m_size = 0;
+#if defined(_WIN32)
+	void *m_fileHandle = nullptr;
+	void *m_mappingHandle = nullptr;
+#endif
+};
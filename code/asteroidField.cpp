@@ -0,0 +1,400 @@
+#include "asteroidField.h"
+
+#include "assetLoader.h"
+
+#include <algorithm>
+#include <cmath>
+
+// 21 bits an axis, so sectors wrap round about a million sectors out from the origin
+static u64 GetSectorKey(SectorCoord coord)
+{
+	constexpr u64 axisMask = (1ULL << 21) - 1;
+	constexpr s32 axisOffset = 1 << 20;
+	return (((u64)(coord.x + axisOffset) & axisMask) << 42) | (((u64)(coord.y + axisOffset) & axisMask) << 21) | ((u64)(coord.z + axisOffset) & axisMask);
+}
+
+// In sectors, along the furthest axis
+static u32 GetSectorDistance(SectorCoord a, SectorCoord b)
+{
+	s32 x = abs(a.x - b.x);
+	s32 y = abs(a.y - b.y);
+	s32 z = abs(a.z - b.z);
+	return (u32)MAX(x, MAX(y, z));
+}
+
+std::vector<AsteroidSpawn> GenerateSector(const AsteroidFieldConfig &config, SectorCoord coord)
+{
+	OPTICK_EVENT();
+
+	RandomStream random(RandomStream::MixSeed(config.seed, GetSectorKey(coord)));
+
+	btVector3 halfSize(config.sectorSize * 0.5f, config.sectorSize * 0.5f, config.sectorSize * 0.5f);
+	btVector3 sectorCenter = btVector3((r32)coord.x, (r32)coord.y, (r32)coord.z) * config.sectorSize;
+	btVector3 sectorMin = sectorCenter - halfSize;
+	btVector3 sectorMax = sectorCenter + halfSize;
+
+	std::vector<AsteroidSpawn> spawns(config.asteroidsPerSector);
+	for(AsteroidSpawn &spawn : spawns)
+	{
+		spawn.position = random.PointInRange(sectorMin, sectorMax);
+
+		btVector3 axis = random.PointInRange(btVector3(-1.0f, -1.0f, -1.0f), btVector3(1.0f, 1.0f, 1.0f));
+		if(axis.length2() < 0.0001f)
+		{
+			axis = Vec3Up;
+		}
+		spawn.rotation = btQuaternion(axis.normalized(), random.Float(0.0f, 2.0f * _PI));
+
+		spawn.modelIndex = random.UInt(0, config.modelCount);
+	}
+	return spawns;
+}
+
+u32 GetMaxAsteroidCount(const AsteroidFieldConfig &config)
+{
+	u32 side = 2 * (config.loadRadius + 1) + 1;
+	return side * side * side * config.asteroidsPerSector;
+}
+
+AsteroidField::AsteroidField(const AsteroidFieldConfig &config, AssetLoader &assetLoader, SpawnFunc spawn, DestroyFunc destroy)
+	: m_config(config), m_assetLoader(assetLoader), m_spawn(std::move(spawn)), m_destroy(std::move(destroy))
+{
+	Assert(m_config.sectorSize > 0.0f);
+	Assert(m_config.modelCount > 0);
+}
+
+AsteroidField::~AsteroidField()
+{
+	for(auto &[key, sector] : m_sectors)
+	{
+		for(entt::entity entity : sector.entities)
+		{
+			if(entity != entt::null)
+			{
+				m_destroy(entity);
+			}
+		}
+	}
+}
+
+SectorCoord AsteroidField::GetSector(const btVector3 &position) const
+{
+	// Sector 0 is centered on the origin
+	btVector3 scaled = position / m_config.sectorSize + btVector3(0.5f, 0.5f, 0.5f);
+	SectorCoord coord = {(s32)std::floor(scaled.x()), (s32)std::floor(scaled.y()), (s32)std::floor(scaled.z())};
+	return coord;
+}
+
+// Only for the rare asteroid that gets destroyed, so a walk over every sector is cheaper than keeping a map
+bool AsteroidField::Remove(entt::entity entity)
+{
+	for(auto &[key, sector] : m_sectors)
+	{
+		auto found = std::find(sector.entities.begin(), sector.entities.end(), entity);
+		if(found != sector.entities.end())
+		{
+			*found = entt::null;
+			--m_asteroidCount;
+			return true;
+		}
+	}
+	return false;
+}
+
+void AsteroidField::LoadAround(const btVector3 &focus)
+{
+	OPTICK_EVENT();
+
+	m_centers.assign(1, GetSector(focus));
+	ReleaseSectors(UINT32_MAX);
+	QueueSectors();
+
+	bool waitForSectors = m_config.waitForSectors;
+	m_config.waitForSectors = true;
+	SpawnSectors(UINT32_MAX);
+	m_config.waitForSectors = waitForSectors;
+}
+
+void AsteroidField::Update(std::span<const btVector3> foci)
+{
+	OPTICK_EVENT();
+
+	m_centers.clear();
+	for(const btVector3 &focus : foci)
+	{
+		m_centers.push_back(GetSector(focus));
+	}
+
+	u32 released = ReleaseSectors(m_config.maxReleasesPerUpdate);
+	QueueSectors();
+	u32 spawned = SpawnSectors(m_config.maxSpawnsPerUpdate);
+
+	OPTICK_TAG("Spawned", spawned);
+	OPTICK_TAG("Released", released);
+	OPTICK_TAG("LoadedSectors", (u32)m_sectors.size());
+	UNUSED(released);
+	UNUSED(spawned);
+}
+
+void AsteroidField::QueueSectors()
+{
+	s32 radius = (s32)m_config.loadRadius;
+	for(SectorCoord center : m_centers)
+	{
+		for(s32 z = center.z - radius; z <= center.z + radius; ++z)
+		{
+			for(s32 y = center.y - radius; y <= center.y + radius; ++y)
+			{
+				for(s32 x = center.x - radius; x <= center.x + radius; ++x)
+				{
+					SectorCoord coord = {x, y, z};
+					auto [it, inserted] = m_sectors.try_emplace(GetSectorKey(coord));
+					if(!inserted)
+					{
+						continue;
+					}
+
+					Sector &sector = it->second;
+					sector.coord = coord;
+					sector.generating = m_assetLoader.Submit([config = m_config, coord]() {
+						return GenerateSector(config, coord);
+					});
+				}
+			}
+		}
+	}
+}
+
+// With no foci everything is out of range
+u32 AsteroidField::GetCenterDistance(SectorCoord coord) const
+{
+	u32 distance = U32_MAX;
+	for(SectorCoord center : m_centers)
+	{
+		distance = MIN(distance, GetSectorDistance(coord, center));
+	}
+	return distance;
+}
+
+void AsteroidField::SortSectors(bool nearestFirst)
+{
+	m_sortedKeys.clear();
+	for(auto &[key, sector] : m_sectors)
+	{
+		m_sortedKeys.push_back(key);
+	}
+
+	std::sort(m_sortedKeys.begin(), m_sortedKeys.end(), [this, nearestFirst](u64 a, u64 b) {
+		u32 distanceA = GetCenterDistance(m_sectors.at(a).coord);
+		u32 distanceB = GetCenterDistance(m_sectors.at(b).coord);
+		if(distanceA != distanceB)
+		{
+			return nearestFirst ? distanceA < distanceB : distanceA > distanceB;
+		}
+		return a < b;
+	});
+}
+
+u32 AsteroidField::SpawnSectors(u32 budget)
+{
+	u32 spawnedCount = 0;
+
+	SortSectors(true);
+	for(u64 key : m_sortedKeys)
+	{
+		Sector &sector = m_sectors.at(key);
+		if(GetCenterDistance(sector.coord) > m_config.loadRadius)
+		{
+			break; // Out of range and waiting to be released, so are all the ones after it
+		}
+
+		if(!sector.generated)
+		{
+			if(!m_config.waitForSectors && !IsFutureReady(sector.generating))
+			{
+				continue;
+			}
+			sector.spawns = sector.generating.get();
+			sector.generated = true;
+			sector.entities.reserve(sector.spawns.size());
+		}
+
+		while(sector.spawnedCount < sector.spawns.size() && spawnedCount < budget)
+		{
+			sector.entities.push_back(m_spawn(sector.spawns[sector.spawnedCount], entt::null));
+			++sector.spawnedCount;
+			++spawnedCount;
+		}
+
+		if(sector.spawnedCount == sector.spawns.size())
+		{
+			std::vector<AsteroidSpawn>().swap(sector.spawns);
+		}
+		if(spawnedCount == budget)
+		{
+			break;
+		}
+	}
+
+	m_asteroidCount += spawnedCount;
+	return spawnedCount;
+}
+
+u32 AsteroidField::ReleaseSectors(u32 budget)
+{
+	u32 releasedCount = 0;
+
+	SortSectors(false);
+	for(u64 key : m_sortedKeys)
+	{
+		Sector &sector = m_sectors.at(key);
+		if(GetCenterDistance(sector.coord) <= m_config.loadRadius + 1)
+		{
+			break;
+		}
+
+		while(!sector.entities.empty() && releasedCount < budget)
+		{
+			if(sector.entities.back() != entt::null)
+			{
+				m_destroy(sector.entities.back());
+				++releasedCount;
+			}
+			sector.entities.pop_back();
+		}
+
+		if(!sector.entities.empty())
+		{
+			break;
+		}
+
+		// A sector still generating is dropped too, its job finishes into a future nobody reads
+		m_sectors.erase(key);
+	}
+
+	m_asteroidCount -= releasedCount;
+	return releasedCount;
+}
+
+void AsteroidField::SaveState(AsteroidFieldState &state) const
+{
+	state.sectors.clear();
+	state.entities.clear();
+	state.asteroidCount = m_asteroidCount;
+
+	for(auto &[key, sector] : m_sectors)
+	{
+		AsteroidFieldState::SectorState sectorState;
+		sectorState.key = key;
+		sectorState.coord = sector.coord;
+		sectorState.spawnedCount = sector.spawnedCount;
+		sectorState.entityCount = (u32)sector.entities.size();
+		sectorState.generated = sector.generated ? 1 : 0;
+		state.sectors.push_back(sectorState);
+	}
+
+	// Same layout whatever order the map is in, so consecutive snapshots delta well
+	std::sort(state.sectors.begin(), state.sectors.end(), [](const AsteroidFieldState::SectorState &a, const AsteroidFieldState::SectorState &b) {
+		return a.key < b.key;
+	});
+	for(AsteroidFieldState::SectorState &sectorState : state.sectors)
+	{
+		const std::vector<entt::entity> &entities = m_sectors.at(sectorState.key).entities;
+		sectorState.firstEntity = (u32)state.entities.size();
+		state.entities.insert(state.entities.end(), entities.begin(), entities.end());
+	}
+}
+
+void AsteroidField::RestoreReleases(const AsteroidFieldState &state)
+{
+	OPTICK_EVENT();
+
+	for(auto it = m_sectors.begin(); it != m_sectors.end();)
+	{
+		Sector &sector = it->second;
+		auto found = std::lower_bound(state.sectors.begin(), state.sectors.end(), it->first, [](const AsteroidFieldState::SectorState &sectorState, u64 key) {
+			return sectorState.key < key;
+		});
+		bool kept = found != state.sectors.end() && found->key == it->first;
+
+		// An asteroid the state has stays, as long as it is at the same place in the same sector
+		const entt::entity *savedEntities = kept ? state.entities.data() + found->firstEntity : nullptr;
+		u32 savedCount = kept ? found->entityCount : 0;
+		for(u32 entityNum = 0; entityNum < sector.entities.size(); ++entityNum)
+		{
+			entt::entity entity = sector.entities[entityNum];
+			if(entity != entt::null && (entityNum >= savedCount || entity != savedEntities[entityNum]))
+			{
+				m_destroy(entity);
+			}
+		}
+
+		if(kept)
+		{
+			++it;
+		}
+		else
+		{
+			it = m_sectors.erase(it);
+		}
+	}
+}
+
+void AsteroidField::RestoreSpawns(const AsteroidFieldState &state)
+{
+	OPTICK_EVENT();
+
+	for(const AsteroidFieldState::SectorState &sectorState : state.sectors)
+	{
+		Sector &sector = m_sectors[sectorState.key];
+		const entt::entity *savedEntities = state.entities.data() + sectorState.firstEntity;
+		sector.coord = sectorState.coord;
+
+		for(u32 entityNum = 0; entityNum < sectorState.entityCount; ++entityNum)
+		{
+			entt::entity entity = savedEntities[entityNum];
+			if(entity == entt::null || (entityNum < sector.entities.size() && sector.entities[entityNum] == entity))
+			{
+				continue;
+			}
+
+			if(sector.spawns.empty())
+			{
+				sector.spawns = GenerateSector(m_config, sector.coord);
+			}
+			entt::entity spawned = m_spawn(sector.spawns[entityNum], entity);
+			Assert(spawned == entity);
+			UNUSED(spawned);
+		}
+		sector.entities.assign(savedEntities, savedEntities + sectorState.entityCount);
+
+		sector.spawnedCount = sectorState.spawnedCount;
+		if(sectorState.generated)
+		{
+			// Whatever job the sector had is no longer wanted
+			sector.generating = {};
+			sector.generated = true;
+			if(sector.spawnedCount < m_config.asteroidsPerSector && sector.spawns.empty())
+			{
+				sector.spawns = GenerateSector(m_config, sector.coord);
+			}
+			else if(sector.spawnedCount == m_config.asteroidsPerSector)
+			{
+				std::vector<AsteroidSpawn>().swap(sector.spawns);
+			}
+		}
+		else
+		{
+			sector.generated = false;
+			std::vector<AsteroidSpawn>().swap(sector.spawns);
+			if(!sector.generating.valid())
+			{
+				sector.generating = m_assetLoader.Submit([config = m_config, coord = sector.coord]() {
+					return GenerateSector(config, coord);
+				});
+			}
+		}
+	}
+
+	m_asteroidCount = state.asteroidCount;
+}
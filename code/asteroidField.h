@@ -0,0 +1,146 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+
+#include <functional>
+#include <future>
+#include <span>
+#include <unordered_map>
+#include <vector>
+
+class AssetLoader;
+
+struct AsteroidFieldConfig
+{
+	u64 seed = 0;
+
+	r32 sectorSize = 200.0f;
+	u32 asteroidsPerSector = 25;
+	u32 modelCount = 1; // Spawns pick a model index below this
+
+	// Sectors up to this many away from a focus's sector on any axis are kept loaded. Sectors are only released
+	// once they are a further one away, so crossing back and forth over an edge doesn't reload anything
+	u32 loadRadius = 1;
+
+	// Spawning and destroying bodies costs the world a broadphase insert or a removal each, so only this many happen
+	// per update. Nearer sectors spawn first
+	u32 maxSpawnsPerUpdate = 64;
+	u32 maxReleasesPerUpdate = 64;
+
+	bool waitForSectors = false; // Block on sectors that are still generating instead of spawning them once ready
+};
+
+struct AsteroidSpawn
+{
+	btVector3 position;
+	btQuaternion rotation;
+	u32 modelIndex;
+};
+
+struct SectorCoord
+{
+	s32 x;
+	s32 y;
+	s32 z;
+
+	bool operator==(const SectorCoord &other) const { return x == other.x && y == other.y && z == other.z; }
+};
+
+// Which sectors were loaded and which entity each of their asteroids became, for snapshots
+struct AsteroidFieldState
+{
+	struct SectorState
+	{
+		u64 key;
+		SectorCoord coord;
+		u32 spawnedCount;
+		u32 firstEntity; // Into entities
+		u32 entityCount; // Fewer than spawnedCount while the sector is being released
+		u32 generated;
+		u32 padding = 0; // Written out whole, so no bytes are left undefined
+	};
+
+	std::vector<SectorState> sectors; // By key
+	std::vector<entt::entity> entities; // Each sector's in turn, in spawn order, entt::null for removed asteroids
+	u32 asteroidCount = 0;
+};
+
+// Everything in a sector comes from its own stream, seeded by the field seed and the sector's coordinates. A sector
+// is the same whichever thread generates it, in whatever order, and however often it is reloaded
+std::vector<AsteroidSpawn> GenerateSector(const AsteroidFieldConfig &config, SectorCoord coord);
+
+// Most asteroids loaded at once. Sectors out of range linger until they are released, so this counts those too
+u32 GetMaxAsteroidCount(const AsteroidFieldConfig &config);
+
+// Endless asteroid field streamed in sectors around focus points, normally the ships. Sectors coming into range of any
+// focus are generated on the asset loader's threads and spawned a few bodies per update once ready, sectors left
+// behind by all of them have their bodies destroyed the same way, so only the sectors around the foci are in memory.
+// Entities are made and destroyed through the callbacks, the field only tracks which sector owns which entity.
+// Asteroids that drift out of their sector still belong to it
+class AsteroidField
+{
+public:
+	// hint is entt::null, or the identifier a restored asteroid had before
+	using SpawnFunc = std::function<entt::entity(const AsteroidSpawn &spawn, entt::entity hint)>;
+	using DestroyFunc = std::function<void(entt::entity entity)>;
+
+	AsteroidField(const AsteroidFieldConfig &config, AssetLoader &assetLoader, SpawnFunc spawn, DestroyFunc destroy);
+	~AsteroidField(); // Destroys every asteroid still loaded
+
+	// Loads every sector in range of the focus straight away, ignoring the budgets. For startup
+	void LoadAround(const btVector3 &focus);
+
+	// Queues sectors coming into range, spawns ready ones and releases ones out of range. Creates and destroys
+	// entities, so run it from an exclusive system outside the physics step. Distances are to the nearest focus
+	void Update(std::span<const btVector3> foci);
+
+	SectorCoord GetSector(const btVector3 &position) const;
+
+	// Forgets an asteroid that was destroyed outside the field, such as by shattering. Its sector treats it as gone
+	// until the sector is released, and reloading the sector brings it back. False if no sector has it
+	bool Remove(entt::entity entity);
+
+	void SaveState(AsteroidFieldState &state) const;
+	// Split like ProjectilePool's. Destroys asteroids the state doesn't have and unloads sectors it doesn't have
+	void RestoreReleases(const AsteroidFieldState &state);
+	// Respawns the state's asteroids that are missing under their old identifiers, regenerating sectors as needed.
+	// Their components and bodies are left for the caller to restore
+	void RestoreSpawns(const AsteroidFieldState &state);
+
+	u32 GetLoadedSectorCount() const { return (u32)m_sectors.size(); }
+	u32 GetAsteroidCount() const { return m_asteroidCount; }
+
+private:
+	struct Sector
+	{
+		SectorCoord coord;
+		std::future<std::vector<AsteroidSpawn>> generating;
+		std::vector<AsteroidSpawn> spawns;
+		u32 spawnedCount = 0;
+		bool generated = false;
+		std::vector<entt::entity> entities; // Indexed like spawns, entt::null once removed
+	};
+
+	// All of these work from the sectors of the foci in m_centers
+	void QueueSectors();
+	u32 SpawnSectors(u32 budget);
+	u32 ReleaseSectors(u32 budget);
+	u32 GetCenterDistance(SectorCoord coord) const;
+
+	// Fills m_sortedKeys with every loaded sector, nearest or furthest from the centers first. Ties go by key so the
+	// order never depends on the map's
+	void SortSectors(bool nearestFirst);
+
+	AsteroidFieldConfig m_config;
+	AssetLoader &m_assetLoader;
+	SpawnFunc m_spawn;
+	DestroyFunc m_destroy;
+
+	std::unordered_map<u64, Sector> m_sectors;
+	u32 m_asteroidCount = 0;
+
+	std::vector<SectorCoord> m_centers; // Sector of each focus, set by LoadAround and Update
+	std::vector<u64> m_sortedKeys; // Scratch for SortSectors
+};
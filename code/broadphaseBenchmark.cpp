@@ -0,0 +1,144 @@
+#include "broadphaseBenchmark.h"
+
+#include "math.h"
+
+#include "btBulletDynamicsCommon.h"
+
+#include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+constexpr u32 warmUpFrames = 5;
+constexpr r32 sphereRadius = 1.0f;
+constexpr r32 spacePerBody = 1000.0f; // Cubic metres, about one neighbour in reach of each sphere
+constexpr u32 maxAxisSweepProxies = 32766;
+constexpr u32 queryCount = 4096; // Half rays, half sweeps
+constexpr r32 queryLength = 50.0f;
+constexpr u32 queryRepeats = 5;
+
+BroadphaseBenchmarkResult RunBroadphaseBenchmark(BroadphaseType broadphase, u32 bodyCount, u32 frameCount, u32 physicsThreads, u32 seed)
+{
+	OPTICK_EVENT();
+
+	BroadphaseBenchmarkResult result = {};
+	result.broadphase = broadphase;
+	result.bodyCount = bodyCount;
+	if(broadphase == BroadphaseType::AXIS_SWEEP && bodyCount > maxAxisSweepProxies)
+	{
+		result.skipped = true;
+		return result;
+	}
+
+	SeedRandom(seed);
+
+	r32 halfExtent = 0.5f * btPow(bodyCount * spacePerBody, 1.0f / 3.0f);
+
+	PhysicsConfig config;
+	config.multithreaded = physicsThreads > 0;
+	config.workerCount = physicsThreads;
+	config.expectedBodyCount = bodyCount;
+	config.broadphase = broadphase;
+	config.gridCellSize = 4.0f * sphereRadius;
+	config.worldMin = btVector3(-halfExtent, -halfExtent, -halfExtent) * 2.0f;
+	config.worldMax = btVector3(halfExtent, halfExtent, halfExtent) * 2.0f;
+
+	PhysicsWorld *physics = new PhysicsWorld(config);
+	btSphereShape *sphereShape = new btSphereShape(sphereRadius);
+
+	const btVector3 boundsMin(-halfExtent, -halfExtent, -halfExtent);
+	const btVector3 boundsMax(halfExtent, halfExtent, halfExtent);
+	for(u32 bodyNum = 0; bodyNum < bodyCount; ++bodyNum)
+	{
+		btVector3 position(RandomFloat(boundsMin.x(), boundsMax.x()), RandomFloat(boundsMin.y(), boundsMax.y()), RandomFloat(boundsMin.z(), boundsMax.z()));
+		RigidBody rigidBody = physics->CreateRigidBody(position, QuatIdentity, 1.0f, sphereShape);
+
+		// Kept awake, a sleeping body costs the tree and sweeps nothing but the grid still bins it
+		btVector3 velocity(RandomFloat(-5.0f, 5.0f), RandomFloat(-5.0f, 5.0f), RandomFloat(-5.0f, 5.0f));
+		rigidBody.body->setLinearVelocity(velocity);
+		rigidBody.body->setActivationState(DISABLE_DEACTIVATION);
+	}
+
+	using Clock = std::chrono::steady_clock;
+
+	std::vector<r32> stepMs;
+	stepMs.reserve(frameCount);
+	for(u32 frameNum = 0; frameNum < warmUpFrames + frameCount; ++frameNum)
+	{
+		Clock::time_point stepStart = Clock::now();
+		physics->Step(1.0f / 60.0f);
+		r32 ms = std::chrono::duration<r32, std::milli>(Clock::now() - stepStart).count();
+		if(frameNum >= warmUpFrames)
+		{
+			stepMs.push_back(ms);
+		}
+	}
+	result.overlappingPairs = physics->GetStepStats().overlappingPairs;
+
+	std::vector<SceneQuery> queries(queryCount);
+	std::vector<SceneQueryHit> hits(queryCount);
+	for(u32 queryNum = 0; queryNum < queryCount; ++queryNum)
+	{
+		SceneQuery &query = queries[queryNum];
+		query.from = btVector3(RandomFloat(boundsMin.x(), boundsMax.x()), RandomFloat(boundsMin.y(), boundsMax.y()), RandomFloat(boundsMin.z(), boundsMax.z()));
+		btVector3 direction(RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f), RandomFloat(-1.0f, 1.0f));
+		query.to = query.from + direction.normalized() * queryLength;
+		query.radius = (queryNum & 1) ? 0.5f : 0.0f;
+	}
+
+	result.queryBatchMs = FLT_MAX;
+	for(u32 repeatNum = 0; repeatNum < queryRepeats; ++repeatNum)
+	{
+		Clock::time_point queryStart = Clock::now();
+		physics->QueryBatch(queries.data(), queryCount, hits.data());
+		r32 ms = std::chrono::duration<r32, std::milli>(Clock::now() - queryStart).count();
+		result.queryBatchMs = MIN(result.queryBatchMs, ms);
+	}
+	for(const SceneQueryHit &hit : hits)
+	{
+		result.queryHits += hit.HasHit() ? 1 : 0;
+	}
+
+	delete physics;
+	delete sphereShape;
+
+	if(!stepMs.empty())
+	{
+		r32 totalMs = 0.0f;
+		for(r32 ms : stepMs)
+		{
+			totalMs += ms;
+		}
+		result.avgMs = totalMs / stepMs.size();
+
+		std::sort(stepMs.begin(), stepMs.end());
+		result.p50Ms = stepMs[(stepMs.size() - 1) / 2];
+		result.p99Ms = stepMs[(stepMs.size() * 99 - 1) / 100];
+	}
+	return result;
+}
+
+void RunBroadphaseBenchmarks(u32 frameCount, u32 physicsThreads, u32 seed)
+{
+	const u32 bodyCounts[] = {1000, 10000, 100000};
+	const BroadphaseType broadphases[] = {BroadphaseType::DYNAMIC_TREE, BroadphaseType::AXIS_SWEEP, BroadphaseType::AXIS_SWEEP_32, BroadphaseType::UNIFORM_GRID};
+
+	printf("Broadphase benchmark: %u steps each, %u physics threads\n", frameCount, physicsThreads);
+	printf("Queries: %u rays and sphere sweeps of %.0f metres in one batch\n", queryCount, queryLength);
+	printf("%-10s %8s %10s %10s %10s %10s %10s %10s\n", "broadphase", "bodies", "p50 ms", "p99 ms", "avg ms", "pairs", "query ms", "hits");
+	for(u32 bodyCount : bodyCounts)
+	{
+		for(BroadphaseType broadphase : broadphases)
+		{
+			BroadphaseBenchmarkResult result = RunBroadphaseBenchmark(broadphase, bodyCount, frameCount, physicsThreads, seed);
+			if(result.skipped)
+			{
+				printf("%-10s %8u %10s\n", GetBroadphaseName(broadphase), bodyCount, "skipped");
+				continue;
+			}
+			printf("%-10s %8u %10.3f %10.3f %10.3f %10u %10.3f %10u\n", GetBroadphaseName(broadphase), bodyCount, result.p50Ms, result.p99Ms,
+				result.avgMs, result.overlappingPairs, result.queryBatchMs, result.queryHits);
+			fflush(stdout);
+		}
+	}
+}
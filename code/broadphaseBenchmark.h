@@ -0,0 +1,28 @@
+#pragma once
+
+#include "defines.h"
+
+#include "physics.h"
+
+struct BroadphaseBenchmarkResult
+{
+	BroadphaseType broadphase;
+	u32 bodyCount;
+	bool skipped; // The broadphase can't hold this many proxies
+	r32 p50Ms;
+	r32 p99Ms;
+	r32 avgMs;
+	u32 overlappingPairs; // On the last step. The tree pads AABBs and the 16 bit sweep rounds them outwards to its
+	// quantisation, so both find more than the grid and 32 bit sweep
+	r32 queryBatchMs; // One QueryBatch of rays and sphere sweeps after the last step, best of a few
+	u32 queryHits;
+};
+
+// Steps a world of bodyCount spheres drifting through a cube sized to keep density the same at every count, timing
+// frameCount steps after a few warm up frames, then times a batch of queries through the same cube. physicsThreads > 0
+// uses a multithreaded world
+BroadphaseBenchmarkResult RunBroadphaseBenchmark(BroadphaseType broadphase, u32 bodyCount, u32 frameCount, u32 physicsThreads, u32 seed);
+
+// Every broadphase at 1k, 10k and 100k bodies, printed as a table. Only the steps are timed: the 32 bit sweep's
+// inserts and removes are linear in the proxy count, so building and tearing down its 100k world alone takes minutes
+void RunBroadphaseBenchmarks(u32 frameCount, u32 physicsThreads, u32 seed);
@@ -0,0 +1,64 @@
+#include "culling.h"
+
+#include "physics.h"
+
+#include <math.h>
+
+static void SetPlane(Frustum &frustum, Frustum::Plane plane, const btVector3 &normal, const btVector3 &pointOnPlane)
+{
+	frustum.normals[plane] = normal;
+	frustum.offsets[plane] = -normal.dot(pointOnPlane);
+}
+
+Frustum BuildCameraFrustum(const Camera &camera, r32 aspect, r32 nearDistance, r32 farDistance)
+{
+	btVector3 forward = (camera.target - camera.position).normalized();
+	btVector3 right = forward.cross(camera.up).normalized();
+	btVector3 up = right.cross(forward);
+
+	Frustum frustum;
+	SetPlane(frustum, Frustum::NEAR_PLANE, forward, camera.position + forward * nearDistance);
+	SetPlane(frustum, Frustum::FAR_PLANE, -forward, camera.position + forward * farDistance);
+
+	if(camera.projection == Camera::Projection::PERSPECTIVE)
+	{
+		// Half extents of the view at distance one. Side planes all pass through the camera position
+		r32 halfHeight = tanf(DegToRad(camera.fovY) * 0.5f);
+		r32 halfWidth = halfHeight * aspect;
+
+		SetPlane(frustum, Frustum::LEFT_PLANE, (right + forward * halfWidth).normalized(), camera.position);
+		SetPlane(frustum, Frustum::RIGHT_PLANE, (-right + forward * halfWidth).normalized(), camera.position);
+		SetPlane(frustum, Frustum::BOTTOM_PLANE, (up + forward * halfHeight).normalized(), camera.position);
+		SetPlane(frustum, Frustum::TOP_PLANE, (-up + forward * halfHeight).normalized(), camera.position);
+	}
+	else
+	{
+		r32 halfHeight = camera.fovY * 0.5f;
+		r32 halfWidth = halfHeight * aspect;
+
+		SetPlane(frustum, Frustum::LEFT_PLANE, right, camera.position - right * halfWidth);
+		SetPlane(frustum, Frustum::RIGHT_PLANE, -right, camera.position + right * halfWidth);
+		SetPlane(frustum, Frustum::BOTTOM_PLANE, up, camera.position - up * halfHeight);
+		SetPlane(frustum, Frustum::TOP_PLANE, -up, camera.position + up * halfHeight);
+	}
+
+	return frustum;
+}
+
+CullingStats CullEntities(const PhysicsWorld &physics, const Frustum &frustum, u32 idleObjectCount, std::vector<entt::entity> &visibleEntities)
+{
+	OPTICK_EVENT();
+
+	visibleEntities.clear();
+	physics.QueryConvexVolume(frustum.normals, frustum.offsets, Frustum::PLANE_TOTAL, visibleEntities);
+
+	CullingStats stats;
+	stats.visible = (u32)visibleEntities.size();
+	u32 objectCount = physics.GetCollisionObjectCount() - idleObjectCount;
+	stats.culled = objectCount > stats.visible ? objectCount - stats.visible : 0;
+
+	OPTICK_TAG("Visible", stats.visible);
+	OPTICK_TAG("Culled", stats.culled);
+
+	return stats;
+}
@@ -0,0 +1,41 @@
+#pragma once
+
+#include "defines.h"
+
+#include "game.h"
+
+#include <vector>
+
+class PhysicsWorld;
+
+// Six inward facing planes, a point p is inside when normals[i].dot(p) + offsets[i] >= 0 for every plane
+struct Frustum
+{
+	enum Plane
+	{
+		NEAR_PLANE,
+		FAR_PLANE,
+		LEFT_PLANE,
+		RIGHT_PLANE,
+		BOTTOM_PLANE,
+		TOP_PLANE,
+
+		PLANE_TOTAL
+	};
+	btVector3 normals[PLANE_TOTAL];
+	r32 offsets[PLANE_TOTAL] = {};
+};
+
+// Matches the projection raylib builds in BeginMode3D, fovY is vertical in degrees (view height for orthographic)
+Frustum BuildCameraFrustum(const Camera &camera, r32 aspect, r32 nearDistance, r32 farDistance);
+
+struct CullingStats
+{
+	u32 visible = 0;
+	u32 culled = 0;
+};
+
+// Walks the physics broadphase tree with the frustum and fills visibleEntities with every entity whose collision
+// object is at least partly inside. Entities without a collision object are never reported. idleObjectCount is how
+// many of the world's objects are free pool bodies, which have no entity and aren't counted as culled
+CullingStats CullEntities(const PhysicsWorld &physics, const Frustum &frustum, u32 idleObjectCount, std::vector<entt::entity> &visibleEntities);
@@ -0,0 +1,250 @@
+#include "debris.h"
+
+#include "renderBatch.h"
+
+#include "btBulletDynamicsCommon.h"
+
+#include <algorithm>
+
+DebrisPool::DebrisPool(entt::registry &registry, PhysicsWorld &physics, const DebrisConfig &config, u32 sourceModelCount)
+	: m_registry(registry), m_physics(physics), m_config(config)
+{
+	OPTICK_EVENT();
+
+	m_placeholderShape = CreateSphereCollision(0.5f);
+	m_modelChunks.resize(sourceModelCount);
+
+	m_slots.resize(config.capacity);
+	m_freeSlots.reserve(config.capacity);
+	m_releaseList.reserve(config.capacity);
+
+	for(u32 slotNum = 0; slotNum < config.capacity; ++slotNum)
+	{
+		Slot &slot = m_slots[slotNum];
+		slot.body = m_physics.CreateRigidBody(Vec3Zero, QuatIdentity, 1.0f, m_placeholderShape).body;
+		m_physics.DisableBody(slot.body);
+
+		// Pushed in reverse so slots are handed out from the front
+		m_freeSlots.push_back(config.capacity - 1 - slotNum);
+	}
+
+	// Sized up front so shattering never grows the storages
+	m_registry.storage<Debris>().reserve(config.capacity);
+	m_registry.storage<RigidBody>().reserve(m_registry.storage<RigidBody>().size() + config.capacity);
+	m_registry.storage<Transform>().reserve(m_registry.storage<Transform>().size() + config.capacity);
+	m_registry.storage<RenderModel>().reserve(m_registry.storage<RenderModel>().size() + config.capacity);
+}
+
+DebrisPool::~DebrisPool()
+{
+	for(Slot &slot : m_slots)
+	{
+		if(slot.entity != entt::null && m_registry.valid(slot.entity))
+		{
+			m_registry.destroy(slot.entity);
+		}
+		m_physics.DestroyRigidBody(slot.body);
+	}
+	m_slots.clear();
+
+	for(std::vector<DebrisChunk> &chunks : m_modelChunks)
+	{
+		for(DebrisChunk &chunk : chunks)
+		{
+			delete chunk.shape;
+		}
+	}
+	delete m_placeholderShape;
+}
+
+void DebrisPool::SetChunks(u32 sourceModel, std::vector<DebrisChunk> &&chunks)
+{
+	Assert(m_modelChunks[sourceModel].empty());
+	m_modelChunks[sourceModel] = std::move(chunks);
+}
+
+u32 DebrisPool::Shatter(u32 sourceModel, const Transform &transform, r32 mass, const btVector3 &linearVelocity, const btVector3 &angularVelocity,
+	const btVector3 &impactPoint)
+{
+	OPTICK_EVENT();
+
+	const std::vector<DebrisChunk> &chunks = m_modelChunks[sourceModel];
+	u32 spawnedCount = 0;
+	for(u32 chunkNum = 0; chunkNum < chunks.size(); ++chunkNum)
+	{
+		if(m_freeSlots.empty() && !EvictOldest())
+		{
+			break;
+		}
+
+		const DebrisChunk &chunk = chunks[chunkNum];
+		btVector3 arm = quatRotate(transform.rotation, chunk.offset);
+
+		Transform chunkTransform;
+		chunkTransform.translation = transform.translation + arm;
+		chunkTransform.rotation = transform.rotation;
+
+		btVector3 burst = chunkTransform.translation - impactPoint;
+		burst = (burst.length2() > 0.0001f) ? burst.normalized() * m_config.burstSpeed : Vec3Zero;
+		btVector3 velocity = linearVelocity + angularVelocity.cross(arm) + burst;
+
+		u32 slotNum = m_freeSlots.back();
+		m_freeSlots.pop_back();
+		SpawnInSlot(slotNum, GetChunkKey(sourceModel, chunkNum), entt::null, chunkTransform, velocity, angularVelocity, mass * chunk.massFraction);
+		++spawnedCount;
+	}
+
+	++m_shatterCount;
+	return spawnedCount;
+}
+
+entt::entity DebrisPool::SpawnInSlot(u32 slotNum, u32 chunkKey, entt::entity hint, const Transform &transform, const btVector3 &linearVelocity,
+	const btVector3 &angularVelocity, r32 mass)
+{
+	Slot &slot = m_slots[slotNum];
+	const DebrisChunk &chunk = GetChunk(chunkKey);
+
+	slot.entity = m_registry.create(hint);
+	slot.chunkKey = chunkKey;
+	slot.mass = mass;
+	m_registry.emplace<Transform>(slot.entity, transform);
+	m_registry.emplace<RigidBody>(slot.entity, slot.body);
+	m_registry.emplace<RenderModel>(slot.entity, chunk.modelIndex);
+
+	Debris &debris = m_registry.emplace<Debris>(slot.entity);
+	debris.timeRemaining = m_config.lifetime;
+	debris.slot = slotNum;
+
+	// The body is disabled and has no pairs, so a new shape only costs the pair cache walk
+	if(slot.body->getCollisionShape() != chunk.shape)
+	{
+		m_physics.SetCollisionShape(slot.body, chunk.shape);
+	}
+	btVector3 inertia;
+	chunk.shape->calculateLocalInertia(mass, inertia);
+	slot.body->setMassProps(mass, inertia);
+	slot.body->updateInertiaTensor();
+
+	m_physics.EnableBody(slot.body, btTransform(transform.rotation, transform.translation), linearVelocity, slot.entity);
+	slot.body->setAngularVelocity(angularVelocity);
+	slot.body->setInterpolationAngularVelocity(angularVelocity);
+	return slot.entity;
+}
+
+void DebrisPool::Release(entt::entity entity)
+{
+	const Debris *debris = m_registry.try_get<Debris>(entity);
+	if(!debris)
+	{
+		return;
+	}
+
+	u32 slotNum = debris->slot;
+	Slot &slot = m_slots[slotNum];
+	Assert(slot.entity == entity);
+
+	m_physics.DisableBody(slot.body);
+	m_registry.destroy(entity);
+
+	slot.entity = entt::null;
+	m_freeSlots.push_back(slotNum);
+}
+
+bool DebrisPool::EvictOldest()
+{
+	// Debris spawned this update still has its whole lifetime, ties go to the lowest slot
+	u32 oldestSlot = U32_MAX;
+	r32 oldestTime = m_config.lifetime;
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		entt::entity entity = m_slots[slotNum].entity;
+		if(entity == entt::null)
+		{
+			continue;
+		}
+
+		r32 timeRemaining = m_registry.get<Debris>(entity).timeRemaining;
+		if(timeRemaining < oldestTime)
+		{
+			oldestTime = timeRemaining;
+			oldestSlot = slotNum;
+		}
+	}
+
+	if(oldestSlot == U32_MAX)
+	{
+		return false;
+	}
+
+	Release(m_slots[oldestSlot].entity);
+	++m_evictedCount;
+	return true;
+}
+
+void DebrisPool::Update(r32 dt)
+{
+	OPTICK_EVENT();
+
+	m_releaseList.clear();
+
+	auto view = m_registry.view<Debris>();
+	view.each([this, dt](entt::entity entity, Debris &debris) {
+		debris.timeRemaining -= dt;
+		if(debris.timeRemaining <= 0.0f)
+		{
+			m_releaseList.push_back(entity);
+		}
+	});
+
+	// In entity order, like ProjectilePool, so the slots handed out next don't depend on storage order
+	std::sort(m_releaseList.begin(), m_releaseList.end());
+	for(entt::entity entity : m_releaseList)
+	{
+		Release(entity);
+	}
+
+	OPTICK_TAG("DebrisActive", GetActiveCount());
+}
+
+void DebrisPool::SaveState(DebrisPoolState &state) const
+{
+	state.slotEntities.resize(m_slots.size());
+	state.slotChunks.resize(m_slots.size());
+	state.slotMasses.resize(m_slots.size());
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		const Slot &slot = m_slots[slotNum];
+		state.slotEntities[slotNum] = slot.entity;
+		state.slotChunks[slotNum] = (slot.entity != entt::null) ? slot.chunkKey : 0;
+		state.slotMasses[slotNum] = (slot.entity != entt::null) ? slot.mass : 0.0f;
+	}
+	state.freeSlots = m_freeSlots;
+}
+
+void DebrisPool::RestoreReleases(const DebrisPoolState &state)
+{
+	Assert(state.slotEntities.size() == m_slots.size());
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		entt::entity entity = m_slots[slotNum].entity;
+		if(entity != entt::null && entity != state.slotEntities[slotNum])
+		{
+			Release(entity);
+		}
+	}
+}
+
+void DebrisPool::RestoreSpawns(const DebrisPoolState &state)
+{
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		entt::entity entity = state.slotEntities[slotNum];
+		if(entity != entt::null && m_slots[slotNum].entity != entity)
+		{
+			entt::entity spawned = SpawnInSlot(slotNum, state.slotChunks[slotNum], entity, Transform(), Vec3Zero, Vec3Zero, state.slotMasses[slotNum]);
+			Assert(spawned == entity);
+			UNUSED(spawned);
+		}
+	}
+	m_freeSlots = state.freeSlots;
+}
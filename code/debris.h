@@ -0,0 +1,107 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+#include "physics.h"
+
+#include <vector>
+
+struct DebrisConfig
+{
+	u32 capacity = 192; // Chunk bodies in the pool. Shattering with none free evicts the oldest debris
+	r32 lifetime = 20.0f; // Seconds before a chunk goes back to the pool
+	r32 burstSpeed = 3.0f; // Added to each chunk's inherited velocity, away from where the body was hit
+};
+
+struct Debris
+{
+	r32 timeRemaining = 0.0f;
+	u32 slot = 0; // Into DebrisPool, the body stays with the slot
+};
+
+// One piece of a pre-fractured model
+struct DebrisChunk
+{
+	btConvexShape *shape = nullptr; // About the chunk's centre of mass
+	btVector3 offset = Vec3Zero; // From the whole model's origin to the chunk's centre of mass
+	r32 massFraction = 0.0f; // Share of the whole model's mass
+	u32 modelIndex = 0; // RenderModel the chunk draws with
+};
+
+// Which entity and chunk each slot was lent to and the order free slots are handed out in, for snapshots
+struct DebrisPoolState
+{
+	std::vector<entt::entity> slotEntities; // entt::null for free slots
+	std::vector<u32> slotChunks;
+	std::vector<r32> slotMasses;
+	std::vector<u32> freeSlots;
+};
+
+// Fixed set of chunk bodies, created up front and kept in the physics world like ProjectilePool's. Shattering a body
+// checks out one per chunk of its model, gives it that chunk's shape and mass and a new entity with a RenderModel,
+// so breaking something never allocates or builds a shape. When the pool runs dry the oldest debris is evicted to
+// make room, which bounds the bodies a battle can leave behind
+class DebrisPool
+{
+public:
+	DebrisPool(entt::registry &registry, PhysicsWorld &physics, const DebrisConfig &config, u32 sourceModelCount);
+	~DebrisPool();
+
+	// Sets the chunks a model breaks into once they are cooked, taking ownership of their shapes. Until then bodies
+	// of that model can't be shattered
+	void SetChunks(u32 sourceModel, std::vector<DebrisChunk> &&chunks);
+	bool CanShatter(u32 sourceModel) const { return m_config.capacity && !m_modelChunks[sourceModel].empty(); }
+
+	// Spawns the chunks of the model in place of a body with that transform, mass and motion. Each chunk carries on
+	// with the velocity its centre had as part of the body, plus burstSpeed directed away from impactPoint. The caller
+	// destroys the body. Returns how many chunks were spawned
+	u32 Shatter(u32 sourceModel, const Transform &transform, r32 mass, const btVector3 &linearVelocity, const btVector3 &angularVelocity,
+		const btVector3 &impactPoint);
+	void Release(entt::entity entity);
+
+	// Ages debris by dt and returns expired chunks to the pool. Creates and destroys entities, so run it from an
+	// exclusive system after the physics step
+	void Update(r32 dt);
+
+	void SaveState(DebrisPoolState &state) const;
+	// Split like ProjectilePool's
+	void RestoreReleases(const DebrisPoolState &state);
+	void RestoreSpawns(const DebrisPoolState &state);
+
+	u32 GetCapacity() const { return (u32)m_slots.size(); }
+	u32 GetActiveCount() const { return (u32)(m_slots.size() - m_freeSlots.size()); }
+	u32 GetShatterCount() const { return m_shatterCount; }
+	u32 GetEvictedCount() const { return m_evictedCount; }
+
+private:
+	// Model in the top 16 bits, chunk in the bottom 16
+	static u32 GetChunkKey(u32 sourceModel, u32 chunkNum) { return (sourceModel << 16) | chunkNum; }
+	const DebrisChunk &GetChunk(u32 chunkKey) const { return m_modelChunks[chunkKey >> 16][chunkKey & 0xffff]; }
+
+	entt::entity SpawnInSlot(u32 slotNum, u32 chunkKey, entt::entity hint, const Transform &transform, const btVector3 &linearVelocity,
+		const btVector3 &angularVelocity, r32 mass);
+	// Frees the slot of the debris with the least time left, other than debris spawned this update. False if there is none
+	bool EvictOldest();
+
+	struct Slot
+	{
+		btRigidBody *body = nullptr;
+		entt::entity entity = entt::null;
+		u32 chunkKey = 0;
+		r32 mass = 0.0f;
+	};
+
+	entt::registry &m_registry;
+	PhysicsWorld &m_physics;
+	DebrisConfig m_config;
+
+	btConvexShape *m_placeholderShape; // Pooled bodies sit in the world with this while they are free
+	std::vector<std::vector<DebrisChunk>> m_modelChunks; // By source model
+
+	std::vector<Slot> m_slots;
+	std::vector<u32> m_freeSlots;
+	std::vector<entt::entity> m_releaseList; // Scratch for Update
+	u32 m_shatterCount = 0;
+	u32 m_evictedCount = 0;
+};
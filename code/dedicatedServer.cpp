@@ -0,0 +1,160 @@
+#include "dedicatedServer.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <vector>
+
+bool RunDedicatedServer(const DedicatedServerConfig &config, const GameConfig &gameConfig, const InputScript &script)
+{
+	OPTICK_EVENT();
+
+	using Clock = std::chrono::steady_clock;
+
+	GameConfig serverConfig = gameConfig;
+	serverConfig.spawnPlayer = false;
+	Game *game = new Game(serverConfig);
+
+	LoopbackTransport transport(config.loopback);
+	ReplicationServer server(*game, transport, config.replication);
+
+	std::vector<ReplicationClient> clients;
+	std::vector<InputScript> scripts;
+	clients.reserve(config.clientCount);
+	for(u32 clientNum = 0; clientNum < config.clientCount; ++clientNum)
+	{
+		u32 connection = transport.Connect();
+
+		Transform spawnTransform;
+		spawnTransform.translation = btVector3(((r32)clientNum - (config.clientCount - 1) * 0.5f) * config.shipSpacing, 0.0f, 0.0f);
+		server.AddClient(connection, spawnTransform);
+		clients.emplace_back(transport, connection, config.replication);
+
+		InputScript &botScript = scripts.emplace_back(script);
+		for(u32 frameNum = 0; frameNum < clientNum * config.scriptOffset; ++frameNum)
+		{
+			botScript.Next();
+		}
+	}
+
+	// Frame is normally timed by UpdateAndDraw
+	FrameTelemetry &telemetry = game->GetTelemetry();
+	const u32 frameSection = telemetry.AddSection("Frame");
+	const u32 replicationSection = telemetry.AddSection("Replication");
+
+	Clock::duration simulateTotal = Clock::duration::zero();
+	Clock::duration replicationTotal = Clock::duration::zero();
+	Clock::duration tickMax = Clock::duration::zero();
+	u32 checkedSnapshots = 0;
+	u32 uncheckedSnapshots = 0;
+	u32 mismatchedSnapshots = 0;
+	u32 firstMismatchFrame = U32_MAX;
+
+	for(u32 frameNum = 0; frameNum < config.frames; ++frameNum)
+	{
+		for(u32 clientNum = 0; clientNum < config.clientCount; ++clientNum)
+		{
+			clients[clientNum].SendInput(scripts[clientNum].Next());
+		}
+		transport.Tick();
+
+		Clock::time_point tickStart = Clock::now();
+		server.ReceiveInputs();
+		game->Simulate(config.dt);
+		Clock::time_point simulateEnd = Clock::now();
+		server.SendSnapshots();
+		Clock::time_point tickEnd = Clock::now();
+
+		telemetry.AddTime(frameSection, simulateEnd - tickStart);
+		telemetry.AddTime(replicationSection, tickEnd - simulateEnd);
+		telemetry.EndFrame();
+		simulateTotal += simulateEnd - tickStart;
+		replicationTotal += tickEnd - simulateEnd;
+		tickMax = MAX(tickMax, tickEnd - tickStart);
+
+		for(u32 clientNum = 0; clientNum < config.clientCount; ++clientNum)
+		{
+			ReplicationClient &client = clients[clientNum];
+			u32 lastSequence = client.GetSequence();
+			client.ReceiveSnapshots();
+			if(client.GetSequence() == lastSequence)
+			{
+				continue;
+			}
+
+			// With more latency than history the server has moved on from it already
+			const std::vector<ReplicatedEntity> *sent = server.FindSentSnapshot(clientNum, client.GetSequence());
+			if(!sent)
+			{
+				++uncheckedSnapshots;
+				continue;
+			}
+
+			++checkedSnapshots;
+			if(*sent != client.GetEntities() || client.GetShip() != server.GetShip(clientNum))
+			{
+				++mismatchedSnapshots;
+				firstMismatchFrame = MIN(firstMismatchFrame, frameNum);
+			}
+		}
+	}
+
+	ReplicationStats totals;
+	LinkStats linkTotals;
+	u32 droppedSnapshots = 0;
+	for(u32 clientNum = 0; clientNum < config.clientCount; ++clientNum)
+	{
+		const ReplicationStats &stats = server.GetStats(clientNum);
+		totals.snapshots += stats.snapshots;
+		totals.fullSnapshots += stats.fullSnapshots;
+		totals.snapshotBytes += stats.snapshotBytes;
+		totals.maxSnapshotBytes = MAX(totals.maxSnapshotBytes, stats.maxSnapshotBytes);
+		totals.interestEntities += stats.interestEntities;
+		totals.writtenEntities += stats.writtenEntities;
+		totals.malformedPackets += stats.malformedPackets;
+
+		const LinkStats &link = transport.GetStats(clientNum);
+		linkTotals.bytesToServer += link.bytesToServer;
+		linkTotals.packetsDropped += link.packetsDropped;
+		droppedSnapshots += clients[clientNum].GetDroppedSnapshots();
+	}
+
+	const AsteroidField &asteroidField = game->GetAsteroidField();
+	u32 asteroidCount = asteroidField.GetAsteroidCount();
+	u32 sectorCount = asteroidField.GetLoadedSectorCount();
+	delete game;
+
+	auto toMs = [](Clock::duration time) { return std::chrono::duration<r64, std::milli>(time).count(); };
+	r64 frames = MAX(config.frames, 1u);
+	r64 clientFrames = MAX(config.frames * config.clientCount, 1u);
+	r64 snapshots = MAX(totals.snapshots, 1u);
+	r64 snapshotBytes = totals.snapshotBytes / snapshots;
+
+	printf("Server: %u clients for %u ticks, tick avg %.4f ms, max %.4f ms (simulate avg %.4f ms, replication avg %.4f ms)\n", config.clientCount,
+		config.frames, (toMs(simulateTotal) + toMs(replicationTotal)) / frames, toMs(tickMax), toMs(simulateTotal) / frames, toMs(replicationTotal) / frames);
+	printf("Per client: %.4f ms of tick, %.4f ms of it replication, %.1f entities of interest and %.1f written per snapshot\n",
+		(toMs(simulateTotal) + toMs(replicationTotal)) / clientFrames, toMs(replicationTotal) / clientFrames, totals.interestEntities / snapshots,
+		totals.writtenEntities / snapshots);
+	printf("Snapshots: avg %.1f bytes, max %u bytes, %.1f kbit/s per client at %.0f ticks a second, %u of %u sent whole\n", snapshotBytes,
+		totals.maxSnapshotBytes, snapshotBytes * 8.0 / (config.dt * 1000.0), 1.0 / config.dt, totals.fullSnapshots, totals.snapshots);
+	printf("Inputs: %.1f bytes per client per tick\n", linkTotals.bytesToServer / clientFrames);
+	printf("Asteroid field at the end: %u asteroids in %u sectors\n", asteroidCount, sectorCount);
+	if(config.loopback.lossRate > 0.0f || droppedSnapshots || totals.malformedPackets)
+	{
+		printf("Loopback dropped %u packets, clients dropped %u snapshots, the server %u malformed inputs\n", linkTotals.packetsDropped, droppedSnapshots,
+			totals.malformedPackets);
+	}
+	if(uncheckedSnapshots)
+	{
+		printf("%u snapshots arrived after the server's history had moved on and went unchecked\n", uncheckedSnapshots);
+	}
+
+	if(mismatchedSnapshots)
+	{
+		printf("%u of %u snapshots decoded differently to what the server sent, the first at tick %u\n", mismatchedSnapshots, checkedSnapshots, firstMismatchFrame);
+	}
+	else
+	{
+		printf("Clients decoded what the server sent in all %u snapshots\n", checkedSnapshots);
+	}
+	return mismatchedSnapshots == 0;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "defines.h"
+
+#include "game.h"
+#include "inputScript.h"
+#include "loopbackTransport.h"
+#include "replication.h"
+
+struct DedicatedServerConfig
+{
+	u32 clientCount = 4;
+	u32 frames = 3600;
+	r32 dt = 1.0f / 60.0f;
+	r32 shipSpacing = 30.0f; // Ships start in a line along X, this far apart
+	u32 scriptOffset = 97; // Frames of the script each bot skips past the one before, so they don't all fly together
+	ReplicationConfig replication;
+	LoopbackConfig loopback;
+};
+
+// Serves a game with no player of its own to clientCount bot clients over a LoopbackTransport, each flying the script
+// from a different point in it, and prints the tick cost and bandwidth per client. Every snapshot a bot decodes is
+// checked against what the server sent, false if any differ
+bool RunDedicatedServer(const DedicatedServerConfig &config, const GameConfig &gameConfig, const InputScript &script);
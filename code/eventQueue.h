@@ -0,0 +1,260 @@
+#pragma once
+
+#include "defines.h"
+
+#include <atomic>
+#include <bit>
+#include <memory>
+#include <span>
+#include <vector>
+
+// Events of one type. Any number of threads can Push at once without locking: each push claims an index with an
+// atomic increment and writes into pages that double in size and never move once allocated.
+// Double buffered, Swap() makes this frame's events readable as one contiguous span and starts an empty frame.
+// Swap and GetEvents must not run while other threads push.
+template<typename T>
+class EventQueue
+{
+public:
+	EventQueue(u32 initialCapacity = 64)
+	{
+		m_buffers[0].Init(initialCapacity);
+		m_buffers[1].Init(initialCapacity);
+	}
+
+	void Push(const T &event)
+	{
+		Buffer &buffer = m_buffers[m_writeBuffer];
+		u32 index = buffer.count.fetch_add(1, std::memory_order_relaxed);
+		buffer.GetSlot(index) = event;
+	}
+
+	void Swap()
+	{
+		Buffer &written = m_buffers[m_writeBuffer];
+		written.Consolidate();
+
+		m_writeBuffer ^= 1;
+		Buffer &next = m_buffers[m_writeBuffer];
+		next.count.store(0, std::memory_order_relaxed);
+
+		// Size the next frame for the same burst so it doesn't spill again
+		next.Reserve(written.pageZeroCapacity);
+	}
+
+	// Events pushed before the last Swap
+	std::span<const T> GetEvents() const
+	{
+		const Buffer &buffer = m_buffers[m_writeBuffer ^ 1];
+		return std::span<const T>(buffer.pages[0].load(std::memory_order_relaxed), buffer.count.load(std::memory_order_relaxed));
+	}
+
+	// Events pushed since the last Swap, in push order. For snapshots, so the same rules as Swap apply
+	u32 GetPendingCount() const { return m_buffers[m_writeBuffer].count.load(std::memory_order_relaxed); }
+
+	template<typename Function>
+	void ForEachPending(Function function)
+	{
+		Buffer &buffer = m_buffers[m_writeBuffer];
+		u32 eventCount = GetPendingCount();
+		for(u32 index = 0; index < eventCount; ++index)
+		{
+			function((const T &)buffer.GetSlot(index));
+		}
+	}
+
+	void ClearPending()
+	{
+		m_buffers[m_writeBuffer].count.store(0, std::memory_order_relaxed);
+	}
+
+private:
+	static constexpr u32 maxPages = 24;
+
+	// Page n holds pageZeroCapacity << n events, so any index maps to a page and offset without a lock
+	struct Buffer
+	{
+		std::atomic<T *> pages[maxPages] = {};
+		std::atomic<u32> count = 0;
+		u32 pageZeroCapacity = 0;
+
+		~Buffer()
+		{
+			for(std::atomic<T *> &page : pages)
+			{
+				delete[] page.load(std::memory_order_relaxed);
+			}
+		}
+
+		void Init(u32 capacity)
+		{
+			pageZeroCapacity = std::bit_ceil(MAX(capacity, 1u));
+			pages[0].store(new T[pageZeroCapacity], std::memory_order_relaxed);
+		}
+
+		T &GetSlot(u32 index)
+		{
+			u32 pageNum = (u32)std::bit_width(index / pageZeroCapacity + 1) - 1;
+			Assert(pageNum < maxPages);
+			u32 offset = index - pageZeroCapacity * ((1u << pageNum) - 1);
+
+			T *page = pages[pageNum].load(std::memory_order_acquire);
+			if(!page)
+			{
+				// First push past the end of the previous page. Threads racing here all allocate, one wins
+				T *newPage = new T[(size_t)pageZeroCapacity << pageNum];
+				if(pages[pageNum].compare_exchange_strong(page, newPage, std::memory_order_acq_rel, std::memory_order_acquire))
+				{
+					page = newPage;
+				}
+				else
+				{
+					delete[] newPage;
+				}
+			}
+			return page[offset];
+		}
+
+		// Moves everything that spilled past page zero into a page zero big enough to hold it all
+		void Consolidate()
+		{
+			u32 eventCount = count.load(std::memory_order_relaxed);
+			if(eventCount <= pageZeroCapacity)
+			{
+				return;
+			}
+
+			u32 newCapacity = std::bit_ceil(eventCount);
+			T *newPage = new T[newCapacity];
+			for(u32 index = 0; index < eventCount; ++index)
+			{
+				newPage[index] = GetSlot(index);
+			}
+
+			for(std::atomic<T *> &page : pages)
+			{
+				delete[] page.exchange(nullptr, std::memory_order_relaxed);
+			}
+			pages[0].store(newPage, std::memory_order_relaxed);
+			pageZeroCapacity = newCapacity;
+		}
+
+		void Reserve(u32 capacity)
+		{
+			if(capacity <= pageZeroCapacity)
+			{
+				return;
+			}
+
+			for(std::atomic<T *> &page : pages)
+			{
+				delete[] page.exchange(nullptr, std::memory_order_relaxed);
+			}
+			pageZeroCapacity = capacity;
+			pages[0].store(new T[pageZeroCapacity], std::memory_order_relaxed);
+		}
+	};
+
+	Buffer m_buffers[2];
+	u32 m_writeBuffer = 0;
+};
+
+// One EventQueue per event type plus the handlers for each. Handlers get every event of their type from the previous
+// frame in one call. Register every type before pushing from worker threads, queues are created on first use
+class EventQueues
+{
+public:
+	template<typename T>
+	using Handler = entt::delegate<void(std::span<const T>)>;
+
+	template<typename T>
+	EventQueue<T> &GetQueue()
+	{
+		return GetEntry<T>().queue;
+	}
+
+	// Thread safe once the queue for T exists
+	template<typename T>
+	void Push(const T &event)
+	{
+		const entt::id_type typeIndex = entt::type_index<T>::value();
+		Assert(typeIndex < m_entries.size() && m_entries[typeIndex]);
+		((Entry<T> *)m_entries[typeIndex].get())->queue.Push(event);
+	}
+
+	template<auto Candidate, typename T, typename Type>
+	void Connect(Type *instance)
+	{
+		Handler<T> handler;
+		handler.template connect<Candidate>(instance);
+		GetEntry<T>().handlers.push_back(handler);
+	}
+
+	// Swaps every queue, then hands each type's events to its handlers, in the order the types were first used.
+	// Events pushed by handlers are dispatched next frame
+	void Dispatch()
+	{
+		OPTICK_EVENT();
+
+		for(EntryBase *entry : m_dispatchOrder)
+		{
+			entry->Swap();
+		}
+		for(EntryBase *entry : m_dispatchOrder)
+		{
+			entry->Dispatch();
+		}
+	}
+
+private:
+	struct EntryBase
+	{
+		virtual ~EntryBase() = default;
+		virtual void Swap() = 0;
+		virtual void Dispatch() = 0;
+	};
+
+	template<typename T>
+	struct Entry : EntryBase
+	{
+		EventQueue<T> queue;
+		std::vector<Handler<T>> handlers;
+
+		void Swap() override { queue.Swap(); }
+
+		void Dispatch() override
+		{
+			std::span<const T> events = queue.GetEvents();
+			if(events.empty())
+			{
+				return;
+			}
+
+			for(Handler<T> &handler : handlers)
+			{
+				handler(events);
+			}
+		}
+	};
+
+	template<typename T>
+	Entry<T> &GetEntry()
+	{
+		const entt::id_type typeIndex = entt::type_index<T>::value();
+		if(typeIndex >= m_entries.size())
+		{
+			m_entries.resize(typeIndex + 1);
+		}
+
+		std::unique_ptr<EntryBase> &entry = m_entries[typeIndex];
+		if(!entry)
+		{
+			entry = std::make_unique<Entry<T>>();
+			m_dispatchOrder.push_back(entry.get());
+		}
+		return *(Entry<T> *)entry.get();
+	}
+
+	std::vector<std::unique_ptr<EntryBase>> m_entries; // Indexed by entt::type_index
+	std::vector<EntryBase *> m_dispatchOrder;
+};
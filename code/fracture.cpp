@@ -0,0 +1,242 @@
+#include "fracture.h"
+
+#include "assetLoader.h"
+
+#include "LinearMath/btConvexHullComputer.h"
+
+// Corners closer to a plane than this count as on it
+constexpr r32 clipEpsilon = 1e-5f;
+
+// Cells smaller than this fraction of the hull are slivers, too thin to collide with well
+constexpr r32 minChunkVolumeFraction = 0.005f;
+
+// Keeps the part of the hull of points with normal.dot(x) <= offset, which is the hull of the corners on that side
+// and the points where edges cross the plane. False once too little is left to make a solid
+static bool ClipHull(std::vector<btVector3> &points, const btVector3 &normal, r32 offset, btConvexHullComputer &hullComputer,
+	std::vector<btVector3> &clipped)
+{
+	bool anyOutside = false;
+	bool anyInside = false;
+	for(const btVector3 &point : points)
+	{
+		r32 distance = normal.dot(point) - offset;
+		anyOutside |= distance > clipEpsilon;
+		anyInside |= distance < -clipEpsilon;
+	}
+
+	if(!anyOutside)
+	{
+		return true;
+	}
+	if(!anyInside)
+	{
+		points.clear();
+		return false;
+	}
+
+	hullComputer.compute(&points[0].x(), (int)sizeof(btVector3), (int)points.size(), 0.0f, 0.0f);
+
+	clipped.clear();
+	for(int vertexNum = 0; vertexNum < hullComputer.vertices.size(); ++vertexNum)
+	{
+		const btVector3 &vertex = hullComputer.vertices[vertexNum];
+		if(normal.dot(vertex) - offset <= clipEpsilon)
+		{
+			clipped.push_back(vertex);
+		}
+	}
+
+	// Every edge is listed once each way
+	for(int edgeNum = 0; edgeNum < hullComputer.edges.size(); ++edgeNum)
+	{
+		const btConvexHullComputer::Edge &edge = hullComputer.edges[edgeNum];
+		int source = edge.getSourceVertex();
+		int target = edge.getTargetVertex();
+		if(source > target)
+		{
+			continue;
+		}
+
+		const btVector3 &sourcePoint = hullComputer.vertices[source];
+		const btVector3 &targetPoint = hullComputer.vertices[target];
+		r32 sourceDistance = normal.dot(sourcePoint) - offset;
+		r32 targetDistance = normal.dot(targetPoint) - offset;
+		if((sourceDistance > clipEpsilon && targetDistance < -clipEpsilon) || (sourceDistance < -clipEpsilon && targetDistance > clipEpsilon))
+		{
+			clipped.push_back(sourcePoint.lerp(targetPoint, sourceDistance / (sourceDistance - targetDistance)));
+		}
+	}
+
+	points.swap(clipped);
+	return points.size() >= 4;
+}
+
+std::vector<CookedHull> FractureHull(const btVector3 *points, u32 pointCount, u64 seed, const FractureConfig &config)
+{
+	OPTICK_EVENT();
+
+	std::vector<CookedHull> chunks;
+	if(!pointCount || !config.chunkCount)
+	{
+		return chunks;
+	}
+
+	btConvexHullComputer hullComputer;
+	hullComputer.compute(&points[0].x(), (int)sizeof(btVector3), (int)pointCount, 0.0f, 0.0f);
+	std::vector<btVector3> corners(&hullComputer.vertices[0], &hullComputer.vertices[0] + hullComputer.vertices.size());
+
+	btVector3 center;
+	r32 volume = ComputeHullVolume(corners.data(), (u32)corners.size(), center);
+	if(volume <= 0.0f)
+	{
+		return chunks;
+	}
+
+	// Somewhere between the centre and a corner, so every site is inside the hull and the cells are roughly the
+	// same size
+	RandomStream random(seed);
+	std::vector<btVector3> sites(config.chunkCount);
+	for(btVector3 &site : sites)
+	{
+		const btVector3 &corner = corners[random.UInt(0, (u32)corners.size())];
+		site = center.lerp(corner, random.Float(0.2f, 0.8f));
+	}
+
+	std::vector<btVector3> cell;
+	std::vector<btVector3> clipped;
+	for(u32 siteNum = 0; siteNum < sites.size(); ++siteNum)
+	{
+		cell = corners;
+		bool solid = true;
+		for(u32 otherNum = 0; otherNum < sites.size() && solid; ++otherNum)
+		{
+			btVector3 normal = sites[otherNum] - sites[siteNum];
+			if(otherNum == siteNum || normal.length2() < clipEpsilon * clipEpsilon)
+			{
+				continue;
+			}
+			btVector3 midpoint = (sites[otherNum] + sites[siteNum]) * 0.5f;
+			solid = ClipHull(cell, normal, normal.dot(midpoint), hullComputer, clipped);
+		}
+
+		btVector3 cellCenter;
+		if(!solid || ComputeHullVolume(cell.data(), (u32)cell.size(), cellCenter) < volume * minChunkVolumeFraction)
+		{
+			continue;
+		}
+		// Only drops duplicate corners, reducing the cell would open gaps between the chunks
+		chunks.push_back(CookHull(cell.data(), (u32)cell.size(), U32_MAX));
+	}
+
+	return chunks;
+}
+
+// Sums the tetrahedra from an inside point to a fan of triangles over each face
+r32 ComputeHullVolume(const btVector3 *points, u32 pointCount, btVector3 &centroid)
+{
+	centroid = Vec3Zero;
+	if(pointCount < 4)
+	{
+		return 0.0f;
+	}
+
+	btConvexHullComputer hullComputer;
+	hullComputer.compute(&points[0].x(), (int)sizeof(btVector3), (int)pointCount, 0.0f, 0.0f);
+	if(hullComputer.vertices.size() < 4)
+	{
+		return 0.0f;
+	}
+
+	btVector3 reference = Vec3Zero;
+	for(int vertexNum = 0; vertexNum < hullComputer.vertices.size(); ++vertexNum)
+	{
+		reference += hullComputer.vertices[vertexNum];
+	}
+	reference /= (r32)hullComputer.vertices.size();
+
+	r32 volume = 0.0f;
+	btVector3 weightedCenter = Vec3Zero;
+	for(int faceNum = 0; faceNum < hullComputer.faces.size(); ++faceNum)
+	{
+		const btConvexHullComputer::Edge *first = &hullComputer.edges[hullComputer.faces[faceNum]];
+		const btVector3 &a = hullComputer.vertices[first->getSourceVertex()];
+		for(const btConvexHullComputer::Edge *edge = first->getNextEdgeOfFace(); edge->getTargetVertex() != first->getSourceVertex();
+			edge = edge->getNextEdgeOfFace())
+		{
+			const btVector3 &b = hullComputer.vertices[edge->getSourceVertex()];
+			const btVector3 &c = hullComputer.vertices[edge->getTargetVertex()];
+			r32 tetrahedronVolume = (a - reference).dot((b - reference).cross(c - reference)) / 6.0f;
+			volume += tetrahedronVolume;
+			weightedCenter += (reference + a + b + c) * (tetrahedronVolume * 0.25f);
+		}
+	}
+
+	// Faces wind the same way round, so the sign is the same for every tetrahedron
+	if(fabsf(volume) < 1e-12f)
+	{
+		centroid = reference;
+		return 0.0f;
+	}
+	centroid = weightedCenter / volume;
+	return fabsf(volume);
+}
+
+void BuildHullMesh(const btVector3 *points, u32 pointCount, r32 texelsPerUnit, MeshData &mesh)
+{
+	mesh = MeshData();
+	if(pointCount < 4)
+	{
+		return;
+	}
+
+	btConvexHullComputer hullComputer;
+	hullComputer.compute(&points[0].x(), (int)sizeof(btVector3), (int)pointCount, 0.0f, 0.0f);
+	mesh.positions.assign(&hullComputer.vertices[0], &hullComputer.vertices[0] + hullComputer.vertices.size());
+
+	btVector3 center;
+	ComputeHullVolume(mesh.positions.data(), (u32)mesh.positions.size(), center);
+
+	auto addVertex = [&mesh, texelsPerUnit](const btVector3 &position, const btVector3 &normal, u32 uAxis, u32 vAxis) {
+		for(u32 axis = 0; axis < 3; ++axis)
+		{
+			mesh.vertices.push_back(position[axis]);
+			mesh.normals.push_back(normal[axis]);
+		}
+		mesh.texcoords.push_back(position[uAxis] * texelsPerUnit);
+		mesh.texcoords.push_back(position[vAxis] * texelsPerUnit);
+		++mesh.vertexCount;
+	};
+
+	for(int faceNum = 0; faceNum < hullComputer.faces.size(); ++faceNum)
+	{
+		const btConvexHullComputer::Edge *first = &hullComputer.edges[hullComputer.faces[faceNum]];
+		const btVector3 &a = hullComputer.vertices[first->getSourceVertex()];
+		const btConvexHullComputer::Edge *second = first->getNextEdgeOfFace();
+		btVector3 normal = (hullComputer.vertices[second->getSourceVertex()] - a).cross(hullComputer.vertices[second->getTargetVertex()] - a);
+		if(normal.length2() < 1e-12f)
+		{
+			continue;
+		}
+		normal.normalize();
+
+		// Faces wind counter-clockwise seen from outside, raylib wants the same
+		bool flipped = normal.dot(a - center) < 0.0f;
+		if(flipped)
+		{
+			normal = -normal;
+		}
+
+		u32 mainAxis = (u32)normal.absolute().maxAxis();
+		u32 uAxis = (mainAxis + 1) % 3;
+		u32 vAxis = (mainAxis + 2) % 3;
+
+		for(const btConvexHullComputer::Edge *edge = second; edge->getTargetVertex() != first->getSourceVertex(); edge = edge->getNextEdgeOfFace())
+		{
+			const btVector3 &b = hullComputer.vertices[edge->getSourceVertex()];
+			const btVector3 &c = hullComputer.vertices[edge->getTargetVertex()];
+			addVertex(a, normal, uAxis, vAxis);
+			addVertex(flipped ? c : b, normal, uAxis, vAxis);
+			addVertex(flipped ? b : c, normal, uAxis, vAxis);
+		}
+	}
+}
@@ -0,0 +1,28 @@
+#pragma once
+
+#include "defines.h"
+
+#include "hullCooker.h"
+#include "math.h"
+
+#include <vector>
+
+struct MeshData;
+
+struct FractureConfig
+{
+	u32 chunkCount = 8; // Cells that come out too thin to collide with are dropped, so there can be fewer chunks
+};
+
+// Splits the convex hull of points into Voronoi cells around sites scattered through it, each cell clipped out of
+// the hull one bisecting plane at a time. Cells are kept exactly, with no vertex limit, so the chunks tile the hull
+// without gaps or overlaps. Cut from an already cooked hull they stay small. Chunks are in the same space as points,
+// and the same points and seed always give the same chunks
+std::vector<CookedHull> FractureHull(const btVector3 *points, u32 pointCount, u64 seed, const FractureConfig &config = FractureConfig());
+
+// Volume and centre of mass of the convex hull of points, a solid of uniform density. 0 for a flat or empty hull
+r32 ComputeHullVolume(const btVector3 *points, u32 pointCount, btVector3 &centroid);
+
+// Flat shaded triangles over the faces of the convex hull of points, for drawing a chunk. Texture coordinates are a
+// box projection, texelsPerUnit of them per unit along each face's main axes
+void BuildHullMesh(const btVector3 *points, u32 pointCount, r32 texelsPerUnit, MeshData &mesh);
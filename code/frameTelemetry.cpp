@@ -0,0 +1,121 @@
+#include "frameTelemetry.h"
+
+#include <algorithm>
+#include <stdio.h>
+#include <string.h>
+
+u32 FrameTelemetry::AddSection(const char *name)
+{
+	for(u32 sectionNum = 0; sectionNum < m_sectionCount; ++sectionNum)
+	{
+		if(strcmp(m_sections[sectionNum].name, name) == 0)
+		{
+			return sectionNum;
+		}
+	}
+
+	Assert(m_sectionCount < maxSections);
+	m_sections[m_sectionCount].name = name;
+	return m_sectionCount++;
+}
+
+void FrameTelemetry::EndFrame()
+{
+	u32 sampleIndex = (u32)(m_frameCount % windowSize);
+	for(u32 sectionNum = 0; sectionNum < m_sectionCount; ++sectionNum)
+	{
+		Section &section = m_sections[sectionNum];
+		section.samplesMs[sampleIndex] = std::chrono::duration<r32, std::milli>(section.frameTime).count();
+		section.frameTime = Clock::duration::zero();
+	}
+	++m_frameCount;
+}
+
+// Nearest rank on samples already sorted ascending
+static r32 Percentile(const r32 *sortedSamples, u32 sampleCount, u32 percentile)
+{
+	u32 rank = (percentile * sampleCount + 99) / 100;
+	return sortedSamples[MAX(rank, 1u) - 1];
+}
+
+void FrameTelemetry::BuildReports(std::vector<TelemetryReport> &reports, u32 frameCount) const
+{
+	OPTICK_EVENT();
+
+	reports.clear();
+
+	u64 available = MIN(m_frameCount, (u64)windowSize);
+	u32 sampleCount = (u32)((frameCount && frameCount < available) ? frameCount : available);
+
+	r32 sortedSamples[windowSize];
+	for(u32 sectionNum = 0; sectionNum < m_sectionCount; ++sectionNum)
+	{
+		const Section &section = m_sections[sectionNum];
+
+		TelemetryReport report = {};
+		report.name = section.name;
+		report.sampleCount = sampleCount;
+		if(sampleCount)
+		{
+			// The most recent sampleCount frames end just before the next write position
+			u32 newest = (u32)((m_frameCount - 1) % windowSize);
+			for(u32 sampleNum = 0; sampleNum < sampleCount; ++sampleNum)
+			{
+				sortedSamples[sampleNum] = section.samplesMs[(newest + windowSize - sampleNum) % windowSize];
+			}
+			std::sort(sortedSamples, sortedSamples + sampleCount);
+
+			report.p50Ms = Percentile(sortedSamples, sampleCount, 50);
+			report.p95Ms = Percentile(sortedSamples, sampleCount, 95);
+			report.p99Ms = Percentile(sortedSamples, sampleCount, 99);
+			report.maxMs = sortedSamples[sampleCount - 1];
+		}
+		reports.push_back(report);
+	}
+}
+
+bool WriteTelemetry(const char *fileName, const std::vector<TelemetryWindow> &windows)
+{
+	FILE *file = fopen(fileName, "w");
+	if(!file)
+	{
+		return false;
+	}
+
+	size_t nameLength = strlen(fileName);
+	bool json = nameLength >= 5 && strcmp(fileName + nameLength - 5, ".json") == 0;
+	if(json)
+	{
+		fprintf(file, "{\n\t\"windows\": [\n");
+		for(size_t windowNum = 0; windowNum < windows.size(); ++windowNum)
+		{
+			const TelemetryWindow &window = windows[windowNum];
+			fprintf(file, "\t\t{\n\t\t\t\"firstFrame\": %llu,\n\t\t\t\"frameCount\": %u,\n\t\t\t\"sections\": [\n",
+				(unsigned long long)window.firstFrame, window.frameCount);
+			for(size_t reportNum = 0; reportNum < window.reports.size(); ++reportNum)
+			{
+				const TelemetryReport &report = window.reports[reportNum];
+				fprintf(file, "\t\t\t\t{ \"name\": \"%s\", \"p50Ms\": %.4f, \"p95Ms\": %.4f, \"p99Ms\": %.4f, \"maxMs\": %.4f }%s\n",
+					report.name, report.p50Ms, report.p95Ms, report.p99Ms, report.maxMs, reportNum + 1 < window.reports.size() ? "," : "");
+			}
+			fprintf(file, "\t\t\t]\n\t\t}%s\n", windowNum + 1 < windows.size() ? "," : "");
+		}
+		fprintf(file, "\t]\n}\n");
+	}
+	else
+	{
+		fprintf(file, "firstFrame,frameCount,section,p50Ms,p95Ms,p99Ms,maxMs\n");
+		for(const TelemetryWindow &window : windows)
+		{
+			for(const TelemetryReport &report : window.reports)
+			{
+				fprintf(file, "%llu,%u,%s,%.4f,%.4f,%.4f,%.4f\n", (unsigned long long)window.firstFrame, window.frameCount,
+					report.name, report.p50Ms, report.p95Ms, report.p99Ms, report.maxMs);
+			}
+		}
+	}
+
+	bool written = !ferror(file);
+	fclose(file);
+	return written;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+#include "defines.h"
+
+#include <chrono>
+#include <vector>
+
+struct TelemetryReport
+{
+	const char *name;
+	r32 p50Ms;
+	r32 p95Ms;
+	r32 p99Ms;
+	r32 maxMs;
+	u32 sampleCount;
+};
+
+// Reports for one window of frames, as written by WriteTelemetry
+struct TelemetryWindow
+{
+	u64 firstFrame;
+	u32 frameCount;
+	std::vector<TelemetryReport> reports;
+};
+
+// Always-on timings of named sections of the frame. Each section keeps its time for the last windowSize frames in a
+// fixed ring buffer, so recording never allocates and percentiles cover a rolling window.
+// A section can be timed from any thread, as long as only one thread times it at once
+class FrameTelemetry
+{
+public:
+	using Clock = std::chrono::steady_clock;
+
+	static constexpr u32 maxSections = 32;
+	static constexpr u32 windowSize = 300;
+
+	// name must outlive the telemetry. Adding the same name again returns the existing section
+	u32 AddSection(const char *name);
+
+	// Times add up when a section runs more than once in a frame
+	void AddTime(u32 section, Clock::duration time) { m_sections[section].frameTime += time; }
+
+	// Pushes this frame's time for every section into its window, sections that didn't run record 0
+	void EndFrame();
+
+	// Percentiles over the most recent frameCount frames, capped at windowSize. 0 uses the whole window
+	void BuildReports(std::vector<TelemetryReport> &reports, u32 frameCount = 0) const;
+
+	u64 GetFrameCount() const { return m_frameCount; }
+
+private:
+	struct Section
+	{
+		const char *name = nullptr;
+		Clock::duration frameTime = Clock::duration::zero();
+		r32 samplesMs[windowSize] = {};
+	};
+
+	Section m_sections[maxSections];
+	u32 m_sectionCount = 0;
+	u64 m_frameCount = 0;
+};
+
+// Times the enclosing scope into a section
+class TelemetryScope
+{
+public:
+	TelemetryScope(FrameTelemetry &telemetry, u32 section) : m_telemetry(telemetry), m_section(section), m_start(FrameTelemetry::Clock::now()) {}
+	~TelemetryScope() { m_telemetry.AddTime(m_section, FrameTelemetry::Clock::now() - m_start); }
+
+	TelemetryScope(const TelemetryScope &) = delete;
+	TelemetryScope &operator=(const TelemetryScope &) = delete;
+
+private:
+	FrameTelemetry &m_telemetry;
+	u32 m_section;
+	FrameTelemetry::Clock::time_point m_start;
+};
+
+// CSV with one row per section per window, or JSON when fileName ends in .json
+bool WriteTelemetry(const char *fileName, const std::vector<TelemetryWindow> &windows);
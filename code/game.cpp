@@ -1,393 +1,1264 @@
 #include "game.h"
 
+#include "assetLoader.h"
+#include "assetPack.h"
+#include "asteroidField.h"
+#include "culling.h"
+#include "debris.h"
+#include "fracture.h"
+#include "hullCooker.h"
+#include "inputRecording.h"
+
+#if !defined(PLATFORM_HEADLESS)
 #include "raylib.h"
 #include "raymath.h"
+#endif
 
 #include "physics.h"
+#include "projectiles.h"
 #include "shipPhysics.h"
+#include "simulationLod.h"
+#include "systemScheduler.h"
+#include "transformKernels.h"
+#include "worldSnapshot.h"
 
 #include "math.h"
 
-struct CameraArm
+#include "BulletCollision/CollisionDispatch/btGhostObject.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+
+#if !defined(PLATFORM_HEADLESS)
+int ToRaylibCameraProjection(Camera::Projection projection)
 {
-	btQuaternion currentRotation = QuatIdentity;
+	return (projection == Camera::Projection::PERSPECTIVE) ? Raylib::CAMERA_PERSPECTIVE : Raylib::CAMERA_ORTHOGRAPHIC;
+}
 
-	btVector3 baseDir = Vec3Forward;
-	btVector3 baseUp = Vec3Up;
+Raylib::Vector3 ToRaylibVec3(const btVector3 &source)
+{
+	Raylib::Vector3 result = {source.getX(), source.getY(), source.getZ()};
+	return result;
+}
+#endif
 
-	r32 currentDistance = 0.0f; // somewhere between min and max depending on camera collision
-	r32 minDistance = 0.0f;
-	r32 maxDistance = 0.0f; 
+struct AsteroidAsset
+{
+	const char *meshFile;
+	const char *albedoFile;
+	const char *normalMapFile;
+};
 
-	CameraArm(const btVector3 &cameraOffset)
-	{
-		baseDir = cameraOffset.normalized();
-		baseUp = -baseDir.cross(Vec3Left); // Using left as its boat to the
-		currentDistance = cameraOffset.length();
-		currentRotation = QuatIdentity;//QuaternionFromVector3ToVector3(Vec3Back, baseDir);
+constexpr r32 asteroidScale = 10.0f;
 
-		minDistance = 2.0f; // TODO: pass in minDistance?
-		maxDistance = currentDistance;
-	};
+static const AsteroidAsset asteroidAssets[] = {
+	{"asteroids/asteroid_small_1.obj", "asteroids/asteroid_small_1_color.png", "asteroids/asteroid_small_1_nm.png"},
+	{"asteroids/asteroid_small_2.obj", "asteroids/asteroid_small_2_color.png", "asteroids/asteroid_small_2_nm.png"},
+	{"asteroids/asteroid_small_3.obj", "asteroids/asteroid_small_3_color.png", "asteroids/asteroid_small_3_nm.png"},
+	{"asteroids/asteroid_small_4.obj", "asteroids/asteroid_small_4_color.png", "asteroids/asteroid_small_4_nm.png"},
+	{"asteroids/asteroid_small_5.obj", "asteroids/asteroid_small_5_color.png", "asteroids/asteroid_small_5_nm.png"},
+	{"asteroids/asteroid_small_6.obj", "asteroids/asteroid_small_6_color.png", "asteroids/asteroid_small_6_nm.png"},
 };
+constexpr u32 asteroidAssetCount = ArrayCount(asteroidAssets);
 
-struct Camera
+static const char *shipMeshFile = "ship/pirate-ship-blender-v2.obj";
+static const char *shipAlbedoFile = "ship/pirate-ship-blender-v2.png";
+
+// Asteroid models take the first RenderModel indices, in asteroidAssets order, then the ship, then each asteroid's
+// chunks in turn
+constexpr u32 shipModelIndex = asteroidAssetCount;
+constexpr u32 maxAsteroidChunks = 8;
+constexpr u32 firstChunkModelIndex = shipModelIndex + 1;
+constexpr u32 modelTotal = firstChunkModelIndex + asteroidAssetCount * maxAsteroidChunks;
+
+constexpr u64 asteroidFractureSeed = 0x5348415454455221; // Fixed so baked and load time chunks match
+
+static u32 GetChunkModelIndex(u32 asteroidModel, u32 chunkNum)
 {
-	enum class Projection
-	{
-		PERSPECTIVE,
-		ORTHOGRAPHIC
-	};
+	return firstChunkModelIndex + asteroidModel * maxAsteroidChunks + chunkNum;
+}
+
+// Chunk hulls go in the pack under the mesh's name with the chunk number after it
+static std::string GetChunkHullName(const char *meshFile, u32 chunkNum)
+{
+	return std::string(meshFile) + "#" + std::to_string(chunkNum);
+}
 
-	btVector3 position = Vec3Zero;
-	btVector3 target = Vec3Zero;
-	btVector3 up = Vec3Up;
-	r32 fovY = 0.0f;
-	Projection projection = Projection::PERSPECTIVE;
+static std::vector<CookedHull> FractureAsteroid(const CookedHull &hull, u32 asteroidModel)
+{
+	FractureConfig fractureConfig;
+	fractureConfig.chunkCount = maxAsteroidChunks;
+	return FractureHull(hull.points.data(), (u32)hull.points.size(), RandomStream::MixSeed(asteroidFractureSeed, asteroidModel), fractureConfig);
+}
 
-	Camera(const btVector3 &position, const btVector3 target, const btVector3 up, r32 fovY, Projection projection)
-		: position(position), target(target), up(up), fovY(fovY), projection(projection) {};
+struct LoadedMesh
+{
+	MeshData mesh;
+	CookedHull hull;
+	std::vector<CookedHull> chunks; // Asteroids only
+	bool loaded = false;
 };
 
-int ToRaylibCameraProjection(Camera::Projection projection)
+// A model table entry whose real assets are still on their way. Until they arrive it draws and collides as a placeholder
+struct PendingModel
 {
-	return (projection == Camera::Projection::PERSPECTIVE) ? Raylib::CAMERA_PERSPECTIVE : Raylib::CAMERA_ORTHOGRAPHIC;
+	u32 modelIndex = 0;
+	const char *meshFile = nullptr;
+	std::future<LoadedMesh> mesh;
+	bool meshApplied = false;
+	r32 collisionScale = 0.0f; // 0 for models without collision
+#if !defined(PLATFORM_HEADLESS)
+	std::future<Raylib::Image> albedo;
+	std::future<Raylib::Image> normalMap;
+#endif
+};
+
+struct SnapshotScratch
+{
+	EntityPoolState entityPool;
+	ProjectilePoolState projectiles;
+	DebrisPoolState debris;
+	AsteroidFieldState asteroidField;
+	std::vector<entt::entity> entities;
+	WorldSnapshot resimulated;
+};
+
+#if !defined(PLATFORM_HEADLESS)
+static Raylib::Matrix GetModelTransform(u32 modelIndex)
+{
+	// The ship model faces backwards
+	return (modelIndex == shipModelIndex) ? Raylib::MatrixRotateY(180.0f * DEG2RAD) : Raylib::MatrixIdentity();
 }
 
-Raylib::Vector3 ToRaylibVec3(const btVector3 &source)
+static Raylib::Model CreateModelFromMeshData(const MeshData &meshData)
 {
-	Raylib::Vector3 result = {source.getX(), source.getY(), source.getZ()};
-	return result;
+	OPTICK_EVENT();
+
+	// raylib frees these with MemFree when the model is unloaded
+	auto copyArray = [](const std::vector<r32> &source) -> r32 * {
+		if(source.empty())
+		{
+			return nullptr;
+		}
+		r32 *dest = (r32 *)Raylib::MemAlloc((u32)(source.size() * sizeof(r32)));
+		memcpy(dest, source.data(), source.size() * sizeof(r32));
+		return dest;
+	};
+
+	Raylib::Mesh mesh = {};
+	mesh.vertexCount = (int)meshData.vertexCount;
+	mesh.triangleCount = (int)meshData.vertexCount / 3;
+	mesh.vertices = copyArray(meshData.vertices);
+	mesh.texcoords = copyArray(meshData.texcoords);
+	mesh.normals = copyArray(meshData.normals);
+
+	Raylib::UploadMesh(&mesh, false);
+	return Raylib::LoadModelFromMesh(mesh);
 }
 
-inline btVector3 RandomPointInRange(btVector3 min, btVector3 max)
+// Default raylib shader doesn't read a per-instance matrix, so instanced draws swap this one into the material
+static const char *instancingVertexShader = R"(#version 330
+in vec3 vertexPosition;
+in vec2 vertexTexCoord;
+in mat4 instanceTransform;
+
+uniform mat4 mvp;
+
+out vec2 fragTexCoord;
+
+void main()
 {
-	r32 x = (r32)Raylib::GetRandomValue((s32)min.getX(), (s32)max.getX());
-	r32 y = (r32)Raylib::GetRandomValue((s32)min.getY(), (s32)max.getY());
-	r32 z = (r32)Raylib::GetRandomValue((s32)min.getZ(), (s32)max.getZ());
+	fragTexCoord = vertexTexCoord;
+	gl_Position = mvp * instanceTransform * vec4(vertexPosition, 1.0);
+}
+)";
 
-	btVector3 result(x, y, z);
-	return result;
+static const char *instancingFragmentShader = R"(#version 330
+in vec2 fragTexCoord;
+
+uniform sampler2D texture0;
+uniform vec4 colDiffuse;
+
+out vec4 finalColor;
+
+void main()
+{
+	finalColor = texture(texture0, fragTexCoord) * colDiffuse;
 }
+)";
 
-Raylib::Model LoadModelWithTextures(const char *meshFile, const char *albedoFile, const char *normalMapFile)
+static Raylib::Shader LoadInstancingShader()
+{
+	Raylib::Shader shader = Raylib::LoadShaderFromMemory(instancingVertexShader, instancingFragmentShader);
+	shader.locs[Raylib::SHADER_LOC_MATRIX_MVP] = Raylib::GetShaderLocation(shader, "mvp");
+	shader.locs[Raylib::SHADER_LOC_MATRIX_MODEL] = Raylib::GetShaderLocationAttrib(shader, "instanceTransform");
+	return shader;
+}
+#endif
+
+
+static void CreatePlayer(Game &game)
+{
+	entt::registry &registry = game.GetRegistry();
+
+	entt::entity entity = game.SpawnShip(Transform());
+
+	const r32 cameraFovY = 45.0f;
+	Camera camera(Vec3Zero, Vec3Forward, Vec3Up, cameraFovY, Camera::Projection::PERSPECTIVE);
+
+	registry.emplace<Camera>(entity, camera);
+	game.SetCameraEntity(entity);
+
+	btVector3 cameraArmOffsetVec(2.5f, 3.0f, 10.0f);
+	CameraArm cameraArm(cameraArmOffsetVec);
+	registry.emplace<CameraArm>(entity, cameraArm);
+}
+
+#if !defined(PLATFORM_HEADLESS)
+struct CylinderMesh
+{
+	r32 radius;
+	r32 height;
+	u32 slices;
+	Raylib::Color color;
+};
+
+static CylinderMesh GetLaserbeamMesh()
+{
+	CylinderMesh cylinderMesh = {};
+	cylinderMesh.radius = 0.05f;
+	cylinderMesh.height = 1.0f;
+	cylinderMesh.slices = 16;
+	cylinderMesh.color = Raylib::ORANGE;
+	return cylinderMesh;
+}
+#endif
+
+Game::Game(const GameConfig &config)
+	: m_windowWidth(config.windowWidth), m_windowHeight(config.windowHeight)
 {
 	OPTICK_EVENT();
 
-	Raylib::Model model = Raylib::LoadModel(meshFile);
-	if(albedoFile)
+	SeedRandom(config.randomSeed);
+
+	AsteroidFieldConfig asteroidFieldConfig = config.asteroidField;
+	asteroidFieldConfig.seed = RandomStream::MixSeed(config.randomSeed, 0);
+	asteroidFieldConfig.modelCount = asteroidAssetCount;
+
+	PhysicsConfig physicsConfig = config.physics;
+	if(!physicsConfig.expectedBodyCount)
 	{
-		Raylib::Texture albedo = Raylib::LoadTexture(albedoFile);
-		SetMaterialTexture(&model.materials[0], Raylib::MATERIAL_MAP_ALBEDO, albedo);
+		physicsConfig.expectedBodyCount = GetMaxAsteroidCount(asteroidFieldConfig) + config.maxProjectiles + config.debris.capacity + 1;
 	}
-	if(normalMapFile)
+	m_physics = new PhysicsWorld(physicsConfig);
+	m_simulationLod = new SimulationLod(m_registry, *m_physics, config.simulationLod);
+
+	// Listed in frame order, systems go in between
+	m_telemetrySections.frame = m_telemetry.AddSection("Frame");
+#if !defined(PLATFORM_HEADLESS)
+	m_telemetrySections.input = m_telemetry.AddSection("Input");
+#endif
+	m_telemetrySections.assets = m_telemetry.AddSection("Assets");
+
+	m_scheduler = new SystemScheduler(m_registry, config.systemWorkerCount);
+	RegisterSystems();
+	m_scheduler->SetTelemetry(&m_telemetry);
+
+#if !defined(PLATFORM_HEADLESS)
+	m_telemetrySections.draw = m_telemetry.AddSection("Draw");
+#endif
+
+	m_events.Connect<&Game::SpawnLaserbeams, SpawnLaserbeamEvent>(this);
+	m_snapshotScratch = new SnapshotScratch();
+
+	u32 assetThreadCount = config.assetLoaderThreadCount ? config.assetLoaderThreadCount : MAX(std::thread::hardware_concurrency(), 2u) - 1;
+	m_assetLoader = new AssetLoader(assetThreadCount);
+
+	// Bodies start out with this until their model's hull is cooked
+	m_placeholderCollision = CreateSphereCollision(asteroidScale);
+	m_modelCollisions.assign(modelTotal, m_placeholderCollision);
+
+	// Before the models, loading one from the pack hands its chunks straight over
+	m_debris = new DebrisPool(m_registry, *m_physics, config.debris, asteroidAssetCount);
+
+#if !defined(PLATFORM_HEADLESS)
+	for(u32 modelNum = 0; modelNum < modelTotal; ++modelNum)
 	{
-		Raylib::Texture normalMap = Raylib::LoadTexture(normalMapFile);
-		SetMaterialTexture(&model.materials[0], Raylib::MATERIAL_MAP_NORMAL, normalMap);
+		// Chunks only spawn once their models are built, this just keeps every index valid
+		Raylib::Mesh placeholderMesh = (modelNum == shipModelIndex) ? Raylib::GenMeshCube(1.0f, 1.0f, 2.0f)
+			: (modelNum >= firstChunkModelIndex) ? Raylib::GenMeshSphere(0.2f, 4, 4) : Raylib::GenMeshSphere(1.0f, 8, 8);
+		m_models.push_back(Raylib::LoadModelFromMesh(placeholderMesh));
+		m_modelScales.push_back((modelNum == shipModelIndex) ? 1.0f : asteroidScale);
 	}
-	return model;
-};
 
-std::vector<Raylib::Model> LoadAsteroidModels()
+	m_instancingShader = LoadInstancingShader();
+#endif
+
+	// Models missing from the pack, or everything when there is no pack, load from the source files instead
+	AssetPack assetPack;
+	if(config.assetPackFile)
+	{
+		assetPack.Open(config.assetPackFile);
+	}
+
+	for(u32 assetNum = 0; assetNum < asteroidAssetCount; ++assetNum)
+	{
+		const AsteroidAsset &asset = asteroidAssets[assetNum];
+		if(!LoadModelFromPack(assetPack, assetNum, asset.meshFile, asset.albedoFile, asset.normalMapFile, asteroidScale))
+		{
+			QueueModelLoad(assetNum, asset.meshFile, asset.albedoFile, asset.normalMapFile, asteroidScale);
+		}
+	}
+#if !defined(PLATFORM_HEADLESS)
+	if(!LoadModelFromPack(assetPack, shipModelIndex, shipMeshFile, shipAlbedoFile, nullptr, 0.0f))
+	{
+		QueueModelLoad(shipModelIndex, shipMeshFile, shipAlbedoFile, nullptr, 0.0f);
+	}
+#endif
+	assetPack.Close();
+
+	if(config.waitForAssets)
+	{
+		ProcessLoadedAssets(true);
+	}
+
+	m_projectiles = new ProjectilePool(m_registry, *m_physics, CreateCapsuleZAxisCollision(0.2f, 0.5f), 1.0f, config.maxProjectiles);
+#if !defined(PLATFORM_HEADLESS)
+	m_registry.storage<CylinderMesh>().reserve(config.maxProjectiles);
+#endif
+
+	if(config.spawnPlayer)
+	{
+		CreatePlayer(*this);
+	}
+
+	m_asteroidField = new AsteroidField(asteroidFieldConfig, *m_assetLoader,
+		[this](const AsteroidSpawn &spawn, entt::entity hint) { return SpawnAsteroid(spawn, hint); },
+		[this](entt::entity entity) { DestroyAsteroid(entity); });
+	m_asteroidField->LoadAround(Vec3Zero);
+}
+
+Game::~Game()
 {
-	OPTICK_EVENT();
+	// Before the asset loader, which would break the promises of sectors still generating
+	delete m_asteroidField;
+	delete m_projectiles;
+	delete m_debris;
+	delete m_simulationLod;
+	delete m_scheduler;
+	delete m_snapshotScratch;
+
+	// Stops the loader threads, so every future left is either ready or never will be
+	delete m_assetLoader;
+#if !defined(PLATFORM_HEADLESS)
+	for(PendingModel &pending : m_pendingModels)
+	{
+		for(std::future<Raylib::Image> *image : {&pending.albedo, &pending.normalMap})
+		{
+			if(IsFutureReady(*image))
+			{
+				Raylib::UnloadImage(image->get());
+			}
+		}
+	}
+#endif
+	m_pendingModels.clear();
+}
+
+entt::entity Game::SpawnAsteroid(const AsteroidSpawn &spawn, entt::entity hint)
+{
+	entt::entity entity = m_registry.create(hint);
+
+	Transform &transform = m_registry.emplace<Transform>(entity);
+	transform.translation = spawn.position;
+	transform.rotation = spawn.rotation;
+
+	r32 mass = 10.0f;
+	btConvexShape *collisionShape = m_modelCollisions.at(spawn.modelIndex);
+
+	RigidBody rigidBody = m_physics->CreateRigidBody(transform.translation, transform.rotation, mass, collisionShape, entity);
+	m_registry.emplace<RigidBody>(entity, rigidBody);
+	m_simulationLod->Add(entity, mass, collisionShape);
 
-	std::vector<Raylib::Model> asteroidModels;
-	asteroidModels.push_back(LoadModelWithTextures("asteroids/asteroid_small_1.obj", "asteroids/asteroid_small_1_color.png", "asteroids/asteroid_small_1_nm.png"));
-	asteroidModels.push_back(LoadModelWithTextures("asteroids/asteroid_small_2.obj", "asteroids/asteroid_small_2_color.png", "asteroids/asteroid_small_2_nm.png"));
-	asteroidModels.push_back(LoadModelWithTextures("asteroids/asteroid_small_3.obj", "asteroids/asteroid_small_3_color.png", "asteroids/asteroid_small_3_nm.png"));
-	asteroidModels.push_back(LoadModelWithTextures("asteroids/asteroid_small_4.obj", "asteroids/asteroid_small_4_color.png", "asteroids/asteroid_small_4_nm.png"));
-	asteroidModels.push_back(LoadModelWithTextures("asteroids/asteroid_small_5.obj", "asteroids/asteroid_small_5_color.png", "asteroids/asteroid_small_5_nm.png"));
-	asteroidModels.push_back(LoadModelWithTextures("asteroids/asteroid_small_6.obj", "asteroids/asteroid_small_6_color.png", "asteroids/asteroid_small_6_nm.png"));
-	return asteroidModels;
+	m_registry.emplace<RenderModel>(entity, spawn.modelIndex);
+	return entity;
 }
 
-std::vector<btConvexShape *> CreateAsteroidCollisions(const std::vector<Raylib::Model> &asteroidModels, r32 scale)
+void Game::DestroyAsteroid(entt::entity entity)
 {
-	std::vector<btConvexShape *> asteroidCollisions;
+	m_physics->DestroyRigidBody(m_registry.get<RigidBody>(entity).body);
+	m_registry.destroy(entity);
+}
 
-	for(const Raylib::Model &model : asteroidModels)
+void Game::ShatterAsteroids(const ContactEvents &contacts)
+{
+	OPTICK_EVENT();
+
+	u32 shatteredCount = 0;
+	for(const ContactEvent &contact : contacts.begins)
 	{
-		btConvexShape * collisionShapes = CreateConvexCollision(model, scale);
-		asteroidCollisions.push_back(collisionShapes);
+		// Either entity may have been shattered by an earlier contact
+		entt::entity projectile = contact.entity0;
+		entt::entity asteroid = contact.entity1;
+		if(!m_registry.valid(projectile) || !m_registry.valid(asteroid))
+		{
+			continue;
+		}
+		if(!m_registry.all_of<Projectile>(projectile))
+		{
+			std::swap(projectile, asteroid);
+		}
+		if(!m_registry.all_of<Projectile>(projectile) || !m_registry.all_of<SimulationLodBody>(asteroid))
+		{
+			continue;
+		}
+
+		u32 modelIndex = m_registry.get<const RenderModel>(asteroid).modelIndex;
+		if(modelIndex >= asteroidAssetCount || !m_debris->CanShatter(modelIndex))
+		{
+			continue;
+		}
+
+		// A kinematic asteroid's motion is kept by the LOD and its Transform is where it really is
+		const SimulationLodBody &lodBody = m_registry.get<const SimulationLodBody>(asteroid);
+		const btRigidBody *body = m_registry.get<const RigidBody>(asteroid).body;
+		Transform transform = m_registry.get<const Transform>(asteroid);
+		btVector3 linearVelocity = lodBody.linearVelocity;
+		btVector3 angularVelocity = lodBody.angularVelocity;
+		if(lodBody.tier == SimulationTier::DYNAMIC)
+		{
+			transform.translation = body->getWorldTransform().getOrigin();
+			transform.rotation = body->getWorldTransform().getRotation();
+			linearVelocity = body->getLinearVelocity();
+			angularVelocity = body->getAngularVelocity();
+		}
+		r32 mass = lodBody.mass;
+
+		m_asteroidField->Remove(asteroid);
+		DestroyAsteroid(asteroid);
+		m_debris->Shatter(modelIndex, transform, mass, linearVelocity, angularVelocity, contact.point);
+		++shatteredCount;
 	}
-	Assert(asteroidCollisions.size() == asteroidModels.size());
 
-	return asteroidCollisions;
+	OPTICK_TAG("AsteroidsShattered", shatteredCount);
 }
 
+void Game::ApplyChunks(u32 modelIndex, std::span<const CookedHull> chunks, r32 collisionScale)
+{
+	OPTICK_EVENT();
 
-static void CreatePlayer(Game &game)
+	u32 chunkCount = MIN((u32)chunks.size(), maxAsteroidChunks);
+	std::vector<DebrisChunk> debrisChunks(chunkCount);
+	std::vector<btVector3> centered;
+	r32 totalVolume = 0.0f;
+	for(u32 chunkNum = 0; chunkNum < chunkCount; ++chunkNum)
+	{
+		const std::vector<btVector3> &points = chunks[chunkNum].points;
+		DebrisChunk &debrisChunk = debrisChunks[chunkNum];
+
+		// Bullet puts a body's centre of mass at its shape's origin
+		btVector3 centroid;
+		debrisChunk.massFraction = ComputeHullVolume(points.data(), (u32)points.size(), centroid);
+		totalVolume += debrisChunk.massFraction;
+		centered.clear();
+		for(const btVector3 &point : points)
+		{
+			centered.push_back(point - centroid);
+		}
+
+		debrisChunk.shape = CreateConvexCollision(centered.data(), (u32)centered.size(), collisionScale);
+		debrisChunk.offset = centroid * collisionScale;
+		debrisChunk.modelIndex = GetChunkModelIndex(modelIndex, chunkNum);
+
+#if !defined(PLATFORM_HEADLESS)
+		constexpr r32 chunkTexelsPerUnit = 0.5f;
+		MeshData mesh;
+		BuildHullMesh(centered.data(), (u32)centered.size(), chunkTexelsPerUnit, mesh);
+		Raylib::UnloadModel(m_models[debrisChunk.modelIndex]);
+		m_models[debrisChunk.modelIndex] = CreateModelFromMeshData(mesh);
+#endif
+	}
+
+	for(DebrisChunk &debrisChunk : debrisChunks)
+	{
+		debrisChunk.massFraction /= MAX(totalVolume, 1e-6f);
+	}
+	m_debris->SetChunks(modelIndex, std::move(debrisChunks));
+
+#if !defined(PLATFORM_HEADLESS)
+	ShareChunkTextures(modelIndex);
+#endif
+}
+
+#if !defined(PLATFORM_HEADLESS)
+// Chunk faces are box mapped onto the asteroid's albedo, the normal map wouldn't line up
+void Game::ShareChunkTextures(u32 modelIndex)
 {
-	entt::registry &registry = game.GetRegistry();
+	Raylib::Texture texture = m_models[modelIndex].materials[0].maps[Raylib::MATERIAL_MAP_ALBEDO].texture;
+	for(u32 chunkNum = 0; chunkNum < maxAsteroidChunks; ++chunkNum)
+	{
+		m_models[GetChunkModelIndex(modelIndex, chunkNum)].materials[0].maps[Raylib::MATERIAL_MAP_ALBEDO].texture = texture;
+	}
+}
+#endif
 
-	entt::entity entity = registry.create();
+entt::entity Game::SpawnShip(const Transform &transform)
+{
+	entt::entity entity = m_registry.create();
 
-	Transform transform;
-	registry.emplace<Transform>(entity, transform);
+	m_registry.emplace<Transform>(entity, transform);
 
-	Raylib::Model shipModel = LoadModelWithTextures("ship/pirate-ship-blender-v2.obj", "ship/pirate-ship-blender-v2.png", nullptr);
-	shipModel.transform = Raylib::MatrixRotateY(180.0f * DEG2RAD);
-	registry.emplace<Raylib::Model>(entity, shipModel);
+	m_registry.emplace<RenderModel>(entity, shipModelIndex);
 
-	registry.emplace<ShipInput>(entity); // Reads from global input and maps to ship movement inputs
+	m_registry.emplace<ShipInput>(entity); // Polled from raylib for the player, set through SetShipInput otherwise
 
 	ShipConfig shipConfig; // Using default initialised values
-	registry.emplace<ShipConfig>(entity, shipConfig);
-
-	PhysicsWorld * const physics = game.GetPhysics();
+	m_registry.emplace<ShipConfig>(entity, shipConfig);
 
 	r32 collisionRadius = 1.0f;
 	r32 collisionLength = 2.5f;
 	//btConvexShape *shipCollision = CreateCapsuleZAxisCollision(collisionRadius, collisionLength);
 	btConvexShape *shipCollision = CreateCylinderZAxisCollision(collisionRadius, collisionLength);
 
-	int filterGroup = 0;
-	int filterMask = 0;
+	// Shots spawn inside the ship, so it never sweeps against them
+	int filterGroup = COLLISION_GROUP_SHIP;
+	int filterMask = COLLISION_GROUP_ALL & ~COLLISION_GROUP_PROJECTILE;
 
-	btPairCachingGhostObject *ghostObject = physics->CreateGhostObject(shipCollision, filterGroup, filterMask);
-	ShipPhysics &shipPhyics = registry.emplace<ShipPhysics>(entity, shipCollision, ghostObject, shipConfig);
-	physics->AddAction((btActionInterface *)&shipPhyics);
+	btTransform startTransform(transform.rotation, transform.translation);
+	btPairCachingGhostObject *ghostObject = m_physics->CreateGhostObject(shipCollision, filterGroup, filterMask, entity, startTransform);
+	ShipPhysics &shipPhyics = m_registry.emplace<ShipPhysics>(entity, shipCollision, ghostObject, shipConfig, transform);
+	m_physics->AddAction((btActionInterface *)&shipPhyics);
 
-	const r32 cameraFovY = 45.0f;
-	Camera camera(Vec3Zero, Vec3Forward, Vec3Up, cameraFovY, Camera::Projection::PERSPECTIVE);
-
-	registry.emplace<Camera>(entity, camera);
-	game.SetCameraEntity(entity);
-
-	btVector3 cameraArmOffsetVec(2.5f, 3.0f, 10.0f);
-	CameraArm cameraArm(cameraArmOffsetVec);
-	registry.emplace<CameraArm>(entity, cameraArm);
+	return entity;
 }
 
-Game::Game(u32 windowWidth, u32 windowHeight)
-	: m_windowWidth(windowWidth), m_windowHeight(windowHeight)
+bool Game::LoadModelFromPack(const AssetPack &pack, u32 modelIndex, const char *meshFile, const char *albedoFile, const char *normalMapFile, r32 collisionScale)
 {
 	OPTICK_EVENT();
 
-	SeedRandom((u32)Raylib::GetTime());
+	if(!pack.IsOpen())
+	{
+		return false;
+	}
 
-	m_physics = new PhysicsWorld();
+	// All or nothing, a model with anything missing, corrupt or edited since the bake loads entirely from its source files
+	u64 meshHash;
+	if(!HashAssetSource(meshFile, meshHash))
+	{
+		return false;
+	}
 
-	std::vector<Raylib::Color> colors = {
-		Raylib::LIGHTGRAY, Raylib::GRAY, Raylib::DARKGRAY, Raylib::YELLOW, Raylib::GOLD, 
-		Raylib::ORANGE, Raylib::PINK, Raylib::RED, Raylib::MAROON, Raylib::GREEN, 
-		Raylib::LIME, Raylib::DARKGREEN, Raylib::SKYBLUE, Raylib::BLUE, Raylib::DARKBLUE, 
-		Raylib::PURPLE, Raylib::VIOLET, Raylib::DARKPURPLE, Raylib::BEIGE, Raylib::BROWN,
-		Raylib::DARKBROWN, Raylib::BLACK
-	};
+	bool hasCollision = collisionScale > 0.0f;
+	CookedHull hull;
+	if(hasCollision && !pack.LoadHull(meshFile, meshHash, hull))
+	{
+		return false;
+	}
 
-	constexpr u32 totalEventDataMemory = Kilobytes(4);
-	m_eventDataMemory = Raylib::MemAlloc(totalEventDataMemory);
-	m_eventDataMemorySize = totalEventDataMemory;
+	// Packs baked before asteroids fractured have no chunks. A fracture with a chunk missing would leave a gap
+	std::vector<CookedHull> chunks;
+	if(hasCollision && modelIndex < asteroidAssetCount)
+	{
+		for(u32 chunkNum = 0; chunkNum < maxAsteroidChunks; ++chunkNum)
+		{
+			std::string chunkName = GetChunkHullName(meshFile, chunkNum);
+			if(!pack.HasEntry(chunkName.c_str(), AssetPackEntryType::HULL))
+			{
+				break;
+			}
+			if(!pack.LoadHull(chunkName.c_str(), meshHash, chunks.emplace_back()))
+			{
+				return false;
+			}
+		}
+		if(chunks.empty())
+		{
+			return false;
+		}
+	}
 
-	CreatePlayer(*this);
+#if !defined(PLATFORM_HEADLESS)
+	u64 albedoHash = 0;
+	u64 normalMapHash = 0;
+	if((albedoFile && !HashAssetSource(albedoFile, albedoHash)) || (normalMapFile && !HashAssetSource(normalMapFile, normalMapHash)))
+	{
+		return false;
+	}
 
-	std::vector<Raylib::Model> asteroidModels = LoadAsteroidModels();
+	const PackedMesh *mesh = pack.FindMesh(meshFile, meshHash);
+	const PackedTexture *albedo = albedoFile ? pack.FindTexture(albedoFile, albedoHash) : nullptr;
+	const PackedTexture *normalMap = normalMapFile ? pack.FindTexture(normalMapFile, normalMapHash) : nullptr;
+	if(!mesh || (albedoFile && !albedo) || (normalMapFile && !normalMap))
+	{
+		return false;
+	}
 
-	r32 asteroidScale = 10.0f;
-	std::vector<btConvexShape *> asteroidCollisions = CreateAsteroidCollisions(asteroidModels, asteroidScale);
+	// The pack only checks the pixels lie inside it, whether there are enough of them for the format is raylib's call
+	constexpr u32 maxTextureSize = 16384;
+	for(const PackedTexture *texture : {albedo, normalMap})
+	{
+		if(!texture)
+		{
+			continue;
+		}
 
+		bool sizeValid = texture->mipmaps == 1 && texture->width && texture->height && texture->width <= maxTextureSize && texture->height <= maxTextureSize;
+		s32 pixelBytes = sizeValid ? Raylib::GetPixelDataSize((int)texture->width, (int)texture->height, (int)texture->format) : 0;
+		if(pixelBytes <= 0 || (u64)pixelBytes > texture->dataSize)
+		{
+			printf("%s in the asset pack is corrupt, loading it from source\n", (texture == albedo) ? albedoFile : normalMapFile);
+			return false;
+		}
+	}
 
-	btVector3 asteroidMinBounds(-200, -200, -200);
-	btVector3 asteroidMaxBounds(200, 200, 200);
+	// Uploaded straight out of the mapping. The CPU pointers are cleared before raylib takes ownership of the mesh,
+	// so unloading never frees pack memory
+	Raylib::Mesh uploadMesh = {};
+	uploadMesh.vertexCount = (int)mesh->vertexCount;
+	uploadMesh.triangleCount = (int)(mesh->indexCount ? mesh->indexCount : mesh->vertexCount) / 3;
+	uploadMesh.vertices = (r32 *)AssetPack::GetArray<r32>(mesh, mesh->verticesOffset);
+	uploadMesh.texcoords = (r32 *)AssetPack::GetArray<r32>(mesh, mesh->texcoordsOffset);
+	uploadMesh.normals = (r32 *)AssetPack::GetArray<r32>(mesh, mesh->normalsOffset);
+	uploadMesh.indices = (u16 *)AssetPack::GetArray<u16>(mesh, mesh->indicesOffset);
+	Raylib::UploadMesh(&uploadMesh, false);
+	uploadMesh.vertices = nullptr;
+	uploadMesh.texcoords = nullptr;
+	uploadMesh.normals = nullptr;
+	uploadMesh.indices = nullptr;
+
+	Raylib::UnloadModel(m_models[modelIndex]);
+	Raylib::Model &model = m_models[modelIndex];
+	model = Raylib::LoadModelFromMesh(uploadMesh);
+	model.transform = GetModelTransform(modelIndex);
+
+	const int materialMaps[] = {Raylib::MATERIAL_MAP_ALBEDO, Raylib::MATERIAL_MAP_NORMAL};
+	const PackedTexture *textures[] = {albedo, normalMap};
+	for(u32 textureNum = 0; textureNum < ArrayCount(textures); ++textureNum)
+	{
+		const PackedTexture *texture = textures[textureNum];
+		if(texture)
+		{
+			Raylib::Image image = {};
+			image.data = (void *)AssetPack::GetArray<u8>(texture, texture->dataOffset);
+			image.width = (int)texture->width;
+			image.height = (int)texture->height;
+			image.mipmaps = (int)texture->mipmaps;
+			image.format = (int)texture->format;
+			SetMaterialTexture(&model.materials[0], materialMaps[textureNum], Raylib::LoadTextureFromImage(image));
+		}
+	}
+#else
+	UNUSED(albedoFile);
+	UNUSED(normalMapFile);
+#endif
 
-	constexpr u32 asteroidsToCreate = 200;
-	for(u32 entityNum = 0; entityNum < asteroidsToCreate; ++entityNum)
+	if(hasCollision)
 	{
-		entt::entity entity = m_registry.create();
+		m_modelCollisions[modelIndex] = CreateConvexCollision(hull.points.data(), (u32)hull.points.size(), collisionScale);
+	}
 
-		Transform &transform = m_registry.emplace<Transform>(entity);
+	if(!chunks.empty())
+	{
+		ApplyChunks(modelIndex, chunks, collisionScale);
+	}
 
-		transform.translation = RandomPointInRange(asteroidMinBounds, asteroidMaxBounds);
+	return true;
+}
 
-		btVector3 randomAxis(RandomFloat(0.0, 100.0), RandomFloat(0.0, 100.0), RandomFloat(0.0, 100.0));
-		randomAxis.normalize();
+// Asteroids also get their chunks, fractured with the seed the game would use at load time
+static bool BakeModel(AssetPackWriter &writer, u32 modelIndex, const char *meshFile, const char *albedoFile, const char *normalMapFile, bool buildCollision)
+{
+	MeshData mesh;
+	u64 meshHash;
+	if(!LoadObjMesh(meshFile, mesh) || !HashAssetSource(meshFile, meshHash))
+	{
+		printf("Failed to load %s\n", meshFile);
+		return false;
+	}
+	writer.AddMesh(meshFile, meshHash, mesh);
 
-		r32 randomAngle = RandomFloat(0.0, 180.0);
-		transform.rotation = btQuaternion(randomAxis, randomAngle);
+	if(buildCollision)
+	{
+		HullSource source;
+		source.points = mesh.positions;
+		CookedHull hull = CookHullCached(source);
+		writer.AddHull(meshFile, meshHash, hull);
+		printf("Hull for %s: %u points down to %u\n", meshFile, (u32)source.points.size(), (u32)hull.points.size());
 
-		transform.scale = btVector3(asteroidScale, asteroidScale, asteroidScale);
+		if(modelIndex < asteroidAssetCount)
+		{
+			std::vector<CookedHull> chunks = FractureAsteroid(hull, modelIndex);
+			for(u32 chunkNum = 0; chunkNum < chunks.size(); ++chunkNum)
+			{
+				writer.AddHull(GetChunkHullName(meshFile, chunkNum).c_str(), meshHash, chunks[chunkNum]);
+			}
+		}
+	}
 
+#if !defined(PLATFORM_HEADLESS)
+	for(const char *textureFile : {albedoFile, normalMapFile})
+	{
+		if(!textureFile)
+		{
+			continue;
+		}
 
-		r32 mass = 10.0f;
+		u64 textureHash;
+		Raylib::Image image = HashAssetSource(textureFile, textureHash) ? Raylib::LoadImage(textureFile) : Raylib::Image{};
+		if(!image.data)
+		{
+			printf("Failed to load %s\n", textureFile);
+			return false;
+		}
 
-		u32 randAsteroidNum = Raylib::GetRandomValue(0, (u32)asteroidModels.size() - 1);
-		btConvexShape *collisionShape = asteroidCollisions.at(randAsteroidNum);
+		Raylib::ImageFormat(&image, Raylib::PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+		writer.AddTexture(textureFile, textureHash, (u32)image.width, (u32)image.height, (u32)image.format, image.data, (u64)image.width * image.height * 4);
+		Raylib::UnloadImage(image);
+	}
+#else
+	UNUSED(albedoFile);
+	UNUSED(normalMapFile);
+#endif
 
-		RigidBody rigidBody = m_physics->CreateRigidBody(transform.translation, transform.rotation, mass, collisionShape);
-		m_registry.emplace<RigidBody>(entity, rigidBody);
+	return true;
+}
 
-		m_registry.emplace<Raylib::Model>(entity, asteroidModels.at(randAsteroidNum));
+bool BakeAssetPack(const char *packFile)
+{
+	OPTICK_EVENT();
 
-		m_entities.push_back(entity);
+	AssetPackWriter writer;
+	bool baked = true;
+	for(u32 assetNum = 0; assetNum < asteroidAssetCount; ++assetNum)
+	{
+		const AsteroidAsset &asset = asteroidAssets[assetNum];
+		baked = BakeModel(writer, assetNum, asset.meshFile, asset.albedoFile, asset.normalMapFile, true) && baked;
 	}
+	baked = BakeModel(writer, shipModelIndex, shipMeshFile, shipAlbedoFile, nullptr, false) && baked;
 
+	// A partial pack is still useful, whatever is missing loads from the source files
+	if(!writer.Write(packFile))
+	{
+		printf("Failed to write %s\n", packFile);
+		return false;
+	}
+	return baked;
 }
 
-Game::~Game()
+void Game::QueueModelLoad(u32 modelIndex, const char *meshFile, const char *albedoFile, const char *normalMapFile, r32 collisionScale)
 {
-	for(const auto entity : m_entities)
+	PendingModel pending;
+	pending.modelIndex = modelIndex;
+	pending.meshFile = meshFile;
+	pending.collisionScale = collisionScale;
+
+	bool buildCollision = collisionScale > 0.0f;
+	pending.mesh = m_assetLoader->Submit([modelIndex, meshFile, buildCollision]() {
+		LoadedMesh loaded;
+		loaded.loaded = LoadObjMesh(meshFile, loaded.mesh);
+		if(loaded.loaded && buildCollision)
+		{
+			HullSource source;
+			source.points = loaded.mesh.positions;
+			loaded.hull = CookHullCached(source);
+			if(modelIndex < asteroidAssetCount && !loaded.hull.points.empty())
+			{
+				loaded.chunks = FractureAsteroid(loaded.hull, modelIndex);
+			}
+		}
+		return loaded;
+	});
+
+#if !defined(PLATFORM_HEADLESS)
+	if(albedoFile)
 	{
-		m_registry.destroy(entity);
-	};
-	m_entities.clear();
+		pending.albedo = m_assetLoader->Submit([albedoFile]() { return Raylib::LoadImage(albedoFile); });
+	}
+	if(normalMapFile)
+	{
+		pending.normalMap = m_assetLoader->Submit([normalMapFile]() { return Raylib::LoadImage(normalMapFile); });
+	}
+#else
+	UNUSED(albedoFile);
+	UNUSED(normalMapFile);
+#endif
+
+	m_pendingModels.push_back(std::move(pending));
 }
 
-struct CylinderMesh
+void Game::ProcessLoadedAssets(bool waitForAll)
 {
-	r32 radius;
-	r32 height;
-	u32 slices;
-	Raylib::Color color;
-};
+	OPTICK_EVENT();
 
-struct SpawnLaserbeamEventData
-{
-	Transform spawnTransform;
-	btVector3 startVelocity;
-};
+	for(u32 pendingNum = 0; pendingNum < m_pendingModels.size();)
+	{
+		PendingModel &pending = m_pendingModels[pendingNum];
 
-void Game::SpawnLaserbeam(void *data)
-{
-	SpawnLaserbeamEventData *eventData = (SpawnLaserbeamEventData *)data;
+		if(!pending.meshApplied && (waitForAll || IsFutureReady(pending.mesh)))
+		{
+			LoadedMesh loaded = pending.mesh.get();
+			pending.meshApplied = true;
 
-	Raylib::TraceLog(Raylib::LOG_INFO, "FIRE!");
+			if(!loaded.loaded)
+			{
+				printf("Failed to load %s, keeping its placeholder\n", pending.meshFile);
+			}
 
-	entt::entity entity = m_registry.create();
+			if(!loaded.hull.points.empty())
+			{
+				btConvexShape *collision = CreateConvexCollision(loaded.hull.points.data(), (u32)loaded.hull.points.size(), pending.collisionScale);
+				m_modelCollisions[pending.modelIndex] = collision;
+
+				auto view = m_registry.view<const RenderModel, const RigidBody>();
+				view.each([this, &pending, collision](entt::entity entity, const RenderModel &renderModel, const RigidBody &rigidBody) {
+					if(renderModel.modelIndex != pending.modelIndex)
+					{
+						return;
+					}
+
+					// Bodies on rails collide with a sphere around the shape instead
+					if(m_registry.all_of<SimulationLodBody>(entity))
+					{
+						m_simulationLod->SetFullShape(entity, collision);
+					}
+					else
+					{
+						m_physics->SetCollisionShape(rigidBody.body, collision);
+					}
+				});
+			}
 
-	Transform &transform = m_registry.emplace<Transform>(entity, eventData->spawnTransform);
+			if(!loaded.chunks.empty())
+			{
+				ApplyChunks(pending.modelIndex, loaded.chunks, pending.collisionScale);
+			}
 
-	btConvexShape *collisionShape = CreateCapsuleZAxisCollision(0.2f, 0.5f);
+#if !defined(PLATFORM_HEADLESS)
+			if(loaded.loaded)
+			{
+				Raylib::UnloadModel(m_models[pending.modelIndex]);
+				m_models[pending.modelIndex] = CreateModelFromMeshData(loaded.mesh);
+				m_models[pending.modelIndex].transform = GetModelTransform(pending.modelIndex);
+			}
+#endif
+		}
 
-	r32 mass = 1.0f;
+		bool done = pending.meshApplied;
 
-	RigidBody rigidBody = m_physics->CreateRigidBody(transform.translation, transform.rotation, mass, collisionShape);
+#if !defined(PLATFORM_HEADLESS)
+		// Textures go on the real model, so they wait for the mesh even if they decoded first
+		const int materialMaps[] = {Raylib::MATERIAL_MAP_ALBEDO, Raylib::MATERIAL_MAP_NORMAL};
+		std::future<Raylib::Image> *images[] = {&pending.albedo, &pending.normalMap};
+		for(u32 imageNum = 0; imageNum < ArrayCount(images); ++imageNum)
+		{
+			std::future<Raylib::Image> &image = *images[imageNum];
+			if(!image.valid())
+			{
+				continue;
+			}
 
-	r32 shipVelocity = eventData->startVelocity.length();
+			if(!pending.meshApplied || !(waitForAll || IsFutureReady(image)))
+			{
+				done = false;
+				continue;
+			}
 
-	btScalar speed = 10.0f;
-	btVector3 beamVelocity = Vec3Forward * speed * shipVelocity;
-	beamVelocity = quatRotate(transform.rotation, beamVelocity);
+			Raylib::Image decoded = image.get();
+			if(decoded.data)
+			{
+				Raylib::Texture texture = Raylib::LoadTextureFromImage(decoded);
+				Raylib::UnloadImage(decoded);
+				SetMaterialTexture(&m_models[pending.modelIndex].materials[0], materialMaps[imageNum], texture);
+				if(pending.modelIndex < asteroidAssetCount)
+				{
+					ShareChunkTextures(pending.modelIndex);
+				}
+			}
+		}
+#endif
 
-	rigidBody.body->setLinearVelocity(beamVelocity);
+		if(done)
+		{
+			m_pendingModels.erase(m_pendingModels.begin() + pendingNum);
+		}
+		else
+		{
+			++pendingNum;
+		}
+	}
+}
 
-	m_registry.emplace<RigidBody>(entity, rigidBody);
-	
-	CylinderMesh cylinderMesh = {};
-	cylinderMesh.radius = 0.05f;
-	cylinderMesh.height = 1.0f;
-	cylinderMesh.slices = 16;
-	cylinderMesh.color = Raylib::ORANGE;
+void Game::SpawnLaserbeams(std::span<const SpawnLaserbeamEvent> events)
+{
+	for(const SpawnLaserbeamEvent &event : events)
+	{
+		r32 shipVelocity = event.startVelocity.length();
+
+		btScalar speed = 10.0f;
+		btVector3 beamVelocity = Vec3Forward * speed * shipVelocity;
+		beamVelocity = quatRotate(event.spawnTransform.rotation, beamVelocity);
+
+		constexpr r32 laserLifetime = 3.0f;
+		entt::entity entity = m_projectiles->Spawn(event.spawnTransform, beamVelocity, laserLifetime);
+		if(entity == entt::null)
+		{
+			continue;
+		}
 
-	m_registry.emplace<CylinderMesh>(entity, cylinderMesh);
+#if !defined(PLATFORM_HEADLESS)
+		Raylib::TraceLog(Raylib::LOG_INFO, "FIRE!");
+
+		m_registry.emplace<CylinderMesh>(entity, GetLaserbeamMesh());
+#endif
+	}
 }
 
 
+#if !defined(PLATFORM_HEADLESS)
 void Game::UpdateAndDraw()
 {
 	OPTICK_EVENT();
 
-	r64 frameTime = Raylib::GetTime();
-	r32 dt = (r32)(frameTime - m_lastFrameTime);
-	m_lastFrameTime = frameTime;
+	{
+		TelemetryScope frameScope(m_telemetry, m_telemetrySections.frame);
 
-	if(Raylib::IsKeyPressed(Raylib::KEY_F1)) { debugFlags.drawCollision = !debugFlags.drawCollision; }
+		r64 frameTime = Raylib::GetTime();
+		r32 dt = (r32)(frameTime - m_lastFrameTime);
+		m_lastFrameTime = frameTime;
+
+		if(Raylib::IsKeyPressed(Raylib::KEY_F1)) { debugFlags.drawCollision = !debugFlags.drawCollision; }
+		if(Raylib::IsKeyPressed(Raylib::KEY_F2)) { debugFlags.drawTelemetry = !debugFlags.drawTelemetry; }
 
-	// Run events
-	{
-		for(Event &evnt : m_events)
 		{
-			evnt.delegate(evnt.data);
-			evnt.data = nullptr;
+			TelemetryScope inputScope(m_telemetry, m_telemetrySections.input);
+			PollShipInput();
 		}
-		m_events.clear();
-		m_eventDataMemoryUsed = 0;
+
+		Simulate(dt);
+
+		if(m_recorder)
+		{
+			RecordedFrame frame;
+			frame.dt = dt;
+			auto inputView = m_registry.view<const ShipInput>();
+			if(!inputView.empty())
+			{
+				frame.input = inputView.get<const ShipInput>(*inputView.begin());
+			}
+			frame.stateHash = ComputeStateHash(m_registry);
+			m_recorder->AddFrame(frame);
+		}
+
+		Draw();
 	}
+	m_telemetry.EndFrame();
+}
+#endif
 
-	// Read input and map to actions
+void Game::SetShipInputs(const ShipInput &shipInput)
+{
+	auto view = m_registry.view<ShipInput>();
+	view.each([&shipInput](ShipInput &input) {
+		input = shipInput;
+	});
+}
+
+void Game::SetShipInput(entt::entity ship, const ShipInput &shipInput)
+{
+	m_registry.get<ShipInput>(ship) = shipInput;
+}
+
+void Game::Simulate(r32 dt)
+{
+	OPTICK_EVENT();
+
+	if(!m_pendingModels.empty())
 	{
-		OPTICK_EVENT("UpdateShipInput");
+		TelemetryScope assetsScope(m_telemetry, m_telemetrySections.assets);
+		ProcessLoadedAssets(false);
+	}
 
-		auto view = m_registry.view<ShipInput>();
-		view.each([](ShipInput &shipInput) {
+	m_simulationDt = dt;
+	m_scheduler->Run();
+}
 
-			Raylib::Vector2 mouseDelta = Raylib::GetMouseDelta();
+void Game::CaptureSnapshot(WorldSnapshot &snapshot)
+{
+	OPTICK_EVENT();
 
-			constexpr r32 mouseSensitivity = 0.15f;
-			mouseDelta = Raylib::Vector2Scale(mouseDelta, mouseSensitivity);
+	SnapshotScratch &scratch = *m_snapshotScratch;
+	snapshot.Clear();
 
-			shipInput.inputs[ShipInput::THRUST_Z] = 0.0f;
-			if(Raylib::IsKeyDown(Raylib::KEY_W)) { shipInput.inputs[ShipInput::THRUST_Z] -= 1.0f; }
-			if(Raylib::IsKeyDown(Raylib::KEY_S)) { shipInput.inputs[ShipInput::THRUST_Z] += 1.0f; }
+	// What exists comes first, restoring has to make the same entities exist before it can fill them in
+	entt::snapshot{m_registry}.entities(snapshot);
 
-			shipInput.inputs[ShipInput::THRUST_X] = 0.0f;
-			if(Raylib::IsKeyDown(Raylib::KEY_A)) { shipInput.inputs[ShipInput::THRUST_X] -= 1.0f; }
-			if(Raylib::IsKeyDown(Raylib::KEY_D)) { shipInput.inputs[ShipInput::THRUST_X] += 1.0f; }
+	m_projectiles->SaveState(scratch.projectiles);
+	snapshot.WriteArray(scratch.projectiles.slotEntities.data(), (u32)scratch.projectiles.slotEntities.size());
+	snapshot.WriteArray(scratch.projectiles.freeSlots.data(), (u32)scratch.projectiles.freeSlots.size());
 
-			shipInput.inputs[ShipInput::THRUST_Y] = 0.0f;
-			if(Raylib::IsKeyDown(Raylib::KEY_LEFT_SHIFT)) { shipInput.inputs[ShipInput::THRUST_Y] += 1.0f; }
-			if(Raylib::IsKeyDown(Raylib::KEY_LEFT_CONTROL)) { shipInput.inputs[ShipInput::THRUST_Y] -= 1.0f; }
+	m_debris->SaveState(scratch.debris);
+	snapshot.WriteArray(scratch.debris.slotEntities.data(), (u32)scratch.debris.slotEntities.size());
+	snapshot.WriteArray(scratch.debris.slotChunks.data(), (u32)scratch.debris.slotChunks.size());
+	snapshot.WriteArray(scratch.debris.slotMasses.data(), (u32)scratch.debris.slotMasses.size());
+	snapshot.WriteArray(scratch.debris.freeSlots.data(), (u32)scratch.debris.freeSlots.size());
 
-			shipInput.inputs[ShipInput::PITCH] = 0.0f;
-			shipInput.inputs[ShipInput::YAW] = 0.0f;
-			shipInput.inputs[ShipInput::ROLL] = 0.0f;
+	m_asteroidField->SaveState(scratch.asteroidField);
+	snapshot.WriteArray(scratch.asteroidField.sectors.data(), (u32)scratch.asteroidField.sectors.size());
+	snapshot.WriteArray(scratch.asteroidField.entities.data(), (u32)scratch.asteroidField.entities.size());
+	snapshot.Write(scratch.asteroidField.asteroidCount);
 
-			shipInput.inputs[ShipInput::PITCH] = -mouseDelta.y;
-			shipInput.inputs[ShipInput::YAW] = -mouseDelta.x;
+	// Components that change after an entity is made. The rest only need their order kept
+	entt::snapshot{m_registry}.component<Transform, SimulationLodBody, Projectile, Debris, ShipInput, CameraArm, Camera>(snapshot);
+	WriteStorageOrder<RenderModel>(m_registry, snapshot);
+	WriteStorageOrder<RigidBody>(m_registry, snapshot);
 
-			if(Raylib::IsKeyDown(Raylib::KEY_Q)) { shipInput.inputs[ShipInput::ROLL] += 1.0f; }
-			if(Raylib::IsKeyDown(Raylib::KEY_E)) { shipInput.inputs[ShipInput::ROLL] -= 1.0f; }
+	// In RigidBody order
+	BodyState bodyState;
+	for(const RigidBody &rigidBody : m_registry.storage<RigidBody>())
+	{
+		m_physics->SaveBodyState(rigidBody.body, bodyState);
+		snapshot.Write(bodyState);
+	}
 
-			shipInput.inputs[ShipInput::FIRE] = Raylib::IsMouseButtonPressed(Raylib::MOUSE_BUTTON_LEFT) ? 1.0f : 0.0f;
-			shipInput.inputs[ShipInput::ALT_FIRE] = Raylib::IsMouseButtonPressed(Raylib::MOUSE_BUTTON_RIGHT) ? 1.0f : 0.0f;
-		});
+	auto shipView = m_registry.view<const ShipPhysics>();
+	snapshot.Write((u32)shipView.size());
+	for(entt::entity entity : shipView)
+	{
+		const ShipPhysics &shipPhysics = shipView.get<const ShipPhysics>(entity);
+		btVector3 aabbMin, aabbMax;
+		m_physics->GetAabb(shipPhysics.GetGhostObject(), aabbMin, aabbMax);
+		snapshot.Write(entity);
+		snapshot.Write(shipPhysics.GetState());
+		snapshot.Write(aabbMin);
+		snapshot.Write(aabbMax);
 	}
 
-	// Update ship physics based of current ship input
+	m_simulationLod->SaveState(snapshot);
+	m_physics->SaveState(snapshot);
+
+	// Shots fired this frame spawn at the start of the next
+	EventQueue<SpawnLaserbeamEvent> &laserbeamEvents = m_events.GetQueue<SpawnLaserbeamEvent>();
+	snapshot.Write(laserbeamEvents.GetPendingCount());
+	laserbeamEvents.ForEachPending([&snapshot](const SpawnLaserbeamEvent &event) {
+		snapshot.Write(event);
+	});
+
+	OPTICK_TAG("SnapshotBytes", (u32)snapshot.GetSize());
+}
+
+void Game::RestoreSnapshot(const WorldSnapshot &snapshot)
+{
+	OPTICK_EVENT();
+
+	SnapshotScratch &scratch = *m_snapshotScratch;
+	SnapshotReader reader(snapshot);
+
+	ReadEntityPool(reader, scratch.entityPool);
+	reader.ReadArray(scratch.projectiles.slotEntities);
+	reader.ReadArray(scratch.projectiles.freeSlots);
+	reader.ReadArray(scratch.debris.slotEntities);
+	reader.ReadArray(scratch.debris.slotChunks);
+	reader.ReadArray(scratch.debris.slotMasses);
+	reader.ReadArray(scratch.debris.freeSlots);
+	reader.ReadArray(scratch.asteroidField.sectors);
+	reader.ReadArray(scratch.asteroidField.entities);
+	scratch.asteroidField.asteroidCount = reader.Read<u32>();
+
+	// Everything is destroyed before anything is respawned, a respawn can need an identifier something made since
+	// the capture is holding
+	m_projectiles->RestoreReleases(scratch.projectiles);
+	m_debris->RestoreReleases(scratch.debris);
+	m_asteroidField->RestoreReleases(scratch.asteroidField);
+	m_projectiles->RestoreSpawns(scratch.projectiles);
+	m_debris->RestoreSpawns(scratch.debris);
+	m_asteroidField->RestoreSpawns(scratch.asteroidField);
+	RestoreEntityPool(m_registry, scratch.entityPool);
+
+#if !defined(PLATFORM_HEADLESS)
+	auto unmeshedView = m_registry.view<const Projectile>(entt::exclude<CylinderMesh>);
+	for(entt::entity entity : unmeshedView)
 	{
-		OPTICK_EVENT("ApplyShipInput");
-		auto view = m_registry.view<const ShipInput, const ShipConfig, ShipPhysics>();
-		view.each([dt, this](const ShipInput &shipInput, const ShipConfig &shipConfig, ShipPhysics &shipPhysics) {
-			shipPhysics.ApplyShipInput(shipInput);
+		m_registry.emplace<CylinderMesh>(entity, GetLaserbeamMesh());
+	}
+#endif
+
+	ReadComponents<Transform>(m_registry, reader);
+	ReadComponents<SimulationLodBody>(m_registry, reader);
+	ReadComponents<Projectile>(m_registry, reader);
+	ReadComponents<Debris>(m_registry, reader);
+	ReadComponents<ShipInput>(m_registry, reader);
+	ReadComponents<CameraArm>(m_registry, reader);
+	ReadComponents<Camera>(m_registry, reader);
+	ReadStorageOrder<RenderModel>(m_registry, reader, scratch.entities);
+	ReadStorageOrder<RigidBody>(m_registry, reader, scratch.entities);
+
+	// Shapes and masses first, switching tier resets some of what the body state then puts back
+	m_simulationLod->RestoreBodyTiers();
+	for(const RigidBody &rigidBody : m_registry.storage<RigidBody>())
+	{
+		m_physics->RestoreBodyState(rigidBody.body, reader.Read<BodyState>());
+	}
 
-			if(shipInput.inputs[ShipInput::FIRE])
-			{
-				Event newEvent;
-				newEvent.delegate.connect<&Game::SpawnLaserbeam>(this);
+	u32 shipCount = reader.Read<u32>();
+	for(u32 shipNum = 0; shipNum < shipCount; ++shipNum)
+	{
+		ShipPhysics &shipPhysics = m_registry.get<ShipPhysics>(reader.Read<entt::entity>());
+		shipPhysics.SetState(reader.Read<ShipPhysicsState>());
+		btVector3 aabbMin = reader.Read<btVector3>();
+		btVector3 aabbMax = reader.Read<btVector3>();
+		m_physics->SetAabb(shipPhysics.GetGhostObject(), aabbMin, aabbMax);
+	}
 
-				SpawnLaserbeamEventData *eventData = AllocEventData<SpawnLaserbeamEventData>(newEvent);
-				eventData->spawnTransform = shipPhysics.GetTransform();
-				eventData->startVelocity = shipPhysics.GetVelocity();
-				m_events.push_back(newEvent);
-			}
-		});
+	m_simulationLod->RestoreState(reader);
+	m_physics->RestoreState(reader);
+
+	EventQueue<SpawnLaserbeamEvent> &laserbeamEvents = m_events.GetQueue<SpawnLaserbeamEvent>();
+	laserbeamEvents.ClearPending();
+	u32 eventCount = reader.Read<u32>();
+	for(u32 eventNum = 0; eventNum < eventCount; ++eventNum)
+	{
+		laserbeamEvents.Push(reader.Read<SpawnLaserbeamEvent>());
 	}
 
-	m_physics->Step(dt);
+	Assert(reader.IsAtEnd());
+}
+
+void Game::Resimulate(std::span<const RecordedFrame> frames, SnapshotRing *ring, u32 firstFrameNum)
+{
+	OPTICK_EVENT();
 
-	// Apply physics update to our transforms
+	for(u32 frameNum = 0; frameNum < (u32)frames.size(); ++frameNum)
 	{
-		OPTICK_EVENT("UpdateTransforms")
-		auto view = m_registry.view<const RigidBody, Transform>();
-		view.each([this](const RigidBody &rigidBody, Transform &transform) {
-			btTransform bodyTransform = rigidBody.body->getWorldTransform();
-			transform.translation = bodyTransform.getOrigin();
-			bodyTransform.getBasis().getRotation(transform.rotation);
+		SetShipInputs(frames[frameNum].input);
+		Simulate(frames[frameNum].dt);
+		if(ring)
+		{
+			CaptureSnapshot(m_snapshotScratch->resimulated);
+			ring->Push(firstFrameNum + frameNum, m_snapshotScratch->resimulated);
+		}
+	}
+}
+
+void Game::RegisterSystems()
+{
+	m_scheduler->AddExclusiveSystem("RunEvents", [this]() {
+		m_events.Dispatch();
+	});
+
+	// Update ship physics based of current ship input. Event queues take pushes from any thread
+	m_scheduler->AddSystem<const ShipInput, ShipPhysics>("ApplyShipInput", [this]() {
+		auto view = m_registry.view<const ShipInput, ShipPhysics>();
+		view.each([this](const ShipInput &shipInput, ShipPhysics &shipPhysics) {
+			shipPhysics.ApplyShipInput(shipInput);
+
+			if(shipInput.inputs[ShipInput::FIRE])
+			{
+				SpawnLaserbeamEvent event;
+				event.spawnTransform = shipPhysics.GetTransform();
+				event.startVelocity = shipPhysics.GetVelocity();
+				m_events.Push(event);
+			}
 		});
+	});
+
+	m_scheduler->AddExclusiveSystem("PhysicsStep", [this]() {
+		m_physics->Step(m_simulationDt);
+	});
+
+	// Before the projectiles that hit something are released
+	m_scheduler->AddExclusiveSystem("ShatterAsteroids", [this]() {
+		ShatterAsteroids(m_physics->GetContactEvents());
+	});
+
+	m_scheduler->AddExclusiveSystem("UpdateDebris", [this]() {
+		m_debris->Update(m_simulationDt);
+	});
+
+	m_scheduler->AddExclusiveSystem("UpdateProjectiles", [this]() {
+		m_projectiles->Update(m_simulationDt, m_physics->GetContactEvents());
+	});
+
+	// Apply physics update to our transforms, only bodies that moved this step are in the list
+	m_scheduler->AddSystem<Transform>("UpdateTransforms", [this]() {
+		const TransformUpdates &updates = m_physics->GetTransformUpdates();
+		auto &transforms = m_registry.storage<Transform>();
+
+		// Every update is a different entity, so chunks never write the same transform
+		m_scheduler->ParallelFor(updates.GetCount(), 256, [&updates, &transforms](u32 begin, u32 end) {
+			// Rotations are converted a block at a time, ParallelFor runs everything as one chunk without workers
+			constexpr u32 blockSize = 256;
+			r32 quaternionData[4][blockSize];
+			r32 *quaternions[4] = {quaternionData[0], quaternionData[1], quaternionData[2], quaternionData[3]};
+
+			for(u32 blockBegin = begin; blockBegin < end; blockBegin += blockSize)
+			{
+				u32 blockEnd = MIN(blockBegin + blockSize, end);
+				const r32 *matrices[9];
+				for(u32 element = 0; element < ArrayCount(matrices); ++element)
+				{
+					matrices[element] = updates.rotations[element].data() + blockBegin;
+				}
+				MatricesToQuaternions(matrices, blockEnd - blockBegin, quaternions);
+
+				for(u32 updateNum = blockBegin; updateNum < blockEnd; ++updateNum)
+				{
+					entt::entity entity = updates.entities[updateNum];
+					if(transforms.contains(entity))
+					{
+						Transform &transform = transforms.get(entity);
+						u32 blockIndex = updateNum - blockBegin;
+						transform.translation = btVector3(updates.translations[0][updateNum], updates.translations[1][updateNum], updates.translations[2][updateNum]);
+						transform.rotation = btQuaternion(quaternions[0][blockIndex], quaternions[1][blockIndex], quaternions[2][blockIndex], quaternions[3][blockIndex]);
+					}
+				}
+			}
+		});
+	});
+
+	// Kinematic bodies get no transform updates, their Transform moves along on its own
+	m_scheduler->AddSystem<const SimulationLodBody, Transform>("AdvanceOnRails", [this]() {
+		auto view = m_registry.view<const SimulationLodBody, Transform>();
+		r32 dt = m_simulationDt;
+		m_scheduler->ParallelEach(view, [dt](const SimulationLodBody &lodBody, Transform &transform) {
+			AdvanceOnRails(lodBody, transform, dt);
+		});
+	});
+
+	m_scheduler->AddExclusiveSystem("UpdateSimulationLod", [this]() {
+		m_simulationLod->Update(m_simulationDt);
+	});
+
+	// Streams sectors around the ships, or the origin while there are none. New asteroids start dynamic and get
+	// tiered on the next LOD update
+	m_scheduler->AddExclusiveSystem("StreamAsteroidField", [this]() {
+		m_shipPositions.clear();
+		auto shipView = m_registry.view<const ShipPhysics>();
+		shipView.each([this](const ShipPhysics &shipPhysics) {
+			m_shipPositions.push_back(shipPhysics.GetTransform().translation);
+		});
+		if(m_shipPositions.empty())
+		{
+			m_shipPositions.push_back(Vec3Zero);
+		}
+		m_asteroidField->Update(m_shipPositions);
+	});
 
+	m_scheduler->AddSystem<const ShipPhysics, Transform>("UpdateShipTransforms", [this]() {
 		auto shipView = m_registry.view<const ShipPhysics, Transform>();
-		shipView.each([this](const ShipPhysics &shipPhysics, Transform &transform) {
+		shipView.each([](const ShipPhysics &shipPhysics, Transform &transform) {
 			transform = shipPhysics.GetTransform();
 		});
-	}
-
-	// Update Camera by attached transform
-	{
-		OPTICK_EVENT("UpdateCamera");
+	});
 
+	// Update Camera by attached transform. Exclusive as the arms are swept through the physics world in one batch
+	m_scheduler->AddExclusiveSystem("UpdateCamera", [this]() {
 		auto view = m_registry.view<const Transform, CameraArm, Camera>();
-		view.each([](const Transform &transform, CameraArm &cameraArm, Camera &camera) {
+
+		m_cameraQueries.clear();
+		view.each([this](entt::entity entity, const Transform &transform, CameraArm &cameraArm, Camera &) {
 
 			if(cameraArm.currentRotation != transform.rotation)
 			{
@@ -395,6 +1266,34 @@ void Game::UpdateAndDraw()
 				cameraArm.currentRotation = cameraArm.currentRotation.slerp(transform.rotation, cameraLerpAmount);
 			}
 
+			// Projectiles are too small and quick to pull the camera in for
+			SceneQuery &query = m_cameraQueries.emplace_back();
+			query.from = transform.translation;
+			query.to = transform.translation + quatRotate(cameraArm.currentRotation, cameraArm.baseDir) * cameraArm.maxDistance;
+			query.radius = cameraArm.radius;
+			query.filterMask = COLLISION_GROUP_ALL & ~(COLLISION_GROUP_PROJECTILE | COLLISION_GROUP_SHIP);
+			query.ignore = entity;
+		});
+
+		m_cameraHits.resize(m_cameraQueries.size());
+		m_physics->QueryBatch(m_cameraQueries.data(), (u32)m_cameraQueries.size(), m_cameraHits.data());
+
+		u32 queryNum = 0;
+		view.each([this, &queryNum](const Transform &transform, CameraArm &cameraArm, Camera &camera) {
+
+			// Pulled in straight away when something is in the way, eased back out once it has gone
+			const SceneQueryHit &hit = m_cameraHits[queryNum++];
+			r32 clearDistance = MAX(cameraArm.minDistance, cameraArm.maxDistance * hit.fraction);
+			if(clearDistance < cameraArm.currentDistance)
+			{
+				cameraArm.currentDistance = clearDistance;
+			}
+			else
+			{
+				constexpr r32 cameraReturnAmount = 0.05f;
+				cameraArm.currentDistance += (clearDistance - cameraArm.currentDistance) * cameraReturnAmount;
+			}
+
 			btVector3 toCameraDir = quatRotate(cameraArm.currentRotation, cameraArm.baseDir);
 			btVector3 toCameraVec = toCameraDir * cameraArm.currentDistance;
 			camera.position = transform.translation + toCameraVec;
@@ -405,9 +1304,96 @@ void Game::UpdateAndDraw()
 			btVector3 inFrontOfBoat = transformFaceDir * inFrontAmount;
 			camera.target = transform.translation + inFrontOfBoat;
 		});
+	});
+}
+
+#if !defined(PLATFORM_HEADLESS)
+void Game::PollShipInput()
+{
+	// Read input and map to actions
+	OPTICK_EVENT("UpdateShipInput");
+
+	auto view = m_registry.view<ShipInput>();
+	view.each([](ShipInput &shipInput) {
+
+		Raylib::Vector2 mouseDelta = Raylib::GetMouseDelta();
+
+		constexpr r32 mouseSensitivity = 0.15f;
+		mouseDelta = Raylib::Vector2Scale(mouseDelta, mouseSensitivity);
+
+		shipInput.inputs[ShipInput::THRUST_Z] = 0.0f;
+		if(Raylib::IsKeyDown(Raylib::KEY_W)) { shipInput.inputs[ShipInput::THRUST_Z] -= 1.0f; }
+		if(Raylib::IsKeyDown(Raylib::KEY_S)) { shipInput.inputs[ShipInput::THRUST_Z] += 1.0f; }
+
+		shipInput.inputs[ShipInput::THRUST_X] = 0.0f;
+		if(Raylib::IsKeyDown(Raylib::KEY_A)) { shipInput.inputs[ShipInput::THRUST_X] -= 1.0f; }
+		if(Raylib::IsKeyDown(Raylib::KEY_D)) { shipInput.inputs[ShipInput::THRUST_X] += 1.0f; }
+
+		shipInput.inputs[ShipInput::THRUST_Y] = 0.0f;
+		if(Raylib::IsKeyDown(Raylib::KEY_LEFT_SHIFT)) { shipInput.inputs[ShipInput::THRUST_Y] += 1.0f; }
+		if(Raylib::IsKeyDown(Raylib::KEY_LEFT_CONTROL)) { shipInput.inputs[ShipInput::THRUST_Y] -= 1.0f; }
+
+		shipInput.inputs[ShipInput::PITCH] = 0.0f;
+		shipInput.inputs[ShipInput::YAW] = 0.0f;
+		shipInput.inputs[ShipInput::ROLL] = 0.0f;
+
+		shipInput.inputs[ShipInput::PITCH] = -mouseDelta.y;
+		shipInput.inputs[ShipInput::YAW] = -mouseDelta.x;
+
+		if(Raylib::IsKeyDown(Raylib::KEY_Q)) { shipInput.inputs[ShipInput::ROLL] += 1.0f; }
+		if(Raylib::IsKeyDown(Raylib::KEY_E)) { shipInput.inputs[ShipInput::ROLL] -= 1.0f; }
+
+		shipInput.inputs[ShipInput::FIRE] = Raylib::IsMouseButtonPressed(Raylib::MOUSE_BUTTON_LEFT) ? 1.0f : 0.0f;
+		shipInput.inputs[ShipInput::ALT_FIRE] = Raylib::IsMouseButtonPressed(Raylib::MOUSE_BUTTON_RIGHT) ? 1.0f : 0.0f;
+	});
+}
+
+void Game::DrawTelemetryOverlay()
+{
+	OPTICK_EVENT();
+
+	// Sorting every window each frame is cheap, but twice a second is plenty to read
+	constexpr u32 reportInterval = 30;
+	if(m_telemetryReports.empty() || m_telemetry.GetFrameCount() % reportInterval == 0)
+	{
+		m_telemetry.BuildReports(m_telemetryReports);
+	}
+
+	// raylib's default font isn't monospaced, so every column gets its own x
+	constexpr s32 fontSize = 16;
+	constexpr s32 lineHeight = 18;
+	constexpr s32 left = 10;
+	constexpr s32 top = 40;
+	constexpr s32 valuesLeft = left + 180;
+	constexpr s32 columnWidth = 60;
+	const char *columnNames[] = {"p50", "p95", "p99", "max"};
+
+	Raylib::DrawRectangle(left - 4, top - 4, valuesLeft - left + columnWidth * 4 + 8, lineHeight * ((s32)m_telemetryReports.size() + 1) + 8, Raylib::Color{0, 0, 0, 160});
+	Raylib::DrawText("ms", left, top, fontSize, Raylib::LIGHTGRAY);
+	for(s32 columnNum = 0; columnNum < 4; ++columnNum)
+	{
+		Raylib::DrawText(columnNames[columnNum], valuesLeft + columnNum * columnWidth, top, fontSize, Raylib::LIGHTGRAY);
+	}
+
+	s32 y = top + lineHeight;
+	for(const TelemetryReport &report : m_telemetryReports)
+	{
+		const r32 values[] = {report.p50Ms, report.p95Ms, report.p99Ms, report.maxMs};
+		Raylib::DrawText(report.name, left, y, fontSize, Raylib::RAYWHITE);
+		for(s32 columnNum = 0; columnNum < 4; ++columnNum)
+		{
+			Raylib::DrawText(Raylib::TextFormat("%.2f", values[columnNum]), valuesLeft + columnNum * columnWidth, y, fontSize, Raylib::RAYWHITE);
+		}
+		y += lineHeight;
 	}
+}
+
+void Game::Draw()
+{
+	OPTICK_EVENT();
+
+	FrameTelemetry::Clock::time_point drawStart = FrameTelemetry::Clock::now();
 
-	
 	Raylib::BeginDrawing();
 
 	Raylib::ClearBackground(Raylib::BLACK);
@@ -422,37 +1408,71 @@ void Game::UpdateAndDraw()
 		ToRaylibCameraProjection(camera.projection)
 	};
 
+	{
+		// Same clip distances raylib uses for its projection in BeginMode3D
+		constexpr r32 nearDistance = 0.01f;
+		constexpr r32 farDistance = 1000.0f;
+		r32 aspect = (r32)m_windowWidth / (r32)m_windowHeight;
+		Frustum frustum = BuildCameraFrustum(camera, aspect, nearDistance, farDistance);
+		u32 idleBodies = (m_projectiles->GetCapacity() - m_projectiles->GetActiveCount()) + (m_debris->GetCapacity() - m_debris->GetActiveCount());
+		CullEntities(*m_physics, frustum, idleBodies, m_visibleEntities);
+	}
+
 	Raylib::BeginMode3D(raylibCamera);
 	//Raylib::DrawCylinderEx({0, 0, 0}, {0,0,1}, 1, 1, 16, Raylib::RED);
 
 	// Draw asteroids
 	{
 		OPTICK_EVENT("Draw");
+		BuildRenderBatches(m_registry, m_visibleEntities, m_modelScales, m_renderBatches);
+
 		{
 			OPTICK_EVENT("DrawModels");
 
-			auto modelView = m_registry.view<const Raylib::Model, const Transform>();
-			modelView.each([](const Raylib::Model &model, const Transform &transform) {
-				btVector3 rotationAxis = transform.rotation.getAxis();
-				r32 rotationAngle = transform.rotation.getAngle();
-				rotationAngle = RadToDeg(rotationAngle);
-				Raylib::DrawModelEx(model, ToRaylibVec3(transform.translation), ToRaylibVec3(rotationAxis), 
-					rotationAngle, ToRaylibVec3(transform.scale), Raylib::WHITE);
-				//DrawModelWiresEx(model, transform.translation, rotationAxis, rotationAngle, transform.scale, Raylib::WHITE);
-			});
+			static_assert(sizeof(RenderMatrix) == sizeof(Raylib::Matrix));
+			const Raylib::Matrix identity = Raylib::MatrixIdentity();
+
+			for(const RenderBatch &batch : m_renderBatches.batches)
+			{
+				const Raylib::Model &model = m_models[batch.modelIndex];
+				Raylib::Matrix *transforms = (Raylib::Matrix *)&m_renderBatches.transforms[batch.firstInstance];
+
+				// DrawModelEx applies the model's own transform before the entity's, keep that for instances
+				if(memcmp(&model.transform, &identity, sizeof(Raylib::Matrix)) != 0)
+				{
+					for(u32 instanceNum = 0; instanceNum < batch.instanceCount; ++instanceNum)
+					{
+						transforms[instanceNum] = Raylib::MatrixMultiply(model.transform, transforms[instanceNum]);
+					}
+				}
+
+				for(int meshNum = 0; meshNum < model.meshCount; ++meshNum)
+				{
+					Raylib::Material material = model.materials[model.meshMaterial[meshNum]];
+					material.shader = m_instancingShader;
+					Raylib::DrawMeshInstanced(model.meshes[meshNum], material, transforms, (int)batch.instanceCount);
+				}
+			}
 		}
 
 		{
 			OPTICK_EVENT("DrawCylinders");
 
 			auto cylinderView = m_registry.view<const CylinderMesh, const Transform>();
-			cylinderView.each([](const CylinderMesh &cylinderMesh, const Transform &transform) {
+			for(entt::entity entity : m_visibleEntities)
+			{
+				if(!cylinderView.contains(entity))
+				{
+					continue;
+				}
+
+				auto [cylinderMesh, transform] = cylinderView.get(entity);
 				btVector3 endPos = transform.translation + quatRotate(transform.rotation, Vec3Forward);
 				endPos *= cylinderMesh.height;
 
 				DrawCylinderEx(ToRaylibVec3(transform.translation), ToRaylibVec3(endPos), 
 					cylinderMesh.radius, cylinderMesh.radius, cylinderMesh.slices, cylinderMesh.color);
-			});
+			}
 		}
 		
 
@@ -466,5 +1486,14 @@ void Game::UpdateAndDraw()
 
 	Raylib::DrawFPS(10, 10);
 
+	if(debugFlags.drawTelemetry)
+	{
+		DrawTelemetryOverlay();
+	}
+
+	// Before EndDrawing, which waits out the rest of the frame for the target FPS
+	m_telemetry.AddTime(m_telemetrySections.draw, FrameTelemetry::Clock::now() - drawStart);
+
 	Raylib::EndDrawing();
-}
\ No newline at end of file
+}
+#endif
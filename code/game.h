@@ -2,7 +2,25 @@
 
 #include "defines.h"
 
-class PhysicsWorld;
+#include "asteroidField.h"
+#include "debris.h"
+#include "eventQueue.h"
+#include "frameTelemetry.h"
+#include "physics.h"
+#include "renderBatch.h"
+#include "simulationLod.h"
+
+class AssetLoader;
+class AssetPack;
+class InputRecorder;
+class SystemScheduler;
+class ProjectilePool;
+class SnapshotRing;
+class WorldSnapshot;
+struct CookedHull;
+struct PendingModel;
+struct RecordedFrame;
+struct SnapshotScratch;
 
 struct ShipInput
 {
@@ -31,71 +49,219 @@ struct ShipConfig
 	r32 rollRate = 30.0f;
 };
 
+struct SpawnLaserbeamEvent
+{
+	Transform spawnTransform;
+	btVector3 startVelocity;
+};
+
+struct CameraArm
+{
+	btQuaternion currentRotation = QuatIdentity;
+
+	btVector3 baseDir = Vec3Forward;
+	btVector3 baseUp = Vec3Up;
+
+	r32 currentDistance = 0.0f; // somewhere between min and max depending on camera collision
+	r32 minDistance = 0.0f;
+	r32 maxDistance = 0.0f; 
+	r32 radius = 0.5f; // Of the sphere swept out along the arm, kept clear of anything in the way
+
+	CameraArm(const btVector3 &cameraOffset)
+	{
+		baseDir = cameraOffset.normalized();
+		baseUp = -baseDir.cross(Vec3Left); // Using left as its boat to the
+		currentDistance = cameraOffset.length();
+		currentRotation = QuatIdentity;//QuaternionFromVector3ToVector3(Vec3Back, baseDir);
+
+		minDistance = 2.0f; // TODO: pass in minDistance?
+		maxDistance = currentDistance;
+	};
+};
+
+struct Camera
+{
+	enum class Projection
+	{
+		PERSPECTIVE,
+		ORTHOGRAPHIC
+	};
+
+	btVector3 position = Vec3Zero;
+	btVector3 target = Vec3Zero;
+	btVector3 up = Vec3Up;
+	r32 fovY = 0.0f;
+	Projection projection = Projection::PERSPECTIVE;
+
+	Camera(const btVector3 &position, const btVector3 target, const btVector3 up, r32 fovY, Projection projection)
+		: position(position), target(target), up(up), fovY(fovY), projection(projection) {};
+};
+
+struct GameConfig
+{
+	u32 windowWidth = 0;
+	u32 windowHeight = 0;
+	u32 randomSeed = 0;
+
+	u32 systemWorkerCount = 0; // Extra threads the ECS systems can run on, 0 runs them all on the calling thread
+
+	u32 maxProjectiles = 256; // Shots fired while this many are in flight are dropped
+
+	DebrisConfig debris; // Asteroids a shot hits shatter into pooled chunks, a capacity of 0 leaves them whole
+
+	AsteroidFieldConfig asteroidField; // Its seed and model count are filled in from randomSeed and the asteroid models
+
+	u32 assetLoaderThreadCount = 0; // 0 uses one less than the hardware thread count
+	bool waitForAssets = false; // Finish loading in the constructor instead of starting with placeholder models
+	const char *assetPackFile = "assets.pack"; // Made by BakeAssetPack. Models missing from it load from their source files
+
+	PhysicsConfig physics;
+	SimulationLodConfig simulationLod;
+
+	bool spawnPlayer = true; // A dedicated server has no player of its own, it spawns a ship per client with SpawnShip
+};
+
 class Game
 {
 public:
-	Game(u32 windowWidth, u32 windowHeight);
+	Game(const GameConfig &config);
 	~Game();
 
+#if !defined(PLATFORM_HEADLESS)
+	// Polls raylib input, simulates a frame of wall-clock time and draws it
 	void UpdateAndDraw();
 
+	// Every frame UpdateAndDraw simulates from now on is added to the recorder, null stops recording
+	void SetRecorder(InputRecorder *recorder) { m_recorder = recorder; }
+#endif
+
+	// Advances everything but input polling and rendering by dt. Safe to call without a window
+	void Simulate(r32 dt);
+
+	// Overwrites the input of every ship. Used to drive the simulation from a non-raylib input source
+	void SetShipInputs(const ShipInput &shipInput);
+
+	// A ship with no camera, for players other than the local one. The asteroid field streams around every ship
+	entt::entity SpawnShip(const Transform &transform);
+	void SetShipInput(entt::entity ship, const ShipInput &shipInput);
+
 
-	void SpawnLaserbeam(void *data);
+	// Captures everything Simulate carries from one frame to the next: entities, components, Bullet's bodies and
+	// contact caches, the ship, the projectile and debris pools, loaded sectors and events waiting for the next frame
+	void CaptureSnapshot(WorldSnapshot &snapshot);
+	// Puts the world back as it was captured. Whatever was fired, streamed in or released since is destroyed or
+	// respawned under the identifiers it had, so simulating on from here repeats the frames after the capture
+	void RestoreSnapshot(const WorldSnapshot &snapshot);
+	// Simulates the frames again with their inputs and dt, from wherever the world is now. With a ring, each frame's
+	// snapshot replaces the one it had from before the rollback, firstFrameNum being the frame number of frames[0]
+	void Resimulate(std::span<const RecordedFrame> frames, SnapshotRing *ring = nullptr, u32 firstFrameNum = 0);
 
-	void AddEvent();
+	void SpawnLaserbeams(std::span<const SpawnLaserbeamEvent> events);
+
+	EventQueues &GetEvents() { return m_events; }
 
 	entt::registry & GetRegistry() { return m_registry; }
 	PhysicsWorld * const GetPhysics() { return m_physics; };
+	const SimulationLod &GetSimulationLod() const { return *m_simulationLod; }
+	const AsteroidField &GetAsteroidField() const { return *m_asteroidField; }
+	const DebrisPool &GetDebris() const { return *m_debris; }
+
+	// Every system plus input, asset processing and draw. UpdateAndDraw ends the telemetry frame, callers driving
+	// Simulate themselves call EndFrame after each one
+	FrameTelemetry &GetTelemetry() { return m_telemetry; }
 
 	void SetCameraEntity(entt::entity entity) { m_cameraEntity = entity; }
 
+
 private:
 	//void Load();
 
-	entt::registry m_registry;
+	void RegisterSystems();
+
+	// Creates the model and its hull straight from the mapped pack. False if the pack doesn't have all of it
+	bool LoadModelFromPack(const AssetPack &pack, u32 modelIndex, const char *meshFile, const char *albedoFile, const char *normalMapFile, r32 collisionScale);
+
+	// Meshes, textures and hulls load on the asset loader's threads. Placeholders fill the model and collision tables
+	// until ProcessLoadedAssets swaps the real ones in on the main thread, where GPU upload has to happen
+	void QueueModelLoad(u32 modelIndex, const char *meshFile, const char *albedoFile, const char *normalMapFile, r32 collisionScale);
+	void ProcessLoadedAssets(bool waitForAll);
+
+	// Gives the debris pool the shapes, and the windowed build the models, of an asteroid's pre-fractured chunks
+	void ApplyChunks(u32 modelIndex, std::span<const CookedHull> chunks, r32 collisionScale);
+#if !defined(PLATFORM_HEADLESS)
+	void ShareChunkTextures(u32 modelIndex);
+#endif
 
-	std::vector<entt::entity> m_entities;
+	entt::entity SpawnAsteroid(const AsteroidSpawn &spawn, entt::entity hint = entt::null);
+	void DestroyAsteroid(entt::entity entity);
+	// Swaps every asteroid a projectile started touching this step for its chunks, which carry on with its motion
+	void ShatterAsteroids(const ContactEvents &contacts);
+
+#if !defined(PLATFORM_HEADLESS)
+	void PollShipInput();
+	void Draw();
+	void DrawTelemetryOverlay();
+#endif
+
+	entt::registry m_registry;
 
 	entt::entity m_cameraEntity = entt::null;
 
 	PhysicsWorld *m_physics;
 
-	r64 m_lastFrameTime = 0;
+	SystemScheduler *m_scheduler;
+	ProjectilePool *m_projectiles;
+	DebrisPool *m_debris;
+	SimulationLod *m_simulationLod;
+	AsteroidField *m_asteroidField = nullptr;
 
-	u32 m_windowWidth = 0;
-	u32 m_windowHeight = 0;
+	AssetLoader *m_assetLoader;
+	std::vector<PendingModel> m_pendingModels;
+	std::vector<btConvexShape *> m_modelCollisions; // Indexed by RenderModel::modelIndex
+	btConvexShape *m_placeholderCollision = nullptr;
+	r32 m_simulationDt = 0.0f; // dt of the frame the scheduler is currently running
+	std::vector<btVector3> m_shipPositions; // Scratch for streaming the asteroid field
+	std::vector<SceneQuery> m_cameraQueries; // Scratch for camera arm collision, one per arm
+	std::vector<SceneQueryHit> m_cameraHits;
 
-	
-	void *m_eventDataMemory = nullptr;
-	u32 m_eventDataMemoryUsed = 0;
-	u32 m_eventDataMemorySize = 0;
+	std::vector<entt::entity> m_visibleEntities; // Filled by culling each draw
+	RenderBatches m_renderBatches;
 
-	using EventDelegate = entt::delegate<void(void *)>;
-	struct Event
+	FrameTelemetry m_telemetry;
+	struct TelemetrySections
 	{
-		EventDelegate delegate;
-		void *data = nullptr; 
+		u32 frame;
+		u32 input;
+		u32 assets;
+		u32 draw;
 	};
-	std::vector<Event> m_events;
+	TelemetrySections m_telemetrySections;
+	std::vector<TelemetryReport> m_telemetryReports; // Rebuilt every so often for the overlay
+#if !defined(PLATFORM_HEADLESS)
+	std::vector<Raylib::Model> m_models;
+	std::vector<r32> m_modelScales; // Indexed like m_models
+	Raylib::Shader m_instancingShader;
+#endif
 
-	template<typename T>
-	T *AllocEventData(Event &newEvent)
-	{
-		u32 dataSize = sizeof(T);
-		Assert((m_eventDataMemoryUsed + dataSize) <= m_eventDataMemorySize);
-		newEvent.data = (void *)((u8 *)m_eventDataMemory + m_eventDataMemoryUsed);
-		m_eventDataMemoryUsed += dataSize;
-		return (T *)newEvent.data;
-	}
-	
-	
+	r64 m_lastFrameTime = 0;
+	InputRecorder *m_recorder = nullptr;
+
+	u32 m_windowWidth = 0;
+	u32 m_windowHeight = 0;
 
-	
+	EventQueues m_events;
 
+	SnapshotScratch *m_snapshotScratch; // Reused by every capture and restore
 
 	struct DebugFlags
 	{
 		bool drawCollision = false;
+		bool drawTelemetry = false;
 	};
 	DebugFlags debugFlags;
-};
\ No newline at end of file
+};
+
+// Bakes the asteroid and ship meshes, cooked hulls and decoded textures into one pack the game can map at startup.
+// Decoding textures needs raylib, so packs baked by the headless build have no textures and windowed runs will load
+// those models from their source files
+bool BakeAssetPack(const char *packFile);
@@ -0,0 +1,443 @@
+#include "gridBroadphase.h"
+
+#include "BulletCollision/BroadphaseCollision/btOverlappingPairCache.h"
+#include "BulletCollision/CollisionDispatch/btCollisionObject.h"
+#include "LinearMath/btAabbUtil2.h"
+#include "LinearMath/btThreads.h"
+
+#include <bit>
+#include <cmath>
+#include <functional>
+#include <stdio.h>
+#include <string.h>
+
+// Cell coordinates are clamped to 21 bits each so a cell packs into one u64 key
+constexpr s32 cellCoordinateBias = 1 << 20;
+constexpr u32 minBucketCount = 1024;
+constexpr u32 maxPairChunks = 64;
+constexpr u32 bucketsPerChunk = 1024;
+constexpr u32 maxLargeProxyChunks = 16;
+constexpr u32 proxiesPerPoolBlock = 1024;
+
+static u64 GetCellKey(s32 x, s32 y, s32 z)
+{
+	return ((u64)(x + cellCoordinateBias) << 42) | ((u64)(y + cellCoordinateBias) << 21) | (u64)(z + cellCoordinateBias);
+}
+
+static s32 ToCellCoordinate(r32 value, r32 inverseCellSize)
+{
+	r32 cell = std::floor(value * inverseCellSize);
+	cell = MAX(cell, (r32)-cellCoordinateBias);
+	cell = MIN(cell, (r32)(cellCoordinateBias - 1));
+	return (s32)cell;
+}
+
+GridBroadphase::GridBroadphase(r32 cellSize)
+	: m_cellSize(cellSize), m_inverseCellSize(1.0f / cellSize),
+	m_proxyPool(sizeof(GridProxy), alignof(GridProxy), proxiesPerPoolBlock),
+	m_boundsMin(-BT_LARGE_FLOAT, -BT_LARGE_FLOAT, -BT_LARGE_FLOAT), m_boundsMax(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT)
+{
+	Assert(cellSize > 0.0f);
+	m_pairCache = new btHashedOverlappingPairCache();
+}
+
+GridBroadphase::~GridBroadphase()
+{
+	for(GridProxy *proxy : m_proxies)
+	{
+		m_proxyPool.Delete(proxy);
+	}
+	delete m_pairCache;
+}
+
+btBroadphaseProxy *GridBroadphase::createProxy(const btVector3 &aabbMin, const btVector3 &aabbMax, int shapeType, void *userPtr, int collisionFilterGroup, int collisionFilterMask, btDispatcher *dispatcher)
+{
+	UNUSED(shapeType);
+	UNUSED(dispatcher);
+
+	GridProxy *proxy = m_proxyPool.New<GridProxy>();
+	proxy->m_clientObject = userPtr;
+	proxy->m_collisionFilterGroup = collisionFilterGroup;
+	proxy->m_collisionFilterMask = collisionFilterMask;
+	proxy->m_aabbMin = aabbMin;
+	proxy->m_aabbMax = aabbMax;
+	proxy->m_uniqueId = m_nextUniqueId++;
+	proxy->index = (u32)m_proxies.size();
+	proxy->large = true; // Not in any cell until the next rebuild, queries test it directly till then
+	proxy->inert = false;
+	m_proxies.push_back(proxy);
+	m_largeProxies.push_back(proxy);
+	return proxy;
+}
+
+void GridBroadphase::destroyProxy(btBroadphaseProxy *proxy, btDispatcher *dispatcher)
+{
+	GridProxy *gridProxy = (GridProxy *)proxy;
+	m_pairCache->removeOverlappingPairsContainingProxy(proxy, dispatcher);
+
+	GridProxy *lastProxy = m_proxies.back();
+	m_proxies[gridProxy->index] = lastProxy;
+	lastProxy->index = gridProxy->index;
+	m_proxies.pop_back();
+
+	m_proxyPool.Delete(gridProxy);
+	m_gridValid = false;
+}
+
+void GridBroadphase::setAabb(btBroadphaseProxy *proxy, const btVector3 &aabbMin, const btVector3 &aabbMax, btDispatcher *dispatcher)
+{
+	UNUSED(dispatcher);
+
+	GridProxy *gridProxy = (GridProxy *)proxy;
+	gridProxy->m_aabbMin = aabbMin;
+	gridProxy->m_aabbMax = aabbMax;
+
+	const btCollisionObject *collisionObject = (const btCollisionObject *)proxy->m_clientObject;
+	if(collisionObject && collisionObject->getInternalType() == btCollisionObject::CO_GHOST_OBJECT)
+	{
+		VisitProxies(GetCellRange(aabbMin, aabbMax), [this, gridProxy](GridProxy *other) {
+			if(other != gridProxy && TestAabbAgainstAabb2(gridProxy->m_aabbMin, gridProxy->m_aabbMax, other->m_aabbMin, other->m_aabbMax))
+			{
+				m_pairCache->addOverlappingPair(gridProxy, other);
+			}
+		});
+	}
+}
+
+void GridBroadphase::getAabb(btBroadphaseProxy *proxy, btVector3 &aabbMin, btVector3 &aabbMax) const
+{
+	aabbMin = proxy->m_aabbMin;
+	aabbMax = proxy->m_aabbMax;
+}
+
+GridBroadphase::CellRange GridBroadphase::GetCellRange(const btVector3 &aabbMin, const btVector3 &aabbMax) const
+{
+	CellRange range;
+	range.cellCount = 1;
+	for(u32 axis = 0; axis < 3; ++axis)
+	{
+		range.min[axis] = ToCellCoordinate(aabbMin[axis], m_inverseCellSize);
+		range.max[axis] = ToCellCoordinate(aabbMax[axis], m_inverseCellSize);
+		range.cellCount *= (u64)(range.max[axis] - range.min[axis] + 1);
+	}
+	return range;
+}
+
+u32 GridBroadphase::GetBucket(u64 cellKey) const
+{
+	return (u32)((cellKey * 0x9E3779B97F4A7C15ULL) >> m_bucketShift);
+}
+
+template<typename Visit>
+void GridBroadphase::VisitProxies(const CellRange &range, Visit visit) const
+{
+	// Walking more cells than there are proxies is slower than testing them all
+	if(!m_gridValid || range.cellCount > m_proxies.size())
+	{
+		for(GridProxy *proxy : m_proxies)
+		{
+			visit(proxy);
+		}
+		return;
+	}
+
+	for(s32 x = range.min[0]; x <= range.max[0]; ++x)
+	{
+		for(s32 y = range.min[1]; y <= range.max[1]; ++y)
+		{
+			for(s32 z = range.min[2]; z <= range.max[2]; ++z)
+			{
+				u64 cellKey = GetCellKey(x, y, z);
+				u32 bucket = GetBucket(cellKey);
+				for(u32 entryNum = m_bucketStarts[bucket]; entryNum < m_bucketStarts[bucket + 1]; ++entryNum)
+				{
+					const CellEntry &entry = m_entries[entryNum];
+					if(entry.cellKey != cellKey)
+					{
+						continue;
+					}
+
+					// Only from the first cell of the range the proxy is in
+					const GridProxy *proxy = entry.proxy;
+					if(x == MAX(range.min[0], proxy->cellMin[0]) && y == MAX(range.min[1], proxy->cellMin[1]) && z == MAX(range.min[2], proxy->cellMin[2]))
+					{
+						visit(entry.proxy);
+					}
+				}
+			}
+		}
+	}
+
+	for(GridProxy *proxy : m_largeProxies)
+	{
+		visit(proxy);
+	}
+	for(GridProxy *proxy : m_inertProxies)
+	{
+		visit(proxy);
+	}
+}
+
+void GridBroadphase::rayTest(const btVector3 &rayFrom, const btVector3 &rayTo, btBroadphaseRayCallback &rayCallback, const btVector3 &aabbMin, const btVector3 &aabbMax)
+{
+	OPTICK_EVENT();
+
+	btVector3 segmentMin = rayFrom;
+	btVector3 segmentMax = rayFrom;
+	segmentMin.setMin(rayTo);
+	segmentMax.setMax(rayTo);
+
+	// aabbMin/aabbMax are the extents of a shape being swept along the ray
+	VisitProxies(GetCellRange(segmentMin + aabbMin, segmentMax + aabbMax), [&](GridProxy *proxy) {
+		btVector3 bounds[2] = {proxy->m_aabbMin - aabbMax, proxy->m_aabbMax - aabbMin};
+		btScalar lambda;
+		if(btRayAabb2(rayFrom, rayCallback.m_rayDirectionInverse, rayCallback.m_signs, bounds, lambda, 0.0f, rayCallback.m_lambda_max))
+		{
+			rayCallback.process(proxy);
+		}
+	});
+}
+
+void GridBroadphase::aabbTest(const btVector3 &aabbMin, const btVector3 &aabbMax, btBroadphaseAabbCallback &callback)
+{
+	OPTICK_EVENT();
+
+	VisitProxies(GetCellRange(aabbMin, aabbMax), [&](GridProxy *proxy) {
+		if(TestAabbAgainstAabb2(aabbMin, aabbMax, proxy->m_aabbMin, proxy->m_aabbMax))
+		{
+			callback.process(proxy);
+		}
+	});
+}
+
+void GridBroadphase::BuildGrid()
+{
+	OPTICK_EVENT();
+
+	m_largeProxies.clear();
+	m_inertProxies.clear();
+	m_boundsMin = btVector3(BT_LARGE_FLOAT, BT_LARGE_FLOAT, BT_LARGE_FLOAT);
+	m_boundsMax = -m_boundsMin;
+
+	u32 entryCount = 0;
+	for(GridProxy *proxy : m_proxies)
+	{
+		CellRange range = GetCellRange(proxy->m_aabbMin, proxy->m_aabbMax);
+		memcpy(proxy->cellMin, range.min, sizeof(range.min));
+		memcpy(proxy->cellMax, range.max, sizeof(range.max));
+		proxy->inert = !proxy->m_collisionFilterGroup || !proxy->m_collisionFilterMask;
+		proxy->large = !proxy->inert && range.cellCount > maxCellsPerProxy;
+		if(proxy->inert)
+		{
+			m_inertProxies.push_back(proxy);
+		}
+		else if(proxy->large)
+		{
+			m_largeProxies.push_back(proxy);
+		}
+		else
+		{
+			entryCount += (u32)range.cellCount;
+		}
+
+		m_boundsMin.setMin(proxy->m_aabbMin);
+		m_boundsMax.setMax(proxy->m_aabbMax);
+	}
+
+	u32 bucketCount = std::bit_ceil(MAX(entryCount, minBucketCount));
+	m_bucketShift = 64 - (u32)std::countr_zero(bucketCount);
+
+	// Counting sort of every (cell, proxy) entry by bucket
+	m_bucketStarts.assign(bucketCount + 1, 0);
+	for(const GridProxy *proxy : m_proxies)
+	{
+		if(proxy->large || proxy->inert)
+		{
+			continue;
+		}
+		for(s32 x = proxy->cellMin[0]; x <= proxy->cellMax[0]; ++x)
+		{
+			for(s32 y = proxy->cellMin[1]; y <= proxy->cellMax[1]; ++y)
+			{
+				for(s32 z = proxy->cellMin[2]; z <= proxy->cellMax[2]; ++z)
+				{
+					++m_bucketStarts[GetBucket(GetCellKey(x, y, z)) + 1];
+				}
+			}
+		}
+	}
+	for(u32 bucket = 0; bucket < bucketCount; ++bucket)
+	{
+		m_bucketStarts[bucket + 1] += m_bucketStarts[bucket];
+	}
+
+	m_bucketCursors.assign(m_bucketStarts.begin(), m_bucketStarts.end() - 1);
+	m_entries.resize(entryCount);
+	for(GridProxy *proxy : m_proxies)
+	{
+		if(proxy->large || proxy->inert)
+		{
+			continue;
+		}
+		for(s32 x = proxy->cellMin[0]; x <= proxy->cellMax[0]; ++x)
+		{
+			for(s32 y = proxy->cellMin[1]; y <= proxy->cellMax[1]; ++y)
+			{
+				for(s32 z = proxy->cellMin[2]; z <= proxy->cellMax[2]; ++z)
+				{
+					u64 cellKey = GetCellKey(x, y, z);
+					m_entries[m_bucketCursors[GetBucket(cellKey)]++] = {cellKey, proxy};
+				}
+			}
+		}
+	}
+
+	m_gridValid = true;
+}
+
+void GridBroadphase::FindPairsInBuckets(u32 firstBucket, u32 endBucket, std::vector<ProxyPair> &pairs) const
+{
+	for(u32 bucket = firstBucket; bucket < endBucket; ++bucket)
+	{
+		u32 bucketEnd = m_bucketStarts[bucket + 1];
+		for(u32 entryNum = m_bucketStarts[bucket]; entryNum < bucketEnd; ++entryNum)
+		{
+			const CellEntry &entry = m_entries[entryNum];
+			GridProxy *proxy = entry.proxy;
+
+			for(u32 otherNum = entryNum + 1; otherNum < bucketEnd; ++otherNum)
+			{
+				const CellEntry &otherEntry = m_entries[otherNum];
+				GridProxy *other = otherEntry.proxy;
+				if(otherEntry.cellKey != entry.cellKey || !TestAabbAgainstAabb2(proxy->m_aabbMin, proxy->m_aabbMax, other->m_aabbMin, other->m_aabbMax))
+				{
+					continue;
+				}
+
+				// Both proxies share every cell of their overlap, count the pair in the lowest one only
+				u64 lowestSharedCell = GetCellKey(MAX(proxy->cellMin[0], other->cellMin[0]), MAX(proxy->cellMin[1], other->cellMin[1]), MAX(proxy->cellMin[2], other->cellMin[2]));
+				if(lowestSharedCell == entry.cellKey && m_pairCache->needsBroadphaseCollision(proxy, other))
+				{
+					pairs.emplace_back(proxy, other);
+				}
+			}
+		}
+	}
+}
+
+void GridBroadphase::FindLargeProxyPairs(u32 firstLarge, u32 endLarge, std::vector<ProxyPair> &pairs) const
+{
+	for(u32 largeNum = firstLarge; largeNum < endLarge; ++largeNum)
+	{
+		GridProxy *largeProxy = m_largeProxies[largeNum];
+		VisitProxies(GetCellRange(largeProxy->m_aabbMin, largeProxy->m_aabbMax), [this, largeProxy, &pairs](GridProxy *other) {
+			// Pairs of two large proxies are found by the one earlier in m_proxies
+			if(other == largeProxy || other->inert || (other->large && other->index < largeProxy->index))
+			{
+				return;
+			}
+
+			if(TestAabbAgainstAabb2(largeProxy->m_aabbMin, largeProxy->m_aabbMax, other->m_aabbMin, other->m_aabbMax) && m_pairCache->needsBroadphaseCollision(largeProxy, other))
+			{
+				pairs.emplace_back(largeProxy, other);
+			}
+		});
+	}
+}
+
+// Drops pairs whose AABBs have separated or whose filters no longer match
+struct RemoveSeparatedPairsCallback : btOverlapCallback
+{
+	const btOverlappingPairCache *pairCache;
+
+	bool processOverlap(btBroadphasePair &pair) override
+	{
+		return !TestAabbAgainstAabb2(pair.m_pProxy0->m_aabbMin, pair.m_pProxy0->m_aabbMax, pair.m_pProxy1->m_aabbMin, pair.m_pProxy1->m_aabbMax)
+			|| !pairCache->needsBroadphaseCollision(pair.m_pProxy0, pair.m_pProxy1);
+	}
+};
+
+struct FindPairsBody : btIParallelForBody
+{
+	const std::function<void(u32 chunk)> *findChunk;
+
+	void forLoop(int iBegin, int iEnd) const override
+	{
+		for(int chunk = iBegin; chunk < iEnd; ++chunk)
+		{
+			(*findChunk)((u32)chunk);
+		}
+	}
+};
+
+void GridBroadphase::calculateOverlappingPairs(btDispatcher *dispatcher)
+{
+	OPTICK_EVENT();
+
+	BuildGrid();
+
+	// Chunks are fixed by the grid's size rather than the thread count so the pairs merge in the same order every run
+	u32 bucketCount = (u32)m_bucketStarts.size() - 1;
+	u32 bucketChunks = MIN(maxPairChunks, MAX(bucketCount / bucketsPerChunk, 1u));
+	u32 largeChunks = MIN(maxLargeProxyChunks, (u32)m_largeProxies.size());
+	u32 chunkCount = bucketChunks + largeChunks;
+	m_chunkPairs.resize(chunkCount);
+
+	std::function<void(u32)> findChunk = [this, bucketCount, bucketChunks, largeChunks](u32 chunk) {
+		std::vector<ProxyPair> &pairs = m_chunkPairs[chunk];
+		pairs.clear();
+		if(chunk < bucketChunks)
+		{
+			FindPairsInBuckets(bucketCount * chunk / bucketChunks, bucketCount * (chunk + 1) / bucketChunks, pairs);
+		}
+		else
+		{
+			u32 largeChunk = chunk - bucketChunks;
+			u32 largeCount = (u32)m_largeProxies.size();
+			FindLargeProxyPairs(largeCount * largeChunk / largeChunks, largeCount * (largeChunk + 1) / largeChunks, pairs);
+		}
+	};
+
+	{
+		OPTICK_EVENT("FindPairs");
+		FindPairsBody body;
+		body.findChunk = &findChunk;
+		if(btGetTaskScheduler() && !btThreadsAreRunning())
+		{
+			btParallelFor(0, (int)chunkCount, 1, body);
+		}
+		else
+		{
+			body.forLoop(0, (int)chunkCount);
+		}
+	}
+
+	{
+		OPTICK_EVENT("UpdatePairCache");
+
+		RemoveSeparatedPairsCallback removeCallback;
+		removeCallback.pairCache = m_pairCache;
+		m_pairCache->processAllOverlappingPairs(&removeCallback, dispatcher);
+
+		// Already cached pairs are found and left as they are
+		for(const std::vector<ProxyPair> &pairs : m_chunkPairs)
+		{
+			for(const ProxyPair &pair : pairs)
+			{
+				m_pairCache->addOverlappingPair(pair.first, pair.second);
+			}
+		}
+	}
+}
+
+void GridBroadphase::getBroadphaseAabb(btVector3 &aabbMin, btVector3 &aabbMax) const
+{
+	aabbMin = m_boundsMin;
+	aabbMax = m_boundsMax;
+}
+
+void GridBroadphase::printStats()
+{
+	printf("GridBroadphase: %u proxies, %u large, %u cell entries in %u buckets, %d pairs\n", (u32)m_proxies.size(),
+		(u32)m_largeProxies.size(), (u32)m_entries.size(), (u32)m_bucketStarts.size() - 1, m_pairCache->getNumOverlappingPairs());
+}
@@ -0,0 +1,108 @@
+#pragma once
+
+#include "defines.h"
+
+// Before Bullet, its <math.h> resolves to ours while code/ is on the include path
+#include "math.h"
+#include "poolAllocator.h"
+
+#include "BulletCollision/BroadphaseCollision/btBroadphaseInterface.h"
+#include "BulletCollision/BroadphaseCollision/btBroadphaseProxy.h"
+
+#include <vector>
+
+class btOverlappingPairCache;
+
+// Uniform grid broadphase, rebuilt from scratch every calculateOverlappingPairs. Cells are hashed, so the grid has no
+// bounds and costs nothing for empty space. Each proxy is added to every cell its AABB touches and pairs are tested
+// per cell, only counting a pair in the cell holding the low corner of the two AABBs' overlap so it is found once.
+// Proxies touching more than maxCellsPerProxy cells stay out of the grid and look up the cells they cover instead. Proxies whose filter group
+// or mask is 0, like pooled bodies that are switched off, can't pair with anything and are left out of the grid.
+// Pair finding runs on Bullet's task scheduler when one is set, split into a fixed number of chunks that are merged
+// in order, so the pair cache is filled the same way on any thread count.
+// setAabb on a ghost object finds its new pairs straight away like the dynamic tree does, so a ghost can grow its
+// AABB and query its pair cache in the same step. Other proxies get theirs on the next calculateOverlappingPairs
+class GridBroadphase : public btBroadphaseInterface
+{
+public:
+	static constexpr u32 maxCellsPerProxy = 64;
+
+	GridBroadphase(r32 cellSize);
+	~GridBroadphase();
+
+	btBroadphaseProxy *createProxy(const btVector3 &aabbMin, const btVector3 &aabbMax, int shapeType, void *userPtr, int collisionFilterGroup, int collisionFilterMask, btDispatcher *dispatcher) override;
+	void destroyProxy(btBroadphaseProxy *proxy, btDispatcher *dispatcher) override;
+	void setAabb(btBroadphaseProxy *proxy, const btVector3 &aabbMin, const btVector3 &aabbMax, btDispatcher *dispatcher) override;
+	void getAabb(btBroadphaseProxy *proxy, btVector3 &aabbMin, btVector3 &aabbMax) const override;
+
+	void rayTest(const btVector3 &rayFrom, const btVector3 &rayTo, btBroadphaseRayCallback &rayCallback, const btVector3 &aabbMin = btVector3(0, 0, 0), const btVector3 &aabbMax = btVector3(0, 0, 0)) override;
+	void aabbTest(const btVector3 &aabbMin, const btVector3 &aabbMax, btBroadphaseAabbCallback &callback) override;
+
+	void calculateOverlappingPairs(btDispatcher *dispatcher) override;
+
+	btOverlappingPairCache *getOverlappingPairCache() override { return m_pairCache; }
+	const btOverlappingPairCache *getOverlappingPairCache() const override { return m_pairCache; }
+
+	void getBroadphaseAabb(btVector3 &aabbMin, btVector3 &aabbMax) const override;
+	void printStats() override;
+
+private:
+	struct GridProxy : btBroadphaseProxy
+	{
+		u32 index; // In m_proxies
+		s32 cellMin[3];
+		s32 cellMax[3];
+		bool large;
+		bool inert; // Filter group or mask is 0
+	};
+
+	struct CellEntry
+	{
+		u64 cellKey;
+		GridProxy *proxy;
+	};
+
+	struct CellRange
+	{
+		s32 min[3];
+		s32 max[3];
+		u64 cellCount;
+	};
+
+	using ProxyPair = std::pair<GridProxy *, GridProxy *>;
+
+	CellRange GetCellRange(const btVector3 &aabbMin, const btVector3 &aabbMax) const;
+	u32 GetBucket(u64 cellKey) const;
+
+	void BuildGrid();
+	void FindPairsInBuckets(u32 firstBucket, u32 endBucket, std::vector<ProxyPair> &pairs) const;
+	void FindLargeProxyPairs(u32 firstLarge, u32 endLarge, std::vector<ProxyPair> &pairs) const;
+
+	// Calls visit on every proxy whose cells might overlap the range, once each. Thread safe while the grid isn't
+	// being rebuilt
+	template<typename Visit>
+	void VisitProxies(const CellRange &range, Visit visit) const;
+
+	r32 m_cellSize;
+	r32 m_inverseCellSize;
+
+	btOverlappingPairCache *m_pairCache;
+
+	PoolAllocator m_proxyPool;
+	std::vector<GridProxy *> m_proxies;
+	std::vector<GridProxy *> m_largeProxies;
+	std::vector<GridProxy *> m_inertProxies;
+	s32 m_nextUniqueId = 1;
+
+	// Entries sorted by bucket, bucket b holds m_entries[m_bucketStarts[b], m_bucketStarts[b + 1])
+	std::vector<CellEntry> m_entries;
+	std::vector<u32> m_bucketStarts;
+	std::vector<u32> m_bucketCursors;
+	u32 m_bucketShift = 64;
+	bool m_gridValid = false; // Cleared when a proxy is destroyed, the entries would point at it
+
+	std::vector<std::vector<ProxyPair>> m_chunkPairs;
+
+	btVector3 m_boundsMin;
+	btVector3 m_boundsMax;
+};
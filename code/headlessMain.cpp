@@ -0,0 +1,395 @@
+#include "defines.h"
+
+#include "broadphaseBenchmark.h"
+#include "dedicatedServer.h"
+#include "game.h"
+#include "inputRecording.h"
+#include "inputScript.h"
+#include "physicsMemory.h"
+#include "worldSnapshot.h"
+
+#include <chrono>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Window-free entry point. Runs the simulation at a fixed timestep with scripted input so it can be
+// profiled on machines without a GPU, without vsync or rendering cost mixed into the timings.
+//
+// Usage: watermelon_headless [-frames N] [-dt seconds] [-seed N] [-script file] [-threads N] [-systemThreads N] [-telemetry file]
+//	[-bake packFile] [-broadphase tree|sweep|sweep32|grid] [-broadphaseBenchmark steps] [-asteroids N] [-simLod 0|1]
+//	[-record file] [-replay file] [-rollback frames] [-server clients] [-interest metres] [-latency ticks] [-loss fraction]
+//	[-debris N]
+// -threads N steps physics on N worker threads, 0 (default) keeps the single-threaded world
+// -systemThreads N runs the ECS systems across N extra worker threads
+// -telemetry file writes per-section p50/p95/p99/max frame times for each window of frames, as JSON if file ends
+// in .json and CSV otherwise
+// -bake packFile writes the asset pack without textures and exits
+// -broadphase picks the physics broadphase, the dynamic tree by default
+// -broadphaseBenchmark steps times that many physics steps of every broadphase at 1k, 10k and 100k bodies, then a batch
+// of ray and sphere sweep queries, and exits, using -threads and -seed. The 32 bit sweep at 100k bodies takes minutes to
+// set up and tear down
+// -asteroids N sets how many asteroids each streamed sector of the field holds, -simLod 0 keeps every asteroid fully simulated however far away it is
+// -record file writes the seed, config, dt, inputs and a state hash per frame to a binary log
+// -replay file runs a log's frames with its seed, config, dt and inputs, checking every frame's state hash against the
+// recorded one. Exits with 2 if they differ. Thread counts and -frames still apply, the rest of the options are ignored.
+// A log recorded with physics threads replays on the multithreaded world, with every hardware thread unless -threads
+// says otherwise
+// -rollback frames captures a snapshot of the world every frame and every that many frames restores the one from
+// that many frames back and simulates forward again, checking the state hash comes out the same. Exits with 2 if not.
+// Physics solves contacts in a canonical order while it is on, which a recording made at the same time keeps
+// -server clients runs as a dedicated server with no player of its own for that many bot clients over a loopback
+// transport, each flying the script from a different point. Clients are sent quantized, delta encoded transforms of
+// everything within -interest metres of their ship on each axis, -latency and -loss delay and drop packets. Prints tick
+// cost and bandwidth per client and exits with 2 if a client decoded anything other than what was sent. Recording,
+// replays and rollbacks don't apply
+// -debris N sets how many chunk bodies shattered asteroids can leave at once, the oldest are evicted past that. 0
+// leaves asteroids whole
+// Run from the data directory like the windowed build so the asteroid meshes resolve.
+
+struct HeadlessConfig
+{
+	u32 frames = 3600;
+	r32 dt = 1.0f / 60.0f;
+	u32 seed = 0;
+	u32 physicsThreads = 0;
+	u32 systemThreads = 0;
+	const char *scriptFile = nullptr;
+	const char *telemetryFile = nullptr;
+	const char *bakeFile = nullptr;
+	BroadphaseType broadphase = BroadphaseType::DYNAMIC_TREE;
+	u32 broadphaseBenchmarkSteps = 0;
+	u32 asteroidsPerSector = AsteroidFieldConfig().asteroidsPerSector;
+	bool simulationLod = true;
+	const char *recordFile = nullptr;
+	const char *replayFile = nullptr;
+	u32 rollbackFrames = 0;
+	u32 serverClients = 0;
+	r32 interestRadius = ReplicationConfig().interestRadius;
+	LoopbackConfig loopback;
+	u32 debrisCapacity = DebrisConfig().capacity;
+	bool framesGiven = false;
+};
+
+static bool ParseBroadphase(const char *name, BroadphaseType &broadphase)
+{
+	const BroadphaseType broadphases[] = {BroadphaseType::DYNAMIC_TREE, BroadphaseType::AXIS_SWEEP, BroadphaseType::AXIS_SWEEP_32, BroadphaseType::UNIFORM_GRID};
+	for(BroadphaseType type : broadphases)
+	{
+		if(strcmp(name, GetBroadphaseName(type)) == 0)
+		{
+			broadphase = type;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool ParseArgs(int argc, char **argv, HeadlessConfig &config)
+{
+	for(int argNum = 1; argNum < argc; ++argNum)
+	{
+		const char *arg = argv[argNum];
+		const char *value = (argNum + 1 < argc) ? argv[argNum + 1] : nullptr;
+		if(!value)
+		{
+			return false;
+		}
+
+		if(strcmp(arg, "-frames") == 0) { config.frames = (u32)strtoul(value, nullptr, 10); config.framesGiven = true; }
+		else if(strcmp(arg, "-dt") == 0) { config.dt = (r32)atof(value); }
+		else if(strcmp(arg, "-seed") == 0) { config.seed = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-script") == 0) { config.scriptFile = value; }
+		else if(strcmp(arg, "-threads") == 0) { config.physicsThreads = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-systemThreads") == 0) { config.systemThreads = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-telemetry") == 0) { config.telemetryFile = value; }
+		else if(strcmp(arg, "-bake") == 0) { config.bakeFile = value; }
+		else if(strcmp(arg, "-broadphase") == 0) { if(!ParseBroadphase(value, config.broadphase)) { return false; } }
+		else if(strcmp(arg, "-broadphaseBenchmark") == 0) { config.broadphaseBenchmarkSteps = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-asteroids") == 0) { config.asteroidsPerSector = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-simLod") == 0) { config.simulationLod = atoi(value) != 0; }
+		else if(strcmp(arg, "-record") == 0) { config.recordFile = value; }
+		else if(strcmp(arg, "-replay") == 0) { config.replayFile = value; }
+		else if(strcmp(arg, "-rollback") == 0) { config.rollbackFrames = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-server") == 0) { config.serverClients = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-interest") == 0) { config.interestRadius = (r32)atof(value); }
+		else if(strcmp(arg, "-latency") == 0) { config.loopback.latencyTicks = (u32)strtoul(value, nullptr, 10); }
+		else if(strcmp(arg, "-loss") == 0) { config.loopback.lossRate = (r32)atof(value); }
+		else if(strcmp(arg, "-debris") == 0) { config.debrisCapacity = (u32)strtoul(value, nullptr, 10); }
+		else { return false; }
+
+		++argNum;
+	}
+	return config.dt > 0.0f;
+}
+
+int main(int argc, char **argv)
+{
+	HeadlessConfig config;
+	if(!ParseArgs(argc, argv, config))
+	{
+		printf("Usage: %s [-frames N] [-dt seconds] [-seed N] [-script file] [-threads N] [-systemThreads N] [-telemetry file] [-bake packFile]"
+			" [-broadphase tree|sweep|sweep32|grid] [-broadphaseBenchmark steps] [-asteroids N] [-simLod 0|1] [-record file] [-replay file]"
+			" [-rollback frames] [-server clients] [-interest metres] [-latency ticks] [-loss fraction] [-debris N]\n", argv[0]);
+		return 1;
+	}
+
+	if(config.bakeFile)
+	{
+		return BakeAssetPack(config.bakeFile) ? 0 : 1;
+	}
+
+	if(config.broadphaseBenchmarkSteps)
+	{
+		RunBroadphaseBenchmarks(config.broadphaseBenchmarkSteps, config.physicsThreads, config.seed);
+		return 0;
+	}
+
+	InputReplay replay;
+	InputScript script;
+	if(config.replayFile)
+	{
+		if(!replay.LoadFromFile(config.replayFile))
+		{
+			printf("Failed to load replay %s\n", config.replayFile);
+			return 1;
+		}
+		config.frames = config.framesGiven ? MIN(config.frames, replay.GetFrameCount()) : replay.GetFrameCount();
+	}
+	else if(config.scriptFile)
+	{
+		if(!script.LoadFromFile(config.scriptFile))
+		{
+			printf("Failed to load input script %s\n", config.scriptFile);
+			return 1;
+		}
+	}
+	else
+	{
+		script = CreateDefaultInputScript();
+	}
+
+	using Clock = std::chrono::steady_clock;
+
+	Clock::time_point loadStart = Clock::now();
+	GameConfig gameConfig;
+	gameConfig.randomSeed = config.seed;
+	gameConfig.physics.multithreaded = config.physicsThreads > 0;
+	gameConfig.physics.workerCount = config.physicsThreads;
+	gameConfig.physics.broadphase = config.broadphase;
+	gameConfig.physics.canonicalPairOrder = config.rollbackFrames > 0; // A restore puts pairs back in a different order
+	gameConfig.asteroidField.asteroidsPerSector = config.asteroidsPerSector;
+	gameConfig.asteroidField.waitForSectors = true; // Same reason, sectors would otherwise spawn whenever their job finishes
+	gameConfig.simulationLod.enabled = config.simulationLod;
+	gameConfig.debris.capacity = config.debrisCapacity;
+	gameConfig.systemWorkerCount = config.systemThreads;
+	gameConfig.waitForAssets = true; // Keeps runs repeatable, hulls would otherwise swap in on whichever frame they finish
+	if(config.replayFile)
+	{
+		ApplyRecordingConfig(replay.GetConfig(), gameConfig);
+	}
+
+	if(config.serverClients)
+	{
+		DedicatedServerConfig serverConfig;
+		serverConfig.clientCount = config.serverClients;
+		serverConfig.frames = config.frames;
+		serverConfig.dt = config.dt;
+		serverConfig.replication.interestRadius = config.interestRadius;
+		serverConfig.loopback = config.loopback;
+		serverConfig.loopback.seed = config.seed;
+		return RunDedicatedServer(serverConfig, gameConfig, script) ? 0 : 2;
+	}
+
+	InputRecorder recorder;
+	if(config.recordFile && !recorder.Open(config.recordFile, GetRecordingConfig(gameConfig)))
+	{
+		printf("Failed to open %s for recording\n", config.recordFile);
+		return 1;
+	}
+
+	Game *game = new Game(gameConfig);
+	r64 loadSeconds = std::chrono::duration<r64>(Clock::now() - loadStart).count();
+
+	r64 longestFrameSeconds = 0.0;
+	u32 longestFrameNum = 0;
+	PhysicsStepStats longestFrameStats;
+	u32 replayMismatchFrame = U32_MAX;
+
+	// Room for a few rollbacks' worth so the keyframes get replaced along the way
+	SnapshotRing snapshotRing(MAX(config.rollbackFrames * 4, 1u));
+	WorldSnapshot snapshot;
+	std::vector<RecordedFrame> rollbackHistory;
+	u32 rollbackCount = 0;
+	u32 rollbackMismatches = 0;
+	u32 rollbackMismatchFrame = U32_MAX;
+	Clock::duration captureTotal = Clock::duration::zero();
+	Clock::duration captureMax = Clock::duration::zero();
+	Clock::duration restoreTotal = Clock::duration::zero();
+	Clock::duration restoreMax = Clock::duration::zero();
+	size_t snapshotBytesMax = 0;
+	size_t ringBytesMax = 0;
+
+	// Frame is normally timed by UpdateAndDraw
+	FrameTelemetry &telemetry = game->GetTelemetry();
+	const u32 frameSection = telemetry.AddSection("Frame");
+	std::vector<TelemetryWindow> telemetryWindows;
+	u64 windowStartFrame = 0;
+
+	Clock::time_point runStart = Clock::now();
+	for(u32 frameNum = 0; frameNum < config.frames; ++frameNum)
+	{
+		RecordedFrame frame;
+		frame.dt = config.dt;
+		if(config.replayFile)
+		{
+			frame = replay.GetFrame(frameNum);
+		}
+		else
+		{
+			frame.input = script.Next();
+		}
+
+		Clock::time_point frameStart = Clock::now();
+
+		game->SetShipInputs(frame.input);
+		game->Simulate(frame.dt);
+
+		Clock::duration frameTime = Clock::now() - frameStart;
+		telemetry.AddTime(frameSection, frameTime);
+		telemetry.EndFrame();
+
+		if(config.recordFile || config.replayFile)
+		{
+			u64 stateHash = ComputeStateHash(game->GetRegistry());
+			if(config.replayFile && stateHash != frame.stateHash && replayMismatchFrame == U32_MAX)
+			{
+				replayMismatchFrame = frameNum;
+			}
+			frame.stateHash = stateHash;
+			recorder.AddFrame(frame);
+		}
+
+		if(config.rollbackFrames)
+		{
+			rollbackHistory.push_back(frame);
+
+			Clock::time_point captureStart = Clock::now();
+			game->CaptureSnapshot(snapshot);
+			snapshotRing.Push(frameNum, snapshot);
+			Clock::duration captureTime = Clock::now() - captureStart;
+			captureTotal += captureTime;
+			captureMax = MAX(captureMax, captureTime);
+			snapshotBytesMax = MAX(snapshotBytesMax, snapshot.GetSize());
+			ringBytesMax = MAX(ringBytesMax, snapshotRing.GetStoredBytes());
+
+			if(frameNum >= config.rollbackFrames && (frameNum + 1) % config.rollbackFrames == 0)
+			{
+				u64 stateHash = ComputeStateHash(game->GetRegistry());
+				u32 restoreFrame = frameNum - config.rollbackFrames;
+
+				Clock::time_point restoreStart = Clock::now();
+				bool restored = snapshotRing.Get(restoreFrame, snapshot);
+				Assert(restored);
+				UNUSED(restored);
+				game->RestoreSnapshot(snapshot);
+				Clock::duration restoreTime = Clock::now() - restoreStart;
+				restoreTotal += restoreTime;
+				restoreMax = MAX(restoreMax, restoreTime);
+
+				game->Resimulate(std::span<const RecordedFrame>(rollbackHistory.data() + restoreFrame + 1, config.rollbackFrames), &snapshotRing, restoreFrame + 1);
+				++rollbackCount;
+				if(ComputeStateHash(game->GetRegistry()) != stateHash)
+				{
+					++rollbackMismatches;
+					rollbackMismatchFrame = MIN(rollbackMismatchFrame, frameNum);
+				}
+			}
+		}
+
+		bool lastFrame = frameNum + 1 == config.frames;
+		u32 windowFrames = (u32)(telemetry.GetFrameCount() - windowStartFrame);
+		if(config.telemetryFile && (windowFrames == FrameTelemetry::windowSize || lastFrame))
+		{
+			TelemetryWindow window;
+			window.firstFrame = windowStartFrame;
+			window.frameCount = windowFrames;
+			telemetry.BuildReports(window.reports, windowFrames);
+			telemetryWindows.push_back(std::move(window));
+			windowStartFrame = telemetry.GetFrameCount();
+		}
+
+		r64 frameSeconds = std::chrono::duration<r64>(frameTime).count();
+		if(frameSeconds > longestFrameSeconds)
+		{
+			longestFrameSeconds = frameSeconds;
+			longestFrameNum = frameNum;
+			longestFrameStats = game->GetPhysics()->GetStepStats();
+		}
+	}
+	r64 runSeconds = std::chrono::duration<r64>(Clock::now() - runStart).count();
+
+	PhysicsMemoryStats memoryStats = GetPhysicsMemoryStats();
+	const AsteroidField &asteroidField = game->GetAsteroidField();
+	u32 asteroidCount = asteroidField.GetAsteroidCount();
+	u32 sectorCount = asteroidField.GetLoadedSectorCount();
+	const DebrisPool &debris = game->GetDebris();
+	u32 debrisCounts[] = {debris.GetActiveCount(), debris.GetShatterCount(), debris.GetEvictedCount()};
+	const SimulationLod &simulationLod = game->GetSimulationLod();
+	u32 tierCounts[] = {simulationLod.GetTierCount(SimulationTier::DYNAMIC), simulationLod.GetTierCount(SimulationTier::REDUCED_RATE),
+		simulationLod.GetTierCount(SimulationTier::ON_RAILS)};
+
+	if(config.telemetryFile && !WriteTelemetry(config.telemetryFile, telemetryWindows))
+	{
+		printf("Failed to write telemetry to %s\n", config.telemetryFile);
+	}
+
+	delete game;
+
+	if(config.recordFile && !recorder.Close())
+	{
+		printf("Failed to write the recording to %s\n", config.recordFile);
+	}
+
+	printf("Load: %.3f ms\n", loadSeconds * 1000.0);
+	printf("Simulated %u frames in %.3f ms (avg %.4f ms, max %.4f ms)\n", config.frames, runSeconds * 1000.0,
+		config.frames ? (runSeconds * 1000.0) / config.frames : 0.0, longestFrameSeconds * 1000.0);
+	printf("Slowest frame %u: %u active and %u sleeping bodies, %u pairs, %u manifolds, %u contacts, %u touching pairs, %u solver calls, %u solver iterations\n",
+		longestFrameNum, longestFrameStats.activeBodies, longestFrameStats.sleepingBodies, longestFrameStats.overlappingPairs,
+		longestFrameStats.manifolds, longestFrameStats.contactPoints, longestFrameStats.touchingPairs,
+		longestFrameStats.solverCalls, longestFrameStats.solverIterations);
+	printf("Asteroid field at the end: %u asteroids in %u sectors\n", asteroidCount, sectorCount);
+	printf("Simulation LOD at the end: %u dynamic, %u reduced rate, %u on rails\n", tierCounts[0], tierCounts[1], tierCounts[2]);
+	printf("Debris at the end: %u chunks, from %u asteroids shattered, %u evicted\n", debrisCounts[0], debrisCounts[1], debrisCounts[2]);
+	if(config.replayFile)
+	{
+		if(replayMismatchFrame == U32_MAX)
+		{
+			printf("Replay matched the recorded state on all %u frames\n", config.frames);
+		}
+		else
+		{
+			printf("Replay diverged from the recording at frame %u\n", replayMismatchFrame);
+		}
+	}
+	if(config.rollbackFrames)
+	{
+		auto toMs = [](Clock::duration time) { return std::chrono::duration<r64, std::milli>(time).count(); };
+		printf("Snapshots: capture avg %.4f ms, max %.4f ms, up to %.1f KB each, ring of %u frames up to %.1f KB\n",
+			config.frames ? toMs(captureTotal) / config.frames : 0.0, toMs(captureMax), snapshotBytesMax / 1024.0,
+			snapshotRing.GetCapacity(), ringBytesMax / 1024.0);
+		printf("Rollbacks: restore avg %.4f ms, max %.4f ms\n", rollbackCount ? toMs(restoreTotal) / rollbackCount : 0.0, toMs(restoreMax));
+		if(rollbackMismatches)
+		{
+			printf("%u of %u rollbacks of %u frames diverged, the first at frame %u\n", rollbackMismatches, rollbackCount, config.rollbackFrames, rollbackMismatchFrame);
+		}
+		else
+		{
+			printf("All %u rollbacks of %u frames re-simulated to the same state\n", rollbackCount, config.rollbackFrames);
+		}
+	}
+	printf("Physics memory: %.1f KB in use, %.1f KB peak, %.1f KB reserved in %u arenas\n", memoryStats.bytesInUse / 1024.0,
+		memoryStats.peakHighWater / 1024.0, memoryStats.bytesReserved / 1024.0, memoryStats.arenaCount);
+
+	return (replayMismatchFrame == U32_MAX && rollbackMismatches == 0) ? 0 : 2;
+}
@@ -0,0 +1,217 @@
+#include "hullCooker.h"
+
+#include "LinearMath/btConvexHullComputer.h"
+
+#include <filesystem>
+#include <math.h>
+#include <stdio.h>
+#include <string>
+
+constexpr u32 hullCacheMagic = 0x4C4C5548; // "HULL"
+constexpr u32 hullCacheVersion = 1;
+
+struct HullCacheHeader
+{
+	u32 magic;
+	u32 version;
+	u64 sourceHash;
+	u32 vertexCount;
+	u32 pad;
+};
+
+// FNV-1a over the raw positions. Only the x, y, z floats are hashed, btVector3's fourth lane is padding
+static u64 HashHullSource(const btVector3 *points, u32 pointCount, u32 maxVertices)
+{
+	u64 hash = 14695981039346656037ULL;
+	auto hashBytes = [&hash](const void *data, size_t size) {
+		const u8 *bytes = (const u8 *)data;
+		for(size_t byteNum = 0; byteNum < size; ++byteNum)
+		{
+			hash ^= bytes[byteNum];
+			hash *= 1099511628211ULL;
+		}
+	};
+
+	hashBytes(&hullCacheVersion, sizeof(hullCacheVersion));
+	hashBytes(&maxVertices, sizeof(maxVertices));
+	for(u32 pointNum = 0; pointNum < pointCount; ++pointNum)
+	{
+		r32 xyz[3] = {points[pointNum].x(), points[pointNum].y(), points[pointNum].z()};
+		hashBytes(xyz, sizeof(xyz));
+	}
+	return hash;
+}
+
+static std::string GetCachePath(const char *cacheDirectory, u64 sourceHash)
+{
+	char fileName[32];
+	snprintf(fileName, sizeof(fileName), "%016llx.hull", (unsigned long long)sourceHash);
+	return (std::filesystem::path(cacheDirectory) / fileName).string();
+}
+
+// The count comes from disk, so it is checked against maxVertices and the file's length before anything is allocated.
+// A degenerate hull that kept more points than maxVertices is never loaded and just gets cooked again
+static bool LoadCachedHull(const std::string &path, u64 sourceHash, u32 maxVertices, CookedHull &hull)
+{
+	std::error_code error;
+	uintmax_t fileSize = std::filesystem::file_size(path, error);
+	if(error)
+	{
+		return false;
+	}
+
+	FILE *file = fopen(path.c_str(), "rb");
+	if(!file)
+	{
+		return false;
+	}
+
+	HullCacheHeader header = {};
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == hullCacheMagic
+		&& header.version == hullCacheVersion && header.sourceHash == sourceHash && header.vertexCount > 0
+		&& header.vertexCount <= maxVertices;
+
+	size_t coordCount = (size_t)header.vertexCount * 3;
+	valid = valid && coordCount * sizeof(r32) <= fileSize - sizeof(header);
+
+	if(valid)
+	{
+		std::vector<r32> coords(coordCount);
+		valid = fread(coords.data(), sizeof(r32), coords.size(), file) == coords.size();
+		if(valid)
+		{
+			hull.points.resize(header.vertexCount);
+			for(u32 vertexNum = 0; vertexNum < header.vertexCount; ++vertexNum)
+			{
+				hull.points[vertexNum] = btVector3(coords[vertexNum * 3], coords[vertexNum * 3 + 1], coords[vertexNum * 3 + 2]);
+			}
+			hull.fromCache = true;
+		}
+	}
+
+	fclose(file);
+	return valid;
+}
+
+static void SaveCachedHull(const std::string &path, u64 sourceHash, const CookedHull &hull)
+{
+	std::error_code error;
+	std::filesystem::create_directories(std::filesystem::path(path).parent_path(), error);
+
+	// Written under a temporary name first so a cache file is never seen half written
+	std::string tempPath = path + ".tmp";
+	FILE *file = fopen(tempPath.c_str(), "wb");
+	if(!file)
+	{
+		return;
+	}
+
+	HullCacheHeader header = {};
+	header.magic = hullCacheMagic;
+	header.version = hullCacheVersion;
+	header.sourceHash = sourceHash;
+	header.vertexCount = (u32)hull.points.size();
+
+	std::vector<r32> coords;
+	coords.reserve(hull.points.size() * 3);
+	for(const btVector3 &point : hull.points)
+	{
+		coords.push_back(point.x());
+		coords.push_back(point.y());
+		coords.push_back(point.z());
+	}
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(coords.data(), sizeof(r32), coords.size(), file) == coords.size();
+	fclose(file);
+
+	if(written)
+	{
+		std::filesystem::rename(tempPath, path, error);
+	}
+	else
+	{
+		std::filesystem::remove(tempPath, error);
+	}
+}
+
+CookedHull CookHull(const btVector3 *points, u32 pointCount, u32 maxVertices)
+{
+	OPTICK_EVENT();
+
+	Assert(pointCount > 0 && maxVertices >= 4);
+
+	// Drops duplicates and interior points, leaving one vertex per hull corner
+	btConvexHullComputer hullComputer;
+	hullComputer.compute(&points[0].x(), (int)sizeof(btVector3), (int)pointCount, 0.0f, 0.0f);
+
+	CookedHull hull;
+	u32 hullVertexCount = (u32)hullComputer.vertices.size();
+	if(hullVertexCount == 0)
+	{
+		hull.points.assign(points, points + pointCount);
+		return hull;
+	}
+
+	if(hullVertexCount <= maxVertices)
+	{
+		hull.points.assign(&hullComputer.vertices[0], &hullComputer.vertices[0] + hullVertexCount);
+		return hull;
+	}
+
+	// Support vertex along each of maxVertices directions spread over a sphere with a Fibonacci spiral.
+	// Nearby directions often pick the same corner, those are only kept once
+	std::vector<bool> picked(hullVertexCount, false);
+	const r32 goldenAngle = _PI * (3.0f - sqrtf(5.0f));
+	for(u32 directionNum = 0; directionNum < maxVertices; ++directionNum)
+	{
+		r32 y = 1.0f - 2.0f * (directionNum + 0.5f) / maxVertices;
+		r32 radius = sqrtf(1.0f - y * y);
+		r32 angle = goldenAngle * directionNum;
+		btVector3 direction(cosf(angle) * radius, y, sinf(angle) * radius);
+
+		u32 bestVertex = 0;
+		r32 bestDot = -R32_MAX;
+		for(u32 vertexNum = 0; vertexNum < hullVertexCount; ++vertexNum)
+		{
+			r32 dot = direction.dot(hullComputer.vertices[vertexNum]);
+			if(dot > bestDot)
+			{
+				bestDot = dot;
+				bestVertex = vertexNum;
+			}
+		}
+
+		if(!picked[bestVertex])
+		{
+			picked[bestVertex] = true;
+			hull.points.push_back(hullComputer.vertices[bestVertex]);
+		}
+	}
+
+	return hull;
+}
+
+CookedHull CookHullCached(const HullSource &source, const HullCookingConfig &config)
+{
+	CookedHull hull;
+	if(source.points.empty())
+	{
+		return hull;
+	}
+
+	u64 sourceHash = HashHullSource(source.points.data(), (u32)source.points.size(), config.maxVertices);
+	std::string cachePath = config.cacheDirectory ? GetCachePath(config.cacheDirectory, sourceHash) : std::string();
+
+	if(!cachePath.empty() && LoadCachedHull(cachePath, sourceHash, config.maxVertices, hull))
+	{
+		return hull;
+	}
+
+	hull = CookHull(source.points.data(), (u32)source.points.size(), config.maxVertices);
+
+	if(!cachePath.empty())
+	{
+		SaveCachedHull(cachePath, sourceHash, hull);
+	}
+	return hull;
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+
+#include <vector>
+
+struct HullCookingConfig
+{
+	u32 maxVertices = 48;
+	const char *cacheDirectory = "cache/hulls"; // Relative to the working directory, null disables the cache
+};
+
+struct HullSource
+{
+	std::vector<btVector3> points; // Raw mesh positions, duplicates and interior points are fine
+};
+
+struct CookedHull
+{
+	std::vector<btVector3> points; // Hull vertices only, at most HullCookingConfig::maxVertices
+	bool fromCache = false;
+};
+
+// Keeps only the vertices on the convex hull of points, then if there are still more than maxVertices keeps the ones
+// furthest along maxVertices evenly spread directions. The reduced hull always fits inside the full one
+CookedHull CookHull(const btVector3 *points, u32 pointCount, u32 maxVertices);
+
+// Loads the hull from the cache, or cooks it and writes it to the cache. Empty sources give an empty hull
+CookedHull CookHullCached(const HullSource &source, const HullCookingConfig &config = HullCookingConfig());
+
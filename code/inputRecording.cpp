@@ -0,0 +1,188 @@
+#include "inputRecording.h"
+
+constexpr u32 recordingMagic = 0x43455257; // "WREC"
+constexpr u32 recordingVersion = 3;
+
+struct RecordingHeader
+{
+	u32 magic;
+	u32 version;
+	RecordingConfig config;
+};
+
+// Each record starts with these flags, followed by the values they mark and then the state hash
+constexpr u16 frameDtChanged = 1 << ShipInput::ACTION_TOTAL;
+static_assert(ShipInput::ACTION_TOTAL < 16, "Changed inputs and dt have to fit a record's flags");
+
+RecordingConfig GetRecordingConfig(const GameConfig &config)
+{
+	RecordingConfig recording;
+	recording.randomSeed = config.randomSeed;
+	recording.asteroidsPerSector = config.asteroidField.asteroidsPerSector;
+	recording.broadphase = (u32)config.physics.broadphase;
+	recording.simulationLod = config.simulationLod.enabled ? 1 : 0;
+	recording.multithreadedPhysics = config.physics.multithreaded ? 1 : 0;
+	recording.canonicalPairOrder = config.physics.canonicalPairOrder ? 1 : 0;
+	recording.debrisCapacity = config.debris.capacity;
+	return recording;
+}
+
+void ApplyRecordingConfig(const RecordingConfig &recording, GameConfig &config)
+{
+	config.randomSeed = recording.randomSeed;
+	config.asteroidField.asteroidsPerSector = recording.asteroidsPerSector;
+	config.physics.broadphase = (BroadphaseType)recording.broadphase;
+	config.simulationLod.enabled = recording.simulationLod != 0;
+	config.physics.multithreaded = recording.multithreadedPhysics != 0;
+	config.physics.canonicalPairOrder = recording.canonicalPairOrder != 0;
+	config.debris.capacity = recording.debrisCapacity;
+}
+
+u64 ComputeStateHash(entt::registry &registry)
+{
+	OPTICK_EVENT();
+
+	u64 hash = 14695981039346656037ULL;
+	auto hashBytes = [&hash](const void *data, size_t size) {
+		const u8 *bytes = (const u8 *)data;
+		for(size_t byteNum = 0; byteNum < size; ++byteNum)
+		{
+			hash ^= bytes[byteNum];
+			hash *= 1099511628211ULL;
+		}
+	};
+
+	auto view = registry.view<const Transform>();
+	view.each([&hashBytes](entt::entity entity, const Transform &transform) {
+		// btVector3's fourth lane is padding and isn't always written
+		r32 values[7] = {transform.translation.x(), transform.translation.y(), transform.translation.z(),
+			transform.rotation.x(), transform.rotation.y(), transform.rotation.z(), transform.rotation.w()};
+		hashBytes(&entity, sizeof(entity));
+		hashBytes(values, sizeof(values));
+	});
+	return hash;
+}
+
+InputRecorder::~InputRecorder()
+{
+	Close();
+}
+
+bool InputRecorder::Open(const char *fileName, const RecordingConfig &config)
+{
+	Close();
+
+	m_file = fopen(fileName, "wb");
+	if(!m_file)
+	{
+		return false;
+	}
+
+	RecordingHeader header = {};
+	header.magic = recordingMagic;
+	header.version = recordingVersion;
+	header.config = config;
+	m_failed = fwrite(&header, sizeof(header), 1, m_file) != 1;
+
+	m_lastFrame = RecordedFrame();
+	m_frameCount = 0;
+	return !m_failed;
+}
+
+void InputRecorder::AddFrame(const RecordedFrame &frame)
+{
+	if(!m_file)
+	{
+		return;
+	}
+
+	u16 flags = 0;
+	r32 values[ShipInput::ACTION_TOTAL + 1];
+	u32 valueCount = 0;
+
+	if(frame.dt != m_lastFrame.dt)
+	{
+		flags |= frameDtChanged;
+		values[valueCount++] = frame.dt;
+	}
+	for(u32 action = 0; action < ShipInput::ACTION_TOTAL; ++action)
+	{
+		if(frame.input.inputs[action] != m_lastFrame.input.inputs[action])
+		{
+			flags |= 1 << action;
+			values[valueCount++] = frame.input.inputs[action];
+		}
+	}
+
+	bool written = fwrite(&flags, sizeof(flags), 1, m_file) == 1;
+	written = written && (valueCount == 0 || fwrite(values, sizeof(r32), valueCount, m_file) == valueCount);
+	written = written && fwrite(&frame.stateHash, sizeof(frame.stateHash), 1, m_file) == 1;
+	m_failed |= !written;
+
+	m_lastFrame = frame;
+	++m_frameCount;
+}
+
+bool InputRecorder::Close()
+{
+	if(!m_file)
+	{
+		return !m_failed;
+	}
+
+	m_failed |= fclose(m_file) != 0;
+	m_file = nullptr;
+	return !m_failed;
+}
+
+bool InputReplay::LoadFromFile(const char *fileName)
+{
+	OPTICK_EVENT();
+
+	m_frames.clear();
+
+	FILE *file = fopen(fileName, "rb");
+	if(!file)
+	{
+		return false;
+	}
+
+	RecordingHeader header;
+	bool valid = fread(&header, sizeof(header), 1, file) == 1 && header.magic == recordingMagic && header.version == recordingVersion;
+
+	// Applied to the config as is, so anything that isn't a broadphase would leave the world without one
+	valid = valid && header.config.broadphase <= (u32)BroadphaseType::UNIFORM_GRID;
+	if(valid)
+	{
+		m_config = header.config;
+	}
+
+	// A log cut short by a crash still replays up to its last whole frame
+	RecordedFrame frame;
+	u16 flags;
+	while(valid && fread(&flags, sizeof(flags), 1, file) == 1)
+	{
+		if((flags & frameDtChanged) && fread(&frame.dt, sizeof(frame.dt), 1, file) != 1)
+		{
+			break;
+		}
+
+		bool complete = true;
+		for(u32 action = 0; action < ShipInput::ACTION_TOTAL && complete; ++action)
+		{
+			if(flags & (1 << action))
+			{
+				complete = fread(&frame.input.inputs[action], sizeof(r32), 1, file) == 1;
+			}
+		}
+		if(!complete || fread(&frame.stateHash, sizeof(frame.stateHash), 1, file) != 1)
+		{
+			break;
+		}
+
+		m_frames.push_back(frame);
+	}
+
+	fclose(file);
+	return valid;
+}
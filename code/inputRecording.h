@@ -0,0 +1,72 @@
+#pragma once
+
+#include "defines.h"
+
+#include "game.h"
+
+#include <stdio.h>
+#include <vector>
+
+// The parts of GameConfig a replay needs to build the same world. Thread counts are left as the replaying side has
+// them, changing them must not change the results and a replay is how that gets checked. Whether physics is
+// multithreaded is recorded though, Bullet's multithreaded world gives different results to the single threaded one.
+// So does canonical pair order
+struct RecordingConfig
+{
+	u32 randomSeed = 0;
+	u32 asteroidsPerSector = 0;
+	u32 broadphase = 0; // BroadphaseType
+	u32 simulationLod = 1;
+	u32 multithreadedPhysics = 0;
+	u32 canonicalPairOrder = 0;
+	u32 debrisCapacity = 0;
+};
+
+RecordingConfig GetRecordingConfig(const GameConfig &config);
+void ApplyRecordingConfig(const RecordingConfig &recording, GameConfig &config);
+
+struct RecordedFrame
+{
+	r32 dt = 0.0f;
+	ShipInput input;
+	u64 stateHash = 0; // ComputeStateHash after the frame was simulated
+};
+
+// FNV-1a over every entity's Transform, in storage order, so any difference in where things are or in the order they
+// were created and destroyed changes it
+u64 ComputeStateHash(entt::registry &registry);
+
+// Writes a compact binary log of a session, a header with the RecordingConfig then one record per frame. A record
+// only holds the inputs and dt that changed since the frame before, plus the state hash
+class InputRecorder
+{
+public:
+	~InputRecorder();
+
+	bool Open(const char *fileName, const RecordingConfig &config);
+	void AddFrame(const RecordedFrame &frame);
+	bool Close(); // False if anything failed to write
+
+	u32 GetFrameCount() const { return m_frameCount; }
+
+private:
+	FILE *m_file = nullptr;
+	RecordedFrame m_lastFrame;
+	u32 m_frameCount = 0;
+	bool m_failed = false;
+};
+
+// Reads a log written by InputRecorder, all of it up front
+class InputReplay
+{
+public:
+	bool LoadFromFile(const char *fileName);
+
+	const RecordingConfig &GetConfig() const { return m_config; }
+	u32 GetFrameCount() const { return (u32)m_frames.size(); }
+	const RecordedFrame &GetFrame(u32 frameNum) const { return m_frames[frameNum]; }
+
+private:
+	RecordingConfig m_config;
+	std::vector<RecordedFrame> m_frames;
+};
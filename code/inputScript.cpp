@@ -0,0 +1,89 @@
+#include "inputScript.h"
+
+#include <stdio.h>
+
+void InputScript::AddStep(u32 frames, const ShipInput &input)
+{
+	Assert(frames > 0);
+	Step step;
+	step.frames = frames;
+	step.input = input;
+	m_steps.push_back(step);
+}
+
+bool InputScript::LoadFromFile(const char *fileName)
+{
+	FILE *file = fopen(fileName, "r");
+	if(!file)
+	{
+		return false;
+	}
+
+	char line[256];
+	while(fgets(line, sizeof(line), file))
+	{
+		if(line[0] == '#')
+		{
+			continue;
+		}
+
+		u32 frames = 0;
+		ShipInput input;
+		r32 *inputs = input.inputs;
+		s32 valuesRead = sscanf(line, "%u %f %f %f %f %f %f %f %f", &frames,
+			&inputs[ShipInput::THRUST_X], &inputs[ShipInput::THRUST_Y], &inputs[ShipInput::THRUST_Z],
+			&inputs[ShipInput::PITCH], &inputs[ShipInput::YAW], &inputs[ShipInput::ROLL],
+			&inputs[ShipInput::FIRE], &inputs[ShipInput::ALT_FIRE]);
+
+		// Trailing values can be left off and stay zero
+		if(valuesRead >= 1 && frames > 0)
+		{
+			AddStep(frames, input);
+		}
+	}
+	fclose(file);
+
+	return !m_steps.empty();
+}
+
+ShipInput InputScript::Next()
+{
+	if(m_steps.empty())
+	{
+		return ShipInput();
+	}
+
+	ShipInput input = m_steps[m_stepIndex].input;
+
+	++m_stepFrame;
+	if(m_stepFrame >= m_steps[m_stepIndex].frames)
+	{
+		m_stepFrame = 0;
+		m_stepIndex = (m_stepIndex + 1) % (u32)m_steps.size();
+	}
+
+	return input;
+}
+
+InputScript CreateDefaultInputScript()
+{
+	InputScript script;
+
+	ShipInput forward;
+	forward.inputs[ShipInput::THRUST_Z] = -1.0f;
+	script.AddStep(120, forward);
+
+	ShipInput turnAndFire = forward;
+	turnAndFire.inputs[ShipInput::YAW] = 1.0f;
+	turnAndFire.inputs[ShipInput::FIRE] = 1.0f;
+	script.AddStep(1, turnAndFire);
+	turnAndFire.inputs[ShipInput::FIRE] = 0.0f;
+	script.AddStep(29, turnAndFire);
+
+	ShipInput climbAndRoll = forward;
+	climbAndRoll.inputs[ShipInput::PITCH] = 1.0f;
+	climbAndRoll.inputs[ShipInput::ROLL] = 1.0f;
+	script.AddStep(60, climbAndRoll);
+
+	return script;
+}
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "defines.h"
+
+#include "game.h"
+
+#include <vector>
+
+// Feeds the ship a fixed sequence of inputs, each held for a number of frames. Stands in for live raylib input
+// when running without a window, so a run can be repeated exactly.
+class InputScript
+{
+public:
+	struct Step
+	{
+		u32 frames = 1;
+		ShipInput input;
+	};
+
+	void AddStep(u32 frames, const ShipInput &input);
+
+	// One step per line: "frames thrustX thrustY thrustZ pitch yaw roll fire altFire". Lines starting with # are skipped
+	bool LoadFromFile(const char *fileName);
+
+	// Returns the input for the current frame and moves on. Loops back to the start once the script runs out
+	ShipInput Next();
+
+	bool IsEmpty() const { return m_steps.empty(); }
+
+private:
+	std::vector<Step> m_steps;
+	u32 m_stepIndex = 0;
+	u32 m_stepFrame = 0;
+};
+
+// Flies forward through the field while turning and firing, used when no script file is given
+InputScript CreateDefaultInputScript();
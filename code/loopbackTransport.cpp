@@ -0,0 +1,80 @@
+#include "loopbackTransport.h"
+
+LoopbackTransport::LoopbackTransport(const LoopbackConfig &config)
+	: m_config(config), m_random(RandomStream::MixSeed(config.seed, 0))
+{
+}
+
+u32 LoopbackTransport::Connect()
+{
+	m_clientQueues.emplace_back();
+	m_stats.emplace_back();
+	return (u32)m_clientQueues.size() - 1;
+}
+
+void LoopbackTransport::SendToServer(u32 connection, std::span<const u8> packet)
+{
+	LinkStats &stats = m_stats[connection];
+	stats.bytesToServer += packet.size();
+	++stats.packetsToServer;
+	Send(m_serverQueue, connection, packet);
+}
+
+void LoopbackTransport::SendToClient(u32 connection, std::span<const u8> packet)
+{
+	LinkStats &stats = m_stats[connection];
+	stats.bytesToClient += packet.size();
+	++stats.packetsToClient;
+	Send(m_clientQueues[connection], connection, packet);
+}
+
+void LoopbackTransport::Send(std::deque<Packet> &queue, u32 connection, std::span<const u8> packet)
+{
+	if(m_config.lossRate > 0.0f && m_random.Float(0.0f, 1.0f) < m_config.lossRate)
+	{
+		++m_stats[connection].packetsDropped;
+		return;
+	}
+
+	Packet &queued = queue.emplace_back();
+	queued.connection = connection;
+	queued.deliveryTick = m_tick + m_config.latencyTicks;
+	if(!m_freeBuffers.empty())
+	{
+		queued.data.swap(m_freeBuffers.back());
+		m_freeBuffers.pop_back();
+	}
+	queued.data.assign(packet.begin(), packet.end());
+}
+
+void LoopbackTransport::Tick()
+{
+	++m_tick;
+}
+
+bool LoopbackTransport::ReceiveOnServer(u32 &connection, std::vector<u8> &packet)
+{
+	return Receive(m_serverQueue, connection, packet);
+}
+
+bool LoopbackTransport::ReceiveOnClient(u32 connection, std::vector<u8> &packet)
+{
+	u32 sender;
+	return Receive(m_clientQueues[connection], sender, packet);
+}
+
+// Every packet has the same latency, so the oldest is always at the front
+bool LoopbackTransport::Receive(std::deque<Packet> &queue, u32 &connection, std::vector<u8> &packet)
+{
+	if(queue.empty() || queue.front().deliveryTick > m_tick)
+	{
+		return false;
+	}
+
+	Packet &received = queue.front();
+	connection = received.connection;
+	packet.swap(received.data);
+	m_freeBuffers.push_back(std::move(received.data));
+	queue.pop_front();
+	return true;
+}
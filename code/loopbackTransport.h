@@ -0,0 +1,70 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+
+#include <deque>
+#include <span>
+#include <vector>
+
+struct LoopbackConfig
+{
+	u32 latencyTicks = 0; // Packets become receivable this many Ticks after they were sent
+	r32 lossRate = 0.0f; // Fraction of packets dropped, in either direction
+	u64 seed = 0; // Picks which packets are dropped
+};
+
+// Per connection totals, counted as packets are sent. Dropped packets still count as sent
+struct LinkStats
+{
+	u64 bytesToClient = 0;
+	u64 bytesToServer = 0;
+	u32 packetsToClient = 0;
+	u32 packetsToServer = 0;
+	u32 packetsDropped = 0;
+};
+
+// Unreliable, ordered packet delivery between a server and its clients inside one process, standing in for sockets
+// so a server and bot clients can run headless together. Latency and loss are simulated per packet
+class LoopbackTransport
+{
+public:
+	LoopbackTransport(const LoopbackConfig &config = LoopbackConfig());
+
+	// Returns the new connection's number, numbers count up from 0
+	u32 Connect();
+	u32 GetConnectionCount() const { return (u32)m_clientQueues.size(); }
+
+	void SendToServer(u32 connection, std::span<const u8> packet);
+	void SendToClient(u32 connection, std::span<const u8> packet);
+
+	// Moves time on by a tick, delivering whatever has waited out the latency
+	void Tick();
+
+	// Pops the oldest packet that has arrived, replacing the contents of packet. False when none have
+	bool ReceiveOnServer(u32 &connection, std::vector<u8> &packet);
+	bool ReceiveOnClient(u32 connection, std::vector<u8> &packet);
+
+	const LinkStats &GetStats(u32 connection) const { return m_stats[connection]; }
+
+private:
+	struct Packet
+	{
+		u32 connection;
+		u64 deliveryTick;
+		std::vector<u8> data;
+	};
+
+	void Send(std::deque<Packet> &queue, u32 connection, std::span<const u8> packet);
+	bool Receive(std::deque<Packet> &queue, u32 &connection, std::vector<u8> &packet);
+
+	LoopbackConfig m_config;
+	RandomStream m_random;
+	u64 m_tick = 0;
+
+	std::deque<Packet> m_serverQueue;
+	std::vector<std::deque<Packet>> m_clientQueues; // Indexed by connection
+	std::vector<LinkStats> m_stats; // Indexed by connection
+	std::vector<std::vector<u8>> m_freeBuffers; // Data of received packets, reused by later sends
+};
@@ -1,10 +1,14 @@
 #include "defines.h"
 
 #include "game.h"
+#include "inputRecording.h"
 
 #include "raylib.h"
 #include "raymath.h"
 
+#include <string.h>
+#include <thread>
+
 #if defined(PLATFORM_WEB)
 #include <emscripten/emscripten.h>
 #endif
@@ -17,8 +21,17 @@ static void UpdateAndDrawWeb(void *context)
 }
 #endif
 
-int main(void)
+int main(int argc, char **argv)
 {
+	// -bake <pack file> writes the asset pack from the data directory and exits without opening a window
+	if(argc == 3 && strcmp(argv[1], "-bake") == 0)
+	{
+		return BakeAssetPack(argv[2]) ? 0 : 1;
+	}
+
+	// -record <file> logs the session for watermelon_headless -replay
+	const char *recordFile = (argc == 3 && strcmp(argv[1], "-record") == 0) ? argv[2] : nullptr;
+
 	OPTICK_START_CAPTURE();
 
 	Raylib::TraceLog(Raylib::LOG_INFO, "WorkDir = %s", Raylib::GetWorkingDirectory());
@@ -46,7 +59,29 @@ int main(void)
 	//Raylib::SetMusicVolume(music, 1.0f);
 	//Raylib::PlayMusicStream(music);
 
-	Game game = Game(windowWidth, windowHeight);
+	GameConfig gameConfig;
+	gameConfig.windowWidth = windowWidth;
+	gameConfig.windowHeight = windowHeight;
+	gameConfig.randomSeed = (u32)Raylib::GetTime();
+	gameConfig.systemWorkerCount = MAX(std::thread::hardware_concurrency(), 2u) - 1;
+
+	InputRecorder recorder;
+	if(recordFile)
+	{
+		// A replay has to see hulls and sectors arrive on the same frames, so don't let them arrive whenever they're ready
+		gameConfig.waitForAssets = true;
+		gameConfig.asteroidField.waitForSectors = true;
+		if(!recorder.Open(recordFile, GetRecordingConfig(gameConfig)))
+		{
+			Raylib::TraceLog(Raylib::LOG_WARNING, "Failed to open %s for recording", recordFile);
+		}
+	}
+
+	Game game = Game(gameConfig);
+	if(recordFile)
+	{
+		game.SetRecorder(&recorder);
+	}
 
 	Raylib::HideCursor();
 	Raylib::DisableCursor();
@@ -65,6 +100,9 @@ int main(void)
 #endif
 	
 	
+	game.SetRecorder(nullptr);
+	recorder.Close();
+
 	//Raylib::UnloadFont(font);
 	//Raylib::UnloadMusicStream(music);
 
@@ -1,35 +1,64 @@
 #include "math.h"
 
+static thread_local RandomStream threadRandom;
+
+u64 RandomStream::NextU64()
+{
+	m_state += 0x9E3779B97F4A7C15ULL;
+	u64 result = m_state;
+	result = (result ^ (result >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	result = (result ^ (result >> 27)) * 0x94D049BB133111EBULL;
+	return result ^ (result >> 31);
+}
+
+r32 RandomStream::Float(r32 min, r32 max)
+{
+	// 24 bits fill a float's mantissa exactly, so the result never rounds up to max
+	r32 zeroToOne = (NextU32() >> 8) * (1.0f / 16777216.0f);
+	return min + (max - min) * zeroToOne;
+}
+
+u32 RandomStream::UInt(u32 min, u32 max)
+{
+	Assert(min < max);
+	return min + (u32)(((u64)NextU32() * (max - min)) >> 32);
+}
+
+btVector3 RandomStream::PointInRange(const btVector3 &min, const btVector3 &max)
+{
+	r32 x = Float(min.getX(), max.getX());
+	r32 y = Float(min.getY(), max.getY());
+	r32 z = Float(min.getZ(), max.getZ());
+	return btVector3(x, y, z);
+}
+
+u64 RandomStream::MixSeed(u64 seed, u64 value)
+{
+	RandomStream stream(seed ^ (value * 0xD6E8FEB86659FD93ULL));
+	stream.NextU64();
+	return stream.NextU64();
+}
 
 void SeedRandom(u32 seed)
 {
-	srand(seed);
+	threadRandom = RandomStream(seed);
 }
 
 s32 RandomInt(s32 min, s32 max)
 {
 	if(min == max) return 0;
 	Assert(min < max);
-	Assert(max <= RAND_MAX);
-	s32 range = max - min;
-	s32 result = (rand() % range) + min;
-	return result;
+	return min + (s32)threadRandom.UInt(0, (u32)(max - min));
 }
 
 u32 RandomUInt(u32 min, u32 max)
 {
 	if(min == max) return 0;
-	Assert(min < max);
-	Assert(max <= RAND_MAX);
-	u32 range = max - min;
-	u32 result = (rand() % range) + min;
-	return result;
+	return threadRandom.UInt(min, max);
 }
 
 r32 RandomFloat(r32 min, r32 max)
 {
 	Assert(min < max);
-	r32 zeroToOneRand = (r32)(rand()) / (r32)(RAND_MAX);
-	r32 result = ((max - min) * zeroToOneRand) + min;
-	return result;
+	return threadRandom.Float(min, max);
 }
@@ -19,13 +19,39 @@ constexpr r32 _PI = 3.14159265358979323846f;
 constexpr r32 DegToRad(r32 deg) { return deg * (_PI / 180.0f); }
 constexpr r32 RadToDeg(r32 rad) { return rad * (180.0f / _PI); }
 
+// Scale belongs to the model being drawn, every instance of a model shares it
 struct Transform
 {
 	btVector3 translation = Vec3Zero;
-	btVector3 scale = btVector3(1.0f, 1.0f, 1.0f);
 	btQuaternion rotation = QuatIdentity;
 };
 
+// SplitMix64. A stream only changes when it is drawn from, so whoever owns one gets the same numbers however many
+// threads are drawing from other streams or in what order
+class RandomStream
+{
+public:
+	explicit RandomStream(u64 seed = 0) : m_state(seed) {}
+
+	u64 NextU64();
+	u32 NextU32() { return (u32)(NextU64() >> 32); }
+
+	r32 Float(r32 min, r32 max); // [min, max)
+	u32 UInt(u32 min, u32 max); // [min, max)
+	btVector3 PointInRange(const btVector3 &min, const btVector3 &max);
+
+	// A new stream starting from a well mixed seed, for handing part of the work to someone else. Every seed is just a
+	// different place on SplitMix64's one 2^64 cycle, so the two streams overlapping is very unlikely but not ruled out
+	RandomStream Split() { return RandomStream(MixSeed(NextU64(), 0)); }
+
+	// Combines a seed with a value into a well spread seed, e.g. a world seed with a sector's coordinates
+	static u64 MixSeed(u64 seed, u64 value);
+
+private:
+	u64 m_state;
+};
+
+// Global helpers drawing from a stream per thread. SeedRandom only seeds the calling thread's stream
 void SeedRandom(u32 seed);
 s32 RandomInt(s32 min, s32 max);
 u32 RandomUInt(u32 min, u32 max);
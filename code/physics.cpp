@@ -2,17 +2,30 @@
 
 #include "game.h"
 
+#include "gridBroadphase.h"
 #include "math.h"
+#include "physicsMemory.h"
+#include "physicsProfiler.h"
+#include "worldSnapshot.h"
 
 #include "btBulletDynamicsCommon.h"
 #include "BulletCollision/CollisionDispatch/btGhostObject.h"
+#include "BulletCollision/CollisionDispatch/btCollisionDispatcherMt.h"
+#include "BulletDynamics/ConstraintSolver/btSequentialImpulseConstraintSolverMt.h"
+#include "BulletDynamics/Dynamics/btDiscreteDynamicsWorldMt.h"
+#include "LinearMath/btThreads.h"
 
 
+#if !defined(PLATFORM_HEADLESS)
 #include "raylib.h"
 #include "raymath.h"
+#endif
 
+#include <algorithm>
+#include <tuple>
 #include <vector>
 
+#if !defined(PLATFORM_HEADLESS)
 class CollisionDrawer : public btIDebugDraw
 {
 public:
@@ -45,82 +58,1052 @@ public:
 private:
 	int m_debugMode = DBG_NoDebug;
 };
+#endif
+
+// Bullet only calls setWorldTransform for active bodies, so this turns motion state syncing into a list of just the
+// entities that moved this step instead of the game polling every body
+class EntityMotionState : public btMotionState
+{
+public:
+	EntityMotionState(const btTransform &startTransform, entt::entity entity, TransformUpdates *transformUpdates)
+		: m_transform(startTransform), m_entity(entity), m_transformUpdates(transformUpdates) {}
+
+	void getWorldTransform(btTransform &worldTransform) const override { worldTransform = m_transform; }
+
+	// Used when a pooled body is handed to a new entity
+	void Reset(const btTransform &transform, entt::entity entity)
+	{
+		m_transform = transform;
+		m_entity = entity;
+	}
+
+	void setWorldTransform(const btTransform &worldTransform) override
+	{
+		m_transform = worldTransform;
+		m_transformUpdates->Add(m_entity, worldTransform);
+	}
+
+private:
+	btTransform m_transform;
+	entt::entity m_entity;
+	TransformUpdates *m_transformUpdates;
+};
+
+void TransformUpdates::Add(entt::entity entity, const btTransform &transform)
+{
+	entities.push_back(entity);
+	for(u32 axis = 0; axis < 3; ++axis)
+	{
+		translations[axis].push_back(transform.getOrigin()[axis]);
+		for(u32 column = 0; column < 3; ++column)
+		{
+			rotations[axis * 3 + column].push_back(transform.getBasis()[axis][column]);
+		}
+	}
+}
+
+void ContactEvents::Clear()
+{
+	begins.clear();
+	persists.clear();
+	ends.clear();
+}
+
+void TransformUpdates::Clear()
+{
+	entities.clear();
+	for(std::vector<r32> &component : translations)
+	{
+		component.clear();
+	}
+	for(std::vector<r32> &component : rotations)
+	{
+		component.clear();
+	}
+}
+
+// Counts the iterations each solver call actually runs, which is fewer than configured when the residual threshold
+// lets it stop early
+template<typename Solver>
+class CountingSolver : public Solver
+{
+public:
+	CountingSolver(SolverCounters *counters) : m_counters(counters) {}
+
+	btScalar solveGroupCacheFriendlyIterations(btCollisionObject **bodies, int numBodies, btPersistentManifold **manifolds, int numManifolds,
+		btTypedConstraint **constraints, int numConstraints, const btContactSolverInfo &infoGlobal, btIDebugDraw *debugDrawer) override
+	{
+		btScalar residual = Solver::solveGroupCacheFriendlyIterations(bodies, numBodies, manifolds, numManifolds, constraints, numConstraints, infoGlobal, debugDrawer);
+		m_counters->calls.fetch_add(1, std::memory_order_relaxed);
+		m_counters->iterations.fetch_add((u32)MAX(this->m_analyticsData.m_numIterationsUsed, 0), std::memory_order_relaxed);
+		return residual;
+	}
+
+private:
+	SolverCounters *m_counters;
+};
+
+static_assert(COLLISION_GROUP_DEFAULT == (int)btBroadphaseProxy::DefaultFilter && COLLISION_GROUP_STATIC == (int)btBroadphaseProxy::StaticFilter);
+static_assert(COLLISION_GROUP_ALL == (int)btBroadphaseProxy::AllFilter);
+
+// Ghost objects only exist for their pair caches, so skip the contact manifolds the dispatcher would build for them
+static void SkipGhostsNearCallback(btBroadphasePair &collisionPair, btCollisionDispatcher &dispatcher, const btDispatcherInfo &dispatchInfo)
+{
+	const btCollisionObject *object0 = (const btCollisionObject *)collisionPair.m_pProxy0->m_clientObject;
+	const btCollisionObject *object1 = (const btCollisionObject *)collisionPair.m_pProxy1->m_clientObject;
+	if(object0->getInternalType() == btCollisionObject::CO_GHOST_OBJECT || object1->getInternalType() == btCollisionObject::CO_GHOST_OBJECT)
+	{
+		return;
+	}
+	btCollisionDispatcher::defaultNearCallback(collisionPair, dispatcher, dispatchInfo);
+}
+
+// Bullet only supports one global task scheduler, so it is created on first use and shared by every world.
+// Returns null if Bullet was built without BT_THREADSAFE, in which case the Mt world runs its tasks inline.
+static btITaskScheduler *GetPhysicsTaskScheduler()
+{
+	static btITaskScheduler *taskScheduler = btCreateDefaultTaskScheduler();
+	return taskScheduler;
+}
+
+constexpr u32 bodiesPerPoolBlock = 256;
+
+// Bullet keeps the time left over from the last fixed step protected, with no accessors. A member pointer named
+// through a derived class still reaches it on any world
+struct WorldLocalTime : btDiscreteDynamicsWorld
+{
+	static btScalar btDiscreteDynamicsWorld::*Get() { return &WorldLocalTime::m_localTime; }
+};
+
+const char *GetBroadphaseName(BroadphaseType type)
+{
+	switch(type)
+	{
+	case BroadphaseType::DYNAMIC_TREE: return "tree";
+	case BroadphaseType::AXIS_SWEEP: return "sweep";
+	case BroadphaseType::AXIS_SWEEP_32: return "sweep32";
+	case BroadphaseType::UNIFORM_GRID: return "grid";
+	}
+	return "unknown";
+}
+
+PhysicsWorld::PhysicsWorld(const PhysicsConfig &config)
+	: m_config(config),
+	m_bodyPool(sizeof(btRigidBody), alignof(btRigidBody), bodiesPerPoolBlock),
+	m_motionStatePool(sizeof(EntityMotionState), alignof(EntityMotionState), bodiesPerPoolBlock)
+{
+	InitWorld();
+}
 
 void PhysicsWorld::InitWorld()
 {
 	OPTICK_EVENT();
-	m_collisionConfiguration = new btDefaultCollisionConfiguration();
-	m_dispatcher = new btCollisionDispatcher(m_collisionConfiguration);
-	m_broadphase = new btDbvtBroadphase();
-	m_solver = new btSequentialImpulseConstraintSolver();
-	m_world = new btDiscreteDynamicsWorld(m_dispatcher, m_broadphase, m_solver, m_collisionConfiguration);
-	
-	CollisionDrawer *m_debugDrawer = new CollisionDrawer();
+
+	InstallPhysicsAllocator();
+	InstallPhysicsProfiler();
+
+	btDefaultCollisionConstructionInfo collisionInfo;
+	if(m_config.expectedBodyCount)
+	{
+		// Room for a couple of touching neighbours per body, anything past that falls back to btAlignedAlloc
+		collisionInfo.m_defaultMaxPersistentManifoldPoolSize = (int)MAX(m_config.expectedBodyCount * 2, 64u);
+		collisionInfo.m_defaultMaxCollisionAlgorithmPoolSize = (int)MAX(m_config.expectedBodyCount * 2, 64u);
+	}
+	m_collisionConfiguration = new btDefaultCollisionConfiguration(collisionInfo);
+	switch(m_config.broadphase)
+	{
+	case BroadphaseType::DYNAMIC_TREE:
+		m_dbvtBroadphase = new btDbvtBroadphase();
+		m_broadphase = m_dbvtBroadphase;
+		if(m_config.canonicalPairOrder)
+		{
+			// Checks every pair for separation each step, rather than the next tenth of the pair array
+			m_dbvtBroadphase->m_cupdates = 100;
+		}
+		break;
+	case BroadphaseType::AXIS_SWEEP:
+		// Handles are allocated up front, leave room for ghosts and projectiles on top of the expected bodies
+		m_broadphase = new btAxisSweep3(m_config.worldMin, m_config.worldMax, (unsigned short)MIN(MAX(m_config.expectedBodyCount + 1024, 16384u), 32766u));
+		break;
+	case BroadphaseType::AXIS_SWEEP_32:
+		m_broadphase = new bt32BitAxisSweep3(m_config.worldMin, m_config.worldMax, m_config.expectedBodyCount ? m_config.expectedBodyCount + 1024 : 1500000u);
+		break;
+	case BroadphaseType::UNIFORM_GRID:
+		m_broadphase = new GridBroadphase(m_config.gridCellSize);
+		break;
+	}
+	Assert(m_broadphase);
+
+	if(m_config.multithreaded)
+	{
+		u32 workerCount = 1;
+		btITaskScheduler *taskScheduler = GetPhysicsTaskScheduler();
+		if(taskScheduler)
+		{
+			workerCount = m_config.workerCount ? m_config.workerCount : (u32)taskScheduler->getMaxNumThreads();
+			taskScheduler->setNumThreads((int)workerCount);
+			workerCount = (u32)taskScheduler->getNumThreads();
+			btSetTaskScheduler(taskScheduler);
+		}
+
+		m_dispatcher = new btCollisionDispatcherMt(m_collisionConfiguration);
+		std::vector<btConstraintSolver *> poolSolvers(workerCount);
+		for(btConstraintSolver *&poolSolver : poolSolvers)
+		{
+			poolSolver = new CountingSolver<btSequentialImpulseConstraintSolver>(&m_solverCounters);
+		}
+		m_solverPool = new btConstraintSolverPoolMt(poolSolvers.data(), (int)workerCount); // Takes ownership of the solvers
+		m_solver = new CountingSolver<btSequentialImpulseConstraintSolverMt>(&m_solverCounters);
+		m_world = new btDiscreteDynamicsWorldMt(m_dispatcher, m_broadphase, m_solverPool, m_solver, m_collisionConfiguration);
+	}
+	else
+	{
+		m_dispatcher = new btCollisionDispatcher(m_collisionConfiguration);
+		m_solver = new CountingSolver<btSequentialImpulseConstraintSolver>(&m_solverCounters);
+		m_world = new btDiscreteDynamicsWorld(m_dispatcher, m_broadphase, m_solver, m_collisionConfiguration);
+	}
+
+	m_dispatcher->setNearCallback(SkipGhostsNearCallback);
+
+	m_ghostPairCallback = new btGhostPairCallback();
+	m_broadphase->getOverlappingPairCache()->setInternalGhostPairCallback(m_ghostPairCallback);
+
+#if !defined(PLATFORM_HEADLESS)
+	m_debugDrawer = new CollisionDrawer();
 	m_debugDrawer->setDebugMode(btIDebugDraw::DBG_DrawAabb);
 	//m_debugDrawer->setDebugMode(btIDebugDraw::DBG_DrawContactPoints);
 	//m_debugDrawer->setDebugMode(btIDebugDraw::DBG_DrawWireframe);
 	//m_debugDrawer->setDebugMode(btIDebugDraw::DBG_DrawAabb | btIDebugDraw::DBG_DrawWireframe);
 	m_world->setDebugDrawer(m_debugDrawer);
+#endif
 
 	m_world->setGravity(btVector3(0.0, 0.0, 0.0));
+
+	// Only active bodies move on their own. Anything placed from outside updates its own AABB
+	m_world->setForceUpdateAllAabbs(false);
+	m_world->getDispatchInfo().m_deterministicOverlappingPairs = m_config.canonicalPairOrder;
 }
 
 void PhysicsWorld::FreeWorld()
 {
 	OPTICK_EVENT();
 
+#if !defined(PLATFORM_HEADLESS)
 	delete m_debugDrawer;
+#endif
+
+	// Bodies live in the pools, which are freed wholesale after this, so take them out of the world first
+	btCollisionObjectArray &collisionObjects = m_world->getCollisionObjectArray();
+	for(int objectNum = collisionObjects.size() - 1; objectNum >= 0; --objectNum)
+	{
+		if(btRigidBody *body = btRigidBody::upcast(collisionObjects[objectNum]))
+		{
+			DestroyRigidBody(body);
+		}
+	}
 
 	delete m_world;
 	delete m_solver;
+	delete m_solverPool;
 	delete m_dispatcher;
 	delete m_collisionConfiguration;
 	delete m_broadphase;
+	delete m_ghostPairCallback;
 }
 
 void PhysicsWorld::Step(r32 deltaTime)
 {
 	OPTICK_EVENT();
+	m_transformUpdates.Clear();
+	BeginPhysicsMemoryFrame();
+	m_solverCounters.calls.store(0, std::memory_order_relaxed);
+	m_solverCounters.iterations.store(0, std::memory_order_relaxed);
+
 	m_world->stepSimulation(deltaTime);
+
+	UpdateStepStats();
+	ExtractContactEvents();
+	OPTICK_TAG("ActiveBodies", m_stepStats.activeBodies);
+	OPTICK_TAG("SleepingBodies", m_stepStats.sleepingBodies);
+	OPTICK_TAG("OverlappingPairs", m_stepStats.overlappingPairs);
+	OPTICK_TAG("Manifolds", m_stepStats.manifolds);
+	OPTICK_TAG("ContactPoints", m_stepStats.contactPoints);
+	OPTICK_TAG("TouchingPairs", m_stepStats.touchingPairs);
+	OPTICK_TAG("ContactBegins", m_stepStats.contactBegins);
+	OPTICK_TAG("ContactEnds", m_stepStats.contactEnds);
+	OPTICK_TAG("SolverCalls", m_stepStats.solverCalls);
+	OPTICK_TAG("SolverIterations", m_stepStats.solverIterations);
+
+	PhysicsMemoryStats memoryStats = GetPhysicsMemoryStats();
+	OPTICK_TAG("PhysicsMemoryInUse", memoryStats.bytesInUse);
+	OPTICK_TAG("PhysicsMemoryFrameHighWater", memoryStats.frameHighWater);
+	OPTICK_TAG("PhysicsAllocations", memoryStats.frameAllocations);
+	UNUSED(memoryStats);
 }
 
-btPairCachingGhostObject *PhysicsWorld::CreateGhostObject(btConvexShape *collisionShape, int filterGroup, int filterMask)
+void PhysicsWorld::UpdateStepStats()
+{
+	OPTICK_EVENT();
+
+	PhysicsStepStats stats;
+
+	const btCollisionObjectArray &collisionObjects = m_world->getCollisionObjectArray();
+	for(int objectNum = 0; objectNum < collisionObjects.size(); ++objectNum)
+	{
+		const btRigidBody *body = btRigidBody::upcast(collisionObjects[objectNum]);
+		if(!body || body->isStaticOrKinematicObject() || body->getActivationState() == DISABLE_SIMULATION)
+		{
+			continue;
+		}
+
+		if(body->isActive())
+		{
+			++stats.activeBodies;
+		}
+		else
+		{
+			++stats.sleepingBodies;
+		}
+	}
+
+	stats.overlappingPairs = (u32)m_broadphase->getOverlappingPairCache()->getNumOverlappingPairs();
+
+	stats.manifolds = (u32)m_dispatcher->getNumManifolds();
+
+	stats.solverCalls = m_solverCounters.calls.load(std::memory_order_relaxed);
+	stats.solverIterations = m_solverCounters.iterations.load(std::memory_order_relaxed);
+
+	m_stepStats = stats;
+}
+
+static u64 GetContactKey(const ContactEvent &contact)
+{
+	return ((u64)entt::to_integral(contact.entity0) << 32) | (u64)entt::to_integral(contact.entity1);
+}
+
+// One pass over the manifolds after the step, so nothing runs inside the dispatcher, which may be on several threads.
+// Pairs are matched to the last step's by entities rather than manifolds, which come and go with the broadphase
+void PhysicsWorld::ExtractContactEvents()
+{
+	OPTICK_EVENT();
+
+	m_lastTouching.swap(m_touching);
+	m_touching.clear();
+	m_contactEvents.Clear();
+
+	u32 contactPoints = 0;
+	int manifoldCount = m_dispatcher->getNumManifolds();
+	for(int manifoldNum = 0; manifoldNum < manifoldCount; ++manifoldNum)
+	{
+		const btPersistentManifold *manifold = m_dispatcher->getManifoldByIndexInternal(manifoldNum);
+		int contactCount = manifold->getNumContacts();
+		contactPoints += (u32)contactCount;
+
+		entt::entity entityA = GetCollisionEntity(manifold->getBody0());
+		entt::entity entityB = GetCollisionEntity(manifold->getBody1());
+		if(entityA == entt::null || entityB == entt::null)
+		{
+			continue;
+		}
+
+		const btManifoldPoint *deepest = nullptr;
+		r32 impulse = 0.0f;
+		for(int contactNum = 0; contactNum < contactCount; ++contactNum)
+		{
+			const btManifoldPoint &point = manifold->getContactPoint(contactNum);
+			if(point.getDistance() <= 0.0f)
+			{
+				impulse += point.getAppliedImpulse();
+				if(!deepest || point.getDistance() < deepest->getDistance())
+				{
+					deepest = &point;
+				}
+			}
+		}
+
+		if(!deepest)
+		{
+			continue;
+		}
+
+		// Bullet's normal is on body 1 pointing at body 0, so it flips along with the bodies
+		bool swapped = entityB < entityA;
+		const btVector3 &point = swapped ? deepest->getPositionWorldOnA() : deepest->getPositionWorldOnB();
+		btVector3 normal = swapped ? -deepest->m_normalWorldOnB : deepest->m_normalWorldOnB;
+
+		// Value initialised so the padding that goes into snapshots is zero, and set by component for the same reason
+		ContactEvent &contact = m_touching.emplace_back();
+		contact.entity0 = swapped ? entityB : entityA;
+		contact.entity1 = swapped ? entityA : entityB;
+		contact.point.setValue(point.x(), point.y(), point.z());
+		contact.normal.setValue(normal.x(), normal.y(), normal.z());
+		contact.impulse = impulse;
+		contact.distance = deepest->getDistance();
+	}
+
+	std::sort(m_touching.begin(), m_touching.end(), [](const ContactEvent &a, const ContactEvent &b) {
+		u64 keyA = GetContactKey(a);
+		u64 keyB = GetContactKey(b);
+		return keyA < keyB || (keyA == keyB && a.distance < b.distance);
+	});
+
+	// Pairs with several manifolds keep the deepest point and add up the impulses
+	u32 touchingCount = 0;
+	for(u32 contactNum = 0; contactNum < m_touching.size(); ++contactNum)
+	{
+		if(touchingCount && GetContactKey(m_touching[touchingCount - 1]) == GetContactKey(m_touching[contactNum]))
+		{
+			m_touching[touchingCount - 1].impulse += m_touching[contactNum].impulse;
+			continue;
+		}
+		m_touching[touchingCount++] = m_touching[contactNum];
+	}
+	m_touching.resize(touchingCount);
+
+	auto endContact = [this](const ContactEvent &contact) {
+		ContactEvent &ended = m_contactEvents.ends.emplace_back(contact);
+		ended.impulse = 0.0f;
+	};
+
+	auto last = m_lastTouching.begin();
+	for(const ContactEvent &contact : m_touching)
+	{
+		u64 key = GetContactKey(contact);
+		for(; last != m_lastTouching.end() && GetContactKey(*last) < key; ++last)
+		{
+			endContact(*last);
+		}
+
+		if(last != m_lastTouching.end() && GetContactKey(*last) == key)
+		{
+			m_contactEvents.persists.push_back(contact);
+			++last;
+		}
+		else
+		{
+			m_contactEvents.begins.push_back(contact);
+		}
+	}
+	for(; last != m_lastTouching.end(); ++last)
+	{
+		endContact(*last);
+	}
+
+	m_stepStats.contactPoints = contactPoints;
+	m_stepStats.touchingPairs = touchingCount;
+	m_stepStats.contactBegins = (u32)m_contactEvents.begins.size();
+	m_stepStats.contactEnds = (u32)m_contactEvents.ends.size();
+}
+
+btPairCachingGhostObject *PhysicsWorld::CreateGhostObject(btConvexShape *collisionShape, int filterGroup, int filterMask, entt::entity entity,
+	const btTransform &transform)
 {
 	btPairCachingGhostObject *ghostObject = new btPairCachingGhostObject();
 	ghostObject->setCollisionShape(collisionShape);
+	ghostObject->setWorldTransform(transform);
+	SetCollisionEntity(ghostObject, entity);
 	m_world->addCollisionObject(ghostObject, filterGroup, filterMask);
 	return ghostObject;
 }
 
-RigidBody PhysicsWorld::CreateRigidBody(btVector3 position, btQuaternion rotation, r32 mass, btConvexShape *collisionShape)
+RigidBody PhysicsWorld::CreateRigidBody(btVector3 position, btQuaternion rotation, r32 mass, btConvexShape *collisionShape, entt::entity entity)
 {
 	btVector3 bodyInertia;
 	collisionShape->calculateLocalInertia(mass, bodyInertia);
 
 	btTransform startTransform(rotation, position);
 
-	btTransform centerOfMassOffset = btTransform::getIdentity();
-	btDefaultMotionState *motionState = new btDefaultMotionState(startTransform, centerOfMassOffset);
+	EntityMotionState *motionState = m_motionStatePool.New<EntityMotionState>(startTransform, entity, &m_transformUpdates);
 
 	btRigidBody::btRigidBodyConstructionInfo constructInfo = btRigidBody::btRigidBodyConstructionInfo(mass, motionState, collisionShape, bodyInertia);
 
 	RigidBody rigidBody;
-	rigidBody.body = new btRigidBody(constructInfo);
+	rigidBody.body = m_bodyPool.New<btRigidBody>(constructInfo);
+	SetCollisionEntity(rigidBody.body, entity);
 
 	m_world->addRigidBody(rigidBody.body);
 	return rigidBody;
 }
 
+void PhysicsWorld::SetCollisionShape(btRigidBody *body, btConvexShape *collisionShape)
+{
+	body->setCollisionShape(collisionShape);
+
+	// Each pair caches a collision algorithm picked for the old shape types
+	m_broadphase->getOverlappingPairCache()->cleanProxyFromPairs(body->getBroadphaseHandle(), m_dispatcher);
+
+	if(body->getInvMass() > 0.0f)
+	{
+		btScalar mass = 1.0f / body->getInvMass();
+		btVector3 inertia;
+		collisionShape->calculateLocalInertia(mass, inertia);
+		body->setMassProps(mass, inertia);
+		body->updateInertiaTensor();
+	}
+
+	m_world->updateSingleAabb(body);
+}
+
+void PhysicsWorld::DestroyRigidBody(btRigidBody *body)
+{
+	m_world->removeRigidBody(body);
+	m_motionStatePool.Delete((EntityMotionState *)body->getMotionState());
+	m_bodyPool.Delete(body);
+}
+
 void PhysicsWorld::AddAction(btActionInterface *action)
 {
 	m_world->addAction(action);
 }
 
+void PhysicsWorld::DisableBody(btRigidBody *body)
+{
+	body->forceActivationState(DISABLE_SIMULATION);
+	body->setLinearVelocity(Vec3Zero);
+	body->setAngularVelocity(Vec3Zero);
+	body->clearForces();
+	SetCollisionEntity(body, entt::null);
+
+	// Pairs are only rejected by the filter when they are created, so drop the ones the body already has
+	btBroadphaseProxy *proxy = body->getBroadphaseHandle();
+	proxy->m_collisionFilterGroup = 0;
+	proxy->m_collisionFilterMask = 0;
+	m_broadphase->getOverlappingPairCache()->removeOverlappingPairsContainingProxy(proxy, m_dispatcher);
+}
+
+void PhysicsWorld::EnableBody(btRigidBody *body, const btTransform &transform, const btVector3 &linearVelocity, entt::entity entity, int filterGroup)
+{
+	((EntityMotionState *)body->getMotionState())->Reset(transform, entity);
+	body->setWorldTransform(transform);
+	body->setInterpolationWorldTransform(transform);
+	body->setLinearVelocity(linearVelocity);
+	body->setInterpolationLinearVelocity(linearVelocity);
+	body->setAngularVelocity(Vec3Zero);
+	body->setInterpolationAngularVelocity(Vec3Zero);
+	SetCollisionEntity(body, entity);
+
+	btBroadphaseProxy *proxy = body->getBroadphaseHandle();
+	proxy->m_collisionFilterGroup = filterGroup;
+	proxy->m_collisionFilterMask = COLLISION_GROUP_ALL;
+	m_world->updateSingleAabb(body);
+
+	body->forceActivationState(ACTIVE_TAG);
+	body->setDeactivationTime(0.0f);
+}
+
+void PhysicsWorld::MakeKinematic(btRigidBody *body)
+{
+	// setMassProps(0) also flags the body static, and removeRigidBody expects that flag not to change while the body
+	// is in the world
+	body->setMassProps(0.0f, Vec3Zero);
+	body->setCollisionFlags((body->getCollisionFlags() & ~btCollisionObject::CF_STATIC_OBJECT) | btCollisionObject::CF_KINEMATIC_OBJECT);
+	body->updateInertiaTensor();
+	body->clearForces();
+	body->forceActivationState(ISLAND_SLEEPING);
+}
+
+void PhysicsWorld::MakeDynamic(btRigidBody *body, r32 mass)
+{
+	btVector3 inertia;
+	body->getCollisionShape()->calculateLocalInertia(mass, inertia);
+	body->setCollisionFlags(body->getCollisionFlags() & ~btCollisionObject::CF_KINEMATIC_OBJECT);
+	body->setMassProps(mass, inertia);
+	body->updateInertiaTensor();
+
+	body->setInterpolationWorldTransform(body->getWorldTransform());
+	body->setInterpolationLinearVelocity(body->getLinearVelocity());
+	body->setInterpolationAngularVelocity(body->getAngularVelocity());
+	body->forceActivationState(ACTIVE_TAG);
+	body->setDeactivationTime(0.0f);
+	m_world->updateSingleAabb(body);
+}
+
+void PhysicsWorld::MoveKinematicBody(btRigidBody *body, const btTransform &transform, const btVector3 &sweep)
+{
+	body->setWorldTransform(transform);
+	body->setInterpolationWorldTransform(transform);
+	((EntityMotionState *)body->getMotionState())->Reset(transform, GetCollisionEntity(body));
+
+	// What updateSingleAabb does for a kinematic body, plus the sweep, in one broadphase update
+	btVector3 aabbMin, aabbMax;
+	body->getCollisionShape()->getAabb(transform, aabbMin, aabbMax);
+	btVector3 contactThreshold(gContactBreakingThreshold, gContactBreakingThreshold, gContactBreakingThreshold);
+	btVector3 sweepMin = sweep;
+	btVector3 sweepMax = sweep;
+	sweepMin.setMin(Vec3Zero);
+	sweepMax.setMax(Vec3Zero);
+	m_broadphase->setAabb(body->getBroadphaseHandle(), aabbMin - contactThreshold + sweepMin, aabbMax + contactThreshold + sweepMax, m_dispatcher);
+}
+
+void PhysicsWorld::SaveBodyState(const btRigidBody *body, BodyState &state) const
+{
+	state.worldTransform = body->getWorldTransform();
+	state.interpolationWorldTransform = body->getInterpolationWorldTransform();
+	state.linearVelocity = body->getLinearVelocity();
+	state.angularVelocity = body->getAngularVelocity();
+	state.interpolationLinearVelocity = body->getInterpolationLinearVelocity();
+	state.interpolationAngularVelocity = body->getInterpolationAngularVelocity();
+	GetAabb(body, state.aabbMin, state.aabbMax);
+	state.deactivationTime = body->getDeactivationTime();
+	state.hitFraction = body->getHitFraction();
+	state.activationState = body->getActivationState();
+}
+
+void PhysicsWorld::RestoreBodyState(btRigidBody *body, const BodyState &state)
+{
+	body->setWorldTransform(state.worldTransform);
+	body->setInterpolationWorldTransform(state.interpolationWorldTransform);
+	body->setLinearVelocity(state.linearVelocity);
+	body->setAngularVelocity(state.angularVelocity);
+	body->setInterpolationLinearVelocity(state.interpolationLinearVelocity);
+	body->setInterpolationAngularVelocity(state.interpolationAngularVelocity);
+	body->updateInertiaTensor();
+	body->setHitFraction(state.hitFraction);
+	body->forceActivationState(state.activationState);
+	body->setDeactivationTime(state.deactivationTime);
+	((EntityMotionState *)body->getMotionState())->Reset(state.worldTransform, GetCollisionEntity(body));
+	SetAabb(body, state.aabbMin, state.aabbMax);
+}
+
+void PhysicsWorld::GetAabb(const btCollisionObject *collisionObject, btVector3 &aabbMin, btVector3 &aabbMax) const
+{
+	const btBroadphaseProxy *proxy = collisionObject->getBroadphaseHandle();
+	aabbMin = proxy->m_aabbMin;
+	aabbMax = proxy->m_aabbMax;
+}
+
+void PhysicsWorld::SetAabb(btCollisionObject *collisionObject, const btVector3 &aabbMin, const btVector3 &aabbMax)
+{
+	btBroadphaseProxy *proxy = collisionObject->getBroadphaseHandle();
+	if(proxy->m_aabbMin == aabbMin && proxy->m_aabbMax == aabbMax)
+	{
+		return;
+	}
+	m_broadphase->setAabb(proxy, aabbMin, aabbMax, m_dispatcher);
+}
+
+void PhysicsWorld::SaveState(WorldSnapshot &snapshot) const
+{
+	OPTICK_EVENT();
+
+	snapshot.Write(m_world->*WorldLocalTime::Get());
+
+	const btOverlappingPairCache *pairCache = m_broadphase->getOverlappingPairCache();
+	u32 pairCount = (u32)pairCache->getNumOverlappingPairs();
+	const btBroadphasePair *pairs = pairCache->getOverlappingPairArrayPtr();
+	snapshot.Write(pairCount);
+	for(u32 pairNum = 0; pairNum < pairCount; ++pairNum)
+	{
+		snapshot.Write(pairs[pairNum].m_pProxy0);
+		snapshot.Write(pairs[pairNum].m_pProxy1);
+	}
+
+	u32 manifoldCount = (u32)m_dispatcher->getNumManifolds();
+	snapshot.Write(manifoldCount);
+	for(u32 manifoldNum = 0; manifoldNum < manifoldCount; ++manifoldNum)
+	{
+		const btPersistentManifold *manifold = m_dispatcher->getManifoldByIndexInternal((int)manifoldNum);
+		u32 contactCount = (u32)manifold->getNumContacts();
+		snapshot.Write(manifold);
+		snapshot.Write(manifold->getBody0());
+		snapshot.Write(manifold->getBody1());
+		snapshot.Write(contactCount);
+		if(contactCount)
+		{
+			snapshot.WriteBytes(&manifold->getContactPoint(0), sizeof(btManifoldPoint) * contactCount);
+		}
+	}
+
+	snapshot.WriteArray(m_touching.data(), (u32)m_touching.size());
+}
+
+void PhysicsWorld::RestoreState(SnapshotReader &reader)
+{
+	OPTICK_EVENT();
+
+	m_world->*WorldLocalTime::Get() = reader.Read<btScalar>();
+
+	// A pair that ended since the save is only found again once one of its proxies moves far enough, so pairs go back
+	// as they were. Removing a pair frees its manifolds, so this comes before them
+	btOverlappingPairCache *pairCache = m_broadphase->getOverlappingPairCache();
+	m_savedPairs.resize(reader.Read<u32>());
+	reader.ReadBytes(m_savedPairs.data(), sizeof(m_savedPairs[0]) * m_savedPairs.size());
+	std::sort(m_savedPairs.begin(), m_savedPairs.end());
+
+	m_currentPairs.clear();
+	const btBroadphasePair *pairs = pairCache->getOverlappingPairArrayPtr();
+	for(int pairNum = 0; pairNum < pairCache->getNumOverlappingPairs(); ++pairNum)
+	{
+		m_currentPairs.emplace_back(pairs[pairNum].m_pProxy0, pairs[pairNum].m_pProxy1);
+	}
+	std::sort(m_currentPairs.begin(), m_currentPairs.end());
+
+	auto saved = m_savedPairs.begin();
+	auto current = m_currentPairs.begin();
+	while(saved != m_savedPairs.end() || current != m_currentPairs.end())
+	{
+		if(current == m_currentPairs.end() || (saved != m_savedPairs.end() && *saved < *current))
+		{
+			pairCache->addOverlappingPair(saved->first, saved->second);
+			++saved;
+		}
+		else if(saved == m_savedPairs.end() || *current < *saved)
+		{
+			pairCache->removeOverlappingPair(current->first, current->second, m_dispatcher);
+			++current;
+		}
+		else
+		{
+			++saved;
+			++current;
+		}
+	}
+
+	// Saved manifolds go back to the ones the same bodies have now. A pair that separated and met again since has a
+	// new manifold, and pairs with a manifold per child shape match by address first
+	auto less = [](const RestoreManifold &a, const RestoreManifold &b) {
+		return std::tie(a.body0, a.body1, a.manifold) < std::tie(b.body0, b.body1, b.manifold);
+	};
+	m_restoreManifolds.clear();
+	for(int manifoldNum = 0; manifoldNum < m_dispatcher->getNumManifolds(); ++manifoldNum)
+	{
+		btPersistentManifold *manifold = m_dispatcher->getManifoldByIndexInternal(manifoldNum);
+		m_restoreManifolds.push_back({manifold->getBody0(), manifold->getBody1(), manifold, false});
+	}
+	std::sort(m_restoreManifolds.begin(), m_restoreManifolds.end(), less);
+
+	u32 manifoldCount = reader.Read<u32>();
+	for(u32 manifoldNum = 0; manifoldNum < manifoldCount; ++manifoldNum)
+	{
+		btPersistentManifold *saved = reader.Read<btPersistentManifold *>();
+		const btCollisionObject *body0 = reader.Read<const btCollisionObject *>();
+		const btCollisionObject *body1 = reader.Read<const btCollisionObject *>();
+		u32 contactCount = reader.Read<u32>();
+
+		auto match = m_restoreManifolds.end();
+		RestoreManifold key = {body0, body1, nullptr, false};
+		for(auto it = std::lower_bound(m_restoreManifolds.begin(), m_restoreManifolds.end(), key, less);
+			it != m_restoreManifolds.end() && it->body0 == body0 && it->body1 == body1; ++it)
+		{
+			if(!it->restored && (match == m_restoreManifolds.end() || it->manifold == saved))
+			{
+				match = it;
+			}
+		}
+
+		// The pair has ended, the broadphase finds it again with an empty manifold
+		if(match == m_restoreManifolds.end())
+		{
+			reader.Skip(sizeof(btManifoldPoint) * contactCount);
+			continue;
+		}
+
+		match->manifold->setNumContacts((int)contactCount);
+		if(contactCount)
+		{
+			reader.ReadBytes(&match->manifold->getContactPoint(0), sizeof(btManifoldPoint) * contactCount);
+		}
+		match->restored = true;
+	}
+
+	for(RestoreManifold &restoreManifold : m_restoreManifolds)
+	{
+		if(!restoreManifold.restored)
+		{
+			restoreManifold.manifold->clearManifold();
+		}
+	}
+
+	// Events belong to the step that made them, the next one is found against the pairs touching at the save
+	reader.ReadArray(m_touching);
+	m_contactEvents.Clear();
+}
+
+struct CollectEntitiesCallback : btDbvt::ICollide
+{
+	std::vector<entt::entity> *entities = nullptr;
+
+	void Process(const btDbvtNode *leaf) override
+	{
+		const btDbvtProxy *proxy = (const btDbvtProxy *)leaf->data;
+		entt::entity entity = GetCollisionEntity((const btCollisionObject *)proxy->m_clientObject);
+		if(entity != entt::null)
+		{
+			entities->push_back(entity);
+		}
+	}
+};
+
+void PhysicsWorld::QueryConvexVolume(const btVector3 *normals, const r32 *offsets, u32 planeCount, std::vector<entt::entity> &entities) const
+{
+	OPTICK_EVENT();
+
+	if(m_dbvtBroadphase)
+	{
+		CollectEntitiesCallback callback;
+		callback.entities = &entities;
+
+		// Set 0 holds moving proxies, set 1 the ones that have come to rest
+		for(const btDbvt &tree : m_dbvtBroadphase->m_sets)
+		{
+			btDbvt::collideKDOP(tree.m_root, normals, offsets, (int)planeCount, callback);
+		}
+		return;
+	}
+
+	// No tree to walk, test every broadphase AABB
+	const btCollisionObjectArray &collisionObjects = m_world->getCollisionObjectArray();
+	for(int objectNum = 0; objectNum < collisionObjects.size(); ++objectNum)
+	{
+		const btCollisionObject *collisionObject = collisionObjects[objectNum];
+		const btBroadphaseProxy *proxy = collisionObject->getBroadphaseHandle();
+
+		btDbvtVolume volume = btDbvtVolume::FromMM(proxy->m_aabbMin, proxy->m_aabbMax);
+
+		bool outside = false;
+		for(u32 planeNum = 0; planeNum < planeCount && !outside; ++planeNum)
+		{
+			const btVector3 &normal = normals[planeNum];
+			s32 signs = (normal.x() >= 0 ? 1 : 0) + (normal.y() >= 0 ? 2 : 0) + (normal.z() >= 0 ? 4 : 0);
+			outside = volume.Classify(normal, offsets[planeNum], signs) < 0;
+		}
+
+		entt::entity entity = GetCollisionEntity(collisionObject);
+		if(!outside && entity != entt::null)
+		{
+			entities.push_back(entity);
+		}
+	}
+}
+
+struct CollectEntitiesAabbCallback : btBroadphaseAabbCallback
+{
+	std::vector<entt::entity> *entities = nullptr;
+
+	bool process(const btBroadphaseProxy *proxy) override
+	{
+		entt::entity entity = GetCollisionEntity((const btCollisionObject *)proxy->m_clientObject);
+		if(entity != entt::null)
+		{
+			entities->push_back(entity);
+		}
+		return true;
+	}
+};
+
+void PhysicsWorld::QueryAabb(const btVector3 &aabbMin, const btVector3 &aabbMax, std::vector<entt::entity> &entities) const
+{
+	CollectEntitiesAabbCallback callback;
+	callback.entities = &entities;
+	m_broadphase->aabbTest(aabbMin, aabbMax, callback);
+}
+
+// Filters on the query as well as the groups, so a query can leave out whoever made it
+template<typename ResultCallback>
+struct SceneQueryResult : ResultCallback
+{
+	entt::entity ignore;
+
+	SceneQueryResult(const SceneQuery &query)
+		: ResultCallback(query.from, query.to), ignore(query.ignore)
+	{
+		this->m_collisionFilterGroup = query.filterGroup;
+		this->m_collisionFilterMask = query.filterMask;
+	}
+
+	bool needsCollision(btBroadphaseProxy *proxy) const override
+	{
+		if(!ResultCallback::needsCollision(proxy))
+		{
+			return false;
+		}
+		return ignore == entt::null || GetCollisionEntity((const btCollisionObject *)proxy->m_clientObject) != ignore;
+	}
+};
+
+using SceneRayResult = SceneQueryResult<btCollisionWorld::ClosestRayResultCallback>;
+using SceneSweepResult = SceneQueryResult<btCollisionWorld::ClosestConvexResultCallback>;
+
+// Runs the narrowphase on each object the broadphase finds along the query, like btCollisionWorld's own ray and sweep
+// callbacks. The results keep the closest hit, which also cuts short the tests of everything found after it
+struct SceneQueryCandidates : btBroadphaseRayCallback
+{
+	btTransform fromTransform;
+	btTransform toTransform;
+	const btSphereShape *sphere = nullptr; // Null for rays
+	SceneRayResult *rayResult = nullptr;
+	SceneSweepResult *sweepResult = nullptr;
+
+	SceneQueryCandidates(const SceneQuery &query)
+		: fromTransform(QuatIdentity, query.from), toTransform(QuatIdentity, query.to)
+	{
+		btVector3 direction = (query.to - query.from).normalized();
+		for(u32 axis = 0; axis < 3; ++axis)
+		{
+			m_rayDirectionInverse[axis] = (direction[axis] == 0.0f) ? BT_LARGE_FLOAT : 1.0f / direction[axis];
+			m_signs[axis] = m_rayDirectionInverse[axis] < 0.0f;
+		}
+		m_lambda_max = direction.dot(query.to - query.from);
+	}
+
+	bool process(const btBroadphaseProxy *proxy) override
+	{
+		// Bullet's single object tests take them non-const, though they only read them
+		btCollisionObject *collisionObject = (btCollisionObject *)proxy->m_clientObject;
+		if(sphere)
+		{
+			if(sweepResult->m_closestHitFraction > 0.0f && sweepResult->needsCollision(collisionObject->getBroadphaseHandle()))
+			{
+				btCollisionWorld::objectQuerySingle(sphere, fromTransform, toTransform, collisionObject, collisionObject->getCollisionShape(),
+					collisionObject->getWorldTransform(), *sweepResult, 0.0f);
+			}
+		}
+		else if(rayResult->m_closestHitFraction > 0.0f && rayResult->needsCollision(collisionObject->getBroadphaseHandle()))
+		{
+			btCollisionWorld::rayTestSingle(fromTransform, toTransform, collisionObject, collisionObject->getCollisionShape(),
+				collisionObject->getWorldTransform(), *rayResult);
+		}
+		return true;
+	}
+};
+
+struct SceneQueryTreeTester : btDbvt::ICollide
+{
+	SceneQueryCandidates *candidates = nullptr;
+
+	void Process(const btDbvtNode *leaf) override
+	{
+		candidates->process((const btBroadphaseProxy *)leaf->data);
+	}
+};
+
+struct SceneQueryBody : btIParallelForBody
+{
+	btBroadphaseInterface *broadphase = nullptr;
+	const btDbvtBroadphase *dbvtBroadphase = nullptr;
+	const SceneQuery *queries = nullptr;
+	SceneQueryHit *hits = nullptr;
+
+	void forLoop(int begin, int end) const override
+	{
+		// btDbvtBroadphase::rayTest allocates a stack for every ray when Bullet is thread safe, walking its trees here
+		// reuses one across the range
+		btAlignedObjectArray<const btDbvtNode *> stack;
+
+		for(int queryNum = begin; queryNum < end; ++queryNum)
+		{
+			const SceneQuery &query = queries[queryNum];
+			SceneQueryHit &hit = hits[queryNum];
+			hit = SceneQueryHit();
+			if((query.to - query.from).length2() < SIMD_EPSILON)
+			{
+				continue;
+			}
+
+			SceneQueryCandidates candidates(query);
+			btSphereShape sphere(query.radius);
+			SceneRayResult rayResult(query);
+			SceneSweepResult sweepResult(query);
+			if(query.radius > 0.0f)
+			{
+				candidates.sphere = &sphere;
+				candidates.sweepResult = &sweepResult;
+			}
+			else
+			{
+				candidates.rayResult = &rayResult;
+			}
+
+			// The walk tests each node grown by the sphere
+			btVector3 aabbMin(-query.radius, -query.radius, -query.radius);
+			btVector3 aabbMax(query.radius, query.radius, query.radius);
+			if(dbvtBroadphase)
+			{
+				SceneQueryTreeTester tester;
+				tester.candidates = &candidates;
+
+				// Set 0 holds moving proxies, set 1 the ones that have come to rest
+				for(const btDbvt &tree : dbvtBroadphase->m_sets)
+				{
+					tree.rayTestInternal(tree.m_root, query.from, query.to, candidates.m_rayDirectionInverse, candidates.m_signs, candidates.m_lambda_max,
+						aabbMin, aabbMax, stack, tester);
+				}
+			}
+			else
+			{
+				broadphase->rayTest(query.from, query.to, candidates, aabbMin, aabbMax);
+			}
+
+			if(sweepResult.hasHit())
+			{
+				hit.entity = GetCollisionEntity(sweepResult.m_hitCollisionObject);
+				hit.point = sweepResult.m_hitPointWorld;
+				hit.normal = sweepResult.m_hitNormalWorld;
+				hit.fraction = sweepResult.m_closestHitFraction;
+			}
+			else if(rayResult.hasHit())
+			{
+				hit.entity = GetCollisionEntity(rayResult.m_collisionObject);
+				hit.point = rayResult.m_hitPointWorld;
+				hit.normal = rayResult.m_hitNormalWorld;
+				hit.fraction = rayResult.m_closestHitFraction;
+			}
+		}
+	}
+};
+
+void PhysicsWorld::QueryBatch(const SceneQuery *queries, u32 queryCount, SceneQueryHit *hits) const
+{
+	OPTICK_EVENT();
+	OPTICK_TAG("Queries", queryCount);
+
+	SceneQueryBody body;
+	body.broadphase = m_broadphase;
+	body.dbvtBroadphase = m_dbvtBroadphase;
+	body.queries = queries;
+	body.hits = hits;
+
+	// Enough queries a chunk to be worth a task, few enough to spread a camera's and a few weapons' worth
+	constexpr int queriesPerChunk = 16;
+	if(m_config.multithreaded && btGetTaskScheduler() && !btThreadsAreRunning())
+	{
+		btParallelFor(0, (int)queryCount, queriesPerChunk, body);
+	}
+	else
+	{
+		body.forLoop(0, (int)queryCount);
+	}
+}
+
+u32 PhysicsWorld::GetCollisionObjectCount() const
+{
+	return (u32)m_world->getNumCollisionObjects();
+}
+
+void SetCollisionEntity(btCollisionObject *collisionObject, entt::entity entity)
+{
+	// Bullet's default user index is -1, which lines up with entt::null
+	collisionObject->setUserIndex((int)entt::to_integral(entity));
+}
+
+entt::entity GetCollisionEntity(const btCollisionObject *collisionObject)
+{
+	return entt::entity((u32)collisionObject->getUserIndex());
+}
+
+#if !defined(PLATFORM_HEADLESS)
 void PhysicsWorld::DrawDebugInfo()
 {
 	OPTICK_EVENT();
 	m_world->debugDrawWorld();
 }
+#endif
+
+btConvexShape *CreateSphereCollision(r32 radius)
+{
+	btSphereShape *collision = new btSphereShape(radius);
+	return collision;
+}
 
 btConvexShape *CreateCapsuleXAxisCollision(r32 radius, r32 length)
 {
@@ -161,22 +1144,16 @@ btConvexShape *CreateCylinderZAxisCollision(r32 radius, r32 length)
 	return collision;
 }
 
-btConvexShape * CreateConvexCollision(const Raylib::Model &model, r32 scale)
+btConvexShape *CreateConvexCollision(const btVector3 *points, u32 pointCount, r32 scale)
 {
-	Assert(model.meshCount == 1);
-	Raylib::Mesh *mesh = &model.meshes[0];
+	Assert(pointCount > 0);
 
 	btConvexHullShape *collision = new btConvexHullShape();
-	
-	Assert(mesh->vertexCount > 0)
-
-	Raylib::Vector3 *vertices = (Raylib::Vector3 *)mesh->vertices;
-	for(int vertexNum = 0; vertexNum < mesh->vertexCount; ++vertexNum)
+	for(u32 pointNum = 0; pointNum < pointCount; ++pointNum)
 	{
-		Raylib::Vector3 *vertex = &vertices[vertexNum];
-		btVector3 btv = btVector3(vertex->x, vertex->y, vertex->z);
-		collision->addPoint(btv);
+		collision->addPoint(points[pointNum], false);
 	}
+	collision->recalcLocalAabb();
 
 	collision->setLocalScaling(btVector3(scale, scale, scale));
 
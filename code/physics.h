@@ -3,21 +3,33 @@
 #include "defines.h"
 
 #include "math.h"
+#include "poolAllocator.h"
 
+#if !defined(PLATFORM_HEADLESS)
 #include "raylib.h"
+#endif
 
+#include <atomic>
 #include <vector>
 
 #include "LinearMath/btVector3.h"
 #include "LinearMath/btQuaternion.h"
+#include "LinearMath/btTransform.h"
 
 class btDefaultCollisionConfiguration;
 class btCollisionDispatcher;
 class btBroadphaseInterface;
+class btDbvtBroadphase;
 class btSequentialImpulseConstraintSolver;
+class btConstraintSolverPoolMt;
 class btDiscreteDynamicsWorld;
 
+class btCollisionObject;
 class btPairCachingGhostObject;
+class btGhostPairCallback;
+
+class btPersistentManifold;
+struct btBroadphaseProxy;
 
 class btConvexShape;
 class btConvexHullShape;
@@ -27,43 +39,278 @@ class CollisionDrawer;
 
 class btActionInterface;
 
+class SnapshotReader;
+class WorldSnapshot;
+
+// Broadphase filter groups. The first two match Bullet's own DefaultFilter and StaticFilter
+enum CollisionGroup : int
+{
+	COLLISION_GROUP_DEFAULT = 1 << 0,
+	COLLISION_GROUP_STATIC = 1 << 1,
+	COLLISION_GROUP_PROJECTILE = 1 << 6,
+	COLLISION_GROUP_SHIP = 1 << 7,
+	COLLISION_GROUP_ALL = -1,
+};
+
 struct RigidBody
 {
 	btRigidBody *body;
 };
 
+// Written by the motion states of the bodies Bullet moved in a step, sleeping bodies produce none. One array per
+// component, rotations are kept as Bullet's matrices so MatricesToQuaternions can convert them a batch at a time
+struct TransformUpdates
+{
+	std::vector<entt::entity> entities;
+	std::vector<r32> translations[3];
+	std::vector<r32> rotations[9]; // Row major
+
+	u32 GetCount() const { return (u32)entities.size(); }
+	void Add(entt::entity entity, const btTransform &transform);
+	void Clear();
+};
+
+// A pair of entities whose bodies touch, with entity0 the lower identifier. Where several manifolds join the same
+// pair, as with compound shapes, they make one contact
+struct ContactEvent
+{
+	entt::entity entity0;
+	entt::entity entity1;
+	btVector3 point; // Deepest point, on entity1
+	btVector3 normal; // On entity1, pointing at entity0
+	r32 impulse; // Applied by the solver over every touching point, 0 for ends
+	r32 distance; // Of the deepest point, negative when penetrating
+};
+
+// Written once a step from the dispatcher's manifolds, each array sorted by entity pair. Ends carry the point and
+// normal of the last step the pair touched, and may name entities destroyed since
+struct ContactEvents
+{
+	std::vector<ContactEvent> begins;
+	std::vector<ContactEvent> persists;
+	std::vector<ContactEvent> ends;
+
+	void Clear();
+};
+
+// One ray or sphere sweep of a PhysicsWorld::QueryBatch, a radius of 0 casts a ray. Objects are filtered like
+// broadphase pairs: an object is hit when its group is in filterMask and filterGroup is in its mask
+struct SceneQuery
+{
+	btVector3 from;
+	btVector3 to;
+	r32 radius = 0.0f;
+	int filterGroup = COLLISION_GROUP_DEFAULT;
+	int filterMask = COLLISION_GROUP_ALL;
+	entt::entity ignore = entt::null; // Usually whoever is asking, so a query from inside a body doesn't hit it
+};
+
+// Closest hit of a SceneQuery
+struct SceneQueryHit
+{
+	entt::entity entity = entt::null;
+	btVector3 point = Vec3Zero; // On the surface hit, for sweeps where the sphere touched it
+	btVector3 normal = Vec3Zero; // Of the surface hit, facing back along the query
+	r32 fraction = 1.0f; // Of the way from from to to, 1 when nothing was hit
+
+	bool HasHit() const { return fraction < 1.0f; }
+};
+
+// What stepping changes about a rigid body, enough to put it back where a snapshot had it. Mass, shape and collision
+// flags are left to whoever changes them
+struct BodyState
+{
+	btTransform worldTransform;
+	btTransform interpolationWorldTransform;
+	btVector3 linearVelocity;
+	btVector3 angularVelocity;
+	btVector3 interpolationLinearVelocity;
+	btVector3 interpolationAngularVelocity;
+	btVector3 aabbMin; // Broadphase AABB, which covers the sweep of a kinematic body
+	btVector3 aabbMax;
+	r32 deactivationTime;
+	r32 hitFraction;
+	s32 activationState;
+};
+
+enum class BroadphaseType
+{
+	DYNAMIC_TREE, // btDbvtBroadphase, unbounded and incremental
+	AXIS_SWEEP, // btAxisSweep3, 16 bit, at most 32766 proxies inside worldMin/worldMax
+	AXIS_SWEEP_32, // bt32BitAxisSweep3 inside worldMin/worldMax
+	UNIFORM_GRID, // GridBroadphase, rebuilt every step and multithreaded along with the world. Keep last, recordings are checked against it
+};
+
+struct PhysicsConfig
+{
+	// Runs collision dispatch, island solving and integration on Bullet's task scheduler threads
+	bool multithreaded = false;
+	u32 workerCount = 0; // 0 uses every hardware thread
+
+	// Sizes Bullet's contact manifold and collision algorithm pools, 0 keeps Bullet's defaults of 4096 each
+	u32 expectedBodyCount = 0;
+
+	BroadphaseType broadphase = BroadphaseType::DYNAMIC_TREE;
+	// Quantisation bounds of the sweep and prune broadphases, proxies outside them are clamped to the edges
+	btVector3 worldMin = btVector3(-1000.0f, -1000.0f, -1000.0f);
+	btVector3 worldMax = btVector3(1000.0f, 1000.0f, 1000.0f);
+	// About the size of a typical body, larger bodies end up in many cells. Asteroids are 30 to 40 metres across
+	r32 gridCellSize = 40.0f;
+
+	// Sorts overlapping pairs and each island's manifolds by proxy before solving, instead of taking them in the order
+	// the broadphase found them. Slower, but a restored snapshot then solves the same way whatever pairs came and went
+	bool canonicalPairOrder = false;
+};
+
+const char *GetBroadphaseName(BroadphaseType type);
+
+// Counters from the last Step, also published to Optick as tags
+struct PhysicsStepStats
+{
+	u32 activeBodies = 0;
+	u32 sleepingBodies = 0; // Disabled pooled bodies count as neither
+	u32 overlappingPairs = 0;
+	u32 manifolds = 0;
+	u32 contactPoints = 0;
+	u32 touchingPairs = 0; // Entity pairs with a point at or inside contact distance
+	u32 contactBegins = 0;
+	u32 contactEnds = 0;
+	u32 solverCalls = 0; // Bullet batches small islands together, so this is at most the island count
+	u32 solverIterations = 0; // Summed over every solver call
+};
+
+// Shared by every constraint solver a world owns, which may run on several threads at once
+struct SolverCounters
+{
+	std::atomic<u32> calls = 0;
+	std::atomic<u32> iterations = 0;
+};
+
 class PhysicsWorld
 {
 public:
-	PhysicsWorld() { InitWorld(); };
+	PhysicsWorld(const PhysicsConfig &config = PhysicsConfig());
 	~PhysicsWorld() { FreeWorld(); };
 
+	// Clears the transform updates, then steps. Read GetTransformUpdates() afterwards for the bodies that moved and
+	// GetContactEvents() for the pairs that started, kept or stopped touching
 	void Step(r32 deltaTime);
 
-	btPairCachingGhostObject *CreateGhostObject(btConvexShape *collisionShape, int filterGroup, int filterMask);
+	const TransformUpdates &GetTransformUpdates() const { return m_transformUpdates; }
+	const ContactEvents &GetContactEvents() const { return m_contactEvents; }
+	const PhysicsStepStats &GetStepStats() const { return m_stepStats; }
+
+	// entity is stored on the collision object so broadphase queries can map back to the ECS.
+	// The ghost's pair cache tracks everything its broadphase AABB overlaps. Ghost pairs never reach the narrowphase,
+	// whoever owns the ghost does its own queries against that cache
+	btPairCachingGhostObject *CreateGhostObject(btConvexShape *collisionShape, int filterGroup, int filterMask, entt::entity entity = entt::null,
+		const btTransform &transform = btTransform::getIdentity());
 
-	RigidBody CreateRigidBody(btVector3 position, btQuaternion rotation, r32 mass, btConvexShape *collisionShape);
+	RigidBody CreateRigidBody(btVector3 position, btQuaternion rotation, r32 mass, btConvexShape *collisionShape, entt::entity entity = entt::null);
+	// Swaps the shape of a body already in the world, keeping its mass
+	void SetCollisionShape(btRigidBody *body, btConvexShape *collisionShape);
+	// Removes the body from the world and returns it and its motion state to the pools. The shape is left to the caller
+	void DestroyRigidBody(btRigidBody *body);
 
 	void AddAction(btActionInterface *action);
 
+	// For pooled bodies that stay in the world between uses. A disabled body is not simulated, generates no pairs and
+	// maps to no entity. Enabling it places it at transform, owned by entity, with its pairs rebuilt on the next step
+	void DisableBody(btRigidBody *body);
+	void EnableBody(btRigidBody *body, const btTransform &transform, const btVector3 &linearVelocity, entt::entity entity, int filterGroup = COLLISION_GROUP_DEFAULT);
+
+	// Takes a body out of the simulation while leaving it in the world, asleep so Bullet neither moves it nor updates
+	// its AABB. It collides as an immovable obstacle travelling at its current velocity, and only moves through
+	// MoveKinematicBody
+	void MakeKinematic(btRigidBody *body);
+	// Hands a kinematic body back to the simulation at its current transform and velocity
+	void MakeDynamic(btRigidBody *body, r32 mass);
+	// Places a kinematic body. Its AABB also covers the body moved on by sweep, so it stays valid for queries until
+	// the next move as long as the body travels no further than that
+	void MoveKinematicBody(btRigidBody *body, const btTransform &transform, const btVector3 &sweep = Vec3Zero);
+
+	void SaveBodyState(const btRigidBody *body, BodyState &state) const;
+	void RestoreBodyState(btRigidBody *body, const BodyState &state);
+
+	// Broadphase AABB of any collision object in the world
+	void GetAabb(const btCollisionObject *collisionObject, btVector3 &aabbMin, btVector3 &aabbMax) const;
+	void SetAabb(btCollisionObject *collisionObject, const btVector3 &aabbMin, const btVector3 &aabbMax);
+
+	// State the world carries between steps that belongs to no body: the time left over from the last fixed step, the
+	// overlapping pairs, the contact points each manifold keeps for warm starting and the entity pairs touching, which
+	// the next step's contact events are found against. Pairs that ended since the save come back with empty
+	// manifolds, and manifolds made after it are cleared
+	void SaveState(WorldSnapshot &snapshot) const;
+	void RestoreState(SnapshotReader &reader);
+
+	// Contact manifolds from the last step, one per overlapping pair
+	btCollisionDispatcher *GetDispatcher() const { return m_dispatcher; }
+
+	const PhysicsConfig &GetConfig() const { return m_config; }
+
+	// Appends the entity of every collision object whose AABB is at least partly inside the convex volume bounded
+	// by the planes. Normals face inwards, a point p is inside a plane when normal.dot(p) + offset >= 0
+	void QueryConvexVolume(const btVector3 *normals, const r32 *offsets, u32 planeCount, std::vector<entt::entity> &entities) const;
+	// Appends the entity of every collision object whose broadphase AABB overlaps the box
+	void QueryAabb(const btVector3 &aabbMin, const btVector3 &aabbMax, std::vector<entt::entity> &entities) const;
+	// Finds the closest hit of each query, written to hits at the same index. The batch is split across Bullet's task
+	// scheduler threads when the world is multithreaded, and each range of queries shares one stack for its walks
+	// through the broadphase tree. Only call it between steps
+	void QueryBatch(const SceneQuery *queries, u32 queryCount, SceneQueryHit *hits) const;
+
+	u32 GetCollisionObjectCount() const;
+
+#if !defined(PLATFORM_HEADLESS)
 	void DrawDebugInfo();
+#endif
 
 
 private:
 	void InitWorld();
 	void FreeWorld();
+	void UpdateStepStats();
+	void ExtractContactEvents();
+
+	PhysicsConfig m_config;
 
 	btDefaultCollisionConfiguration *m_collisionConfiguration;
 	btCollisionDispatcher *m_dispatcher;
 	btBroadphaseInterface *m_broadphase;
+	btDbvtBroadphase *m_dbvtBroadphase = nullptr; // Same object as m_broadphase when it is a dynamic AABB tree
 	btSequentialImpulseConstraintSolver *m_solver;
+	btConstraintSolverPoolMt *m_solverPool = nullptr; // Only used when multithreaded
 	btDiscreteDynamicsWorld *m_world;
+	btGhostPairCallback *m_ghostPairCallback;
+
+	TransformUpdates m_transformUpdates;
+	ContactEvents m_contactEvents;
+	std::vector<ContactEvent> m_touching; // Pairs touching after the last step, sorted by entity pair
+	std::vector<ContactEvent> m_lastTouching;
+	struct RestoreManifold
+	{
+		const btCollisionObject *body0;
+		const btCollisionObject *body1;
+		btPersistentManifold *manifold;
+		bool restored;
+	};
+	std::vector<RestoreManifold> m_restoreManifolds; // Scratch for RestoreState, sorted by bodies then address
+	std::vector<std::pair<btBroadphaseProxy *, btBroadphaseProxy *>> m_savedPairs; // Scratch for RestoreState
+	std::vector<std::pair<btBroadphaseProxy *, btBroadphaseProxy *>> m_currentPairs;
+
+	SolverCounters m_solverCounters;
+	PhysicsStepStats m_stepStats;
 
-	CollisionDrawer *m_debugDrawer;
+	PoolAllocator m_bodyPool;
+	PoolAllocator m_motionStatePool;
+
+	CollisionDrawer *m_debugDrawer = nullptr;
 };
 
 
 
+void SetCollisionEntity(btCollisionObject *collisionObject, entt::entity entity);
+entt::entity GetCollisionEntity(const btCollisionObject *collisionObject);
+
 btConvexShape * CreateCapsuleXAxisCollision(r32 radius, r32 length);
 btConvexShape * CreateCapsuleYAxisCollision(r32 radius, r32 length);
 btConvexShape * CreateCapsuleZAxisCollision(r32 radius, r32 length);
@@ -73,4 +320,6 @@ btConvexShape *CreateCylinderYAxisCollision(r32 radius, r32 length);
 btConvexShape *CreateCylinderZAxisCollision(r32 radius, r32 length);
 
 
-btConvexShape * CreateConvexCollision(const Raylib::Model &model, r32 scale);
\ No newline at end of file
+btConvexShape *CreateSphereCollision(r32 radius);
+
+btConvexShape *CreateConvexCollision(const btVector3 *points, u32 pointCount, r32 scale);
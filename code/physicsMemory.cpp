@@ -0,0 +1,273 @@
+#include "physicsMemory.h"
+
+// Before Bullet, its <math.h> resolves to ours while code/ is on the include path
+#include "math.h"
+
+#include "LinearMath/btAlignedAllocator.h"
+
+#include <atomic>
+#include <new>
+#include <stdlib.h>
+
+// Every allocation is preceded by a header, so payloads of the size class slots stay 16 byte aligned
+constexpr u32 headerSize = 16;
+constexpr u32 smallestSizeClass = 16;
+constexpr u32 sizeClassCount = 9; // 16 bytes to 4KB, slot sizes include the header
+constexpr u32 largeSizeClass = sizeClassCount;
+constexpr u64 chunkSize = Kilobytes(64);
+
+struct Arena;
+
+struct AllocationHeader
+{
+	union
+	{
+		Arena *owner; // Size class slots
+		u64 largeSize; // Large allocations, which go straight to malloc
+	};
+	u32 sizeClass;
+	u32 baseOffset; // Large allocations only, bytes from the malloc'd pointer to this header
+};
+static_assert(sizeof(AllocationHeader) <= headerSize, "Allocation header must fit before the payload");
+
+// Free slots keep their header, the link lives in the payload
+struct FreeSlot
+{
+	FreeSlot *next;
+};
+
+struct Arena
+{
+	FreeSlot *freeLists[sizeClassCount] = {};
+	u8 *chunkCursor = nullptr;
+	u8 *chunkEnd = nullptr;
+
+	// Slots freed by other threads, moved onto the free lists by the owner on its next allocation
+	std::atomic<FreeSlot *> remoteFrees = nullptr;
+
+	// Only written by the owning thread, apart from BeginPhysicsMemoryFrame resetting the frame values
+	std::atomic<s64> bytesInUse = 0;
+	std::atomic<s64> frameHighWater = 0;
+	std::atomic<s64> peakHighWater = 0;
+	std::atomic<u64> bytesReserved = 0;
+	std::atomic<u64> frameAllocations = 0;
+
+	Arena *next = nullptr;
+};
+
+static std::atomic<Arena *> arenaList = nullptr;
+static thread_local Arena *threadArena = nullptr;
+
+static u32 SizeClassBytes(u32 sizeClass)
+{
+	return smallestSizeClass << sizeClass;
+}
+
+static FreeSlot *SlotFromHeader(AllocationHeader *header)
+{
+	return (FreeSlot *)((u8 *)header + headerSize);
+}
+
+static AllocationHeader *HeaderFromSlot(FreeSlot *slot)
+{
+	return (AllocationHeader *)((u8 *)slot - headerSize);
+}
+
+static Arena *GetThreadArena()
+{
+	if(!threadArena)
+	{
+		// Arenas outlive their threads, another thread may still free into them
+		Arena *arena = new Arena();
+		arena->next = arenaList.load(std::memory_order_relaxed);
+		while(!arenaList.compare_exchange_weak(arena->next, arena, std::memory_order_release, std::memory_order_relaxed)) {}
+		threadArena = arena;
+	}
+	return threadArena;
+}
+
+static void TrackAllocation(Arena *arena, s64 bytes)
+{
+	s64 inUse = arena->bytesInUse.load(std::memory_order_relaxed) + bytes;
+	arena->bytesInUse.store(inUse, std::memory_order_relaxed);
+	arena->frameAllocations.store(arena->frameAllocations.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+
+	if(inUse > arena->frameHighWater.load(std::memory_order_relaxed))
+	{
+		arena->frameHighWater.store(inUse, std::memory_order_relaxed);
+	}
+	if(inUse > arena->peakHighWater.load(std::memory_order_relaxed))
+	{
+		arena->peakHighWater.store(inUse, std::memory_order_relaxed);
+	}
+}
+
+static void TrackFree(Arena *arena, s64 bytes)
+{
+	arena->bytesInUse.store(arena->bytesInUse.load(std::memory_order_relaxed) - bytes, std::memory_order_relaxed);
+}
+
+static void DrainRemoteFrees(Arena *arena)
+{
+	FreeSlot *slot = arena->remoteFrees.exchange(nullptr, std::memory_order_acquire);
+	while(slot)
+	{
+		FreeSlot *next = slot->next;
+		u32 sizeClass = HeaderFromSlot(slot)->sizeClass;
+		slot->next = arena->freeLists[sizeClass];
+		arena->freeLists[sizeClass] = slot;
+		TrackFree(arena, SizeClassBytes(sizeClass));
+		slot = next;
+	}
+}
+
+static void *AllocateLarge(Arena *arena, size_t size, u32 alignment)
+{
+	size_t totalSize = size + alignment + headerSize;
+	u8 *base = (u8 *)malloc(totalSize);
+	if(!base)
+	{
+		return nullptr;
+	}
+
+	uintptr_t payload = ((uintptr_t)base + headerSize + alignment - 1) & ~(uintptr_t)(alignment - 1);
+	AllocationHeader *header = (AllocationHeader *)(payload - headerSize);
+	header->largeSize = totalSize;
+	header->sizeClass = largeSizeClass;
+	header->baseOffset = (u32)((u8 *)header - base);
+
+	arena->bytesReserved.store(arena->bytesReserved.load(std::memory_order_relaxed) + totalSize, std::memory_order_relaxed);
+	TrackAllocation(arena, (s64)totalSize);
+	return (void *)payload;
+}
+
+static void *ArenaAlignedAlloc(size_t size, int alignment)
+{
+	Arena *arena = GetThreadArena();
+
+	if(alignment > (int)headerSize || size + headerSize > SizeClassBytes(sizeClassCount - 1))
+	{
+		return AllocateLarge(arena, size, (u32)MAX(alignment, (int)headerSize));
+	}
+
+	u32 sizeClass = 0;
+	while(SizeClassBytes(sizeClass) < size + headerSize)
+	{
+		++sizeClass;
+	}
+	u32 slotBytes = SizeClassBytes(sizeClass);
+
+	if(!arena->freeLists[sizeClass] && arena->remoteFrees.load(std::memory_order_relaxed))
+	{
+		DrainRemoteFrees(arena);
+	}
+
+	AllocationHeader *header = nullptr;
+	if(FreeSlot *slot = arena->freeLists[sizeClass])
+	{
+		arena->freeLists[sizeClass] = slot->next;
+		header = HeaderFromSlot(slot);
+	}
+	else
+	{
+		if(arena->chunkCursor + slotBytes > arena->chunkEnd)
+		{
+			// Whatever is left of the old chunk is too small for this class and gets abandoned
+			arena->chunkCursor = (u8 *)::operator new(chunkSize, std::align_val_t(headerSize));
+			arena->chunkEnd = arena->chunkCursor + chunkSize;
+			arena->bytesReserved.store(arena->bytesReserved.load(std::memory_order_relaxed) + chunkSize, std::memory_order_relaxed);
+		}
+
+		header = (AllocationHeader *)arena->chunkCursor;
+		arena->chunkCursor += slotBytes;
+		header->owner = arena;
+		header->sizeClass = sizeClass;
+	}
+
+	TrackAllocation(arena, slotBytes);
+	return SlotFromHeader(header);
+}
+
+static void *ArenaAlloc(size_t size)
+{
+	return ArenaAlignedAlloc(size, (int)headerSize);
+}
+
+static void ArenaFree(void *memory)
+{
+	if(!memory)
+	{
+		return;
+	}
+
+	AllocationHeader *header = HeaderFromSlot((FreeSlot *)memory);
+	Arena *arena = GetThreadArena();
+
+	if(header->sizeClass == largeSizeClass)
+	{
+		// Counted against the freeing thread, the sum over arenas still comes out right
+		s64 totalSize = (s64)header->largeSize;
+		arena->bytesReserved.store(arena->bytesReserved.load(std::memory_order_relaxed) - totalSize, std::memory_order_relaxed);
+		TrackFree(arena, totalSize);
+		free((u8 *)header - header->baseOffset);
+		return;
+	}
+
+	Assert(header->sizeClass < sizeClassCount);
+	FreeSlot *slot = (FreeSlot *)memory;
+	Arena *owner = header->owner;
+	if(owner == arena)
+	{
+		slot->next = arena->freeLists[header->sizeClass];
+		arena->freeLists[header->sizeClass] = slot;
+		TrackFree(arena, SizeClassBytes(header->sizeClass));
+	}
+	else
+	{
+		slot->next = owner->remoteFrees.load(std::memory_order_relaxed);
+		while(!owner->remoteFrees.compare_exchange_weak(slot->next, slot, std::memory_order_release, std::memory_order_relaxed)) {}
+	}
+}
+
+void InstallPhysicsAllocator()
+{
+	static bool installed = false;
+	if(!installed)
+	{
+		btAlignedAllocSetCustom(ArenaAlloc, ArenaFree);
+		btAlignedAllocSetCustomAligned(ArenaAlignedAlloc, ArenaFree);
+		installed = true;
+	}
+}
+
+void BeginPhysicsMemoryFrame()
+{
+	for(Arena *arena = arenaList.load(std::memory_order_acquire); arena; arena = arena->next)
+	{
+		arena->frameHighWater.store(arena->bytesInUse.load(std::memory_order_relaxed), std::memory_order_relaxed);
+		arena->frameAllocations.store(0, std::memory_order_relaxed);
+	}
+}
+
+PhysicsMemoryStats GetPhysicsMemoryStats()
+{
+	s64 bytesInUse = 0;
+	s64 frameHighWater = 0;
+	s64 peakHighWater = 0;
+
+	PhysicsMemoryStats stats;
+	for(Arena *arena = arenaList.load(std::memory_order_acquire); arena; arena = arena->next)
+	{
+		bytesInUse += arena->bytesInUse.load(std::memory_order_relaxed);
+		frameHighWater += arena->frameHighWater.load(std::memory_order_relaxed);
+		peakHighWater += arena->peakHighWater.load(std::memory_order_relaxed);
+		stats.bytesReserved += arena->bytesReserved.load(std::memory_order_relaxed);
+		stats.frameAllocations += arena->frameAllocations.load(std::memory_order_relaxed);
+		++stats.arenaCount;
+	}
+
+	stats.bytesInUse = (u64)MAX(bytesInUse, (s64)0);
+	stats.frameHighWater = (u64)MAX(frameHighWater, (s64)0);
+	stats.peakHighWater = (u64)MAX(peakHighWater, (s64)0);
+	return stats;
+}
@@ -0,0 +1,24 @@
+#pragma once
+
+#include "defines.h"
+
+// Routes Bullet's btAlignedAlloc/btAlignedFree through per-thread arenas. Every thread carves size classes out of
+// chunks it owns, so Bullet's worker threads never share a lock or a free list. Memory freed on another thread is
+// handed back to the arena that owns it. Chunks are reused and only returned to the system at exit.
+
+struct PhysicsMemoryStats
+{
+	u64 bytesInUse = 0;
+	u64 frameHighWater = 0; // Most in use since BeginPhysicsMemoryFrame. Summed per thread, so an upper bound
+	u64 peakHighWater = 0; // Same, over the whole run
+	u64 bytesReserved = 0; // Arena chunks plus the allocations too large for a size class
+	u64 frameAllocations = 0;
+	u32 arenaCount = 0;
+};
+
+// Must run before Bullet allocates anything, memory from Bullet's default allocator can't be freed by the arenas.
+// Safe to call more than once
+void InstallPhysicsAllocator();
+
+void BeginPhysicsMemoryFrame();
+PhysicsMemoryStats GetPhysicsMemoryStats();
@@ -0,0 +1,51 @@
+#include "physicsProfiler.h"
+
+// Before Bullet, its <math.h> resolves to ours while code/ is on the include path
+#include "math.h"
+
+#include "LinearMath/btQuickprof.h"
+#include "LinearMath/btThreads.h"
+
+#if USE_OPTICK
+#include <unordered_map>
+
+// Bullet names its zones with string literals, so each thread maps the pointer straight to an Optick description and
+// only takes Optick's shared lock the first time it sees a zone
+static thread_local std::unordered_map<const char *, Optick::EventDescription *> zoneDescriptions;
+static thread_local bool threadChecked = false;
+
+static void EnterPhysicsZone(const char *name)
+{
+	if(!threadChecked)
+	{
+		threadChecked = true;
+
+		// Bullet's workers only ever run inside its parallel sections and nothing else registers them. Game threads
+		// register themselves and only reach Bullet while it is idle, so they don't get a second registration
+		if(btThreadsAreRunning() && !btIsMainThread())
+		{
+			Optick::RegisterThread("PhysicsWorker");
+		}
+	}
+
+	Optick::EventDescription *&description = zoneDescriptions[name];
+	if(!description)
+	{
+		description = Optick::EventDescription::CreateShared(name);
+	}
+	Optick::Event::Push(*description);
+}
+
+static void LeavePhysicsZone()
+{
+	Optick::Event::Pop();
+}
+#endif
+
+void InstallPhysicsProfiler()
+{
+#if USE_OPTICK
+	btSetCustomEnterProfileZoneFunc(EnterPhysicsZone);
+	btSetCustomLeaveProfileZoneFunc(LeavePhysicsZone);
+#endif
+}
@@ -0,0 +1,9 @@
+#pragma once
+
+#include "defines.h"
+
+// Forwards Bullet's BT_PROFILE zones (broadphase, narrowphase, islands, solver...) to Optick as nested events, so a
+// slow PhysicsStep breaks down in the capture. Bullet's task scheduler threads register with Optick the first time
+// they enter a zone. Does nothing when Optick is compiled out.
+// Safe to call more than once
+void InstallPhysicsProfiler();
@@ -0,0 +1,96 @@
+#pragma once
+
+#include "defines.h"
+
+#include <new>
+#include <utility>
+#include <vector>
+
+// Fixed size slots carved out of blocks that stay allocated until the pool is destroyed, so objects of one kind sit
+// next to each other in memory and allocating is a free list pop. Not thread safe
+class PoolAllocator
+{
+public:
+	PoolAllocator(u32 slotSize, u32 slotAlignment, u32 slotsPerBlock)
+		: m_slotSize((u32)Align16(MAX(slotSize, (u32)sizeof(FreeSlot)))), m_slotAlignment(MAX(slotAlignment, 16u)), m_slotsPerBlock(slotsPerBlock)
+	{
+		Assert(m_slotSize % m_slotAlignment == 0);
+	}
+
+	~PoolAllocator()
+	{
+		for(void *block : m_blocks)
+		{
+			::operator delete(block, std::align_val_t(m_slotAlignment));
+		}
+	}
+
+	PoolAllocator(const PoolAllocator &) = delete;
+	PoolAllocator &operator=(const PoolAllocator &) = delete;
+
+	void *Allocate()
+	{
+		if(!m_freeSlots)
+		{
+			AddBlock();
+		}
+
+		FreeSlot *slot = m_freeSlots;
+		m_freeSlots = slot->next;
+		++m_usedCount;
+		return slot;
+	}
+
+	void Free(void *memory)
+	{
+		FreeSlot *slot = (FreeSlot *)memory;
+		slot->next = m_freeSlots;
+		m_freeSlots = slot;
+		--m_usedCount;
+	}
+
+	template<typename T, typename... Args>
+	T *New(Args &&... args)
+	{
+		Assert(sizeof(T) <= m_slotSize && alignof(T) <= m_slotAlignment);
+		return new(Allocate()) T(std::forward<Args>(args)...);
+	}
+
+	template<typename T>
+	void Delete(T *object)
+	{
+		object->~T();
+		Free(object);
+	}
+
+	u32 GetUsedCount() const { return m_usedCount; }
+	u64 GetReservedBytes() const { return (u64)m_blocks.size() * m_slotsPerBlock * m_slotSize; }
+
+private:
+	struct FreeSlot
+	{
+		FreeSlot *next;
+	};
+
+	void AddBlock()
+	{
+		u8 *block = (u8 *)::operator new((size_t)m_slotsPerBlock * m_slotSize, std::align_val_t(m_slotAlignment));
+		m_blocks.push_back(block);
+
+		// Linked back to front so slots are handed out in address order
+		for(u32 slotNum = m_slotsPerBlock; slotNum > 0; --slotNum)
+		{
+			FreeSlot *slot = (FreeSlot *)(block + (size_t)(slotNum - 1) * m_slotSize);
+			slot->next = m_freeSlots;
+			m_freeSlots = slot;
+		}
+	}
+
+	u32 m_slotSize;
+	u32 m_slotAlignment;
+	u32 m_slotsPerBlock;
+
+	FreeSlot *m_freeSlots = nullptr;
+	u32 m_usedCount = 0;
+	std::vector<void *> m_blocks;
+};
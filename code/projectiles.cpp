@@ -0,0 +1,177 @@
+#include "projectiles.h"
+
+#include "btBulletDynamicsCommon.h"
+
+#include <algorithm>
+
+ProjectilePool::ProjectilePool(entt::registry &registry, PhysicsWorld &physics, btConvexShape *collisionShape, r32 mass, u32 capacity)
+	: m_registry(registry), m_physics(physics), m_collisionShape(collisionShape)
+{
+	OPTICK_EVENT();
+
+	m_slots.resize(capacity);
+	m_freeSlots.reserve(capacity);
+	m_releaseList.reserve(capacity);
+
+	for(u32 slotNum = 0; slotNum < capacity; ++slotNum)
+	{
+		Slot &slot = m_slots[slotNum];
+		slot.body = m_physics.CreateRigidBody(Vec3Zero, QuatIdentity, mass, m_collisionShape).body;
+		m_physics.DisableBody(slot.body);
+
+		// Pushed in reverse so slots are handed out from the front
+		m_freeSlots.push_back(capacity - 1 - slotNum);
+	}
+
+	// Sized up front so spawning never grows the storages
+	m_registry.storage<Projectile>().reserve(capacity);
+	m_registry.storage<RigidBody>().reserve(m_registry.storage<RigidBody>().size() + capacity);
+	m_registry.storage<Transform>().reserve(m_registry.storage<Transform>().size() + capacity);
+}
+
+ProjectilePool::~ProjectilePool()
+{
+	for(Slot &slot : m_slots)
+	{
+		if(slot.entity != entt::null && m_registry.valid(slot.entity))
+		{
+			m_registry.destroy(slot.entity);
+		}
+		m_physics.DestroyRigidBody(slot.body);
+	}
+	m_slots.clear();
+
+	delete m_collisionShape;
+}
+
+entt::entity ProjectilePool::Spawn(const Transform &transform, const btVector3 &velocity, r32 lifetime)
+{
+	if(m_freeSlots.empty())
+	{
+		return entt::null;
+	}
+
+	u32 slotNum = m_freeSlots.back();
+	m_freeSlots.pop_back();
+	return SpawnInSlot(slotNum, entt::null, transform, velocity, lifetime);
+}
+
+entt::entity ProjectilePool::SpawnInSlot(u32 slotNum, entt::entity hint, const Transform &transform, const btVector3 &velocity, r32 lifetime)
+{
+	Slot &slot = m_slots[slotNum];
+
+	slot.entity = m_registry.create(hint);
+	m_registry.emplace<Transform>(slot.entity, transform);
+	m_registry.emplace<RigidBody>(slot.entity, slot.body);
+
+	Projectile &projectile = m_registry.emplace<Projectile>(slot.entity);
+	projectile.timeRemaining = lifetime;
+	projectile.slot = slotNum;
+
+	m_physics.EnableBody(slot.body, btTransform(transform.rotation, transform.translation), velocity, slot.entity, COLLISION_GROUP_PROJECTILE);
+	return slot.entity;
+}
+
+void ProjectilePool::Release(entt::entity entity)
+{
+	const Projectile *projectile = m_registry.try_get<Projectile>(entity);
+	if(!projectile)
+	{
+		return;
+	}
+
+	u32 slotNum = projectile->slot;
+	Slot &slot = m_slots[slotNum];
+	Assert(slot.entity == entity);
+
+	m_physics.DisableBody(slot.body);
+	m_registry.destroy(entity);
+
+	slot.entity = entt::null;
+	m_freeSlots.push_back(slotNum);
+}
+
+void ProjectilePool::SaveState(ProjectilePoolState &state) const
+{
+	state.slotEntities.resize(m_slots.size());
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		state.slotEntities[slotNum] = m_slots[slotNum].entity;
+	}
+	state.freeSlots = m_freeSlots;
+}
+
+void ProjectilePool::RestoreReleases(const ProjectilePoolState &state)
+{
+	Assert(state.slotEntities.size() == m_slots.size());
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		entt::entity entity = m_slots[slotNum].entity;
+		if(entity != entt::null && entity != state.slotEntities[slotNum])
+		{
+			Release(entity);
+		}
+	}
+}
+
+void ProjectilePool::RestoreSpawns(const ProjectilePoolState &state)
+{
+	for(u32 slotNum = 0; slotNum < m_slots.size(); ++slotNum)
+	{
+		entt::entity entity = state.slotEntities[slotNum];
+		if(entity != entt::null && m_slots[slotNum].entity != entity)
+		{
+			entt::entity spawned = SpawnInSlot(slotNum, entity, Transform(), Vec3Zero, 0.0f);
+			Assert(spawned == entity);
+			UNUSED(spawned);
+		}
+	}
+	m_freeSlots = state.freeSlots;
+}
+
+void ProjectilePool::Update(r32 dt, const ContactEvents &contacts)
+{
+	OPTICK_EVENT();
+
+	m_releaseList.clear();
+
+	auto view = m_registry.view<Projectile>();
+	view.each([this, dt](entt::entity entity, Projectile &projectile) {
+		projectile.timeRemaining -= dt;
+		if(projectile.timeRemaining <= 0.0f)
+		{
+			m_releaseList.push_back(entity);
+		}
+	});
+
+	// A projectile goes on its first touch, so it only persists in a contact when it was spawned already touching
+	for(const std::vector<ContactEvent> *events : {&contacts.begins, &contacts.persists})
+	{
+		for(const ContactEvent &contact : *events)
+		{
+			for(entt::entity entity : {contact.entity0, contact.entity1})
+			{
+				if(m_registry.valid(entity) && m_registry.all_of<Projectile>(entity))
+				{
+					m_releaseList.push_back(entity);
+				}
+			}
+		}
+	}
+
+	OPTICK_TAG("ProjectilesReleased", (u32)m_releaseList.size());
+
+	// Released in entity order rather than contact order, so the identifiers and slots the next shots get don't depend
+	// on what each one hit. A projectile that expired and made contact, or touched two bodies, is listed more than
+	// once and the later entries are already destroyed
+	std::sort(m_releaseList.begin(), m_releaseList.end());
+	for(entt::entity entity : m_releaseList)
+	{
+		if(m_registry.valid(entity))
+		{
+			Release(entity);
+		}
+	}
+
+	OPTICK_TAG("ProjectilesActive", GetActiveCount());
+}
@@ -0,0 +1,67 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+#include "physics.h"
+
+#include <vector>
+
+struct Projectile
+{
+	r32 timeRemaining = 0.0f; // Seconds until it is recycled
+	u32 slot = 0; // Into ProjectilePool, the body stays with the slot
+};
+
+// Which entity each slot was lent to and the order free slots are handed out in, for snapshots
+struct ProjectilePoolState
+{
+	std::vector<entt::entity> slotEntities; // entt::null for free slots
+	std::vector<u32> freeSlots;
+};
+
+// Fixed set of projectile bodies sharing one collision shape, created up front and kept in the physics world.
+// Spawning checks a body out and gives it a new entity, releasing disables the body and destroys the entity.
+// Projectiles are released when their lifetime runs out or when they touch anything.
+class ProjectilePool
+{
+public:
+	ProjectilePool(entt::registry &registry, PhysicsWorld &physics, btConvexShape *collisionShape, r32 mass, u32 capacity);
+	~ProjectilePool();
+
+	// Returns entt::null when every projectile is already in flight
+	entt::entity Spawn(const Transform &transform, const btVector3 &velocity, r32 lifetime);
+	void Release(entt::entity entity);
+
+	// Ages projectiles by dt and releases the expired ones along with any touching something in the last step's
+	// contacts. Creates and destroys entities, so run it from an exclusive system after the physics step
+	void Update(r32 dt, const ContactEvents &contacts);
+
+	void SaveState(ProjectilePoolState &state) const;
+	// Restoring is split in two so every system can destroy the entities a snapshot doesn't have before any of them
+	// recreate the ones it does, which take their old identifiers back. Releases projectiles the state doesn't have
+	void RestoreReleases(const ProjectilePoolState &state);
+	// Respawns the state's projectiles that are missing. Their components and bodies are left for the caller to restore
+	void RestoreSpawns(const ProjectilePoolState &state);
+
+	u32 GetCapacity() const { return (u32)m_slots.size(); }
+	u32 GetActiveCount() const { return (u32)(m_slots.size() - m_freeSlots.size()); }
+
+private:
+	entt::entity SpawnInSlot(u32 slotNum, entt::entity hint, const Transform &transform, const btVector3 &velocity, r32 lifetime);
+
+	struct Slot
+	{
+		btRigidBody *body = nullptr;
+		entt::entity entity = entt::null;
+	};
+
+	entt::registry &m_registry;
+	PhysicsWorld &m_physics;
+
+	btConvexShape *m_collisionShape;
+
+	std::vector<Slot> m_slots;
+	std::vector<u32> m_freeSlots;
+	std::vector<entt::entity> m_releaseList; // Scratch for Update
+};
@@ -0,0 +1,114 @@
+#include "renderBatch.h"
+
+#include "transformKernels.h"
+
+RenderMatrix TransformToRenderMatrix(const Transform &transform, r32 scale)
+{
+	const btQuaternion &q = transform.rotation;
+	r32 xx = q.x() * q.x(), yy = q.y() * q.y(), zz = q.z() * q.z();
+	r32 xy = q.x() * q.y(), xz = q.x() * q.z(), yz = q.y() * q.z();
+	r32 wx = q.w() * q.x(), wy = q.w() * q.y(), wz = q.w() * q.z();
+
+	r32 sx = scale, sy = scale, sz = scale;
+
+	RenderMatrix result;
+	result.m0 = (1.0f - 2.0f * (yy + zz)) * sx;
+	result.m1 = (2.0f * (xy + wz)) * sx;
+	result.m2 = (2.0f * (xz - wy)) * sx;
+	result.m3 = 0.0f;
+
+	result.m4 = (2.0f * (xy - wz)) * sy;
+	result.m5 = (1.0f - 2.0f * (xx + zz)) * sy;
+	result.m6 = (2.0f * (yz + wx)) * sy;
+	result.m7 = 0.0f;
+
+	result.m8 = (2.0f * (xz + wy)) * sz;
+	result.m9 = (2.0f * (yz - wx)) * sz;
+	result.m10 = (1.0f - 2.0f * (xx + yy)) * sz;
+	result.m11 = 0.0f;
+
+	result.m12 = transform.translation.x();
+	result.m13 = transform.translation.y();
+	result.m14 = transform.translation.z();
+	result.m15 = 1.0f;
+	return result;
+}
+
+void BuildRenderBatches(entt::registry &registry, const std::vector<entt::entity> &entities, const std::vector<r32> &modelScales, RenderBatches &batches)
+{
+	OPTICK_EVENT();
+
+	u32 modelCount = (u32)modelScales.size();
+
+	auto view = registry.view<const RenderModel, const Transform>();
+
+	// Counting sort by model index, first pass sizes each batch
+	std::vector<u32> &counts = batches.modelInstanceCounts;
+	counts.assign(modelCount, 0);
+	u32 instanceTotal = 0;
+	for(entt::entity entity : entities)
+	{
+		if(view.contains(entity))
+		{
+			const RenderModel &renderModel = view.get<const RenderModel>(entity);
+			Assert(renderModel.modelIndex < modelCount);
+			++counts[renderModel.modelIndex];
+			++instanceTotal;
+		}
+	}
+
+	batches.batches.clear();
+	batches.transforms.resize(instanceTotal);
+	for(std::vector<r32> &component : batches.instanceTranslations)
+	{
+		component.resize(instanceTotal);
+	}
+	for(std::vector<r32> &component : batches.instanceRotations)
+	{
+		component.resize(instanceTotal);
+	}
+	batches.instanceScales.resize(instanceTotal);
+
+	u32 firstInstance = 0;
+	for(u32 modelIndex = 0; modelIndex < modelCount; ++modelIndex)
+	{
+		u32 instanceCount = counts[modelIndex];
+		if(instanceCount > 0)
+		{
+			RenderBatch batch;
+			batch.modelIndex = modelIndex;
+			batch.firstInstance = firstInstance;
+			batch.instanceCount = 0; // Filled back up to instanceCount in the second pass
+			batches.batches.push_back(batch);
+		}
+		// Reuse counts as the slot of each model's batch
+		counts[modelIndex] = instanceCount > 0 ? (u32)batches.batches.size() - 1 : U32_MAX;
+		firstInstance += instanceCount;
+	}
+
+	r32 *translations[3] = {batches.instanceTranslations[0].data(), batches.instanceTranslations[1].data(), batches.instanceTranslations[2].data()};
+	r32 *rotations[4] = {batches.instanceRotations[0].data(), batches.instanceRotations[1].data(), batches.instanceRotations[2].data(), batches.instanceRotations[3].data()};
+	r32 *scales = batches.instanceScales.data();
+
+	RenderBatch *batchData = batches.batches.data();
+	for(entt::entity entity : entities)
+	{
+		if(view.contains(entity))
+		{
+			auto [renderModel, transform] = view.get(entity);
+			RenderBatch &batch = batchData[counts[renderModel.modelIndex]];
+			u32 instance = batch.firstInstance + batch.instanceCount;
+			translations[0][instance] = transform.translation.x();
+			translations[1][instance] = transform.translation.y();
+			translations[2][instance] = transform.translation.z();
+			rotations[0][instance] = transform.rotation.x();
+			rotations[1][instance] = transform.rotation.y();
+			rotations[2][instance] = transform.rotation.z();
+			rotations[3][instance] = transform.rotation.w();
+			scales[instance] = modelScales[renderModel.modelIndex];
+			++batch.instanceCount;
+		}
+	}
+
+	ComposeRenderMatrices(translations, rotations, scales, instanceTotal, batches.transforms.data());
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+
+#include <vector>
+
+// Index into the renderer's model table. Entities sharing an index are drawn together with one instanced call per mesh
+struct RenderModel
+{
+	u32 modelIndex = 0;
+};
+
+// Same layout as Raylib::Matrix so a batch can be handed straight to DrawMeshInstanced, without this needing raylib
+struct RenderMatrix
+{
+	r32 m0, m4, m8, m12;
+	r32 m1, m5, m9, m13;
+	r32 m2, m6, m10, m14;
+	r32 m3, m7, m11, m15;
+};
+
+// Translation * rotation * uniform scale, built straight from the quaternion. ComposeRenderMatrices does the same for
+// a batch of transforms at once
+RenderMatrix TransformToRenderMatrix(const Transform &transform, r32 scale);
+
+struct RenderBatch
+{
+	u32 modelIndex = 0;
+	u32 firstInstance = 0; // Into RenderBatches::transforms
+	u32 instanceCount = 0;
+};
+
+struct RenderBatches
+{
+	std::vector<RenderBatch> batches;
+	std::vector<RenderMatrix> transforms; // Instances of one batch are contiguous
+
+	// Scratch, kept so building doesn't allocate once warmed up
+	std::vector<u32> modelInstanceCounts;
+	std::vector<r32> instanceTranslations[3]; // Instance transforms gathered in batch order for ComposeRenderMatrices
+	std::vector<r32> instanceRotations[4];
+	std::vector<r32> instanceScales;
+};
+
+// Groups the given entities that have a RenderModel and Transform by model index and fills their instance transforms,
+// scaled by their model's entry in modelScales. Buffers in batches are reused from the last call
+void BuildRenderBatches(entt::registry &registry, const std::vector<entt::entity> &entities, const std::vector<r32> &modelScales, RenderBatches &batches);
@@ -0,0 +1,546 @@
+#include "replication.h"
+
+#include "loopbackTransport.h"
+#include "physics.h"
+#include "projectiles.h"
+#include "renderBatch.h"
+
+#include <algorithm>
+#include <cmath>
+
+enum PacketType : u8
+{
+	PACKET_INPUT, // Client to server: acknowledged sequence, input tick, then the inputs
+	PACKET_SNAPSHOT, // Server to client: sequence, baseline sequence, ship, removed entities, then written entities
+};
+
+// Flags leading each written entity. A new entity deltas against a zero transform, after its model index
+enum EntityFlags : u8
+{
+	ENTITY_NEW = 1 << 0,
+	ENTITY_POSITION_X = 1 << 1,
+	ENTITY_POSITION_Y = 1 << 2,
+	ENTITY_POSITION_Z = 1 << 3,
+	ENTITY_ROTATION_DELTA = 1 << 4, // Same largest component, the other three as deltas
+	ENTITY_ROTATION_FULL = 1 << 5,
+};
+
+constexpr u32 rotationComponentBits = 10;
+constexpr u32 rotationComponentMask = (1 << rotationComponentBits) - 1;
+constexpr r32 rotationComponentRange = 0.70710678f; // None but the largest component can be bigger than 1 / sqrt(2)
+
+static u32 GetEntityId(entt::entity entity)
+{
+	return entt::to_integral(entity);
+}
+
+static bool IsEntityBefore(const ReplicatedEntity &a, const ReplicatedEntity &b)
+{
+	return GetEntityId(a.entity) < GetEntityId(b.entity);
+}
+
+QuantizedTransform QuantizeTransform(const Transform &transform)
+{
+	QuantizedTransform quantized;
+	for(u32 axis = 0; axis < 3; ++axis)
+	{
+		quantized.position[axis] = (s32)std::lround(transform.translation[axis] * quantizedPositionScale);
+	}
+
+	r32 components[4] = {transform.rotation.x(), transform.rotation.y(), transform.rotation.z(), transform.rotation.w()};
+	u32 largest = 0;
+	for(u32 componentNum = 1; componentNum < 4; ++componentNum)
+	{
+		if(fabsf(components[componentNum]) > fabsf(components[largest]))
+		{
+			largest = componentNum;
+		}
+	}
+
+	// q and -q are the same rotation, so the largest is made positive and left out
+	r32 sign = (components[largest] < 0.0f) ? -1.0f : 1.0f;
+	quantized.rotation = largest << (3 * rotationComponentBits);
+	u32 shift = 2 * rotationComponentBits;
+	for(u32 componentNum = 0; componentNum < 4; ++componentNum)
+	{
+		if(componentNum == largest)
+		{
+			continue;
+		}
+		r32 normalized = (components[componentNum] * sign / rotationComponentRange + 1.0f) * 0.5f;
+		u32 value = (u32)std::lround(MIN(MAX(normalized, 0.0f), 1.0f) * rotationComponentMask);
+		quantized.rotation |= value << shift;
+		shift -= rotationComponentBits;
+	}
+	return quantized;
+}
+
+Transform DequantizeTransform(const QuantizedTransform &quantized)
+{
+	Transform transform;
+	transform.translation = btVector3((r32)quantized.position[0], (r32)quantized.position[1], (r32)quantized.position[2]) / quantizedPositionScale;
+
+	u32 largest = quantized.rotation >> (3 * rotationComponentBits);
+	r32 components[4];
+	r32 sumSquares = 0.0f;
+	u32 shift = 2 * rotationComponentBits;
+	for(u32 componentNum = 0; componentNum < 4; ++componentNum)
+	{
+		if(componentNum == largest)
+		{
+			continue;
+		}
+		u32 value = (quantized.rotation >> shift) & rotationComponentMask;
+		components[componentNum] = ((r32)value / rotationComponentMask * 2.0f - 1.0f) * rotationComponentRange;
+		sumSquares += components[componentNum] * components[componentNum];
+		shift -= rotationComponentBits;
+	}
+	components[largest] = sqrtf(MAX(1.0f - sumSquares, 0.0f));
+
+	transform.rotation = btQuaternion(components[0], components[1], components[2], components[3]).normalized();
+	return transform;
+}
+
+// Differences wrap, the decoder adds them back the same way
+static s32 GetDelta(s32 value, s32 base)
+{
+	return (s32)((u32)value - (u32)base);
+}
+
+static s32 ApplyDelta(s32 base, s32 delta)
+{
+	return (s32)((u32)base + (u32)delta);
+}
+
+static void WriteEntity(PacketWriter &writer, const ReplicatedEntity &entity, const ReplicatedEntity *base)
+{
+	static const ReplicatedEntity zero = {};
+	u8 flags = base ? 0 : ENTITY_NEW;
+	const QuantizedTransform &baseTransform = base ? base->transform : zero.transform;
+	const QuantizedTransform &transform = entity.transform;
+
+	for(u32 axis = 0; axis < 3; ++axis)
+	{
+		if(transform.position[axis] != baseTransform.position[axis])
+		{
+			flags |= ENTITY_POSITION_X << axis;
+		}
+	}
+
+	constexpr u32 largestShift = 3 * rotationComponentBits;
+	if(transform.rotation != baseTransform.rotation)
+	{
+		flags |= ((transform.rotation >> largestShift) == (baseTransform.rotation >> largestShift)) ? ENTITY_ROTATION_DELTA : ENTITY_ROTATION_FULL;
+	}
+
+	writer.Write(flags);
+	if(flags & ENTITY_NEW)
+	{
+		writer.WriteVarint(entity.modelIndex);
+	}
+	for(u32 axis = 0; axis < 3; ++axis)
+	{
+		if(flags & (ENTITY_POSITION_X << axis))
+		{
+			writer.WriteSigned(GetDelta(transform.position[axis], baseTransform.position[axis]));
+		}
+	}
+	if(flags & ENTITY_ROTATION_DELTA)
+	{
+		for(u32 shift = 0; shift < largestShift; shift += rotationComponentBits)
+		{
+			s32 component = (s32)((transform.rotation >> shift) & rotationComponentMask);
+			s32 baseComponent = (s32)((baseTransform.rotation >> shift) & rotationComponentMask);
+			writer.WriteSigned(component - baseComponent);
+		}
+	}
+	else if(flags & ENTITY_ROTATION_FULL)
+	{
+		writer.Write(transform.rotation);
+	}
+}
+
+// False if the record is malformed or doesn't fit the baseline
+static bool ReadEntity(PacketReader &reader, ReplicatedEntity &entity, const ReplicatedEntity *base)
+{
+	u8 flags = reader.Read<u8>();
+	if((flags & ENTITY_NEW) == (base != nullptr))
+	{
+		return false;
+	}
+
+	if(base)
+	{
+		entity.modelIndex = base->modelIndex;
+		entity.transform = base->transform;
+	}
+	else
+	{
+		entity.modelIndex = reader.ReadVarint();
+		entity.transform = QuantizedTransform();
+	}
+
+	QuantizedTransform &transform = entity.transform;
+	for(u32 axis = 0; axis < 3; ++axis)
+	{
+		if(flags & (ENTITY_POSITION_X << axis))
+		{
+			transform.position[axis] = ApplyDelta(transform.position[axis], reader.ReadSigned());
+		}
+	}
+
+	constexpr u32 largestShift = 3 * rotationComponentBits;
+	if(flags & ENTITY_ROTATION_DELTA)
+	{
+		u32 rotation = transform.rotation & ~((1u << largestShift) - 1);
+		for(u32 shift = 0; shift < largestShift; shift += rotationComponentBits)
+		{
+			s32 component = (s32)((transform.rotation >> shift) & rotationComponentMask) + reader.ReadSigned();
+			if(component < 0 || component > (s32)rotationComponentMask)
+			{
+				return false;
+			}
+			rotation |= (u32)component << shift;
+		}
+		transform.rotation = rotation;
+	}
+	else if(flags & ENTITY_ROTATION_FULL)
+	{
+		transform.rotation = reader.Read<u32>();
+	}
+	return !reader.HasFailed();
+}
+
+// Identifiers go up through each list, so each is written as the step from the one before
+static void WriteSnapshot(PacketWriter &writer, const std::vector<ReplicatedEntity> &base, const std::vector<ReplicatedEntity> &entities,
+	std::vector<u32> &removed, std::vector<std::pair<u32, u32>> &written)
+{
+	removed.clear();
+	written.clear();
+	u32 baseNum = 0;
+	for(u32 entityNum = 0; entityNum < (u32)entities.size(); ++entityNum)
+	{
+		const ReplicatedEntity &entity = entities[entityNum];
+		while(baseNum < base.size() && IsEntityBefore(base[baseNum], entity))
+		{
+			removed.push_back(baseNum++);
+		}
+
+		if(baseNum < base.size() && base[baseNum].entity == entity.entity)
+		{
+			if(!(base[baseNum] == entity))
+			{
+				written.emplace_back(entityNum, baseNum);
+			}
+			++baseNum;
+		}
+		else
+		{
+			written.emplace_back(entityNum, U32_MAX);
+		}
+	}
+	while(baseNum < base.size())
+	{
+		removed.push_back(baseNum++);
+	}
+
+	writer.WriteVarint((u32)removed.size());
+	u32 previousId = 0;
+	for(u32 removedNum : removed)
+	{
+		u32 id = GetEntityId(base[removedNum].entity);
+		writer.WriteVarint(id - previousId);
+		previousId = id;
+	}
+
+	writer.WriteVarint((u32)written.size());
+	previousId = 0;
+	for(auto [entityNum, writtenBaseNum] : written)
+	{
+		u32 id = GetEntityId(entities[entityNum].entity);
+		writer.WriteVarint(id - previousId);
+		previousId = id;
+		WriteEntity(writer, entities[entityNum], (writtenBaseNum != U32_MAX) ? &base[writtenBaseNum] : nullptr);
+	}
+}
+
+// Rebuilds the snapshot from the baseline and the changes, false if the packet doesn't fit the baseline
+static bool ReadSnapshot(PacketReader &reader, const std::vector<ReplicatedEntity> &base, std::vector<ReplicatedEntity> &entities)
+{
+	entities.clear();
+
+	// Removed identifiers have to be in the baseline, in order
+	u32 removedCount = reader.ReadVarint();
+	if(removedCount > base.size())
+	{
+		return false;
+	}
+
+	size_t baseNum = 0;
+	u32 previousId = 0;
+	for(u32 removedNum = 0; removedNum < removedCount; ++removedNum)
+	{
+		u32 step = reader.ReadVarint();
+		if(reader.HasFailed() || (removedNum > 0 && step == 0))
+		{
+			return false;
+		}
+		u32 id = previousId + step;
+		previousId = id;
+
+		while(baseNum < base.size() && GetEntityId(base[baseNum].entity) < id)
+		{
+			entities.push_back(base[baseNum++]);
+		}
+		if(baseNum == base.size() || GetEntityId(base[baseNum].entity) != id)
+		{
+			return false;
+		}
+		++baseNum;
+	}
+	while(baseNum < base.size())
+	{
+		entities.push_back(base[baseNum++]);
+	}
+
+	// What's left is sorted, written entities either replace one of them or go in between
+	u32 writtenCount = reader.ReadVarint();
+	size_t keptCount = entities.size();
+	size_t keptNum = 0;
+	previousId = 0;
+	for(u32 writtenNum = 0; writtenNum < writtenCount; ++writtenNum)
+	{
+		u32 step = reader.ReadVarint();
+		if(reader.HasFailed() || (writtenNum > 0 && step == 0))
+		{
+			return false;
+		}
+		u32 id = previousId + step;
+		previousId = id;
+
+		while(keptNum < keptCount && GetEntityId(entities[keptNum].entity) < id)
+		{
+			++keptNum;
+		}
+
+		if(keptNum < keptCount && GetEntityId(entities[keptNum].entity) == id)
+		{
+			if(!ReadEntity(reader, entities[keptNum], &entities[keptNum]))
+			{
+				return false;
+			}
+		}
+		else
+		{
+			ReplicatedEntity &entity = entities.emplace_back();
+			entity.entity = (entt::entity)id;
+			if(!ReadEntity(reader, entity, nullptr))
+			{
+				return false;
+			}
+		}
+	}
+
+	// New entities were added on the end, merge them in
+	std::inplace_merge(entities.begin(), entities.begin() + keptCount, entities.end(), IsEntityBefore);
+	return !reader.HasFailed() && reader.IsAtEnd();
+}
+
+std::vector<ReplicatedEntity> &ReplicationHistory::Add(u32 sequence)
+{
+	Snapshot &snapshot = m_snapshots[sequence % m_snapshots.size()];
+	snapshot.sequence = sequence;
+	snapshot.entities.clear();
+	return snapshot.entities;
+}
+
+const std::vector<ReplicatedEntity> *ReplicationHistory::Find(u32 sequence) const
+{
+	const Snapshot &snapshot = m_snapshots[sequence % m_snapshots.size()];
+	return (sequence != 0 && snapshot.sequence == sequence) ? &snapshot.entities : nullptr;
+}
+
+ReplicationServer::ReplicationServer(Game &game, LoopbackTransport &transport, const ReplicationConfig &config)
+	: m_game(game), m_transport(transport), m_config(config)
+{
+}
+
+u32 ReplicationServer::AddClient(u32 connection, const Transform &spawnTransform)
+{
+	Client &client = m_clients.emplace_back(m_config.historySize);
+	client.connection = connection;
+	client.ship = m_game.SpawnShip(spawnTransform);
+
+	if(connection >= m_connectionClients.size())
+	{
+		m_connectionClients.resize(connection + 1, U32_MAX);
+	}
+	m_connectionClients[connection] = (u32)m_clients.size() - 1;
+	return (u32)m_clients.size() - 1;
+}
+
+void ReplicationServer::ReceiveInputs()
+{
+	OPTICK_EVENT();
+
+	u32 connection;
+	while(m_transport.ReceiveOnServer(connection, m_packet))
+	{
+		if(connection >= m_connectionClients.size() || m_connectionClients[connection] == U32_MAX)
+		{
+			continue;
+		}
+		Client &client = m_clients[m_connectionClients[connection]];
+
+		PacketReader reader(m_packet);
+		u8 type = reader.Read<u8>();
+		u32 ackedSequence = reader.ReadVarint();
+		u32 inputTick = reader.ReadVarint();
+		ShipInput input;
+		for(r32 &value : input.inputs)
+		{
+			value = reader.Read<r32>();
+		}
+
+		if(type != PACKET_INPUT || reader.HasFailed() || !reader.IsAtEnd() || ackedSequence >= client.nextSequence)
+		{
+			++client.stats.malformedPackets;
+			continue;
+		}
+
+		client.ackedSequence = MAX(client.ackedSequence, ackedSequence);
+		if(inputTick > client.inputTick)
+		{
+			client.inputTick = inputTick;
+			m_game.SetShipInput(client.ship, input);
+		}
+	}
+}
+
+void ReplicationServer::GatherInterest(const Client &client, std::vector<ReplicatedEntity> &entities)
+{
+	OPTICK_EVENT();
+
+	entt::registry &registry = m_game.GetRegistry();
+	const btVector3 &center = registry.get<const Transform>(client.ship).translation;
+	btVector3 extent(m_config.interestRadius, m_config.interestRadius, m_config.interestRadius);
+
+	m_queryEntities.clear();
+	m_game.GetPhysics()->QueryAabb(center - extent, center + extent, m_queryEntities);
+	std::sort(m_queryEntities.begin(), m_queryEntities.end(), [](entt::entity a, entt::entity b) {
+		return GetEntityId(a) < GetEntityId(b);
+	});
+	m_queryEntities.erase(std::unique(m_queryEntities.begin(), m_queryEntities.end()), m_queryEntities.end());
+
+	for(entt::entity entity : m_queryEntities)
+	{
+		const Transform *transform = (entity != entt::null) ? registry.try_get<const Transform>(entity) : nullptr;
+		if(!transform)
+		{
+			continue;
+		}
+
+		ReplicatedEntity replicated;
+		replicated.entity = entity;
+		if(const RenderModel *renderModel = registry.try_get<const RenderModel>(entity))
+		{
+			replicated.modelIndex = renderModel->modelIndex;
+		}
+		else if(registry.all_of<Projectile>(entity))
+		{
+			replicated.modelIndex = replicatedProjectileModel;
+		}
+		else
+		{
+			continue;
+		}
+		replicated.transform = QuantizeTransform(*transform);
+		entities.push_back(replicated);
+	}
+}
+
+void ReplicationServer::SendSnapshots()
+{
+	OPTICK_EVENT();
+
+	for(Client &client : m_clients)
+	{
+		u32 sequence = client.nextSequence++;
+
+		// Adding takes over the slot historySize sequences back, so the baseline has to be newer than that
+		u32 baselineSequence = (client.ackedSequence + client.history.GetSize() > sequence) ? client.ackedSequence : 0;
+		const std::vector<ReplicatedEntity> *baseline = client.history.Find(baselineSequence);
+		if(!baseline)
+		{
+			baselineSequence = 0;
+		}
+
+		std::vector<ReplicatedEntity> &entities = client.history.Add(sequence);
+		GatherInterest(client, entities);
+
+		PacketWriter writer(m_packet);
+		writer.Write((u8)PACKET_SNAPSHOT);
+		writer.WriteVarint(sequence);
+		writer.WriteVarint(baselineSequence);
+		writer.WriteVarint(GetEntityId(client.ship));
+		static const std::vector<ReplicatedEntity> empty;
+		WriteSnapshot(writer, baseline ? *baseline : empty, entities, m_removed, m_written);
+
+		m_transport.SendToClient(client.connection, m_packet);
+
+		ReplicationStats &stats = client.stats;
+		++stats.snapshots;
+		stats.fullSnapshots += baseline ? 0 : 1;
+		stats.snapshotBytes += m_packet.size();
+		stats.maxSnapshotBytes = MAX(stats.maxSnapshotBytes, (u32)m_packet.size());
+		stats.interestEntities += entities.size();
+		stats.writtenEntities += m_written.size();
+	}
+}
+
+ReplicationClient::ReplicationClient(LoopbackTransport &transport, u32 connection, const ReplicationConfig &config)
+	: m_transport(transport), m_connection(connection), m_history(config.historySize)
+{
+}
+
+void ReplicationClient::ReceiveSnapshots()
+{
+	OPTICK_EVENT();
+
+	static const std::vector<ReplicatedEntity> empty;
+
+	while(m_transport.ReceiveOnClient(m_connection, m_packet))
+	{
+		PacketReader reader(m_packet);
+		u8 type = reader.Read<u8>();
+		u32 sequence = reader.ReadVarint();
+		u32 baselineSequence = reader.ReadVarint();
+		entt::entity ship = (entt::entity)reader.ReadVarint();
+
+		const std::vector<ReplicatedEntity> *baseline = baselineSequence ? m_history.Find(baselineSequence) : &empty;
+		if(type != PACKET_SNAPSHOT || reader.HasFailed() || sequence <= m_sequence || baselineSequence >= sequence || !baseline
+			|| !ReadSnapshot(reader, *baseline, m_decoded))
+		{
+			++m_droppedSnapshots;
+			continue;
+		}
+
+		m_history.Add(sequence) = m_decoded;
+		m_entities.swap(m_decoded);
+		m_sequence = sequence;
+		m_ship = ship;
+	}
+}
+
+void ReplicationClient::SendInput(const ShipInput &input)
+{
+	PacketWriter writer(m_packet);
+	writer.Write((u8)PACKET_INPUT);
+	writer.WriteVarint(m_sequence);
+	writer.WriteVarint(++m_inputTick);
+	for(r32 value : input.inputs)
+	{
+		writer.Write(value);
+	}
+	m_transport.SendToServer(m_connection, m_packet);
+}
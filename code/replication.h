@@ -0,0 +1,254 @@
+#pragma once
+
+#include "defines.h"
+
+#include "game.h"
+
+#include <span>
+#include <string.h>
+#include <utility>
+#include <vector>
+
+class LoopbackTransport;
+
+constexpr r32 quantizedPositionScale = 128.0f; // Steps per metre, good to 4mm anywhere within 16000 km of the origin
+
+// Transform as it goes over the wire
+struct QuantizedTransform
+{
+	s32 position[3]; // In steps of 1 / quantizedPositionScale metres
+	u32 rotation; // Smallest three: index of the largest component in the top two bits, the other three in 10 bits each
+
+	bool operator==(const QuantizedTransform &other) const
+	{
+		return position[0] == other.position[0] && position[1] == other.position[1] && position[2] == other.position[2] && rotation == other.rotation;
+	}
+};
+
+QuantizedTransform QuantizeTransform(const Transform &transform);
+Transform DequantizeTransform(const QuantizedTransform &quantized);
+
+constexpr u32 replicatedProjectileModel = U32_MAX; // Projectiles have no RenderModel, clients draw their own beam
+
+struct ReplicatedEntity
+{
+	entt::entity entity; // As the server knows it
+	u32 modelIndex;
+	QuantizedTransform transform;
+
+	bool operator==(const ReplicatedEntity &other) const
+	{
+		return entity == other.entity && modelIndex == other.modelIndex && transform == other.transform;
+	}
+};
+
+struct ReplicationConfig
+{
+	// Clients are sent everything whose broadphase AABB overlaps a cube this far out from their ship on each axis
+	r32 interestRadius = 150.0f;
+	// Snapshots each side keeps to delta against. A client whose newest acknowledgement is older gets a whole snapshot
+	u32 historySize = 32;
+};
+
+// Counted by the server for each client
+struct ReplicationStats
+{
+	u32 snapshots = 0;
+	u32 fullSnapshots = 0; // Sent without a baseline
+	u64 snapshotBytes = 0;
+	u32 maxSnapshotBytes = 0;
+	u64 interestEntities = 0; // Summed over every snapshot
+	u64 writtenEntities = 0; // Entities that entered the area or moved, summed over every snapshot
+	u32 malformedPackets = 0;
+};
+
+// Builds a packet in a buffer it clears first. Counts, identifiers and deltas are varints, 7 bits a byte
+class PacketWriter
+{
+public:
+	PacketWriter(std::vector<u8> &data) : m_data(data) { m_data.clear(); }
+
+	template<typename T>
+	void Write(const T &value)
+	{
+		size_t offset = m_data.size();
+		m_data.resize(offset + sizeof(T));
+		memcpy(m_data.data() + offset, &value, sizeof(T));
+	}
+
+	void WriteVarint(u32 value)
+	{
+		while(value >= 0x80)
+		{
+			m_data.push_back((u8)(value | 0x80));
+			value >>= 7;
+		}
+		m_data.push_back((u8)value);
+	}
+
+	// Zigzag, so small negative values stay small
+	void WriteSigned(s32 value) { WriteVarint(((u32)value << 1) ^ (u32)(value >> 31)); }
+
+private:
+	std::vector<u8> &m_data;
+};
+
+// Reads what a PacketWriter wrote. Packets come off the network, so running off the end or a varint that is too long
+// fails the reader instead of asserting, and every read after that returns 0
+class PacketReader
+{
+public:
+	PacketReader(std::span<const u8> data) : m_data(data) {}
+
+	template<typename T>
+	T Read()
+	{
+		T value = {};
+		if(m_offset + sizeof(T) > m_data.size())
+		{
+			m_failed = true;
+			return value;
+		}
+		memcpy(&value, m_data.data() + m_offset, sizeof(T));
+		m_offset += sizeof(T);
+		return value;
+	}
+
+	u32 ReadVarint()
+	{
+		u32 value = 0;
+		for(u32 shift = 0; shift < 35; shift += 7)
+		{
+			u8 byte = Read<u8>();
+			value |= (u32)(byte & 0x7f) << shift;
+			if(!(byte & 0x80))
+			{
+				return value;
+			}
+		}
+		m_failed = true;
+		return 0;
+	}
+
+	s32 ReadSigned()
+	{
+		u32 value = ReadVarint();
+		return (s32)(value >> 1) ^ -(s32)(value & 1);
+	}
+
+	bool HasFailed() const { return m_failed; }
+	bool IsAtEnd() const { return m_offset == m_data.size(); }
+
+private:
+	std::span<const u8> m_data;
+	size_t m_offset = 0;
+	bool m_failed = false;
+};
+
+// The last few snapshots sent or received, by sequence number
+class ReplicationHistory
+{
+public:
+	ReplicationHistory(u32 size) : m_snapshots(MAX(size, 1u)) {}
+
+	// Empty buffer for the snapshot, taking over the slot of the one size sequences before it
+	std::vector<ReplicatedEntity> &Add(u32 sequence);
+	// Null once it has been replaced
+	const std::vector<ReplicatedEntity> *Find(u32 sequence) const;
+
+	u32 GetSize() const { return (u32)m_snapshots.size(); }
+
+private:
+	struct Snapshot
+	{
+		u32 sequence = 0;
+		std::vector<ReplicatedEntity> entities; // Sorted by entity
+	};
+
+	std::vector<Snapshot> m_snapshots; // Indexed by sequence % size
+};
+
+// Serves a Game to clients connected over a LoopbackTransport. Each client gets a ship, steered by the inputs it
+// sends, and every tick a snapshot of what is around that ship: the entities the broadphase finds in its area of
+// interest, with quantized transforms delta encoded against the newest snapshot the client acknowledged. An entity
+// that didn't change costs nothing, one that left the area costs its identifier
+class ReplicationServer
+{
+public:
+	ReplicationServer(Game &game, LoopbackTransport &transport, const ReplicationConfig &config = ReplicationConfig());
+
+	// Spawns a ship for a client already connected to the transport. Returns the client's number, they count up from 0
+	u32 AddClient(u32 connection, const Transform &spawnTransform);
+
+	// Reads every input packet that has arrived. A ship keeps the newest input it was given until another arrives
+	void ReceiveInputs();
+	// Sends every client a snapshot of its area of interest, run after simulating
+	void SendSnapshots();
+
+	u32 GetClientCount() const { return (u32)m_clients.size(); }
+	entt::entity GetShip(u32 clientNum) const { return m_clients[clientNum].ship; }
+	const ReplicationStats &GetStats(u32 clientNum) const { return m_clients[clientNum].stats; }
+	// What a client was sent as that sequence, while it is still in the history
+	const std::vector<ReplicatedEntity> *FindSentSnapshot(u32 clientNum, u32 sequence) const { return m_clients[clientNum].history.Find(sequence); }
+
+private:
+	struct Client
+	{
+		u32 connection;
+		entt::entity ship;
+		u32 nextSequence = 1; // 0 stands for no snapshot
+		u32 ackedSequence = 0;
+		u32 inputTick = 0; // Of the newest input given to the ship
+		ReplicationHistory history;
+		ReplicationStats stats;
+
+		Client(u32 historySize) : history(historySize) {}
+	};
+
+	void GatherInterest(const Client &client, std::vector<ReplicatedEntity> &entities);
+
+	Game &m_game;
+	LoopbackTransport &m_transport;
+	ReplicationConfig m_config;
+
+	std::vector<Client> m_clients;
+	std::vector<u32> m_connectionClients; // Client number of each connection, U32_MAX for none
+
+	std::vector<entt::entity> m_queryEntities; // Scratch for GatherInterest
+	std::vector<u32> m_removed; // Scratch for SendSnapshots, indices into the baseline
+	std::vector<std::pair<u32, u32>> m_written; // Scratch for SendSnapshots, into the snapshot and baseline, U32_MAX when new
+	std::vector<u8> m_packet;
+};
+
+// The other end of a ReplicationServer, with no game of its own. Holds the world as the newest snapshot describes it,
+// decoded against the snapshot the server based it on
+class ReplicationClient
+{
+public:
+	ReplicationClient(LoopbackTransport &transport, u32 connection, const ReplicationConfig &config = ReplicationConfig());
+
+	// Decodes every snapshot that has arrived. Ones older than the newest so far, malformed, or based on a snapshot
+	// no longer in the history are dropped and counted
+	void ReceiveSnapshots();
+	// Also acknowledges the newest snapshot received
+	void SendInput(const ShipInput &input);
+
+	const std::vector<ReplicatedEntity> &GetEntities() const { return m_entities; } // Sorted by entity
+	u32 GetSequence() const { return m_sequence; } // Of the snapshot GetEntities came from, 0 before the first
+	entt::entity GetShip() const { return m_ship; }
+	u32 GetDroppedSnapshots() const { return m_droppedSnapshots; }
+
+private:
+	LoopbackTransport &m_transport;
+	u32 m_connection;
+
+	ReplicationHistory m_history;
+	std::vector<ReplicatedEntity> m_entities;
+	u32 m_sequence = 0;
+	entt::entity m_ship = entt::null;
+	u32 m_inputTick = 0;
+	u32 m_droppedSnapshots = 0;
+
+	std::vector<u8> m_packet;
+	std::vector<ReplicatedEntity> m_decoded; // Scratch for ReceiveSnapshots
+};
@@ -3,28 +3,73 @@
 #include "btBulletDynamicsCommon.h"
 #include "BulletCollision/CollisionDispatch/btGhostObject.h"
 
-ShipPhysics::ShipPhysics(btConvexShape *convexShape, btPairCachingGhostObject *ghostObject, ShipConfig &shipConfig)
+ShipPhysics::ShipPhysics(btConvexShape *convexShape, btPairCachingGhostObject *ghostObject, ShipConfig &shipConfig, const Transform &transform)
 	: m_convexShape(convexShape), m_ghostObject(ghostObject), m_shipConfig(shipConfig)
 {
 	m_thrustInput = btVector3(0.0f, 0.0f, 0.0f);
 	m_rotationInput = btVector3(0.0f, 0.0f, 0.0f);
-	m_position = btVector3(0.0f, 0.0f, 0.0f);
+	m_position = transform.translation;
 	m_velocity = btVector3(0.0f, 0.0f, 0.0f);
-	m_rotation = btQuaternion::getIdentity();
+	m_rotation = transform.rotation;
 }
 
-static bool CollisionMasksCollides(const btCollisionObject *obj1, const btCollisionObject *obj2)
+// Closest hit the motion is heading into. A sweep that starts touching the surface it is sliding along would
+// otherwise stop on it straight away
+class ShipSweepCallback : public btCollisionWorld::ClosestConvexResultCallback
 {
-	bool maskCollides = (obj1->getBroadphaseHandle()->m_collisionFilterGroup & obj2->getBroadphaseHandle()->m_collisionFilterMask) != 0;
-	maskCollides = maskCollides && ((obj2->getBroadphaseHandle()->m_collisionFilterGroup & obj1->getBroadphaseHandle()->m_collisionFilterMask) != 0);
-	return maskCollides;
-}
+public:
+	ShipSweepCallback(const btCollisionObject *ship, const btVector3 &motion)
+		: ClosestConvexResultCallback(btVector3(0.0f, 0.0f, 0.0f), btVector3(0.0f, 0.0f, 0.0f)), m_motion(motion)
+	{
+		m_collisionFilterGroup = ship->getBroadphaseHandle()->m_collisionFilterGroup;
+		m_collisionFilterMask = ship->getBroadphaseHandle()->m_collisionFilterMask;
+	}
+
+	btScalar addSingleResult(btCollisionWorld::LocalConvexResult &convexResult, bool normalInWorldSpace) override
+	{
+		btVector3 hitNormal = normalInWorldSpace ? convexResult.m_hitNormalLocal
+			: convexResult.m_hitCollisionObject->getWorldTransform().getBasis() * convexResult.m_hitNormalLocal;
+		if(hitNormal.dot(m_motion) >= 0.0f)
+		{
+			return 1.0f;
+		}
+		return ClosestConvexResultCallback::addSingleResult(convexResult, normalInWorldSpace);
+	}
+
+private:
+	btVector3 m_motion;
+};
 
 static btVector3 ComputeReflectionDirection(const btVector3 &direction, const btVector3 &normal)
 {
 	return direction - (btScalar(2.0) * direction.dot(normal)) * normal;
 }
 
+// Bounces the velocity off the hit and pushes the body that was hit
+static btVector3 RespondToHit(const btVector3 &movementDirection, const ShipSweepCallback &hit, const btVector3 &velocity)
+{
+	btVector3 reflectDir = ComputeReflectionDirection(movementDirection, hit.m_hitNormalWorld);
+	reflectDir.normalize();
+
+	btScalar velocityTotal = velocity.length();
+
+	btScalar collisionSlowdownFract = btFabs(movementDirection.dot(hit.m_hitNormalWorld));
+	btScalar slowDownAmount = velocityTotal * collisionSlowdownFract;
+
+	if(hit.m_hitCollisionObject->getInternalType() == btCollisionObject::CO_RIGID_BODY)
+	{
+		btRigidBody *otherBody = btRigidBody::upcast((btCollisionObject *)hit.m_hitCollisionObject);
+
+		btScalar normalImpulse = 10.0f;
+		btVector3 impulseVec = -hit.m_hitNormalWorld * (normalImpulse);
+		btVector3 rel_pos1 = hit.m_hitPointWorld - otherBody->getWorldTransform().getOrigin();
+		otherBody->activate();
+		otherBody->applyImpulse(impulseVec, rel_pos1);
+	}
+
+	return reflectDir * (velocityTotal - slowDownAmount);
+}
+
 //static btVector3 ParallelComponent(const btVector3 &direction, const btVector3 &normal)
 //{
 //	btScalar magnitude = direction.dot(normal);
@@ -40,9 +85,9 @@ void ShipPhysics::updateAction(btCollisionWorld *collisionWorld, btScalar deltaT
 {
 	OPTICK_EVENT();
 
-	r32 pitchRadians = m_rotationInput.getX() * m_shipConfig.pitchRate * DEG2RAD * deltaTimeStep;
-	r32 yawRadians = m_rotationInput.getY() * m_shipConfig.yawRate * DEG2RAD * deltaTimeStep;
-	r32 rollRadians = m_rotationInput.getZ() * m_shipConfig.rollRate * DEG2RAD * deltaTimeStep;
+	r32 pitchRadians = m_rotationInput.getX() * DegToRad(m_shipConfig.pitchRate) * deltaTimeStep;
+	r32 yawRadians = m_rotationInput.getY() * DegToRad(m_shipConfig.yawRate) * deltaTimeStep;
+	r32 rollRadians = m_rotationInput.getZ() * DegToRad(m_shipConfig.rollRate) * deltaTimeStep;
 
 	btQuaternion rotationDelta(yawRadians, pitchRadians, rollRadians);
 	btQuaternion targetRotation = m_rotation * rotationDelta;
@@ -57,54 +102,47 @@ void ShipPhysics::updateAction(btCollisionWorld *collisionWorld, btScalar deltaT
 	btVector3 thrustVector = m_thrustInput * m_shipConfig.thrustSpeed * deltaTimeStep;
 	btVector3 targetVelocity = m_velocity + thrustVector;
 
-
-	btCollisionWorld::ClosestConvexResultCallback sweepResultCallback(btVector3(0.0f, 0.0f, 0.0f), btVector3(0.0f, 0.0f, 0.0f));
-	sweepResultCallback.m_collisionFilterGroup = m_ghostObject->getBroadphaseHandle()->m_collisionFilterGroup;
-	sweepResultCallback.m_collisionFilterMask = m_ghostObject->getBroadphaseHandle()->m_collisionFilterMask;
-
-
-	btTransform start = btTransform::getIdentity();
-	start.setOrigin(m_position);
-	start.setRotation(m_rotation);
-
-	btTransform end = btTransform::getIdentity();
-	end.setOrigin(targetPosition);
-	end.setRotation(targetRotation);
-
-	collisionWorld->convexSweepTest(m_convexShape, start, end, sweepResultCallback, collisionWorld->getDispatchInfo().m_allowedCcdPenetration);
-
-	if(sweepResultCallback.hasHit() && m_ghostObject->hasContactResponse() && CollisionMasksCollides(m_ghostObject, sweepResultCallback.m_hitCollisionObject))
+	// Grow the ghost's broadphase AABB over the whole motion so its pair cache holds everything the sweeps could
+	// reach. The dynamic AABB tree adds the new pairs straight away and the world shrinks the AABB back next step
 	{
-		btVector3 movementVector = targetPosition - m_position;
-		btScalar movementLength = movementVector.length();
-		if(movementLength > SIMD_EPSILON)
-		{
-			btVector3 movementDirection = movementVector.normalized();
-
-			btVector3 reflectDir = ComputeReflectionDirection(movementDirection, sweepResultCallback.m_hitNormalWorld);
-			reflectDir.normalize();
+		btVector3 aabbMin, aabbMax, endMin, endMax;
+		m_convexShape->getAabb(btTransform(m_rotation, m_position), aabbMin, aabbMax);
+		m_convexShape->getAabb(btTransform(targetRotation, targetPosition), endMin, endMax);
+		aabbMin.setMin(endMin);
+		aabbMax.setMax(endMax);
+		collisionWorld->getBroadphase()->setAabb(m_ghostObject->getBroadphaseHandle(), aabbMin, aabbMax, collisionWorld->getDispatcher());
+	}
 
-			btScalar velocityTotal = targetVelocity.length();
+	// Sweep against just the ghost's overlapping pairs. Each hit stops the ship on the surface and the rest of the
+	// motion slides along it, so several contacts in one step are all resolved
+	constexpr u32 maxSweepIterations = 4;
+	btVector3 position = m_position;
+	btQuaternion rotation = m_rotation;
+	btVector3 remainingMotion = targetPosition - m_position;
+	for(u32 iteration = 0; iteration < maxSweepIterations && remainingMotion.length2() > SIMD_EPSILON; ++iteration)
+	{
+		ShipSweepCallback sweepResultCallback(m_ghostObject, remainingMotion);
+		btTransform start(rotation, position);
+		btTransform end(targetRotation, position + remainingMotion);
+		m_ghostObject->convexSweepTest(m_convexShape, start, end, sweepResultCallback, collisionWorld->getDispatchInfo().m_allowedCcdPenetration);
+		rotation = targetRotation;
 
-			btScalar collisionSlowdownFract = btFabs(movementDirection.dot(sweepResultCallback.m_hitNormalWorld));
-			btScalar slowDownAmount = velocityTotal * collisionSlowdownFract;
-			targetVelocity = reflectDir * (velocityTotal - slowDownAmount);
+		if(!sweepResultCallback.hasHit() || !m_ghostObject->hasContactResponse())
+		{
+			position += remainingMotion;
+			remainingMotion.setZero();
+			break;
+		}
 
-			btScalar impulseOnOtherObject = (collisionSlowdownFract);
-			if(sweepResultCallback.m_hitCollisionObject->getInternalType() == btCollisionObject::CO_RIGID_BODY)
-			{
-				btRigidBody *otherBody = btRigidBody::upcast((btCollisionObject *)sweepResultCallback.m_hitCollisionObject);
+		btVector3 movementDirection = remainingMotion.normalized();
+		targetVelocity = RespondToHit(movementDirection, sweepResultCallback, targetVelocity);
 
-				btScalar normalImpulse = 10.0f;
-				btVector3 impulseVec = -sweepResultCallback.m_hitNormalWorld * (normalImpulse);
-				btVector3 rel_pos1 = sweepResultCallback.m_hitPointWorld - otherBody->getWorldTransform().getOrigin();
-				otherBody->activate();
-				otherBody->applyImpulse(impulseVec, rel_pos1);
-			}
-		}
+		position += remainingMotion * sweepResultCallback.m_closestHitFraction;
+		remainingMotion *= 1.0f - sweepResultCallback.m_closestHitFraction;
+		remainingMotion -= sweepResultCallback.m_hitNormalWorld * remainingMotion.dot(sweepResultCallback.m_hitNormalWorld);
 	}
 
-	m_position = targetPosition;
+	m_position = position;
 	m_velocity = targetVelocity;
 	m_rotation = targetRotation;
 
@@ -157,4 +195,29 @@ Transform ShipPhysics::GetTransform() const
 btVector3 ShipPhysics::GetVelocity() const
 {
 	return m_velocity;
-}
\ No newline at end of file
+}
+
+ShipPhysicsState ShipPhysics::GetState() const
+{
+	ShipPhysicsState state;
+	state.thrustInput = m_thrustInput;
+	state.rotationInput = m_rotationInput;
+	state.position = m_position;
+	state.velocity = m_velocity;
+	state.rotation = m_rotation;
+	return state;
+}
+
+void ShipPhysics::SetState(const ShipPhysicsState &state)
+{
+	m_thrustInput = state.thrustInput;
+	m_rotationInput = state.rotationInput;
+	m_position = state.position;
+	m_velocity = state.velocity;
+	m_rotation = state.rotation;
+
+	btTransform transform = btTransform::getIdentity();
+	transform.setOrigin(m_position);
+	transform.setRotation(m_rotation);
+	m_ghostObject->setWorldTransform(transform);
+}
@@ -7,16 +7,24 @@
 
 #include "BulletDynamics/Dynamics/btActionInterface.h"
 
-#include "raylib.h"
-
 class btConvexShape;
 class btPairCachingGhostObject;
 
+// Everything the ship carries from one step to the next, for snapshots
+struct ShipPhysicsState
+{
+	btVector3 thrustInput;
+	btVector3 rotationInput;
+	btVector3 position;
+	btVector3 velocity;
+	btQuaternion rotation;
+};
+
 class ShipPhysics : public btActionInterface
 {
 public:
 	ShipPhysics() = delete;
-	ShipPhysics(btConvexShape *convexShape, btPairCachingGhostObject *ghostObject, ShipConfig &shipConfig);
+	ShipPhysics(btConvexShape *convexShape, btPairCachingGhostObject *ghostObject, ShipConfig &shipConfig, const Transform &transform = Transform());
 
 	~ShipPhysics() {};
 
@@ -32,6 +40,12 @@ public:
 
 	Transform GetTransform() const;
 	btVector3 GetVelocity() const;
+
+	ShipPhysicsState GetState() const;
+	// Moves the ghost along too, its broadphase AABB is left to the caller
+	void SetState(const ShipPhysicsState &state);
+
+	btPairCachingGhostObject *GetGhostObject() const { return m_ghostObject; }
 private:
 	btConvexShape *m_convexShape = nullptr;
 	btPairCachingGhostObject *m_ghostObject = nullptr;
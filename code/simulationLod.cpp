@@ -0,0 +1,258 @@
+#include "simulationLod.h"
+
+#include "projectiles.h"
+#include "shipPhysics.h"
+#include "worldSnapshot.h"
+
+#include "btBulletDynamicsCommon.h"
+#include "LinearMath/btTransformUtil.h"
+
+#include <algorithm>
+#include <float.h>
+#include <string.h>
+
+void AdvanceOnRails(const SimulationLodBody &lodBody, Transform &transform, r32 dt)
+{
+	if(lodBody.tier == SimulationTier::DYNAMIC)
+	{
+		return;
+	}
+
+	btTransform advanced;
+	btTransformUtil::integrateTransform(btTransform(transform.rotation, transform.translation), lodBody.linearVelocity, lodBody.angularVelocity, dt, advanced);
+	transform.translation = advanced.getOrigin();
+	transform.rotation = advanced.getRotation();
+}
+
+SimulationLod::SimulationLod(entt::registry &registry, PhysicsWorld &physics, const SimulationLodConfig &config)
+	: m_registry(registry), m_physics(physics), m_config(config)
+{
+	// Create the storage now so views made from worker threads never modify the registry
+	m_registry.storage<SimulationLodBody>();
+}
+
+SimulationLod::~SimulationLod()
+{
+	for(auto &[fullShape, railsShape] : m_railsShapes)
+	{
+		delete railsShape;
+	}
+}
+
+void SimulationLod::Add(entt::entity entity, r32 mass, btConvexShape *fullShape)
+{
+	SimulationLodBody &lodBody = m_registry.emplace<SimulationLodBody>(entity);
+	lodBody.fullShape = fullShape;
+	lodBody.mass = mass;
+}
+
+void SimulationLod::SetFullShape(entt::entity entity, btConvexShape *fullShape)
+{
+	SimulationLodBody &lodBody = m_registry.get<SimulationLodBody>(entity);
+	lodBody.fullShape = fullShape;
+	if(lodBody.tier == SimulationTier::ON_RAILS)
+	{
+		fullShape = GetRailsShape(fullShape);
+	}
+
+	btRigidBody *body = m_registry.get<RigidBody>(entity).body;
+	m_physics.SetCollisionShape(body, fullShape);
+	if(lodBody.tier != SimulationTier::DYNAMIC)
+	{
+		// SetCollisionShape drops the sweep from the AABB
+		m_physics.MoveKinematicBody(body, body->getWorldTransform(), GetSweep(lodBody, m_lastDt));
+	}
+}
+
+btConvexShape *SimulationLod::GetRailsShape(btConvexShape *fullShape)
+{
+	btConvexShape *&railsShape = m_railsShapes[fullShape];
+	if(!railsShape)
+	{
+		btVector3 center;
+		btScalar radius;
+		fullShape->getBoundingSphere(center, radius);
+		railsShape = CreateSphereCollision(center.length() + radius);
+	}
+	return railsShape;
+}
+
+btVector3 SimulationLod::GetSweep(const SimulationLodBody &lodBody, r32 dt) const
+{
+	u32 tickInterval = (lodBody.tier == SimulationTier::REDUCED_RATE) ? m_config.reducedTickInterval : m_config.railsTickInterval;
+	return lodBody.linearVelocity * (dt * tickInterval);
+}
+
+SimulationTier SimulationLod::PickTier(SimulationTier currentTier, r32 shipDistance, bool nearProjectile) const
+{
+	r32 dynamicEdge = m_config.dynamicRadius + ((currentTier == SimulationTier::DYNAMIC) ? m_config.hysteresis : 0.0f);
+	r32 railsEdge = m_config.railsRadius - ((currentTier == SimulationTier::ON_RAILS) ? m_config.hysteresis : 0.0f);
+
+	if(nearProjectile || shipDistance < dynamicEdge)
+	{
+		return SimulationTier::DYNAMIC;
+	}
+	return (shipDistance > railsEdge) ? SimulationTier::ON_RAILS : SimulationTier::REDUCED_RATE;
+}
+
+void SimulationLod::SetTier(SimulationLodBody &lodBody, btRigidBody *body, const Transform &transform, SimulationTier tier, r32 dt)
+{
+	// The Transform is what was last drawn, so the body carries on from there
+	btTransform worldTransform(transform.rotation, transform.translation);
+
+	if(tier == SimulationTier::DYNAMIC)
+	{
+		if(body->getCollisionShape() != lodBody.fullShape)
+		{
+			m_physics.SetCollisionShape(body, lodBody.fullShape);
+		}
+		m_physics.MoveKinematicBody(body, worldTransform);
+		body->setLinearVelocity(lodBody.linearVelocity);
+		body->setAngularVelocity(lodBody.angularVelocity);
+		m_physics.MakeDynamic(body, lodBody.mass);
+		lodBody.tier = tier;
+		return;
+	}
+
+	if(lodBody.tier == SimulationTier::DYNAMIC)
+	{
+		lodBody.linearVelocity = body->getLinearVelocity();
+		lodBody.angularVelocity = body->getAngularVelocity();
+		m_physics.MakeKinematic(body);
+	}
+	lodBody.tier = tier;
+
+	btConvexShape *shape = (tier == SimulationTier::ON_RAILS) ? GetRailsShape(lodBody.fullShape) : lodBody.fullShape;
+	if(body->getCollisionShape() != shape)
+	{
+		m_physics.SetCollisionShape(body, shape);
+	}
+	m_physics.MoveKinematicBody(body, worldTransform, GetSweep(lodBody, dt));
+}
+
+void SimulationLod::Update(r32 dt)
+{
+	OPTICK_EVENT();
+
+	if(!m_config.enabled)
+	{
+		m_tierCounts[(u32)SimulationTier::DYNAMIC] = (u32)m_registry.storage<SimulationLodBody>().size();
+		return;
+	}
+
+	++m_updateCount;
+	m_lastDt = dt;
+
+	m_shipPositions.clear();
+	auto shipView = m_registry.view<const ShipPhysics>();
+	shipView.each([this](const ShipPhysics &shipPhysics) {
+		m_shipPositions.push_back(shipPhysics.GetTransform().translation);
+	});
+
+	// Everything near where a projectile is heading, sorted for the lookups below
+	m_nearProjectiles.clear();
+	auto projectileView = m_registry.view<const Projectile, const RigidBody>();
+	projectileView.each([this](const Projectile &projectile, const RigidBody &rigidBody) {
+		UNUSED(projectile);
+		const btVector3 &start = rigidBody.body->getWorldTransform().getOrigin();
+		btVector3 end = start + rigidBody.body->getLinearVelocity() * m_config.projectileLookAhead;
+		btVector3 padding(m_config.projectileRadius, m_config.projectileRadius, m_config.projectileRadius);
+
+		btVector3 aabbMin = start;
+		btVector3 aabbMax = start;
+		aabbMin.setMin(end);
+		aabbMax.setMax(end);
+		m_physics.QueryAabb(aabbMin - padding, aabbMax + padding, m_nearProjectiles);
+	});
+	std::sort(m_nearProjectiles.begin(), m_nearProjectiles.end());
+
+	memset(m_tierCounts, 0, sizeof(m_tierCounts));
+	u32 demotionsLeft = m_config.maxDemotionsPerUpdate;
+
+	auto view = m_registry.view<SimulationLodBody, const RigidBody, const Transform>();
+	view.each([this, dt, &demotionsLeft](entt::entity entity, SimulationLodBody &lodBody, const RigidBody &rigidBody, const Transform &transform) {
+		r32 shipDistanceSq = FLT_MAX;
+		for(const btVector3 &shipPosition : m_shipPositions)
+		{
+			shipDistanceSq = MIN(shipDistanceSq, transform.translation.distance2(shipPosition));
+		}
+		bool nearProjectile = std::binary_search(m_nearProjectiles.begin(), m_nearProjectiles.end(), entity);
+
+		SimulationTier tier = PickTier(lodBody.tier, btSqrt(shipDistanceSq), nearProjectile);
+		if(tier > lodBody.tier)
+		{
+			if(demotionsLeft)
+			{
+				--demotionsLeft;
+			}
+			else
+			{
+				tier = lodBody.tier;
+			}
+		}
+
+		if(tier != lodBody.tier)
+		{
+			SetTier(lodBody, rigidBody.body, transform, tier, dt);
+		}
+		else if(tier != SimulationTier::DYNAMIC)
+		{
+			// Staggered by entity so a tier's catch ups are spread over its interval
+			u32 tickInterval = (tier == SimulationTier::REDUCED_RATE) ? m_config.reducedTickInterval : m_config.railsTickInterval;
+			if((m_updateCount + entt::to_entity(entity)) % tickInterval == 0)
+			{
+				m_physics.MoveKinematicBody(rigidBody.body, btTransform(transform.rotation, transform.translation), GetSweep(lodBody, dt));
+			}
+		}
+
+		++m_tierCounts[(u32)tier];
+	});
+
+	OPTICK_TAG("DynamicBodies", m_tierCounts[(u32)SimulationTier::DYNAMIC]);
+	OPTICK_TAG("ReducedRateBodies", m_tierCounts[(u32)SimulationTier::REDUCED_RATE]);
+	OPTICK_TAG("OnRailsBodies", m_tierCounts[(u32)SimulationTier::ON_RAILS]);
+}
+
+void SimulationLod::SaveState(WorldSnapshot &snapshot) const
+{
+	snapshot.Write(m_updateCount);
+	snapshot.Write(m_lastDt);
+	snapshot.Write(m_tierCounts);
+}
+
+void SimulationLod::RestoreState(SnapshotReader &reader)
+{
+	m_updateCount = reader.Read<u32>();
+	m_lastDt = reader.Read<r32>();
+	reader.ReadInto(m_tierCounts);
+}
+
+void SimulationLod::RestoreBodyTiers()
+{
+	OPTICK_EVENT();
+
+	auto view = m_registry.view<const SimulationLodBody, const RigidBody>();
+	view.each([this](const SimulationLodBody &lodBody, const RigidBody &rigidBody) {
+		btRigidBody *body = rigidBody.body;
+		btConvexShape *shape = (lodBody.tier == SimulationTier::ON_RAILS) ? GetRailsShape(lodBody.fullShape) : lodBody.fullShape;
+		bool kinematic = lodBody.tier != SimulationTier::DYNAMIC;
+		if(body->getCollisionShape() == shape && body->isKinematicObject() == kinematic)
+		{
+			return;
+		}
+
+		// The same steps SetTier takes, so the mass properties come out the same
+		if(!body->isKinematicObject())
+		{
+			m_physics.MakeKinematic(body);
+		}
+		if(body->getCollisionShape() != shape)
+		{
+			m_physics.SetCollisionShape(body, shape);
+		}
+		if(!kinematic)
+		{
+			m_physics.MakeDynamic(body, lodBody.mass);
+		}
+	});
+}
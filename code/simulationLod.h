@@ -0,0 +1,112 @@
+#pragma once
+
+#include "defines.h"
+
+#include "math.h"
+#include "physics.h"
+
+#include <unordered_map>
+#include <vector>
+
+class SnapshotReader;
+class WorldSnapshot;
+
+// How much of the simulation a body gets, picked by how close it is to a ship or a projectile
+enum class SimulationTier : u8
+{
+	DYNAMIC, // Simulated by Bullet every step
+	REDUCED_RATE, // Kinematic on rails with its full shape, not a slower dynamic step. Its collision catches up every reducedTickInterval updates
+	ON_RAILS, // Kinematic on rails with a bounding sphere for collision, catching up every railsTickInterval updates
+
+	TIER_TOTAL
+};
+
+struct SimulationLodConfig
+{
+	bool enabled = true; // Off keeps every body dynamic
+
+	r32 dynamicRadius = 120.0f; // From a ship
+	r32 railsRadius = 300.0f; // From a ship, bodies further out than this are ON_RAILS
+	r32 hysteresis = 20.0f; // A body only drops a tier once it is this far past the edge it came in over
+
+	// Bodies near where a projectile will be over the look ahead are dynamic, so shots push what they hit
+	r32 projectileRadius = 40.0f;
+	r32 projectileLookAhead = 0.5f;
+
+	u32 reducedTickInterval = 4;
+	u32 railsTickInterval = 30;
+
+	// Moving a body to a lower tier swaps its shape and pairs, so only this many happen per update and the rest wait.
+	// Bodies are always promoted straight away
+	u32 maxDemotionsPerUpdate = 256;
+};
+
+// Velocities are only kept here while the body is kinematic, Bullet has them while it is dynamic
+struct SimulationLodBody
+{
+	btConvexShape *fullShape = nullptr;
+	r32 mass = 0.0f;
+	SimulationTier tier = SimulationTier::DYNAMIC;
+	btVector3 linearVelocity = Vec3Zero;
+	btVector3 angularVelocity = Vec3Zero;
+};
+
+// Moves the Transform of a kinematic body along its velocity and spin by dt. Nothing else writes it while the body
+// is kinematic, so it is the body's real position and its collision catches up to it
+void AdvanceOnRails(const SimulationLodBody &lodBody, Transform &transform, r32 dt);
+
+// Distance based simulation level of detail. Away from ships and projectiles bodies turn kinematic and move on rails
+// instead of being simulated: their Transform advances smoothly every frame through AdvanceOnRails while their
+// collision is only moved every few updates, less often the further out they are. Velocity carries across every
+// switch and rails motion is what a lone body does in zero gravity, so changing tier doesn't pop.
+// Kinematic bodies still block dynamic ones and get hit by projectiles, but nothing can push them. Bullet gives
+// kinematic pairs no response either, so two asteroids out past dynamicRadius fly through each other until a ship
+// or a shot comes near enough to make them dynamic again
+class SimulationLod
+{
+public:
+	SimulationLod(entt::registry &registry, PhysicsWorld &physics, const SimulationLodConfig &config);
+	~SimulationLod();
+
+	// Tracks the dynamic body of an entity that has a RigidBody and a Transform. It is tiered on the next Update
+	void Add(entt::entity entity, r32 mass, btConvexShape *fullShape);
+
+	// Replaces the shape the body collides with while it isn't ON_RAILS
+	void SetFullShape(entt::entity entity, btConvexShape *fullShape);
+
+	// Retiers every body and moves the collision of kinematic ones that are due, run after AdvanceOnRails.
+	// Changes Bullet state, so run it from an exclusive system outside the physics step
+	void Update(r32 dt);
+
+	// The counters carried from one update to the next, for snapshots
+	void SaveState(WorldSnapshot &snapshot) const;
+	void RestoreState(SnapshotReader &reader);
+
+	// Gives each body the shape and mass its SimulationLodBody's tier calls for. Run once the components have been
+	// restored and before the bodies' own state is
+	void RestoreBodyTiers();
+
+	u32 GetTierCount(SimulationTier tier) const { return m_tierCounts[(u32)tier]; }
+
+private:
+	SimulationTier PickTier(SimulationTier currentTier, r32 shipDistance, bool nearProjectile) const;
+	void SetTier(SimulationLodBody &lodBody, btRigidBody *body, const Transform &transform, SimulationTier tier, r32 dt);
+	btVector3 GetSweep(const SimulationLodBody &lodBody, r32 dt) const;
+
+	// Bounding sphere of the shape about its origin, made on first use
+	btConvexShape *GetRailsShape(btConvexShape *fullShape);
+
+	entt::registry &m_registry;
+	PhysicsWorld &m_physics;
+	SimulationLodConfig m_config;
+
+	std::unordered_map<btConvexShape *, btConvexShape *> m_railsShapes;
+
+	u32 m_updateCount = 0;
+	r32 m_lastDt = 1.0f / 60.0f;
+	u32 m_tierCounts[(u32)SimulationTier::TIER_TOTAL] = {};
+
+	// Scratch for Update
+	std::vector<btVector3> m_shipPositions;
+	std::vector<entt::entity> m_nearProjectiles;
+};
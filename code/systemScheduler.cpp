@@ -0,0 +1,291 @@
+#include "systemScheduler.h"
+
+#include "frameTelemetry.h"
+
+#include <algorithm>
+
+static bool SharesComponent(const std::vector<entt::id_type> &a, const std::vector<entt::id_type> &b)
+{
+	for(entt::id_type id : a)
+	{
+		if(std::find(b.begin(), b.end(), id) != b.end())
+		{
+			return true;
+		}
+	}
+	return false;
+}
+
+SystemScheduler::SystemScheduler(entt::registry &registry, u32 workerCount)
+	: m_registry(registry), m_mainThreadId(std::this_thread::get_id())
+{
+	for(u32 workerIndex = 0; workerIndex < workerCount; ++workerIndex)
+	{
+		m_workers.emplace_back(&SystemScheduler::WorkerLoop, this, workerIndex);
+	}
+}
+
+SystemScheduler::~SystemScheduler()
+{
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		m_quit = true;
+	}
+	m_jobSignal.notify_all();
+
+	for(std::thread &worker : m_workers)
+	{
+		worker.join();
+	}
+}
+
+void SystemScheduler::AddExclusiveSystem(const char *name, SystemFunction function)
+{
+	System system;
+	system.name = name;
+	system.function = std::move(function);
+	system.exclusive = true;
+	AddSystem(std::move(system));
+}
+
+void SystemScheduler::AddSystem(System &&system)
+{
+	m_systems.push_back(std::move(system));
+	m_graphDirty = true;
+}
+
+void SystemScheduler::SetTelemetry(FrameTelemetry *telemetry)
+{
+	m_telemetry = telemetry;
+	m_graphDirty = true;
+
+	// Sections for the systems so far now, so they list in registration order
+	if(m_telemetry)
+	{
+		for(System &system : m_systems)
+		{
+			system.telemetrySection = m_telemetry->AddSection(system.name);
+		}
+	}
+}
+
+void SystemScheduler::BuildGraph()
+{
+	OPTICK_EVENT();
+
+	for(System &system : m_systems)
+	{
+		system.dependents.clear();
+		system.dependencyCount = 0;
+		if(m_telemetry)
+		{
+			system.telemetrySection = m_telemetry->AddSection(system.name);
+		}
+	}
+
+	// Registration order decides which way round a conflicting pair runs
+	for(u32 later = 0; later < (u32)m_systems.size(); ++later)
+	{
+		System &laterSystem = m_systems[later];
+		for(u32 earlier = 0; earlier < later; ++earlier)
+		{
+			System &earlierSystem = m_systems[earlier];
+
+			bool conflicts = earlierSystem.exclusive || laterSystem.exclusive ||
+				SharesComponent(earlierSystem.writes, laterSystem.writes) ||
+				SharesComponent(earlierSystem.writes, laterSystem.reads) ||
+				SharesComponent(earlierSystem.reads, laterSystem.writes);
+
+			if(conflicts)
+			{
+				earlierSystem.dependents.push_back(later);
+				++laterSystem.dependencyCount;
+			}
+		}
+	}
+
+	m_remainingDependencies = std::make_unique<std::atomic<u32>[]>(m_systems.size());
+	m_graphDirty = false;
+}
+
+void SystemScheduler::Run()
+{
+	OPTICK_EVENT();
+
+	Assert(std::this_thread::get_id() == m_mainThreadId);
+
+	if(m_graphDirty)
+	{
+		BuildGraph();
+	}
+
+	if(m_systems.empty())
+	{
+		return;
+	}
+
+	for(u32 systemIndex = 0; systemIndex < (u32)m_systems.size(); ++systemIndex)
+	{
+		m_remainingDependencies[systemIndex] = m_systems[systemIndex].dependencyCount;
+	}
+	m_systemsRemaining = (u32)m_systems.size();
+
+	for(u32 systemIndex = 0; systemIndex < (u32)m_systems.size(); ++systemIndex)
+	{
+		if(m_systems[systemIndex].dependencyCount == 0)
+		{
+			ScheduleSystem(systemIndex);
+		}
+	}
+
+	WaitForCounter(m_systemsRemaining);
+}
+
+void SystemScheduler::ScheduleSystem(u32 systemIndex)
+{
+	Job job;
+	job.function = [this, systemIndex]() { RunSystem(systemIndex); };
+	job.mainThreadOnly = m_systems[systemIndex].exclusive;
+	PushJob(std::move(job));
+}
+
+void SystemScheduler::RunSystem(u32 systemIndex)
+{
+	System &system = m_systems[systemIndex];
+	{
+		OPTICK_EVENT_DYNAMIC(system.name);
+		FrameTelemetry::Clock::time_point start = FrameTelemetry::Clock::now();
+		system.function();
+		if(m_telemetry)
+		{
+			m_telemetry->AddTime(system.telemetrySection, FrameTelemetry::Clock::now() - start);
+		}
+	}
+
+	for(u32 dependent : system.dependents)
+	{
+		if(m_remainingDependencies[dependent].fetch_sub(1) == 1)
+		{
+			ScheduleSystem(dependent);
+		}
+	}
+
+	m_systemsRemaining.fetch_sub(1);
+}
+
+void SystemScheduler::ParallelFor(u32 count, u32 chunkSize, const RangeFunction &function)
+{
+	if(count == 0)
+	{
+		return;
+	}
+
+	chunkSize = MAX(chunkSize, 1u);
+	u32 chunkCount = (count + chunkSize - 1) / chunkSize;
+	if(chunkCount == 1 || m_workers.empty())
+	{
+		function(0, count);
+		return;
+	}
+
+	std::atomic<u32> chunksRemaining = chunkCount - 1;
+	for(u32 chunkNum = 1; chunkNum < chunkCount; ++chunkNum)
+	{
+		u32 begin = chunkNum * chunkSize;
+		u32 end = MIN(begin + chunkSize, count);
+
+		Job job;
+		job.function = [&function, &chunksRemaining, begin, end]() {
+			OPTICK_EVENT("ParallelForChunk");
+			function(begin, end);
+			chunksRemaining.fetch_sub(1);
+		};
+		PushJob(std::move(job));
+	}
+
+	function(0, MIN(chunkSize, count));
+
+	WaitForCounter(chunksRemaining);
+}
+
+void SystemScheduler::PushJob(Job &&job)
+{
+	bool mainThreadOnly = job.mainThreadOnly;
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		if(mainThreadOnly)
+		{
+			m_mainThreadJobs.push_back(std::move(job));
+		}
+		else
+		{
+			m_jobs.push_back(std::move(job));
+		}
+	}
+
+	// The main thread never sleeps on the signal, it polls while it waits in Run
+	if(!mainThreadOnly)
+	{
+		m_jobSignal.notify_one();
+	}
+}
+
+bool SystemScheduler::TryRunJob(bool isMainThread)
+{
+	Job job;
+	{
+		std::lock_guard<std::mutex> lock(m_jobMutex);
+		if(isMainThread && !m_mainThreadJobs.empty())
+		{
+			job = std::move(m_mainThreadJobs.front());
+			m_mainThreadJobs.pop_front();
+		}
+		else if(!m_jobs.empty())
+		{
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+		else
+		{
+			return false;
+		}
+	}
+
+	job.function();
+	return true;
+}
+
+void SystemScheduler::WaitForCounter(const std::atomic<u32> &counter)
+{
+	bool isMainThread = std::this_thread::get_id() == m_mainThreadId;
+	while(counter.load() != 0)
+	{
+		if(!TryRunJob(isMainThread))
+		{
+			std::this_thread::yield();
+		}
+	}
+}
+
+void SystemScheduler::WorkerLoop(u32 workerIndex)
+{
+	OPTICK_THREAD("SystemWorker");
+	UNUSED(workerIndex);
+
+	for(;;)
+	{
+		Job job;
+		{
+			std::unique_lock<std::mutex> lock(m_jobMutex);
+			m_jobSignal.wait(lock, [this]() { return m_quit || !m_jobs.empty(); });
+			if(m_quit)
+			{
+				return;
+			}
+			job = std::move(m_jobs.front());
+			m_jobs.pop_front();
+		}
+
+		job.function();
+	}
+}
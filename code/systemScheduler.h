@@ -0,0 +1,141 @@
+#pragma once
+
+#include "defines.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <tuple>
+#include <type_traits>
+#include <vector>
+
+class FrameTelemetry;
+
+// Runs per-frame ECS systems on a pool of worker threads.
+// Each system declares the components it touches, const for read and non-const for write, e.g.
+//     scheduler.AddSystem<const RigidBody, Transform>("UpdateTransforms", func);
+// Systems are ordered by registration. A system waits only on earlier systems whose access conflicts with its own
+// (write/write or read/write on a shared component), anything else is free to run alongside it.
+// Exclusive systems wait on everything before them, block everything after them and always run on the thread calling
+// Run(). Use them for anything that creates/destroys entities or talks to raylib/Bullet's own scheduler.
+class SystemScheduler
+{
+public:
+	using SystemFunction = std::function<void()>;
+	using RangeFunction = std::function<void(u32 begin, u32 end)>;
+
+	SystemScheduler(entt::registry &registry, u32 workerCount);
+	~SystemScheduler();
+
+	template<typename... Components>
+	void AddSystem(const char *name, SystemFunction function)
+	{
+		System system;
+		system.name = name;
+		system.function = std::move(function);
+		(AddAccess<Components>(system), ...);
+		AddSystem(std::move(system));
+	}
+
+	void AddExclusiveSystem(const char *name, SystemFunction function);
+
+	// Runs every registered system once and returns when they have all finished
+	void Run();
+
+	// Splits [0, count) into chunks and runs them across the workers. The calling thread helps until all are done,
+	// so this is safe to call from inside a system
+	void ParallelFor(u32 count, u32 chunkSize, const RangeFunction &function);
+
+	// view.each() split into chunks of the view's leading storage. Only use with the components the system declared
+	template<typename View, typename Func>
+	void ParallelEach(const View &view, Func func, u32 chunkSize = 256)
+	{
+		const auto &leadingStorage = view.handle();
+		auto entities = leadingStorage.begin();
+		ParallelFor((u32)leadingStorage.size(), chunkSize, [&view, &func, entities](u32 begin, u32 end) {
+			for(u32 index = begin; index < end; ++index)
+			{
+				const entt::entity entity = entities[index];
+				if(view.contains(entity))
+				{
+					std::apply(func, view.get(entity));
+				}
+			}
+		});
+	}
+
+	u32 GetWorkerCount() const { return (u32)m_workers.size(); }
+
+	// Times every system into a telemetry section of the same name. A system's time includes any jobs its thread
+	// helps with while it waits inside ParallelFor
+	void SetTelemetry(FrameTelemetry *telemetry);
+
+private:
+	struct System
+	{
+		const char *name = nullptr;
+		SystemFunction function;
+		std::vector<entt::id_type> reads;
+		std::vector<entt::id_type> writes;
+		bool exclusive = false;
+		u32 telemetrySection = 0;
+
+		std::vector<u32> dependents;
+		u32 dependencyCount = 0;
+	};
+
+	struct Job
+	{
+		std::function<void()> function;
+		bool mainThreadOnly = false;
+	};
+
+	template<typename Component>
+	void AddAccess(System &system)
+	{
+		using ComponentType = std::remove_const_t<Component>;
+		// Create the storage now so views made from worker threads never modify the registry
+		m_registry.storage<ComponentType>();
+
+		entt::id_type id = entt::type_hash<ComponentType>::value();
+		if constexpr(std::is_const_v<Component>)
+		{
+			system.reads.push_back(id);
+		}
+		else
+		{
+			system.writes.push_back(id);
+		}
+	}
+
+	void AddSystem(System &&system);
+	void BuildGraph();
+	void ScheduleSystem(u32 systemIndex);
+	void RunSystem(u32 systemIndex);
+
+	void PushJob(Job &&job);
+	bool TryRunJob(bool isMainThread);
+	void WaitForCounter(const std::atomic<u32> &counter);
+	void WorkerLoop(u32 workerIndex);
+
+	entt::registry &m_registry;
+
+	std::vector<System> m_systems;
+	std::unique_ptr<std::atomic<u32>[]> m_remainingDependencies;
+	bool m_graphDirty = true;
+	std::atomic<u32> m_systemsRemaining = 0;
+
+	std::thread::id m_mainThreadId;
+	FrameTelemetry *m_telemetry = nullptr;
+
+	std::vector<std::thread> m_workers;
+	std::mutex m_jobMutex;
+	std::condition_variable m_jobSignal;
+	std::deque<Job> m_jobs;
+	std::deque<Job> m_mainThreadJobs;
+	bool m_quit = false;
+};
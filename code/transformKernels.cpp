@@ -0,0 +1,237 @@
+#include "transformKernels.h"
+
+#include <cmath>
+
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define TRANSFORM_KERNELS_AVX2
+#elif defined(__SSE2__) || defined(_M_X64)
+#include <emmintrin.h>
+#define TRANSFORM_KERNELS_SSE2
+#endif
+
+// The kernels are written once against these lane types. Masks are all ones or all zeros per lane
+
+struct ScalarLanes
+{
+	static constexpr u32 width = 1;
+	using Mask = bool;
+
+	r32 v;
+
+	static ScalarLanes Load(const r32 *source) { return {*source}; }
+	static ScalarLanes Set(r32 value) { return {value}; }
+	void Store(r32 *dest) const { *dest = v; }
+
+	friend ScalarLanes operator+(ScalarLanes a, ScalarLanes b) { return {a.v + b.v}; }
+	friend ScalarLanes operator-(ScalarLanes a, ScalarLanes b) { return {a.v - b.v}; }
+	friend ScalarLanes operator*(ScalarLanes a, ScalarLanes b) { return {a.v * b.v}; }
+	friend ScalarLanes operator/(ScalarLanes a, ScalarLanes b) { return {a.v / b.v}; }
+	static ScalarLanes Sqrt(ScalarLanes a) { return {std::sqrt(a.v)}; }
+
+	static Mask Less(ScalarLanes a, ScalarLanes b) { return a.v < b.v; }
+	static Mask And(Mask a, Mask b) { return a && b; }
+	static Mask Or(Mask a, Mask b) { return a || b; }
+	static Mask AndNot(Mask a, Mask b) { return !a && b; } // Not a, and b like _mm_andnot_ps
+	static ScalarLanes Select(Mask mask, ScalarLanes a, ScalarLanes b) { return mask ? a : b; }
+
+	// dest[lane * stride + n] = nth argument's lane, for writing a row of 4 values per transform
+	static void StoreRows(r32 *dest, u32 stride, ScalarLanes a, ScalarLanes b, ScalarLanes c, ScalarLanes d)
+	{
+		UNUSED(stride);
+		dest[0] = a.v;
+		dest[1] = b.v;
+		dest[2] = c.v;
+		dest[3] = d.v;
+	}
+};
+
+#if defined(TRANSFORM_KERNELS_SSE2)
+struct SimdLanes
+{
+	static constexpr u32 width = 4;
+	using Mask = __m128;
+
+	__m128 v;
+
+	static SimdLanes Load(const r32 *source) { return {_mm_loadu_ps(source)}; }
+	static SimdLanes Set(r32 value) { return {_mm_set1_ps(value)}; }
+	void Store(r32 *dest) const { _mm_storeu_ps(dest, v); }
+
+	friend SimdLanes operator+(SimdLanes a, SimdLanes b) { return {_mm_add_ps(a.v, b.v)}; }
+	friend SimdLanes operator-(SimdLanes a, SimdLanes b) { return {_mm_sub_ps(a.v, b.v)}; }
+	friend SimdLanes operator*(SimdLanes a, SimdLanes b) { return {_mm_mul_ps(a.v, b.v)}; }
+	friend SimdLanes operator/(SimdLanes a, SimdLanes b) { return {_mm_div_ps(a.v, b.v)}; }
+	static SimdLanes Sqrt(SimdLanes a) { return {_mm_sqrt_ps(a.v)}; }
+
+	static Mask Less(SimdLanes a, SimdLanes b) { return _mm_cmplt_ps(a.v, b.v); }
+	static Mask And(Mask a, Mask b) { return _mm_and_ps(a, b); }
+	static Mask Or(Mask a, Mask b) { return _mm_or_ps(a, b); }
+	static Mask AndNot(Mask a, Mask b) { return _mm_andnot_ps(a, b); }
+	static SimdLanes Select(Mask mask, SimdLanes a, SimdLanes b) { return {_mm_or_ps(_mm_and_ps(mask, a.v), _mm_andnot_ps(mask, b.v))}; }
+
+	static void StoreRows(r32 *dest, u32 stride, SimdLanes a, SimdLanes b, SimdLanes c, SimdLanes d)
+	{
+		_MM_TRANSPOSE4_PS(a.v, b.v, c.v, d.v);
+		_mm_storeu_ps(dest, a.v);
+		_mm_storeu_ps(dest + stride, b.v);
+		_mm_storeu_ps(dest + stride * 2, c.v);
+		_mm_storeu_ps(dest + stride * 3, d.v);
+	}
+};
+#elif defined(TRANSFORM_KERNELS_AVX2)
+struct SimdLanes
+{
+	static constexpr u32 width = 8;
+	using Mask = __m256;
+
+	__m256 v;
+
+	static SimdLanes Load(const r32 *source) { return {_mm256_loadu_ps(source)}; }
+	static SimdLanes Set(r32 value) { return {_mm256_set1_ps(value)}; }
+	void Store(r32 *dest) const { _mm256_storeu_ps(dest, v); }
+
+	friend SimdLanes operator+(SimdLanes a, SimdLanes b) { return {_mm256_add_ps(a.v, b.v)}; }
+	friend SimdLanes operator-(SimdLanes a, SimdLanes b) { return {_mm256_sub_ps(a.v, b.v)}; }
+	friend SimdLanes operator*(SimdLanes a, SimdLanes b) { return {_mm256_mul_ps(a.v, b.v)}; }
+	friend SimdLanes operator/(SimdLanes a, SimdLanes b) { return {_mm256_div_ps(a.v, b.v)}; }
+	static SimdLanes Sqrt(SimdLanes a) { return {_mm256_sqrt_ps(a.v)}; }
+
+	static Mask Less(SimdLanes a, SimdLanes b) { return _mm256_cmp_ps(a.v, b.v, _CMP_LT_OQ); }
+	static Mask And(Mask a, Mask b) { return _mm256_and_ps(a, b); }
+	static Mask Or(Mask a, Mask b) { return _mm256_or_ps(a, b); }
+	static Mask AndNot(Mask a, Mask b) { return _mm256_andnot_ps(a, b); }
+	static SimdLanes Select(Mask mask, SimdLanes a, SimdLanes b) { return {_mm256_blendv_ps(b.v, a.v, mask)}; }
+
+	static void StoreRows(r32 *dest, u32 stride, SimdLanes a, SimdLanes b, SimdLanes c, SimdLanes d)
+	{
+		// Transposes within each 128 bit half, so the low halves hold lanes 0 to 3 and the high halves 4 to 7
+		__m256 ab0 = _mm256_unpacklo_ps(a.v, b.v);
+		__m256 ab1 = _mm256_unpackhi_ps(a.v, b.v);
+		__m256 cd0 = _mm256_unpacklo_ps(c.v, d.v);
+		__m256 cd1 = _mm256_unpackhi_ps(c.v, d.v);
+		__m256 rows[4] = {
+			_mm256_shuffle_ps(ab0, cd0, _MM_SHUFFLE(1, 0, 1, 0)),
+			_mm256_shuffle_ps(ab0, cd0, _MM_SHUFFLE(3, 2, 3, 2)),
+			_mm256_shuffle_ps(ab1, cd1, _MM_SHUFFLE(1, 0, 1, 0)),
+			_mm256_shuffle_ps(ab1, cd1, _MM_SHUFFLE(3, 2, 3, 2)),
+		};
+		for(u32 rowNum = 0; rowNum < 4; ++rowNum)
+		{
+			_mm_storeu_ps(dest + stride * rowNum, _mm256_castps256_ps128(rows[rowNum]));
+			_mm_storeu_ps(dest + stride * (rowNum + 4), _mm256_extractf128_ps(rows[rowNum], 1));
+		}
+	}
+};
+#endif
+
+// Same steps as btMatrix3x3::getRotation, with its branches turned into selects. Returns how many were converted,
+// a multiple of the lane width
+template<typename Lanes>
+static u32 MatricesToQuaternionsLanes(const r32 *const matrices[9], u32 first, u32 count, r32 *const quaternions[4])
+{
+	using Mask = typename Lanes::Mask;
+	const Lanes zero = Lanes::Set(0.0f);
+	const Lanes one = Lanes::Set(1.0f);
+	const Lanes half = Lanes::Set(0.5f);
+
+	u32 index = first;
+	for(; index + Lanes::width <= count; index += Lanes::width)
+	{
+		Lanes m00 = Lanes::Load(matrices[0] + index), m01 = Lanes::Load(matrices[1] + index), m02 = Lanes::Load(matrices[2] + index);
+		Lanes m10 = Lanes::Load(matrices[3] + index), m11 = Lanes::Load(matrices[4] + index), m12 = Lanes::Load(matrices[5] + index);
+		Lanes m20 = Lanes::Load(matrices[6] + index), m21 = Lanes::Load(matrices[7] + index), m22 = Lanes::Load(matrices[8] + index);
+
+		// Which of w, x, y or z is largest and gets the square root, picked the way Bullet does
+		Lanes trace = m00 + m11 + m22;
+		Mask useW = Lanes::Less(zero, trace);
+		Mask xLessY = Lanes::Less(m00, m11);
+		Mask useY = Lanes::AndNot(useW, Lanes::AndNot(Lanes::Less(m11, m22), xLessY));
+		Mask useZ = Lanes::AndNot(useW, Lanes::Or(Lanes::And(xLessY, Lanes::Less(m11, m22)), Lanes::AndNot(xLessY, Lanes::Less(m00, m22))));
+
+		Lanes squared = Lanes::Select(useW, trace + one,
+			Lanes::Select(useY, m11 - m22 - m00 + one,
+			Lanes::Select(useZ, m22 - m00 - m11 + one, m00 - m11 - m22 + one)));
+		Lanes root = Lanes::Sqrt(squared);
+		Lanes largest = root * half;
+		Lanes scale = half / root;
+
+		Lanes diff0 = (m21 - m12) * scale, diff1 = (m02 - m20) * scale, diff2 = (m10 - m01) * scale;
+		Lanes sum0 = (m21 + m12) * scale, sum1 = (m02 + m20) * scale, sum2 = (m10 + m01) * scale;
+
+		Lanes x = Lanes::Select(useW, diff0, Lanes::Select(useY, sum2, Lanes::Select(useZ, sum1, largest)));
+		Lanes y = Lanes::Select(useW, diff1, Lanes::Select(useY, largest, Lanes::Select(useZ, sum0, sum2)));
+		Lanes z = Lanes::Select(useW, diff2, Lanes::Select(useY, sum0, Lanes::Select(useZ, largest, sum1)));
+		Lanes w = Lanes::Select(useW, largest, Lanes::Select(useY, diff1, Lanes::Select(useZ, diff2, diff0)));
+
+		x.Store(quaternions[0] + index);
+		y.Store(quaternions[1] + index);
+		z.Store(quaternions[2] + index);
+		w.Store(quaternions[3] + index);
+	}
+	return index;
+}
+
+// Same as TransformToRenderMatrix
+template<typename Lanes>
+static u32 ComposeRenderMatricesLanes(const r32 *const translations[3], const r32 *const rotations[4], const r32 *scales, u32 first, u32 count, RenderMatrix *matrices)
+{
+	const Lanes zero = Lanes::Set(0.0f);
+	const Lanes one = Lanes::Set(1.0f);
+	const Lanes two = Lanes::Set(2.0f);
+	constexpr u32 stride = sizeof(RenderMatrix) / sizeof(r32);
+
+	u32 index = first;
+	for(; index + Lanes::width <= count; index += Lanes::width)
+	{
+		Lanes qx = Lanes::Load(rotations[0] + index), qy = Lanes::Load(rotations[1] + index);
+		Lanes qz = Lanes::Load(rotations[2] + index), qw = Lanes::Load(rotations[3] + index);
+		Lanes s = Lanes::Load(scales + index);
+
+		Lanes xx = qx * qx, yy = qy * qy, zz = qz * qz;
+		Lanes xy = qx * qy, xz = qx * qz, yz = qy * qz;
+		Lanes wx = qw * qx, wy = qw * qy, wz = qw * qz;
+
+		Lanes m0 = (one - two * (yy + zz)) * s, m1 = (two * (xy + wz)) * s, m2 = (two * (xz - wy)) * s;
+		Lanes m4 = (two * (xy - wz)) * s, m5 = (one - two * (xx + zz)) * s, m6 = (two * (yz + wx)) * s;
+		Lanes m8 = (two * (xz + wy)) * s, m9 = (two * (yz - wx)) * s, m10 = (one - two * (xx + yy)) * s;
+		Lanes m12 = Lanes::Load(translations[0] + index), m13 = Lanes::Load(translations[1] + index), m14 = Lanes::Load(translations[2] + index);
+
+		// RenderMatrix is stored a row at a time, m0 m4 m8 m12 first
+		r32 *dest = &matrices[index].m0;
+		Lanes::StoreRows(dest, stride, m0, m4, m8, m12);
+		Lanes::StoreRows(dest + 4, stride, m1, m5, m9, m13);
+		Lanes::StoreRows(dest + 8, stride, m2, m6, m10, m14);
+		Lanes::StoreRows(dest + 12, stride, zero, zero, zero, one);
+	}
+	return index;
+}
+
+void MatricesToQuaternions(const r32 *const matrices[9], u32 count, r32 *const quaternions[4])
+{
+	u32 done = 0;
+#if defined(TRANSFORM_KERNELS_SSE2) || defined(TRANSFORM_KERNELS_AVX2)
+	done = MatricesToQuaternionsLanes<SimdLanes>(matrices, done, count, quaternions);
+#endif
+	MatricesToQuaternionsLanes<ScalarLanes>(matrices, done, count, quaternions);
+}
+
+void ComposeRenderMatrices(const r32 *const translations[3], const r32 *const rotations[4], const r32 *scales, u32 count, RenderMatrix *matrices)
+{
+	u32 done = 0;
+#if defined(TRANSFORM_KERNELS_SSE2) || defined(TRANSFORM_KERNELS_AVX2)
+	done = ComposeRenderMatricesLanes<SimdLanes>(translations, rotations, scales, done, count, matrices);
+#endif
+	ComposeRenderMatricesLanes<ScalarLanes>(translations, rotations, scales, done, count, matrices);
+}
+
+const char *GetTransformKernelTarget()
+{
+#if defined(TRANSFORM_KERNELS_AVX2)
+	return "AVX2";
+#elif defined(TRANSFORM_KERNELS_SSE2)
+	return "SSE2";
+#else
+	return "scalar";
+#endif
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "defines.h"
+
+#include "renderBatch.h"
+
+// Batch transform conversions over structure of arrays data, one array per component so consecutive transforms fill
+// SIMD lanes. Built for AVX2 when the compiler targets it, SSE2 on any other x64 build and plain scalar code otherwise.
+// Every path gives the same results as the scalar code, which matches Bullet's own conversions
+
+// Rotation matrices to quaternions like btMatrix3x3::getRotation. matrices[row * 3 + column], quaternions x, y, z, w
+void MatricesToQuaternions(const r32 *const matrices[9], u32 count, r32 *const quaternions[4]);
+
+// Translation * rotation * uniform scale into render matrices. translations x, y, z, rotations x, y, z, w
+void ComposeRenderMatrices(const r32 *const translations[3], const r32 *const rotations[4], const r32 *scales, u32 count, RenderMatrix *matrices);
+
+// Name of the instruction set the kernels were built for
+const char *GetTransformKernelTarget();
@@ -0,0 +1,179 @@
+#include "worldSnapshot.h"
+
+using EntityTraits = entt::entt_traits<entt::entity>;
+
+void ReadEntityPool(SnapshotReader &reader, EntityPoolState &pool)
+{
+	// entt::snapshot::entities writes the pool size plus one, then the head of the free list, then the pool
+	u32 count = (u32)reader.Read<EntityTraits::entity_type>() - 1;
+	pool.released = reader.Read<entt::entity>();
+	pool.entities.resize(count);
+	reader.ReadBytes(pool.entities.data(), sizeof(entt::entity) * count);
+}
+
+void RestoreEntityPool(entt::registry &registry, const EntityPoolState &pool)
+{
+	OPTICK_EVENT();
+
+	u32 count = (u32)pool.entities.size();
+	u32 currentCount = (u32)registry.size();
+	Assert(currentCount >= count);
+
+	if(currentCount == count && registry.released() == pool.released
+		&& memcmp(registry.data(), pool.entities.data(), sizeof(entt::entity) * count) == 0)
+	{
+		return;
+	}
+
+	// Take every released identifier off the free list, then release them again in the captured order. Releasing
+	// pushes onto the front of the list, so the captured list goes in back to front
+	while(registry.released() != entt::null)
+	{
+		UNUSED(registry.create());
+	}
+
+	// Slots the pool didn't have yet were made after the capture. The first time round they were new identifiers at
+	// version 0 handed out in index order, so they go at the end of the list the same way
+	for(u32 index = currentCount; index > count; --index)
+	{
+		registry.release(registry.data()[index - 1], 0);
+	}
+
+	std::vector<u32> freeList;
+	for(entt::entity released = pool.released; released != entt::null; released = pool.entities[EntityTraits::to_entity(released)])
+	{
+		freeList.push_back(EntityTraits::to_entity(released));
+	}
+	for(u32 listNum = (u32)freeList.size(); listNum > 0; --listNum)
+	{
+		u32 index = freeList[listNum - 1];
+		registry.release(registry.data()[index], EntityTraits::to_version(pool.entities[index]));
+	}
+
+	// With nothing on the captured list the extra slots head it instead, which hands out the same identifiers
+	Assert(!freeList.empty() || currentCount == count || EntityTraits::to_entity(registry.released()) == count);
+	Assert(freeList.empty() || registry.released() == pool.released);
+}
+
+SnapshotRing::SnapshotRing(u32 capacity, u32 keyframeInterval)
+	: m_keyframeInterval(MAX(keyframeInterval, 1u))
+{
+	Assert(capacity > 0);
+	m_frames.resize(capacity);
+
+	// The oldest frame held may be in the interval before the oldest whole one
+	m_keyframes.resize((capacity + m_keyframeInterval - 1) / m_keyframeInterval + 1);
+}
+
+void SnapshotRing::Push(u32 frameNum, const WorldSnapshot &snapshot)
+{
+	OPTICK_EVENT();
+
+	u32 interval = frameNum / m_keyframeInterval;
+	Keyframe &keyframe = m_keyframes[interval % m_keyframes.size()];
+	Frame &frame = m_frames[frameNum % m_frames.size()];
+
+	frame.frameNum = frameNum;
+	frame.size = snapshot.GetSize();
+	frame.delta.clear();
+
+	// Starting an interval again after a rollback replaces its keyframe, which strands the frames after it
+	if(keyframe.interval != interval || frameNum % m_keyframeInterval == 0)
+	{
+		keyframe.interval = interval;
+		keyframe.serial = m_nextSerial++;
+		keyframe.snapshot.Clear();
+		keyframe.snapshot.WriteBytes(snapshot.GetData(), snapshot.GetSize());
+
+		frame.keyframeSerial = keyframe.serial;
+		frame.isKeyframe = true;
+		return;
+	}
+
+	frame.keyframeSerial = keyframe.serial;
+	frame.isKeyframe = false;
+
+	const u64 *words = snapshot.GetWords();
+	const u64 *keyWords = keyframe.snapshot.GetWords();
+	u32 wordCount = snapshot.GetWordCount();
+	u32 keyWordCount = keyframe.snapshot.GetWordCount();
+
+	// Zero runs then literal runs, each pair behind a header word
+	u32 wordNum = 0;
+	while(wordNum < wordCount)
+	{
+		u32 runStart = wordNum;
+		while(wordNum < wordCount && words[wordNum] == ((wordNum < keyWordCount) ? keyWords[wordNum] : 0))
+		{
+			++wordNum;
+		}
+		u32 zeroCount = wordNum - runStart;
+
+		size_t header = frame.delta.size();
+		frame.delta.push_back(0);
+		while(wordNum < wordCount)
+		{
+			u64 changed = words[wordNum] ^ ((wordNum < keyWordCount) ? keyWords[wordNum] : 0);
+			if(!changed)
+			{
+				break;
+			}
+			frame.delta.push_back(changed);
+			++wordNum;
+		}
+		u32 literalCount = (u32)(frame.delta.size() - header - 1);
+		frame.delta[header] = ((u64)zeroCount << 32) | literalCount;
+	}
+}
+
+bool SnapshotRing::Get(u32 frameNum, WorldSnapshot &snapshot) const
+{
+	OPTICK_EVENT();
+
+	const Frame &frame = m_frames[frameNum % m_frames.size()];
+	u32 interval = frameNum / m_keyframeInterval;
+	const Keyframe &keyframe = m_keyframes[interval % m_keyframes.size()];
+	if(frame.frameNum != frameNum || keyframe.interval != interval || keyframe.serial != frame.keyframeSerial)
+	{
+		return false;
+	}
+
+	u64 *words = snapshot.Resize(frame.size);
+	u32 wordCount = snapshot.GetWordCount();
+	u32 keyWordCount = MIN(keyframe.snapshot.GetWordCount(), wordCount);
+	memcpy(words, keyframe.snapshot.GetWords(), sizeof(u64) * keyWordCount);
+	memset(words + keyWordCount, 0, sizeof(u64) * (wordCount - keyWordCount));
+
+	if(frame.isKeyframe)
+	{
+		return true;
+	}
+
+	u32 wordNum = 0;
+	for(size_t deltaNum = 0; deltaNum < frame.delta.size();)
+	{
+		u64 header = frame.delta[deltaNum++];
+		wordNum += (u32)(header >> 32);
+		u32 literalCount = (u32)header;
+		for(u32 literalNum = 0; literalNum < literalCount; ++literalNum)
+		{
+			words[wordNum++] ^= frame.delta[deltaNum++];
+		}
+	}
+	Assert(wordNum <= wordCount);
+	return true;
+}
+
+size_t SnapshotRing::GetStoredBytes() const
+{
+	size_t bytes = 0;
+	for(const Keyframe &keyframe : m_keyframes)
+	{
+		bytes += keyframe.snapshot.GetSize();
+	}
+	for(const Frame &frame : m_frames)
+	{
+		bytes += frame.delta.size() * sizeof(u64);
+	}
+	return bytes;
+}
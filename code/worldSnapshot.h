@@ -0,0 +1,217 @@
+#pragma once
+
+#include "defines.h"
+
+#include <string.h>
+#include <vector>
+
+// Everything the simulation carries from one frame to the next, captured into one flat buffer so it can be copied,
+// delta compressed and restored without allocating. Also the archive entt::snapshot writes through. Only plain data
+// goes in, pointers included, so a snapshot is only good for the Game that captured it
+class WorldSnapshot
+{
+public:
+	void Clear() { m_size = 0; }
+
+	template<typename T>
+	void Write(const T &value) { WriteBytes(&value, sizeof(T)); }
+
+	// Count then the values
+	template<typename T>
+	void WriteArray(const T *values, u32 count)
+	{
+		Write(count);
+		WriteBytes(values, sizeof(T) * count);
+	}
+
+	void WriteBytes(const void *data, size_t size)
+	{
+		Reserve(m_size + size);
+		memcpy((u8 *)m_words.data() + m_size, data, size);
+		m_size += size;
+	}
+
+	// For entt::snapshot, which passes an entity and its component together
+	template<typename... T>
+	void operator()(const T &...values) { (Write(values), ...); }
+
+	size_t GetSize() const { return m_size; }
+	const u8 *GetData() const { return (const u8 *)m_words.data(); }
+
+	// Whole words, the bytes past the size in the last one are whatever was there before
+	u32 GetWordCount() const { return (u32)((m_size + 7) / 8); }
+	const u64 *GetWords() const { return m_words.data(); }
+
+	// For SnapshotRing to decode into, leaves the contents undefined
+	u64 *Resize(size_t size)
+	{
+		Reserve(size);
+		m_size = size;
+		return m_words.data();
+	}
+
+private:
+	void Reserve(size_t size)
+	{
+		size_t wordCount = (size + 7) / 8;
+		if(wordCount > m_words.size())
+		{
+			m_words.resize(MAX(wordCount, m_words.size() * 2));
+		}
+	}
+
+	std::vector<u64> m_words; // Words so the ring can delta them eight bytes at a time
+	size_t m_size = 0;
+};
+
+// Reads a WorldSnapshot back in the order it was written. Reading past the end asserts
+class SnapshotReader
+{
+public:
+	SnapshotReader(const WorldSnapshot &snapshot) : m_data(snapshot.GetData()), m_size(snapshot.GetSize()) {}
+
+	template<typename T>
+	T Read()
+	{
+		T value;
+		ReadBytes(&value, sizeof(T));
+		return value;
+	}
+
+	// Over a value that already exists, for types with no default constructor
+	template<typename T>
+	void ReadInto(T &value) { ReadBytes(&value, sizeof(T)); }
+
+	// What WriteArray wrote, replacing the contents of values
+	template<typename T>
+	void ReadArray(std::vector<T> &values)
+	{
+		values.resize(Read<u32>());
+		ReadBytes(values.data(), sizeof(T) * values.size());
+	}
+
+	void ReadBytes(void *data, size_t size)
+	{
+		Assert(m_offset + size <= m_size);
+		memcpy(data, m_data + m_offset, size);
+		m_offset += size;
+	}
+
+	void Skip(size_t size)
+	{
+		Assert(m_offset + size <= m_size);
+		m_offset += size;
+	}
+
+	bool IsAtEnd() const { return m_offset == m_size; }
+
+private:
+	const u8 *m_data;
+	size_t m_size;
+	size_t m_offset = 0;
+};
+
+// Puts a storage's entities in the order they were written, swapping each into place. Views iterate storages in
+// this order, so anything that depends on iteration order repeats the same way after a restore
+inline void RestoreStorageOrder(entt::sparse_set &storage, const entt::entity *entities, u32 count)
+{
+	Assert(count == storage.size());
+	for(u32 index = 0; index < count; ++index)
+	{
+		entt::entity current = storage.data()[index];
+		if(current != entities[index])
+		{
+			storage.swap_elements(current, entities[index]);
+		}
+	}
+}
+
+template<typename T>
+void WriteStorageOrder(entt::registry &registry, WorldSnapshot &snapshot)
+{
+	auto &storage = registry.storage<T>();
+	snapshot.WriteArray(storage.data(), (u32)storage.size());
+}
+
+template<typename T>
+void ReadStorageOrder(entt::registry &registry, SnapshotReader &reader, std::vector<entt::entity> &scratch)
+{
+	reader.ReadArray(scratch);
+	RestoreStorageOrder(registry.storage<T>(), scratch.data(), (u32)scratch.size());
+}
+
+// Reads what entt::snapshot::component wrote for T, in storage order, back into the entities that still have T.
+// Unlike entt's snapshot loader this writes into a live registry instead of an empty one
+template<typename T>
+void ReadComponents(entt::registry &registry, SnapshotReader &reader)
+{
+	auto &storage = registry.storage<T>();
+	u32 count = (u32)reader.Read<entt::entt_traits<entt::entity>::entity_type>();
+	Assert(count == storage.size());
+
+	for(u32 index = 0; index < count; ++index)
+	{
+		entt::entity entity = reader.Read<entt::entity>();
+		entt::entity current = storage.data()[index];
+		if(current != entity)
+		{
+			storage.swap_elements(current, entity);
+		}
+		reader.ReadInto(storage.get(entity));
+	}
+}
+
+// Captured entity pool, read back from entt::snapshot::entities
+struct EntityPoolState
+{
+	std::vector<entt::entity> entities;
+	entt::entity released = entt::null;
+};
+
+void ReadEntityPool(SnapshotReader &reader, EntityPoolState &pool);
+
+// Gives every identifier the registry has released the version and free list position the pool had, so entities
+// created after a restore get the same identifiers they did the first time. The live entities have to match the
+// pool's already
+void RestoreEntityPool(entt::registry &registry, const EntityPoolState &pool);
+
+// Fixed history of snapshots, one per frame. Every keyframeInterval'th frame keeps a whole copy, the rest only the
+// words that changed since their keyframe: XORed with it, with runs of zero words collapsed. Keyframes are kept
+// apart from the frames so every frame still in the ring can be decoded. Slots are made up front and reuse their
+// buffers, so after the first lap through the ring pushing doesn't allocate
+class SnapshotRing
+{
+public:
+	SnapshotRing(u32 capacity, u32 keyframeInterval = 16);
+
+	// Replaces whatever the ring had for frameNum. Frames pushed again after a rollback replace the old ones
+	void Push(u32 frameNum, const WorldSnapshot &snapshot);
+
+	// False when frameNum was never pushed or has been pushed out
+	bool Get(u32 frameNum, WorldSnapshot &snapshot) const;
+
+	u32 GetCapacity() const { return (u32)m_frames.size(); }
+	size_t GetStoredBytes() const; // Encoded size of every frame held, keyframes included
+
+private:
+	struct Keyframe
+	{
+		u32 interval = U32_MAX; // frameNum / keyframeInterval
+		u32 serial = 0; // Changes every time the keyframe is replaced, invalidating the deltas against the old one
+		WorldSnapshot snapshot;
+	};
+
+	struct Frame
+	{
+		u32 frameNum = U32_MAX;
+		u32 keyframeSerial = 0;
+		bool isKeyframe = false;
+		size_t size = 0;
+		std::vector<u64> delta; // Per run, one word of zero count << 32 | literal count, then the literal words
+	};
+
+	u32 m_keyframeInterval;
+	std::vector<Frame> m_frames; // Indexed by frameNum % capacity
+	std::vector<Keyframe> m_keyframes; // Indexed by interval % count
+	u32 m_nextSerial = 1;
+};